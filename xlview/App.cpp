@@ -7,6 +7,7 @@
 #include "Registry.h"
 #include "MainWindow.h"
 #include "Settings.h"
+#include "JobScheduler.h"
 #include "resource.h"
 
 #pragma warning (disable:4996)
@@ -56,7 +57,7 @@ public:
 	}
 
 	virtual void postRun () {
-
+		CJobScheduler::getInstance()->stop();
 	}
 };
 
@@ -4,29 +4,47 @@
 #include "ImageConfig.h"
 #include "CachedImage.h"
 #include "ImageManager.h"
+#include "PixelBufferPool.h"
+#include "ThumbnailStore.h"
+#include "ImageCache.h"
 
-CCachedImage::CCachedImage (const xl::tstring &fileName)
+CCachedImage::CCachedImage (const xl::tstring &fileName, int index)
 	: m_fileName(fileName)
+	, m_index(index)
 	, m_szImage(-1, -1)
+	, m_thumbnail(INVALID_THUMBNAIL)
 {
 	assert(xl::file_exists(m_fileName));
 }
 
 CCachedImage::~CCachedImage () {
+	CImageCache::getInstance()->remove(this); // must be the first, the cache may be evicting it
+	CThumbnailAtlas::getInstance()->release(m_thumbnail);
+}
 
+void CCachedImage::_SetThumbnail (CImagePtr thumbnail) {
+	assert(getLockLevel() > 0);
+	CThumbnailAtlas *atlas = CThumbnailAtlas::getInstance();
+	atlas->release(m_thumbnail);
+	m_thumbnail = atlas->store(thumbnail);
 }
 
 bool CCachedImage::loadSuitable (CSize szView, xl::ILongTimeRunCallback *pCallback) {
 	assert(szView.cx >= MIN_ZOOM_WIDTH);
 	assert(szView.cy >= MIN_ZOOM_HEIGHT);
 
+	CImageCache *cache = CImageCache::getInstance();
 	xl::CScopeLock lock(this);
-		if (m_suitableImage != NULL) {
-			return true;
-		}
-		CImagePtr thumbnailImage = m_thumbnailImage;
+		bool cached = m_suitableImage != NULL;
+		bool hasThumbnail = m_thumbnail != INVALID_THUMBNAIL;
 	lock.unlock();
 
+	if (cached) {
+		cache->touch(this);
+		return true;
+	}
+	cache->miss();
+
 	// below is lock free
 	CSize szImage;
 	CImageLoader *pLoader = CImageLoader::getInstance();
@@ -35,32 +53,45 @@ bool CCachedImage::loadSuitable (CSize szView, xl::ILongTimeRunCallback *pCallba
 		return false;
 	}
 
-	if (thumbnailImage == NULL) {
+	CImagePtr thumbnailImage;
+	if (!hasThumbnail) {
 		CSize szThumbnail(THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
 		szThumbnail = CImage::getSuitableSize(szThumbnail, szImage, false);
 		thumbnailImage = image->resize(szThumbnail.cx, szThumbnail.cy, true, pCallback);
 	}
 
 	// lock again
+	size_t bytes = image->getMemorySize();
 	lock.lock(this);
 		m_szImage = szImage;
 		m_suitableImage = image;
-		m_thumbnailImage = thumbnailImage;
+		if (thumbnailImage != NULL && m_thumbnail == INVALID_THUMBNAIL) {
+			_SetThumbnail(thumbnailImage);
+		}
 
 		image.reset();
-		thumbnailImage.reset();
 	lock.unlock();
+
+	cache->insert(this, m_index, bytes, szImage);
+
+	if (thumbnailImage != NULL) {
+		CThumbnailStore::getInstance()->add(m_fileName, thumbnailImage, szImage);
+	}
 	return true;
 }
 
 bool CCachedImage::loadThumbnail (bool fastOnly, xl::ILongTimeRunCallback *pCancel) {
 	xl::CScopeLock lock(this);
-		if (m_thumbnailImage != NULL) {
+		if (m_thumbnail != INVALID_THUMBNAIL) {
 			return true;
 		}
 		xl::tstring fileName = m_fileName;
 	lock.unlock();
 
+	if (loadStoredThumbnail()) {
+		return true;
+	}
+
 	// below is lock free
 	assert(xl::file_exists(fileName)); // TODO
 	CImageLoader *pLoader = CImageLoader::getInstance();
@@ -71,11 +102,37 @@ bool CCachedImage::loadThumbnail (bool fastOnly, xl::ILongTimeRunCallback *pCanc
 	}
 
 	lock.lock(this);
-		m_thumbnailImage = image;
+		_SetThumbnail(image);
 		m_szImage = szImageRS;
+	lock.unlock();
 
-		image.reset();
+	CThumbnailStore::getInstance()->add(fileName, image, szImageRS);
+	CDIBSectionPool::getInstance()->recycle(image); // copied into the atlas
+	return true;
+}
+
+bool CCachedImage::loadStoredThumbnail () {
+	xl::CScopeLock lock(this);
+		if (m_thumbnail != INVALID_THUMBNAIL) {
+			return true;
+		}
+		xl::tstring fileName = m_fileName;
 	lock.unlock();
+
+	CSize szImage;
+	CImagePtr image = CThumbnailStore::getInstance()->lookup(fileName, szImage);
+	if (image == NULL) {
+		return false;
+	}
+
+	lock.lock(this);
+		if (m_thumbnail == INVALID_THUMBNAIL) {
+			_SetThumbnail(image);
+			m_szImage = szImage;
+		}
+	lock.unlock();
+
+	CDIBSectionPool::getInstance()->recycle(image);
 	return true;
 }
 
@@ -86,10 +143,11 @@ void CCachedImage::setSuitableImage (CImagePtr image, CSize realSize) {
 		if (m_szImage != CSize(-1, -1)) {
 			assert(m_szImage == realSize);
 		}
-		CImagePtr thumbnail = m_thumbnailImage;
+		bool hasThumbnail = m_thumbnail != INVALID_THUMBNAIL;
 		lock.unlock();
 
-		if (thumbnail == NULL) {
+		CImagePtr thumbnail;
+		if (!hasThumbnail) {
 			CSize szThumbnail(THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
 			szThumbnail = CImage::getSuitableSize(szThumbnail, realSize, false);
 			thumbnail = image->resize(szThumbnail.cx, szThumbnail.cy, true);
@@ -98,22 +156,34 @@ void CCachedImage::setSuitableImage (CImagePtr image, CSize realSize) {
 		lock.lock(this);
 			m_szImage = realSize;
 			m_suitableImage = image;
-			if (m_thumbnailImage == NULL) {
-				m_thumbnailImage = thumbnail;
+			if (thumbnail != NULL && m_thumbnail == INVALID_THUMBNAIL) {
+				_SetThumbnail(thumbnail);
 			}
 		lock.unlock();
+
+		CImageCache::getInstance()->insert(this, m_index, image->getMemorySize(), realSize);
+
+		if (thumbnail != NULL) {
+			CThumbnailStore::getInstance()->add(m_fileName, thumbnail, realSize);
+		}
 	}
 }
 
 void CCachedImage::clear (bool clearThumbnail) {
 	lock();
+	CImagePtr suitableImage = m_suitableImage;
 	m_suitableImage.reset();
 	if (clearThumbnail) {
-		m_thumbnailImage.reset();
+		CThumbnailAtlas::getInstance()->release(m_thumbnail);
+		m_thumbnail = INVALID_THUMBNAIL;
 		m_szImage.cx = -1;
 		m_szImage.cy = -1;
 	}
 	unlock();
+
+	CImageCache::getInstance()->remove(this);
+	// the bitmaps are reused by the next images (if no one else is using them)
+	CDIBSectionPool::getInstance()->recycle(suitableImage);
 }
 
 xl::tstring CCachedImage::getFileName () const {
@@ -134,11 +204,12 @@ CSize CCachedImage::getImageSize () const {
 CImagePtr CCachedImage::getCachedImage () const {
 	lock();
 	CImagePtr image = m_suitableImage;
-	if (image == NULL) {
-		image = m_thumbnailImage;
-	}
+	ThumbnailHandle thumbnail = m_thumbnail;
 	unlock();
 
+	if (image == NULL) {
+		image = CThumbnailAtlas::getInstance()->createImage(thumbnail);
+	}
 	return image;
 }
 
@@ -149,9 +220,17 @@ CImagePtr CCachedImage::getSuitableImage () const {
 	return image;
 }
 
-CImagePtr CCachedImage::getThumbnailImage () const {
+bool CCachedImage::hasThumbnail () const {
+	return CThumbnailAtlas::getInstance()->isValid(getThumbnail());
+}
+
+ThumbnailHandle CCachedImage::getThumbnail () const {
 	lock();
-	CImagePtr image = m_thumbnailImage;
+	ThumbnailHandle thumbnail = m_thumbnail;
 	unlock();
-	return image;
+	return thumbnail;
+}
+
+CImagePtr CCachedImage::getThumbnailImage () const {
+	return CThumbnailAtlas::getInstance()->createImage(getThumbnail());
 }
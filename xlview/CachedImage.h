@@ -5,6 +5,7 @@
 #include "libxl/include/interfaces.h"
 #include "Image.h"
 #include "ImageLoader.h"
+#include "ThumbnailAtlas.h"
 
 class CCachedImage;
 typedef std::tr1::shared_ptr<CCachedImage>             CCachedImagePtr;
@@ -13,23 +14,32 @@ class CCachedImage
 	: public xl::CUserLock
 {
 	xl::tstring        m_fileName;
+	int                m_index;     // in the image list
 	CSize              m_szImage;
 	CImagePtr          m_suitableImage;
-	CImagePtr          m_thumbnailImage;
+	ThumbnailHandle    m_thumbnail; // in CThumbnailAtlas
+
+	void _SetThumbnail (CImagePtr thumbnail);
 
 public:
-	CCachedImage (const xl::tstring &fileName);
+	CCachedImage (const xl::tstring &fileName, int index);
 	virtual ~CCachedImage ();
 
 	bool loadSuitable (CSize szView, xl::ILongTimeRunCallback *pCallback = NULL);
 	bool loadThumbnail (bool fastOnly, xl::ILongTimeRunCallback *pCallback = NULL);
+	// from CThumbnailStore only, no decoding
+	bool loadStoredThumbnail ();
 	void setSuitableImage (CImagePtr image, CSize realSize);
+	// also the eviction hook of CImageCache
 	void clear (bool clearThumbnail = false);
 
 	xl::tstring getFileName () const;
 	CSize getImageSize () const;
 	CImagePtr getCachedImage () const;
 	CImagePtr getSuitableImage () const;
+	bool hasThumbnail () const;
+	ThumbnailHandle getThumbnail () const;
+	// a new image created from the atlas, prefer getThumbnail() for drawing
 	CImagePtr getThumbnailImage () const;
 };
 
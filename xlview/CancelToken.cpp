@@ -0,0 +1,174 @@
+#include <assert.h>
+#include <algorithm>
+#include "libxl/include/utilities.h"
+#include "CancelToken.h"
+
+static LONGLONG getCounterFrequency () {
+	static LONGLONG frequency = 0;
+	if (frequency == 0) {
+		LARGE_INTEGER li;
+		::QueryPerformanceFrequency(&li);
+		frequency = li.QuadPart;
+	}
+	return frequency;
+}
+
+static LONGLONG getCounter () {
+	LARGE_INTEGER li;
+	::QueryPerformanceCounter(&li);
+	return li.QuadPart;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CGeneration
+
+CGeneration::CGeneration ()
+	: m_value(0)
+	, m_bumpTime(0)
+	, m_bumps(0)
+	, m_aborts(0)
+	, m_totalLatency(0)
+	, m_maxLatency(0)
+{
+}
+
+LONG CGeneration::bump () {
+	::InterlockedExchange64(&m_bumpTime, getCounter()); // before the value, so the workers see it
+	::InterlockedIncrement(&m_bumps);
+	LONG value = ::InterlockedIncrement(&m_value);
+
+	xl::CScopeLock lock(&m_waitersLock);
+	for (std::vector<HANDLE>::iterator it = m_waiters.begin(); it != m_waiters.end(); ++ it) {
+		::SetEvent(*it);
+	}
+	return value;
+}
+
+void CGeneration::addWaiter (HANDLE hEvent) {
+	assert(hEvent != NULL);
+	xl::CScopeLock lock(&m_waitersLock);
+	m_waiters.push_back(hEvent);
+}
+
+void CGeneration::removeWaiter (HANDLE hEvent) {
+	xl::CScopeLock lock(&m_waitersLock);
+	std::vector<HANDLE>::iterator it = std::find(m_waiters.begin(), m_waiters.end(), hEvent);
+	if (it != m_waiters.end()) {
+		m_waiters.erase(it);
+	}
+}
+
+void CGeneration::onAborted () {
+	LONGLONG elapsed = getCounter() - m_bumpTime;
+	LONG latency = (LONG)(elapsed * 1000000 / getCounterFrequency());
+	::InterlockedIncrement(&m_aborts);
+	::InterlockedExchangeAdd(&m_totalLatency, latency);
+
+	LONG max = m_maxLatency;
+	while (latency > max) {
+		LONG prev = ::InterlockedCompareExchange(&m_maxLatency, latency, max);
+		if (prev == max) {
+			break;
+		}
+		max = prev;
+	}
+}
+
+CGeneration::Stats CGeneration::getStats () const {
+	Stats stats;
+	stats.bumps = m_bumps;
+	stats.aborts = m_aborts;
+	stats.totalLatency = m_totalLatency;
+	stats.maxLatency = m_maxLatency;
+	return stats;
+}
+
+void CGeneration::traceStats (const xl::tchar *name) const {
+	Stats stats = getStats();
+	XLTRACE(_T("** %s generation: %d bumps, %d aborts, latency avg %.2f ms, max %.2f ms\n"),
+		name, stats.bumps, stats.aborts,
+		stats.aborts > 0 ? stats.totalLatency / 1000.0 / stats.aborts : 0.0,
+		stats.maxLatency / 1000.0);
+	XL_PARAMETER_NOT_USED(stats);
+	XL_PARAMETER_NOT_USED(name);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CCancelToken
+
+CCancelToken::CCancelToken (CJob *job, CGeneration *first, LONG firstValue, CGeneration *second, LONG secondValue)
+	: m_job(job)
+	, m_stopped(false)
+	, m_hCancel(NULL)
+{
+	assert(first != NULL);
+	m_generations[0] = first;
+	m_captured[0] = firstValue;
+	m_generations[1] = second;
+	m_captured[1] = secondValue;
+}
+
+CCancelToken::~CCancelToken () {
+	if (m_hCancel == NULL) {
+		return;
+	}
+	for (int i = 0; i < MAX_GENERATIONS; ++ i) {
+		if (m_generations[i] != NULL) {
+			m_generations[i]->removeWaiter(m_hCancel);
+		}
+	}
+	if (m_job != NULL) {
+		m_job->setWaiter(NULL);
+	}
+	::CloseHandle(m_hCancel);
+}
+
+HANDLE CCancelToken::getCancelEvent () {
+	if (m_hCancel != NULL) {
+		return m_hCancel;
+	}
+	m_hCancel = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (m_hCancel == NULL) {
+		return NULL;
+	}
+	for (int i = 0; i < MAX_GENERATIONS; ++ i) {
+		if (m_generations[i] != NULL) {
+			m_generations[i]->addWaiter(m_hCancel);
+		}
+	}
+	if (m_job != NULL) {
+		m_job->setWaiter(m_hCancel);
+	}
+	return m_hCancel;
+}
+
+bool CCancelToken::_CheckChanged () const {
+	bool changed = false;
+	LONG values[MAX_GENERATIONS];
+	for (int i = 0; i < MAX_GENERATIONS; ++ i) {
+		if (m_generations[i] == NULL) {
+			continue;
+		}
+		values[i] = m_generations[i]->get();
+		if (values[i] == m_captured[i]) {
+			continue;
+		}
+		if (!_IsStillWanted(i)) {
+			m_stopped = true;
+			m_generations[i]->onAborted();
+			return true;
+		}
+		changed = true;
+	}
+
+	if (changed) {
+		for (int i = 0; i < MAX_GENERATIONS; ++ i) {
+			if (m_generations[i] != NULL) {
+				m_captured[i] = values[i];
+			}
+		}
+	}
+	return false;
+}
@@ -0,0 +1,107 @@
+#ifndef XL_VIEW_CANCEL_TOKEN_H
+#define XL_VIEW_CANCEL_TOKEN_H
+#include <vector>
+#include <Windows.h>
+#include "libxl/include/common.h"
+#include "libxl/include/interfaces.h"
+#include "libxl/include/lockable.h"
+#include "JobScheduler.h"
+
+/**
+ * A counter bumped when the work based on it is out of date (the current
+ * index, the view size, the zoom size, ...). The workers capture it when
+ * they start, and stop when it changes, so one poll is just an aligned read.
+ *
+ * The time of the last bump is kept to measure the latency from the user's
+ * action to the abort of the workers.
+ */
+class CGeneration
+{
+public:
+	struct Stats {
+		LONG           bumps;
+		LONG           aborts;
+		LONG           totalLatency; // in microseconds
+		LONG           maxLatency;   // in microseconds
+	};
+
+protected:
+	volatile LONG      m_value;
+	volatile LONGLONG  m_bumpTime; // QueryPerformanceCounter()
+	volatile LONG      m_bumps;
+	volatile LONG      m_aborts;
+	volatile LONG      m_totalLatency;
+	volatile LONG      m_maxLatency;
+
+	// the events set by bump(), see CCancelToken::getCancelEvent()
+	xl::CUserLock      m_waitersLock;
+	std::vector<HANDLE> m_waiters;
+
+public:
+	CGeneration ();
+
+	LONG get () const { return m_value; }
+	LONG bump ();
+
+	void addWaiter (HANDLE hEvent);
+	void removeWaiter (HANDLE hEvent);
+
+	// called once by the worker stopped by the bump
+	void onAborted ();
+
+	Stats getStats () const;
+	void traceStats (const xl::tchar *name) const;
+};
+
+
+/**
+ * The callback for the decoders and the resizers, stops when one of the
+ * generations changes (or the job is canceled). The subclass can accept the
+ * change by _IsStillWanted(), then the new generations are captured.
+ */
+class CCancelToken : public xl::ILongTimeRunCallback
+{
+protected:
+	enum { MAX_GENERATIONS = 2 };
+
+	CGeneration       *m_generations[MAX_GENERATIONS];
+	mutable LONG       m_captured[MAX_GENERATIONS];
+	CJob              *m_job;
+	mutable bool       m_stopped;
+	HANDLE             m_hCancel; // see getCancelEvent()
+
+	// @which generation changed, returns true if the work is still wanted
+	virtual bool _IsStillWanted (int /*which*/) const { return false; }
+
+public:
+	// @firstValue and @secondValue should be read in the same lock with the
+	// state the work is based on
+	CCancelToken (CJob *job, CGeneration *first, LONG firstValue, CGeneration *second = NULL, LONG secondValue = 0);
+	virtual ~CCancelToken ();
+
+	// an (auto reset) event set when one of the generations changes, or the job
+	// is canceled, so the waiting (for the others) wakes up at once and checks
+	// shouldStop(); created on the first call, check shouldStop() after that
+	HANDLE getCancelEvent ();
+
+	virtual bool shouldStop () const {
+		if (m_stopped) {
+			return true;
+		}
+		for (int i = 0; i < MAX_GENERATIONS; ++ i) {
+			if (m_generations[i] != NULL && m_generations[i]->get() != m_captured[i]) {
+				return _CheckChanged();
+			}
+		}
+		if (m_job != NULL && m_job->isCanceled()) {
+			m_stopped = true;
+		}
+		return m_stopped;
+	}
+
+protected:
+	bool _CheckChanged () const; // the slow path
+};
+
+
+#endif
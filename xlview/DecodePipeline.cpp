@@ -0,0 +1,399 @@
+#include <assert.h>
+#include "libxl/include/utilities.h"
+#include "DecodePipeline.h"
+#include "JobScheduler.h"
+#include "PixelBufferPool.h"
+#include "ImageReducer.h"
+
+static CDecodePipeline::Stats _stats;
+
+
+//////////////////////////////////////////////////////////////////////////
+// CStrip
+
+CStrip::CStrip (int y, int lines)
+	: y(y)
+	, lines(lines)
+	, data(NULL)
+	, bytes(0)
+	, stride(0)
+{
+	assert(y >= 0 && lines > 0);
+}
+
+CStrip::~CStrip () {
+	if (data != NULL) {
+		CPixelBufferPool::getInstance()->release(data, bytes);
+	}
+	if (dib != NULL) {
+		CDIBSectionPool::getInstance()->recycle(dib);
+	}
+}
+
+bool CStrip::allocate (int stride) {
+	assert(data == NULL && stride > 0);
+	this->stride = stride;
+	bytes = (size_t)stride * lines;
+	data = (xl::uint8 *)CPixelBufferPool::getInstance()->allocate(bytes);
+	return data != NULL;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CStripQueue
+
+CStripQueue::CStripQueue (size_t capacity) : m_capacity(capacity), m_closed(false) {
+	assert(capacity > 0);
+}
+
+bool CStripQueue::isFull () const {
+	xl::CScopeLock lock(this);
+	return m_strips.size() >= m_capacity;
+}
+
+bool CStripQueue::isDrained () const {
+	xl::CScopeLock lock(this);
+	return m_closed && m_strips.empty();
+}
+
+void CStripQueue::push (CStripPtr strip) {
+	assert(strip != NULL);
+	xl::CScopeLock lock(this);
+	assert(!m_closed);
+	m_strips.push_back(strip);
+}
+
+CStripPtr CStripQueue::front () const {
+	xl::CScopeLock lock(this);
+	return m_strips.empty() ? CStripPtr() : m_strips.front();
+}
+
+CStripPtr CStripQueue::pop () {
+	xl::CScopeLock lock(this);
+	CStripPtr strip;
+	if (!m_strips.empty()) {
+		strip = m_strips.front();
+		m_strips.pop_front();
+	}
+	return strip;
+}
+
+void CStripQueue::close () {
+	xl::CScopeLock lock(this);
+	m_closed = true;
+}
+
+void CStripQueue::clear () {
+	xl::CScopeLock lock(this);
+	m_strips.clear();
+	m_closed = true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CDecodeStage
+
+CDecodeStage::CDecodeStage (CStripQueue *in, CStripQueue *out)
+	: m_in(in)
+	, m_out(out)
+	, m_running(0)
+	, m_done(false)
+{
+}
+
+CDecodeStage::~CDecodeStage () {
+	assert(m_running == 0);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CResampleStage
+
+CResampleStage::CResampleStage (CStripQueue *in, CStripQueue *out, xl::ui::CResizeEngine *pResizer, xl::ui::CDIBSection *dibTmp, int reduceShift)
+	: CDecodeStage(in, out)
+	, m_pResizer(pResizer)
+	, m_dibTmp(dibTmp)
+	, m_reduceShift(reduceShift)
+{
+	assert(in != NULL && out != NULL && pResizer != NULL && dibTmp != NULL);
+	assert(reduceShift >= 0 && (1 << reduceShift) <= CDecodePipeline::STRIP_LINES);
+}
+
+CDecodeStage::STATE CResampleStage::step (xl::ILongTimeRunCallback *pCallback) {
+	if (m_out->isFull()) {
+		return STATE_BLOCKED;
+	}
+	CStripPtr strip = m_in->front();
+	if (strip == NULL) {
+		return m_in->isDrained() ? STATE_DONE : STATE_BLOCKED;
+	}
+
+	// the strips start at the multiples of STRIP_LINES, so the reduced ones are
+	// still adjacent, the odd lines at the bottom are dropped as reduceHalf() does
+	assert(strip->dib != NULL);
+	assert(strip->dib->getHeight() == CDecodePipeline::STRIP_LINES);
+	CDIBSectionPool *pool = CDIBSectionPool::getInstance();
+	xl::ui::CDIBSectionPtr dib = strip->dib;
+	for (int i = 0; i < m_reduceShift; ++ i) {
+		xl::ui::CDIBSectionPtr half = pool->create(dib->getWidth() / 2, dib->getHeight() / 2, dib->getBitCounts(), false);
+		bool reduced = half != NULL && reduceHalf(dib.get(), half.get(), pCallback);
+		if (dib != strip->dib) {
+			pool->recycle(dib);
+		}
+		if (!reduced) {
+			return pCallback && pCallback->shouldStop() ? STATE_STOPPED : STATE_FAILED;
+		}
+		dib = half;
+	}
+
+	int y = strip->y >> m_reduceShift;
+	int lines = strip->lines >> m_reduceShift;
+	bool filtered = lines == 0 || m_pResizer->horizontalFilter(dib.get(), dib->getHeight(), m_dibTmp, y, lines, pCallback);
+	if (dib != strip->dib) {
+		pool->recycle(dib);
+	}
+	if (!filtered) {
+		return pCallback && pCallback->shouldStop() ? STATE_STOPPED : STATE_FAILED;
+	}
+
+	// only the lines are passed on, the pixels are in m_dibTmp now
+	strip.reset();
+	m_in->pop();
+	if (lines > 0) {
+		m_out->push(CStripPtr(new CStrip(y, lines)));
+	}
+	return STATE_PROGRESS;
+}
+
+int CResampleStage::getReduceShift (CSize szSrc, CSize szDst, int bitcount) {
+	if (bitcount != 24 && bitcount != 32) {
+		return 0; // not supported by reduceHalf()
+	}
+	int shift = 0;
+	while ((2 << shift) <= CDecodePipeline::STRIP_LINES
+		&& (szSrc.cx >> (shift + 1)) >= szDst.cx && (szSrc.cy >> (shift + 1)) >= szDst.cy) {
+		++ shift;
+	}
+	return shift;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CPublishStage
+
+CPublishStage::CPublishStage (CStripQueue *in, xl::ui::CResizeEngine *pResizer, xl::ui::CDIBSection *dibTmp, xl::ui::CDIBSection *dst)
+	: CDecodeStage(in, NULL)
+	, m_pResizer(pResizer)
+	, m_dibTmp(dibTmp)
+	, m_dst(dst)
+	, m_lines(0)
+{
+	assert(in != NULL && pResizer != NULL && dibTmp != NULL && dst != NULL);
+}
+
+CDecodeStage::STATE CPublishStage::step (xl::ILongTimeRunCallback *pCallback) {
+	CStripPtr strip = m_in->pop();
+	if (strip != NULL) {
+		m_lines += strip->lines;
+		return STATE_PROGRESS;
+	}
+	if (!m_in->isDrained()) {
+		return STATE_BLOCKED;
+	}
+
+	// the lines not decoded (a broken file) are left blank
+	if (m_lines == 0) {
+		return STATE_FAILED;
+	}
+	if (!m_pResizer->verticalFilter(m_dibTmp, m_dst, pCallback)) {
+		return pCallback && pCallback->shouldStop() ? STATE_STOPPED : STATE_FAILED;
+	}
+	return STATE_DONE;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CDecodePipeline
+
+// stops when the caller stops, or the helper is canceled; the yielding is checked
+// between the steps only (see _Drive()), it never stops a filter in the middle
+class CDecodePipeline::_StopCallback : public xl::ILongTimeRunCallback {
+	CJob *m_job;
+	_Shared *m_shared;
+public:
+	_StopCallback (CJob *job, _Shared *shared) : m_job(job), m_shared(shared) {}
+	virtual bool shouldStop () const {
+		return m_shared->stopped || m_job->isCanceled();
+	}
+};
+
+class CDecodePipeline::_HelperJob : public CJob {
+	_SharedPtr m_shared;
+public:
+	_HelperJob (_SharedPtr shared) : CJob(PRIORITY_PREFETCH, shared.get()), m_shared(shared) {}
+	virtual void run () {
+		xl::CScopeLock lock(m_shared.get());
+		CDecodePipeline *pipeline = m_shared->pipeline;
+		m_shared->queued = false;
+		if (pipeline == NULL) {
+			return; // the caller did all the work
+		}
+		m_shared->drivers ++;
+		lock.unlock();
+
+		_StopCallback callback(this, m_shared.get());
+		pipeline->_Drive(&callback, this);
+
+		lock.lock(m_shared.get());
+		m_shared->drivers --;
+		lock.unlock();
+		::SetEvent(m_shared->hStepped);
+	}
+};
+
+CDecodePipeline::_Shared::_Shared ()
+	: pipeline(NULL)
+	, drivers(0)
+	, queued(false)
+	, stopped(false)
+	, hStepped(::CreateEvent(NULL, FALSE, FALSE, NULL))
+{
+	assert(hStepped != NULL);
+}
+
+CDecodePipeline::_Shared::~_Shared () {
+	::CloseHandle(hStepped);
+}
+
+CDecodePipeline::CDecodePipeline () : m_shared(new _Shared()), m_failed(false) {
+	m_shared->pipeline = this;
+}
+
+CDecodePipeline::~CDecodePipeline () {
+	_Close();
+}
+
+void CDecodePipeline::addStage (CDecodeStage *stage) {
+	assert(stage != NULL);
+	assert(m_stages.empty() || m_stages.back()->m_out == stage->m_in);
+	m_stages.push_back(stage);
+}
+
+bool CDecodePipeline::_Drive (xl::ILongTimeRunCallback *pCallback, CJob *helper) {
+	bool worked = false;
+	for (;;) {
+		if (m_failed) {
+			return true;
+		}
+		if (pCallback && pCallback->shouldStop()) {
+			return false;
+		}
+		if (helper != NULL && helper->shouldYield()) {
+			return false; // the caller goes on
+		}
+
+		// from the last one, to free the strips as soon as possible
+		bool done = true;
+		bool progress = false;
+		bool busy = false; // some stage is run by the other one
+		for (int i = (int)m_stages.size() - 1; i >= 0; -- i) {
+			CDecodeStage *stage = m_stages[i];
+			if (stage->m_done) {
+				continue;
+			}
+			done = false;
+			if (::InterlockedCompareExchange(&stage->m_running, 1, 0) != 0) {
+				busy = true;
+				continue; // run by the other one
+			}
+			CDecodeStage::STATE state = stage->m_done ? CDecodeStage::STATE_DONE : stage->step(pCallback);
+			if (state == CDecodeStage::STATE_DONE && !stage->m_done) {
+				if (stage->m_out != NULL) {
+					stage->m_out->close();
+				}
+				stage->m_done = true;
+			}
+			::InterlockedExchange(&stage->m_running, 0);
+			if (helper != NULL) {
+				::SetEvent(m_shared->hStepped); // the caller may wait for the stage
+			}
+
+			if (state == CDecodeStage::STATE_FAILED) {
+				m_failed = true;
+				return true;
+			} else if (state == CDecodeStage::STATE_STOPPED) {
+				return false; // the stage is run again by the one not stopped
+			} else if (state != CDecodeStage::STATE_BLOCKED) {
+				::InterlockedIncrement(helper != NULL ? &_stats.helperSteps : &_stats.steps);
+				if (helper != NULL && !worked) {
+					worked = true;
+					::InterlockedIncrement(&_stats.helpers);
+				}
+				progress = true;
+				if (helper == NULL && m_stages.size() > 1) {
+					_KickHelper();
+				}
+				break;
+			}
+		}
+
+		if (done) {
+			return true;
+		}
+		if (!progress) {
+			if (helper != NULL) {
+				return false; // the caller goes on
+			}
+			if (busy) {
+				// the helper is in the stage we are waiting for, the event is
+				// set (and kept) if it leaves the stage before we wait
+				::WaitForSingleObject(m_shared->hStepped, INFINITE);
+			}
+		}
+	}
+}
+
+void CDecodePipeline::_KickHelper () {
+	CJobScheduler *scheduler = CJobScheduler::getInstance();
+	if (!scheduler->hasIdleWorker()) {
+		return;
+	}
+	xl::CScopeLock lock(m_shared.get());
+	if (m_shared->drivers > 0 || m_shared->queued) {
+		return;
+	}
+	m_shared->queued = true;
+	lock.unlock();
+
+	CJobPtr job(new _HelperJob(m_shared));
+	scheduler->submit(job);
+}
+
+void CDecodePipeline::_Close () {
+	xl::CScopeLock lock(m_shared.get());
+	m_shared->pipeline = NULL;
+	m_shared->stopped = true;
+	while (m_shared->drivers > 0) {
+		lock.unlock();
+		::WaitForSingleObject(m_shared->hStepped, INFINITE);
+		lock.lock(m_shared.get());
+	}
+}
+
+bool CDecodePipeline::run (xl::ILongTimeRunCallback *pCallback) {
+	assert(!m_stages.empty());
+	::InterlockedIncrement(&_stats.pipelines);
+
+	bool finished = _Drive(pCallback, NULL);
+	_Close(); // the stages are on the stack of the caller
+	return finished && !m_failed;
+}
+
+CDecodePipeline::Stats CDecodePipeline::getStats () {
+	return _stats;
+}
+
+void CDecodePipeline::traceStats () {
+	XLTRACE(_T("** decode pipeline: %d pipelines, %d steps, %d helpers (%d steps)\n"),
+		(int)_stats.pipelines, (int)_stats.steps, (int)_stats.helpers, (int)_stats.helperSteps);
+}
@@ -0,0 +1,216 @@
+#ifndef XL_VIEW_DECODE_PIPELINE_H
+#define XL_VIEW_DECODE_PIPELINE_H
+#include <deque>
+#include <vector>
+#include <memory>
+#include <Windows.h>
+#include "libxl/include/common.h"
+#include "libxl/include/interfaces.h"
+#include "libxl/include/lockable.h"
+#include "libxl/include/ui/DIBSection.h"
+#include "libxl/include/ui/DIBResizer.h"
+#include "Image.h"
+
+/**
+ * The decoding of one image as a chain of resumable stages:
+ *
+ *   (read) -> decode strips -> convert -> resample -> publish
+ *
+ * The data is read by CImageLoader before the plugin is called, so the first
+ * stage is the decoding. Every stage does a small piece of work in step() (one
+ * strip usually) and returns, the strips are passed by the bounded queues, so
+ * a stage is blocked when its output is full (the back-pressure), and only a
+ * few strips of the image are in memory besides the result.
+ *
+ * The stages are run by the loader (the job of the caller), and by a helper job
+ * if a worker is idle, so the decoding of one strip goes with the converting
+ * and resampling of the previous ones, and the stages of the different images
+ * share the pool. A stage is never run by two at once. The helper gives the
+ * worker up when all the stages it could run are blocked, and is submitted
+ * again when the caller makes some progress. The caller waits (for an event)
+ * when the only stage it could run is run by the helper.
+ */
+
+//////////////////////////////////////////////////////////////////////////
+// CStrip, some lines of the image
+
+class CJob;
+class CStrip;
+typedef std::tr1::shared_ptr<CStrip>           CStripPtr;
+
+class CStrip
+{
+public:
+	int                y;       // the first line
+	int                lines;
+	xl::uint8         *data;    // the raw lines of the decoder (from CPixelBufferPool)
+	size_t             bytes;
+	int                stride;
+	xl::ui::CDIBSectionPtr dib; // the converted lines
+
+	CStrip (int y, int lines);
+	~CStrip ();
+
+	// returns false if out of memory
+	bool allocate (int stride);
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// CStripQueue
+
+class CStripQueue : public xl::CUserLock
+{
+	typedef std::deque<CStripPtr>                  _Strips;
+
+	_Strips            m_strips;
+	size_t             m_capacity;
+	bool               m_closed;    // no more strips
+
+public:
+	CStripQueue (size_t capacity);
+
+	bool isFull () const;
+	// all the strips are popped, and no more
+	bool isDrained () const;
+	void push (CStripPtr strip);
+	CStripPtr front () const; // NULL if empty, the strip is not removed
+	CStripPtr pop (); // NULL if empty
+	void close ();
+	void clear ();
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// CDecodeStage
+
+class CDecodeStage
+{
+public:
+	enum STATE {
+		STATE_PROGRESS,    // some work done, call step() again
+		STATE_BLOCKED,     // the input is empty, or the output is full
+		STATE_STOPPED,     // @pCallback stops, the input is kept for the next step()
+		STATE_DONE,
+		STATE_FAILED       // a broken image, or out of memory
+	};
+
+protected:
+	CStripQueue       *m_in;   // NULL for the first stage
+	CStripQueue       *m_out;  // NULL for the last stage
+	volatile LONG      m_running;
+	volatile bool      m_done;
+
+	friend class CDecodePipeline;
+
+public:
+	CDecodeStage (CStripQueue *in, CStripQueue *out);
+	virtual ~CDecodeStage ();
+
+	// @pCallback is the one of the caller, or of the helper job, the strip is
+	// popped only when it is done, so a stopped step() is done again by the next
+	virtual STATE step (xl::ILongTimeRunCallback *pCallback) = 0;
+};
+
+
+// horizontalFilter() the converted strips into the temporary image, each strip
+// is reduced by 2^@reduceShift (see reduceHalf()) first, so the temporary image
+// is of the reduced height, and the filters do the fractional step only
+class CResampleStage : public CDecodeStage
+{
+	xl::ui::CResizeEngine *m_pResizer;
+	xl::ui::CDIBSection *m_dibTmp;
+	int                m_reduceShift;
+public:
+	CResampleStage (CStripQueue *in, CStripQueue *out, xl::ui::CResizeEngine *pResizer, xl::ui::CDIBSection *dibTmp, int reduceShift = 0);
+	virtual STATE step (xl::ILongTimeRunCallback *pCallback);
+
+	// how many times @szSrc can be reduced by 2 and still not smaller than
+	// @szDst, at most the strip is reduced to one line
+	static int getReduceShift (CSize szSrc, CSize szDst, int bitcount);
+};
+
+
+// verticalFilter() the temporary image into the result, when all the strips are resampled
+class CPublishStage : public CDecodeStage
+{
+	xl::ui::CResizeEngine *m_pResizer;
+	xl::ui::CDIBSection *m_dibTmp;
+	xl::ui::CDIBSection *m_dst;
+	int                m_lines; // resampled
+public:
+	CPublishStage (CStripQueue *in, xl::ui::CResizeEngine *pResizer, xl::ui::CDIBSection *dibTmp, xl::ui::CDIBSection *dst);
+	virtual STATE step (xl::ILongTimeRunCallback *pCallback);
+	int getLines () const { return m_lines; }
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// CDecodePipeline
+
+class CDecodePipeline
+{
+public:
+	enum {
+		STRIP_LINES = 32,
+		QUEUE_CAPACITY = 4  // strips in each queue
+	};
+
+	struct Stats {
+		volatile LONG  pipelines;
+		volatile LONG  helpers;       // the helper jobs which did some work
+		volatile LONG  steps;
+		volatile LONG  helperSteps;
+
+		Stats () {
+			memset((void *)this, 0, sizeof(*this));
+		}
+	};
+
+protected:
+	typedef std::vector<CDecodeStage *>            _Stages;
+
+	// shared with the helper job, which may run after the pipeline is gone
+	struct _Shared : public xl::CUserLock {
+		CDecodePipeline *pipeline;  // NULL when closed
+		LONG           drivers;    // the helpers in run()
+		bool           queued;     // a helper is submitted, and not run yet
+		volatile bool  stopped;    // the caller stops, seen by the helpers
+		HANDLE         hStepped;   // (auto reset) a helper leaves a stage, or run()
+
+		_Shared ();
+		~_Shared ();
+	};
+	typedef std::tr1::shared_ptr<_Shared>          _SharedPtr;
+
+	class _HelperJob;
+	class _StopCallback;
+
+	_Stages            m_stages;
+	_SharedPtr         m_shared;
+	volatile bool      m_failed;
+
+	// returns true if all the stages are done (or failed), false if blocked, stopped or
+	// yielded, @helper is NULL for the caller
+	bool _Drive (xl::ILongTimeRunCallback *pCallback, CJob *helper);
+	// the helper returns when blocked, and is submitted again when there is work
+	void _KickHelper ();
+	void _Close ();
+
+public:
+	CDecodePipeline ();
+	~CDecodePipeline ();
+
+	// from the first to the last, not owned
+	void addStage (CDecodeStage *stage);
+
+	// run all the stages to the end in the calling thread (with a helper job if
+	// a worker is idle), returns false if any stage fails, or @pCallback stops
+	bool run (xl::ILongTimeRunCallback *pCallback);
+
+	static Stats getStats ();
+	static void traceStats ();
+};
+
+
+#endif
@@ -1,4 +1,7 @@
 #include <assert.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
 #include <setjmp.h>
 #include <process.h>
 #include "libxl/include/fs.h"
@@ -6,8 +9,196 @@
 #include "ImageConfig.h"
 #include "Image.h"
 #include "ImageLoader.h"
+#include "ImageReducer.h"
+#include "PixelBufferPool.h"
+#include "TiledImage.h"
 
 
+//////////////////////////////////////////////////////////////////////////
+// local functions
+static void _CopyRect (xl::ui::CDIBSection *dst, int dx, int dy, 
+                       xl::ui::CDIBSection *src, int sx, int sy, int w, int h) {
+	assert(dst->getBitCounts() == src->getBitCounts());
+	assert(dx >= 0 && dy >= 0 && dx + w <= dst->getWidth() && dy + h <= dst->getHeight());
+	assert(sx >= 0 && sy >= 0 && sx + w <= src->getWidth() && sy + h <= src->getHeight());
+	int bytes = src->getBitCounts() / 8;
+	for (int y = 0; y < h; ++ y) {
+		xl::uint8 *dst_line = dst->getLine(dy + y) + dx * bytes;
+		xl::uint8 *src_line = src->getLine(sy + y) + sx * bytes;
+		memcpy(dst_line, src_line, w * bytes);
+	}
+}
+
+
+// the source pixels which one destination pixel is made of, the weights are
+// fixed-point (of WEIGHT_SHIFT bits), and the ones of all the pixels are in
+// one array, so the filters never allocate
+static const int WEIGHT_SHIFT = 14;
+static const int WEIGHT_ONE = 1 << WEIGHT_SHIFT;
+
+struct _Contribution {
+	int                left;
+	int                count;
+	int                offset; // in _Contributions::weights
+};
+
+struct _Contributions {
+	std::vector<_Contribution> pixels;
+	std::vector<int>   weights;
+
+	int size () const { return (int)pixels.size(); }
+	const _Contribution& operator [] (int i) const { return pixels[i]; }
+	const int* getWeights (const _Contribution &c) const { return &weights[c.offset]; }
+	int getRight () const; // the end of the source pixels of all
+};
+
+int _Contributions::getRight () const {
+	int right = 0;
+	for (std::vector<_Contribution>::const_iterator it = pixels.begin(); it != pixels.end(); ++ it) {
+		right = (std::max)(right, it->left + it->count);
+	}
+	return right;
+}
+
+// Mitchell-Netravali (B = C = 1/3), the same as xl::ui::CBicubicFilter
+static double _BicubicFilter (double x) {
+	x = fabs(x);
+	if (x < 1.0) {
+		return (16.0 + x * x * (-36.0 + x * 21.0)) / 18.0;
+	} else if (x < 2.0) {
+		return (32.0 + x * (-60.0 + x * (36.0 - x * 7.0))) / 18.0;
+	}
+	return 0.0;
+}
+
+static double _BoxFilter (double x) {
+	return x >= -0.5 && x < 0.5 ? 1.0 : 0.0;
+}
+
+// the destination pixels [@begin, @end) of the whole image resized from @srcSize
+// to @dstSize, the centers are mapped by the exact scale, not of the rounded rects
+static void _GetContributions (_Contributions &contributions, int srcSize, int dstSize,
+                               int begin, int end, xl::ui::CDIBSection::RESIZE_TYPE rt) {
+	assert(srcSize > 0 && dstSize > 0 && begin >= 0 && begin < end && end <= dstSize);
+	double scale = (double)dstSize / (double)srcSize;
+	double fscale = scale < 1.0 ? scale : 1.0; // the filter is widened when reducing
+	double (*filter)(double) = rt == xl::ui::CDIBSection::RT_BOX ? _BoxFilter : _BicubicFilter;
+	double radius = (rt == xl::ui::CDIBSection::RT_BOX ? 0.5 : 2.0) / fscale;
+
+	contributions.pixels.resize(end - begin);
+	contributions.weights.clear();
+	contributions.weights.reserve((end - begin) * ((int)ceil(radius * 2) + 1));
+	std::vector<double> weights;
+	for (int x = begin; x < end; ++ x) {
+		_Contribution &c = contributions.pixels[x - begin];
+		double center = (x + 0.5) / scale;
+		c.offset = (int)contributions.weights.size();
+		double total = 0.0;
+		if (rt != xl::ui::CDIBSection::RT_FAST) {
+			c.left = (std::max)(0, (int)floor(center - radius));
+			int right = (std::min)(srcSize, (int)ceil(center + radius));
+			weights.clear();
+			for (int i = c.left; i < right; ++ i) {
+				double w = filter((i + 0.5 - center) * fscale);
+				weights.push_back(w);
+				total += w;
+			}
+		}
+		if (total <= 0.0) {
+			c.left = (std::min)((int)center, srcSize - 1); // the nearest one
+			c.count = 1;
+			contributions.weights.push_back(WEIGHT_ONE);
+			continue;
+		}
+
+		// normalized, and the rounding error goes to the largest one, so the
+		// weights always sum to WEIGHT_ONE (a flat area stays flat)
+		c.count = (int)weights.size();
+		int sum = 0;
+		int largest = c.offset;
+		for (int i = 0; i < c.count; ++ i) {
+			int w = (int)floor(weights[i] / total * WEIGHT_ONE + 0.5);
+			contributions.weights.push_back(w);
+			sum += w;
+			if (w > contributions.weights[largest]) {
+				largest = c.offset + i;
+			}
+		}
+		contributions.weights[largest] += WEIGHT_ONE - sum;
+	}
+}
+
+static inline xl::uint8 _ClampPixel (int v) {
+	return v <= 0 ? 0 : v >= (255 << WEIGHT_SHIFT) ? 255 : (xl::uint8)((v + (WEIGHT_ONE >> 1)) >> WEIGHT_SHIFT);
+}
+
+// filter the columns of @src (which starts at the source pixel @left) into @dst
+static bool _HorizontalFilter (xl::ui::CDIBSection *dst, xl::ui::CDIBSection *src, int left,
+                               const _Contributions &contributions, xl::ILongTimeRunCallback *pCallback) {
+	assert(dst->getHeight() == src->getHeight() && dst->getWidth() == contributions.size());
+	const int bytes = src->getBitCounts() / 8;
+	assert(bytes == 3 || bytes == 4);
+	for (int y = 0; y < dst->getHeight(); ++ y) {
+		if (pCallback && pCallback->shouldStop()) {
+			return false;
+		}
+		const xl::uint8 *src_line = src->getLine(y);
+		xl::uint8 *dst_line = dst->getLine(y);
+		for (int x = 0; x < dst->getWidth(); ++ x) {
+			const _Contribution &c = contributions[x];
+			const int *weights = contributions.getWeights(c);
+			const xl::uint8 *p = src_line + (c.left - left) * bytes;
+			int b = 0, g = 0, r = 0, a = 0;
+			for (int i = 0; i < c.count; ++ i, p += bytes) {
+				int w = weights[i];
+				b += w * p[0];
+				g += w * p[1];
+				r += w * p[2];
+				if (bytes == 4) {
+					a += w * p[3];
+				}
+			}
+			dst_line[0] = _ClampPixel(b);
+			dst_line[1] = _ClampPixel(g);
+			dst_line[2] = _ClampPixel(r);
+			if (bytes == 4) {
+				dst_line[3] = _ClampPixel(a);
+			}
+			dst_line += bytes;
+		}
+	}
+	return true;
+}
+
+// filter the lines of @src (which starts at the source line @top) into @dst
+static bool _VerticalFilter (xl::ui::CDIBSection *dst, xl::ui::CDIBSection *src, int top,
+                             const _Contributions &contributions, xl::ILongTimeRunCallback *pCallback) {
+	assert(dst->getWidth() == src->getWidth() && dst->getHeight() == contributions.size());
+	const int length = dst->getWidth() * (dst->getBitCounts() / 8);
+	std::vector<int> line(length);
+	int *sum = &line[0];
+	for (int y = 0; y < dst->getHeight(); ++ y) {
+		if (pCallback && pCallback->shouldStop()) {
+			return false;
+		}
+		const _Contribution &c = contributions[y];
+		const int *weights = contributions.getWeights(c);
+		memset(sum, 0, length * sizeof(int));
+		for (int i = 0; i < c.count; ++ i) {
+			const xl::uint8 *src_line = src->getLine(c.left - top + i);
+			int w = weights[i];
+			for (int x = 0; x < length; ++ x) {
+				sum[x] += w * src_line[x];
+			}
+		}
+		xl::uint8 *dst_line = dst->getLine(y);
+		for (int x = 0; x < length; ++ x) {
+			dst_line[x] = _ClampPixel(sum[x]);
+		}
+	}
+	return true;
+}
+
 //////////////////////////////////////////////////////////////////////////
 // CImage::BitmapAndDelay
 CImage::Frame::Frame () {
@@ -36,10 +227,12 @@ void CImage::operator = (const CImage &image) {
 	clear();
 	m_width = image.m_width;
 	m_height = image.m_height;
+	m_tiled = image.m_tiled; // the tiles are never changed after loaded
 
+	// share the bitmaps, they are copied in getWritableImage() when needed
 	for (size_t i = 0; i < image.m_frames.size(); ++ i) {
 		_FramePtr bad(new Frame());
-		bad->bitmap = image.m_frames[i]->bitmap->clone();
+		bad->bitmap = image.m_frames[i]->bitmap;
 		bad->delay = image.m_frames[i]->delay;
 
 		m_frames.push_back(bad);
@@ -58,12 +251,22 @@ CImagePtr CImage::clone () {
 void CImage::clear () {
 	m_height = m_width = -1;
 	m_frames.clear();
+	m_tiled.reset();
 }
 
 xl::uint CImage::getImageCount () const {
 	return m_frames.size();
 }
 
+size_t CImage::getMemorySize () const {
+	size_t bytes = 0;
+	for (_FrameContainer::const_iterator it = m_frames.begin(); it != m_frames.end(); ++ it) {
+		xl::ui::CDIBSectionPtr bitmap = (*it)->bitmap;
+		bytes += (size_t)bitmap->getStride() * bitmap->getHeight();
+	}
+	return bytes;
+}
+
 xl::uint CImage::getImageDelay (xl::uint index) const {
 	assert(index < getImageCount());
 	return m_frames[index]->delay;
@@ -74,8 +277,30 @@ xl::ui::CDIBSectionPtr CImage::getImage (xl::uint index) {
 	return m_frames[index]->bitmap;
 }
 
+xl::ui::CDIBSectionPtr CImage::getWritableImage (xl::uint index) {
+	assert(index < getImageCount());
+	xl::ui::CDIBSectionPtr &bitmap = m_frames[index]->bitmap;
+	if (!bitmap.unique()) {
+		xl::ui::CDIBSectionPtr copy = bitmap->clone();
+		if (copy == NULL) {
+			return xl::ui::CDIBSectionPtr();
+		}
+		bitmap = copy;
+	}
+	return bitmap;
+}
+
+void CImage::setTiledImage (CTiledImagePtr tiled) {
+	assert(tiled != NULL);
+	assert(m_frames.size() == 0);
+	m_tiled = tiled;
+	m_width = tiled->getWidth();
+	m_height = tiled->getHeight();
+}
+
 void CImage::insertImage (xl::ui::CDIBSectionPtr bitmap, xl::uint delay) {
 	assert(bitmap != NULL);
+	assert(m_tiled == NULL);
 	if (m_width != -1 || m_height != -1) {
 		assert(m_width == bitmap->getWidth() && m_height == bitmap->getHeight());
 	} else {
@@ -89,9 +314,18 @@ void CImage::insertImage (xl::ui::CDIBSectionPtr bitmap, xl::uint delay) {
 	m_frames.push_back(bad);
 }
 
+xl::ui::CDIBSection::RESIZE_TYPE CImage::_GetResizeType (double ratio, bool highQuality) {
+	if (!highQuality) {
+		return xl::ui::CDIBSection::RT_FAST;
+	}
+	return ratio > 0.33 ? xl::ui::CDIBSection::RT_BICUBIC : xl::ui::CDIBSection::RT_BOX;
+}
+
 CImagePtr CImage::resize (int width, int height, bool highQuality, xl::ILongTimeRunCallback *pCallback) {
 	if (width == m_width && height == m_height) {
 		return clone();
+	} else if (m_tiled != NULL) {
+		return m_tiled->resize(width, height, highQuality, pCallback);
 	} else {
 		assert(width > 0 && height > 0);
 		CImage *pImage = new CImage();
@@ -100,15 +334,22 @@ CImagePtr CImage::resize (int width, int height, bool highQuality, xl::ILongTime
 		pImage->m_width = width;
 		pImage->m_height = height;
 
-		xl::ui::CDIBSection::RESIZE_TYPE rt_hq = xl::ui::CDIBSection::RT_BOX;
-		double ratio = (double)width / (double)m_width;
-		if (ratio > 0.33) {
-			rt_hq = xl::ui::CDIBSection::RT_BICUBIC;
-		} 
-		xl::ui::CDIBSection::RESIZE_TYPE rt = highQuality ? rt_hq : xl::ui::CDIBSection::RT_FAST;
 		for (size_t i = 0; i < m_frames.size(); ++ i) {
 			xl::ui::CDIBSectionPtr src = m_frames[i]->bitmap;
-			xl::ui::CDIBSectionPtr dib = xl::ui::CDIBSection::createDIBSection(width, height, src->getBitCounts(), false);
+			if (highQuality) {
+				// reduce by 2, 4, 8... with the fast kernels first, leave only the fractional step
+				src = reduceByIntegerRatio(src, width, height, pCallback);
+				if (src == NULL) {
+					return CImagePtr();
+				} else if (src->getWidth() == width && src->getHeight() == height) {
+					pImage->insertImage(src, m_frames[i]->delay);
+					continue;
+				}
+			}
+
+			double ratio = (double)width / (double)src->getWidth();
+			xl::ui::CDIBSection::RESIZE_TYPE rt = _GetResizeType(ratio, highQuality);
+			xl::ui::CDIBSectionPtr dib = CDIBSectionPool::getInstance()->create(width, height, src->getBitCounts(), false);
 			if (!dib) {
 				return CImagePtr();
 			}
@@ -123,6 +364,66 @@ CImagePtr CImage::resize (int width, int height, bool highQuality, xl::ILongTime
 	}
 }
 
+CImagePtr CImage::resizeRect (CSize szZoom, CRect rcZoom, bool highQuality, xl::ILongTimeRunCallback *pCallback) {
+	assert(szZoom.cx > 0 && szZoom.cy > 0);
+	assert(m_width > 0 && m_height > 0);
+	CRect rcAll(0, 0, szZoom.cx, szZoom.cy);
+	rcZoom.IntersectRect(rcZoom, rcAll);
+	if (rcZoom.IsRectEmpty()) {
+		return CImagePtr();
+	} else if (rcZoom == rcAll) {
+		return resize(szZoom.cx, szZoom.cy, highQuality, pCallback);
+	}
+
+	// 1. the weights from the scale of the whole image, so the result is exactly
+	// the area of the whole resized one, the source area is what they cover
+	double sx = (double)szZoom.cx / (double)m_width;
+	xl::ui::CDIBSection::RESIZE_TYPE rt = _GetResizeType(sx, highQuality);
+	_Contributions cx, cy;
+	_GetContributions(cx, m_width, szZoom.cx, rcZoom.left, rcZoom.right, rt);
+	_GetContributions(cy, m_height, szZoom.cy, rcZoom.top, rcZoom.bottom, rt);
+	CRect rcSrc(cx[0].left, cy[0].left, cx.getRight(), cy.getRight());
+	assert(rcSrc.left >= 0 && rcSrc.top >= 0 && rcSrc.right <= m_width && rcSrc.bottom <= m_height);
+
+	CImage *pImage = new CImage();
+	CImagePtr image(pImage);
+	pImage->m_width = rcZoom.Width();
+	pImage->m_height = rcZoom.Height();
+
+	// 2. the source area -> (horizontal) -> the columns of the result -> (vertical) -> the result
+	CDIBSectionPool *pool = CDIBSectionPool::getInstance();
+	size_t count = m_tiled != NULL ? 1 : m_frames.size();
+	for (size_t i = 0; i < count; ++ i) {
+		xl::ui::CDIBSectionPtr src = m_tiled != NULL ? xl::ui::CDIBSectionPtr() : m_frames[i]->bitmap;
+		int bitcount = m_tiled != NULL ? m_tiled->getBitCounts() : src->getBitCounts();
+		xl::ui::CDIBSectionPtr crop = pool->create(rcSrc.Width(), rcSrc.Height(), bitcount, false);
+		xl::ui::CDIBSectionPtr tmp = pool->create(rcZoom.Width(), rcSrc.Height(), bitcount, false);
+		xl::ui::CDIBSectionPtr dib = pool->create(rcZoom.Width(), rcZoom.Height(), bitcount, false);
+		if (!crop || !tmp || !dib) {
+			return CImagePtr();
+		}
+
+		if (m_tiled != NULL) {
+			if (!m_tiled->readRect(crop.get(), 0, 0, rcSrc)) {
+				return CImagePtr();
+			}
+		} else {
+			_CopyRect(crop.get(), 0, 0, src.get(), rcSrc.left, rcSrc.top, rcSrc.Width(), rcSrc.Height());
+		}
+		if (!_HorizontalFilter(tmp.get(), crop.get(), rcSrc.left, cx, pCallback)
+			|| !_VerticalFilter(dib.get(), tmp.get(), rcSrc.top, cy, pCallback))
+		{
+			assert(pCallback && pCallback->shouldStop());
+			return CImagePtr();
+		}
+		pool->recycle(crop);
+		pool->recycle(tmp);
+		pImage->insertImage(dib, m_tiled != NULL ? (xl::uint)DELAY_INFINITE : m_frames[i]->delay);
+	}
+
+	return image;
+}
+
 
 CSize CImage::getSuitableSize (CSize szArea, CSize szImage, bool dontEnlarge) {
 	CSize sz(1, 1);
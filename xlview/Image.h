@@ -11,6 +11,8 @@
 
 class CImage;
 typedef std::tr1::shared_ptr<CImage>    CImagePtr;
+class CTiledImage;
+typedef std::tr1::shared_ptr<CTiledImage>      CTiledImagePtr;
 
 
 //////////////////////////////////////////////////////////////////////////
@@ -36,6 +38,9 @@ protected:
 	_FrameContainer                                m_frames;
 	int                                            m_width;
 	int                                            m_height;
+	CTiledImagePtr                                 m_tiled; // if set, there is no frames
+
+	static xl::ui::CDIBSection::RESIZE_TYPE _GetResizeType (double ratio, bool highQuality);
 
 public:
 	enum {
@@ -50,15 +55,31 @@ public:
 	void clear ();
 
 	xl::uint getImageCount () const;
+	// the bytes of the pixels of all the frames (the tiles are not counted)
+	size_t getMemorySize () const;
 	CSize getImageSize () const { return CSize(m_width, m_height); }
 	int getImageWidth () const { return m_width; }
 	int getImageHeight () const { return m_height; }
 
 	xl::uint getImageDelay (xl::uint index) const;
+	// the frames are shared between the copies (by operator = () and clone()), so
+	// the returned bitmap must not be changed, use getWritableImage() to change it
 	xl::ui::CDIBSectionPtr getImage (xl::uint index);
+	// copy on write, the bitmap is copied first if it is shared
+	xl::ui::CDIBSectionPtr getWritableImage (xl::uint index);
+
+	// the very large image is stored in tiles, and can only be resized
+	void setTiledImage (CTiledImagePtr tiled);
+	bool isTiled () const { return m_tiled != NULL; }
+	CTiledImagePtr getTiledImage () const { return m_tiled; }
 
 	void insertImage (xl::ui::CDIBSectionPtr bitmap, xl::uint delay);
 	CImagePtr resize (int width, int height, bool highQuality, xl::ILongTimeRunCallback *pCallback = NULL);
+	/**
+	 * Resize only the area @rcZoom of the image, as if the whole image is resized to @szZoom.
+	 * The returned image is of the size of @rcZoom (clipped by @szZoom)
+	 */
+	CImagePtr resizeRect (CSize szZoom, CRect rcZoom, bool highQuality, xl::ILongTimeRunCallback *pCallback = NULL);
 
 	static CSize getSuitableSize (CSize szArea, CSize szImage, bool dontEnlarge = true);
 };
@@ -0,0 +1,189 @@
+#include <assert.h>
+#include <tchar.h>
+#include <atltypes.h>
+#include "libxl/include/utilities.h"
+#include "ImageConfig.h"
+#include "Options.h"
+#include "ImageCache.h"
+#include "CachedImage.h"
+
+
+CImageCache::CImageCache ()
+	: m_budget((size_t)COptions::getInstance()->getImageCacheMB() * 1024 * 1024)
+	, m_focus(0)
+	, m_count(0)
+	, m_forward(true)
+{
+}
+
+CImageCache::~CImageCache () {
+}
+
+CImageCache::_Entries::iterator CImageCache::_Find (const CCachedImage *image) {
+	assert(getLockLevel() > 0);
+	for (_Entries::iterator it = m_entries.begin(); it != m_entries.end(); ++ it) {
+		if (it->image == image) {
+			return it;
+		}
+	}
+	return m_entries.end();
+}
+
+int CImageCache::_GetDistance (const Entry &entry) const {
+	int distance = 0;
+	if (m_count > 0) {
+		int ahead = (entry.index - m_focus + m_count) % m_count;
+		int behind = (m_focus - entry.index + m_count) % m_count;
+		if (!m_forward) {
+			int tmp = ahead;
+			ahead = behind;
+			behind = tmp;
+		}
+		distance = ahead < behind * 2 ? ahead : behind * 2;
+	}
+	return distance;
+}
+
+double CImageCache::_GetValue (const Entry &entry) const {
+	assert(entry.bytes > 0);
+	return entry.cost / entry.bytes / (1 + _GetDistance(entry));
+}
+
+void CImageCache::_Shrink (const CCachedImage *except) {
+	assert(getLockLevel() > 0);
+	while (m_stats.usedBytes > m_budget) {
+		_Entries::iterator victim = m_entries.end();
+		double value = 0;
+		for (_Entries::iterator it = m_entries.begin(); it != m_entries.end(); ++ it) {
+			if (it->image == except || it->index == m_focus) {
+				continue;
+			}
+			double v = _GetValue(*it);
+			if (victim == m_entries.end() || v <= value) { // "<=" for the least recently used
+				victim = it;
+				value = v;
+			}
+		}
+		if (victim == m_entries.end()) {
+			break;
+		}
+
+		CCachedImage *image = victim->image;
+		m_stats.usedBytes -= victim->bytes;
+		m_stats.evictions ++;
+		m_entries.erase(victim);
+
+		// the lock order is always cache -> image, see insert()
+		image->clear(false);
+	}
+}
+
+CImageCache* CImageCache::getInstance () {
+	// never destroyed, see CPixelBufferPool::getInstance()
+	static CImageCache *cache = new CImageCache();
+	return cache;
+}
+
+void CImageCache::setBudget (size_t bytes) {
+	xl::CScopeLock lock(this);
+	m_budget = bytes;
+	_Shrink(NULL);
+}
+
+size_t CImageCache::getBudget () const {
+	xl::CScopeLock lock(this);
+	return m_budget;
+}
+
+void CImageCache::setFocus (int index, int count, bool forward) {
+	xl::CScopeLock lock(this);
+	m_focus = index;
+	m_count = count;
+	m_forward = forward;
+}
+
+void CImageCache::insert (CCachedImage *image, int index, size_t bytes, CSize szImage) {
+	assert(image != NULL);
+	if (bytes == 0) {
+		return;
+	}
+
+	xl::CScopeLock lock(this);
+	_Entries::iterator it = _Find(image);
+	if (it != m_entries.end()) {
+		m_stats.usedBytes -= it->bytes;
+		m_entries.erase(it);
+	}
+
+	Entry entry;
+	entry.image = image;
+	entry.index = index;
+	entry.bytes = bytes;
+	entry.cost = (double)szImage.cx * szImage.cy;
+	if (entry.cost < bytes) {
+		entry.cost = (double)bytes;
+	}
+	m_entries.push_front(entry);
+	m_stats.usedBytes += bytes;
+	if (m_stats.usedBytes > m_stats.peakUsedBytes) {
+		m_stats.peakUsedBytes = m_stats.usedBytes;
+	}
+
+	_Shrink(image);
+}
+
+void CImageCache::remove (const CCachedImage *image) {
+	xl::CScopeLock lock(this);
+	_Entries::iterator it = _Find(image);
+	if (it != m_entries.end()) {
+		m_stats.usedBytes -= it->bytes;
+		m_entries.erase(it);
+	}
+}
+
+void CImageCache::touch (const CCachedImage *image) {
+	xl::CScopeLock lock(this);
+	_Entries::iterator it = _Find(image);
+	if (it != m_entries.end()) {
+		m_entries.splice(m_entries.begin(), m_entries, it);
+		m_stats.hits ++;
+	}
+}
+
+void CImageCache::miss () {
+	xl::CScopeLock lock(this);
+	m_stats.misses ++;
+}
+
+size_t CImageCache::shed (int maxDistance) {
+	xl::CScopeLock lock(this);
+	size_t released = 0;
+	_Entries::iterator it = m_entries.begin();
+	while (it != m_entries.end()) {
+		if (it->index == m_focus || _GetDistance(*it) <= maxDistance) {
+			++ it;
+			continue;
+		}
+
+		CCachedImage *image = it->image;
+		released += it->bytes;
+		m_stats.usedBytes -= it->bytes;
+		m_stats.evictions ++;
+		it = m_entries.erase(it);
+		image->clear(false);
+	}
+	return released;
+}
+
+CImageCache::Stats CImageCache::getStats () const {
+	xl::CScopeLock lock(this);
+	return m_stats;
+}
+
+void CImageCache::traceStats () const {
+	Stats stats = getStats();
+	XLTRACE(_T("** image cache: used %d KB (peak %d KB) of %d KB, hits %d, misses %d, evictions %d\n"),
+		(int)(stats.usedBytes / 1024), (int)(stats.peakUsedBytes / 1024), (int)(getBudget() / 1024),
+		(int)stats.hits, (int)stats.misses, (int)stats.evictions);
+	XL_PARAMETER_NOT_USED(stats);
+}
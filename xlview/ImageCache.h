@@ -0,0 +1,86 @@
+#ifndef XL_VIEW_IMAGE_CACHE_H
+#define XL_VIEW_IMAGE_CACHE_H
+#include <list>
+#include <atltypes.h>
+#include "libxl/include/common.h"
+#include "libxl/include/lockable.h"
+
+class CCachedImage;
+
+/**
+ * All the decoded (suitable) images share one memory budget. When it is
+ * exceeded, the image of the least value is evicted by CCachedImage::clear(),
+ * the value (per byte) of an image is:
+ *
+ *   (pixels of the image / bytes cached) / (1 + distance from the current index)
+ *
+ * so a small image downscaled from a huge one, which is expensive to decode
+ * again, is kept longer than a large one from a small file. The distance in
+ * the browsing direction counts half, and the least recently used one is
+ * evicted first if the values are the same. The current image is never evicted.
+ */
+class CImageCache : public xl::CUserLock
+{
+public:
+	struct Stats {
+		size_t         usedBytes;
+		size_t         peakUsedBytes;
+		size_t         hits;
+		size_t         misses;
+		size_t         evictions;
+
+		Stats () {
+			memset(this, 0, sizeof(*this));
+		}
+	};
+
+protected:
+	struct Entry {
+		CCachedImage  *image;
+		int            index;
+		size_t         bytes;
+		double         cost;   // the pixels of the real image
+	};
+	typedef std::list<Entry>                       _Entries;
+
+	_Entries           m_entries; // the front is the most recently used
+	size_t             m_budget;
+	int                m_focus;
+	int                m_count;
+	bool               m_forward;
+	Stats              m_stats;
+
+	CImageCache ();
+	~CImageCache ();
+
+	_Entries::iterator _Find (const CCachedImage *image);
+	int _GetDistance (const Entry &entry) const;
+	double _GetValue (const Entry &entry) const;
+	void _Shrink (const CCachedImage *except);
+
+public:
+	static CImageCache* getInstance ();
+
+	void setBudget (size_t bytes);
+	size_t getBudget () const;
+
+	// the current index, the count of the images, and the browsing direction
+	void setFocus (int index, int count, bool forward);
+
+	// must NOT be called with the lock of @image held, it may be evicted here
+	void insert (CCachedImage *image, int index, size_t bytes, CSize szImage);
+	void remove (const CCachedImage *image);
+	// a cached image is used (a hit), or it has to be decoded (a miss)
+	void touch (const CCachedImage *image);
+	void miss ();
+
+	// evict all the images farther than @maxDistance (but the current one) for
+	// the memory pressure, returns the bytes released
+	size_t shed (int maxDistance);
+
+	Stats getStats () const;
+	void traceStats () const;
+};
+
+
+#endif
@@ -15,9 +15,70 @@ inline void CHECK_ZOOM_SIZE (CSize &sz) {
 	}
 }
 
+// when the zoomed image is larger than the view, only the visible area
+// and this margin (in zoomed pixels) around it is resampled
+static const int VIEWPORT_MARGIN = 256;
+
+// the high quality zooming starts after the zoom size keeps unchanged for
+// this time (ms), and it is not canceled if the zoom size changes slightly
+static const int ZOOM_DEBOUNCE_TIME = 80;
+static const double ZOOM_TOLERANCE = 0.05;
+
+// the images larger than that are stored in tiles (if the loader supports),
+// and all the tiles share the memory budget, the others are swapped out
+static const __int64 TILED_IMAGE_PIXELS = 128 * 1024 * 1024;
+static const size_t TILE_CACHE_BUDGET = 512 * 1024 * 1024;
+
+// the recycled DIB sections kept for the next images (see CDIBSectionPool)
+static const size_t DIB_POOL_BUDGET = 128 * 1024 * 1024;
+
+// all the decoded (suitable) images share this budget (see CImageCache),
+// it is the default of the option "ImageCacheMB" (see COptions)
+static const size_t IMAGE_CACHE_BUDGET = 256 * 1024 * 1024;
+
+// the memory is checked (see CMemoryGovernor) every this time (ms), and it is
+// under pressure if the available physical memory is less than the percent, or
+// the available address space (of the 32 bit process) is less than the bytes,
+// then the thumbnails farther than the range from the current one can be shed
+static const int MEMORY_CHECK_INTERVAL = 1000;
+static const int MEMORY_LOW_PERCENT = 10;
+static const size_t MEMORY_LOW_VIRTUAL = 256 * 1024 * 1024;
+// the pressure is relieved only when the memory is above the thresholds by this
+// percent (of the thresholds), so it doesn't flip at every check; and the low
+// physical memory is the pressure of xlview only if its working set is larger
+// than the floor, and than the percent of all the physical memory in use
+static const int MEMORY_RELIEF_PERCENT = 50;
+static const size_t MEMORY_FOOTPRINT_FLOOR = 128 * 1024 * 1024;
+static const int MEMORY_FOOTPRINT_SHARE = 20;
+static const int THUMBNAIL_KEEP_RANGE = 64;
+
+// the images prefetched on both sides when the user doesn't browse, the max
+// ahead when flicking, and the steps one way to stop prefetching backward
+static const int PREFETCH_RANGE = 4;
+static const int PREFETCH_MAX_AHEAD = 16;
+static const int PREFETCH_IDLE_TIME = 2000;
+static const int PREFETCH_ONE_WAY_STEPS = 4;
+
+// the events of the jobs are dispatched to the UI thread at most once in
+// this time (ms), the loaded thumbnails are notified in one event
+static const int EVENT_FRAME_TIME = 16;
+
+// the thumbnail sweep leaves one worker for the loading and zooming, and each
+// of its jobs returns to the scheduler after this many thumbnails
+static const int THUMBNAIL_SWEEP_BATCH = 16;
+
 // the thumbnail size
 static const int THUMBNAIL_WIDTH = 120;
 static const int THUMBNAIL_HEIGHT = 160;
 
+// the thumbnail store (see CThumbnailStore) is compacted when it's opened, if
+// the dead entries (replaced by the later ones) are more than the min and the
+// percent of all, or the data file is larger than the cap; the newest ones fit
+// in the percent of the cap are kept, and no more are added over the cap
+static const int THUMBNAIL_STORE_DEAD_MIN = 256;
+static const int THUMBNAIL_STORE_DEAD_PERCENT = 25;
+static const unsigned __int64 THUMBNAIL_STORE_MAX_BYTES = 256 * 1024 * 1024;
+static const int THUMBNAIL_STORE_KEEP_PERCENT = 75;
+
 
 #endif
@@ -3,31 +3,39 @@
 #include "libxl/include/fs.h"
 #include "libxl/include/utilities.h"
 #include "ImageConfig.h"
+#include "Options.h"
 #include "ImageLoader.h"
+#include "PixelBufferPool.h"
 
 
-CImageLoader::CImageLoader () {
-
+CImageLoader::CImageLoader () : m_layout(PL_NATIVE) {
+	if (COptions::getInstance()->isPixelLayoutBgrx()) {
+		m_layout = PL_BGRX32;
+	}
 }
 
 CImageLoader::~CImageLoader () {
 
 }
 
+int CImageLoader::_GetFrameBitCount (const ImageHeaderInfo &info) const {
+	return m_layout == PL_BGRX32 ? 32 : info.bitcount;
+}
+
 CImagePtr CImageLoader::_CreateImageFromHeaderInfo (ImageHeaderInfo &info) {
 	assert(info.width > 0 && info.height > 0 && info.bitcount > 16 && info.frame_count > 0);
 
 	int w = info.width;
 	int h = info.height;
-	int bitcount = info.bitcount;
+	int bitcount = _GetFrameBitCount(info);
 
 	CImagePtr image(new CImage());
 	if (image != NULL) {
 		for (int i = 0; i < info.frame_count; ++ i) {
 			xl::ui::CDIBSectionPtr dib = 
-				xl::ui::CDIBSection::createDIBSection(w, h, bitcount);
+				CDIBSectionPool::getInstance()->create(w, h, bitcount);
 			if (dib == NULL) {
-				return CImagePtr(); // TODO: out of memory
+				return CImagePtr(); // out of memory, even after the caches are shed
 			}
 
 			// the "delay" is left for the loader to modify
@@ -47,7 +55,7 @@ CImagePtr CImageLoader::_CreateSuitableImageFromHeaderInfo (CSize szArea, ImageH
 
 	int w = info.width;
 	int h = info.height;
-	int bitcount = info.bitcount;
+	int bitcount = _GetFrameBitCount(info);
 	CSize szImage(w, h);
 	CSize szSuitable = CImage::getSuitableSize(szArea, szImage, dontEnlarge);
 	w = szSuitable.cx;
@@ -57,9 +65,9 @@ CImagePtr CImageLoader::_CreateSuitableImageFromHeaderInfo (CSize szArea, ImageH
 	if (image != NULL) {
 		for (int i = 0; i < info.frame_count; ++ i) {
 			xl::ui::CDIBSectionPtr dib = 
-				xl::ui::CDIBSection::createDIBSection(w, h, bitcount);
+				CDIBSectionPool::getInstance()->create(w, h, bitcount);
 			if (dib == NULL) {
-				return CImagePtr(); // TODO: out of memory
+				return CImagePtr(); // out of memory, even after the caches are shed
 			}
 
 			// the "delay" is left for the loader to modify
@@ -73,6 +81,62 @@ CImagePtr CImageLoader::_CreateSuitableImageFromHeaderInfo (CSize szArea, ImageH
 }
 
 
+CImagePtr CImageLoader::_LoadInFlight (
+                                       CInFlightTable::KIND kind,
+                                       const xl::tstring &fileName,
+                                       CSize *szImageRS,
+                                       CSize szTarget,
+                                       xl::ILongTimeRunCallback *pCallback
+                                      ) {
+	xl::tstring key = CInFlightTable::getKey(fileName, kind, szTarget);
+	for (;;) {
+		CInFlightTable::RequestPtr request;
+		if (m_inFlight.join(key, request, pCallback)) {
+			// decode it until all the requesters stop
+			CInFlightTable::CCallback callback(&m_inFlight, request, pCallback);
+			CSize szImage(-1, -1);
+			CImagePtr image;
+			switch (kind) {
+			case CInFlightTable::KIND_IMAGE:
+				image = _Load(fileName, &callback);
+				if (image != NULL) {
+					szImage = image->getImageSize();
+				}
+				break;
+			case CInFlightTable::KIND_SUITABLE:
+				image = _LoadSuitable(fileName, &szImage, szTarget, &callback);
+				break;
+			case CInFlightTable::KIND_THUMBNAIL:
+			case CInFlightTable::KIND_FAST_THUMBNAIL:
+				image = _LoadThumbnail(fileName, szImage, szTarget, kind == CInFlightTable::KIND_FAST_THUMBNAIL, &callback);
+				break;
+			default:
+				assert(false);
+				break;
+			}
+			m_inFlight.complete(request, image, szImage);
+
+			if (szImageRS != NULL && szImage.cx > 0) {
+				*szImageRS = szImage;
+			}
+			return image;
+		}
+
+		CImagePtr image;
+		CSize szImage;
+		if (m_inFlight.wait(request, pCallback, image, szImage)) {
+			if (szImageRS != NULL) {
+				*szImageRS = szImage;
+			}
+			return image;
+		} else if (pCallback != NULL && pCallback->shouldStop()) {
+			return CImagePtr();
+		}
+		// the in-flight one failed, try it again
+	}
+}
+
+
 //////////////////////////////////////////////////////////////////////////
 // static 
 CImageLoader* CImageLoader::getInstance () {
@@ -94,6 +158,10 @@ void CImageLoader::registerPlugin (ImageLoaderPluginRawPtr plugin) {
 	plugin->registerExt(m_exts);
 }
 
+void CImageLoader::setPixelLayout (PIXEL_LAYOUT layout) {
+	m_layout = layout;
+}
+
 bool CImageLoader::isFileSupported (const xl::tstring &fileName) {
 	size_t offset = fileName.rfind(_T("."));
 	if (offset == fileName.npos) { // no extension
@@ -110,7 +178,16 @@ bool CImageLoader::isFileSupported (const xl::tstring &fileName) {
 	return false;
 }
 
-CImagePtr CImageLoader::load (const xl::tstring &fileName, xl::ILongTimeRunCallback *pCallback) {
+ImageLoaderPluginRawPtr CImageLoader::getPlugin (const std::string &data, ImageHeaderInfo &info) {
+	for (_Plugins::iterator it = m_plugins.begin(); it != m_plugins.end(); ++ it) {
+		if ((*it)->readHeader(data, info)) {
+			return *it;
+		}
+	}
+	return NULL;
+}
+
+CImagePtr CImageLoader::_Load (const xl::tstring &fileName, xl::ILongTimeRunCallback *pCallback) {
 	std::string data;
 	if (!file_get_contents(fileName, data, 0, pCallback)) {
 		return CImagePtr();
@@ -119,9 +196,27 @@ CImagePtr CImageLoader::load (const xl::tstring &fileName, xl::ILongTimeRunCallb
 	ImageHeaderInfo info;
 	for (_Plugins::iterator it = m_plugins.begin(); it != m_plugins.end(); ++ it) {
 		if ((*it)->readHeader(data, info)) {
+			if ((__int64)info.width * info.height > TILED_IMAGE_PIXELS && info.frame_count == 1) {
+				CImagePtr image(new CImage());
+				ImageHeaderInfo infoTiled = info;
+				infoTiled.bitcount = _GetFrameBitCount(info);
+				if ((*it)->loadTiled(image, data, infoTiled, pCallback)) {
+					assert(image->isTiled());
+					return image;
+				} else if (pCallback && pCallback->shouldStop()) {
+					break;
+				}
+				// try to load it normally
+			}
+
 			CImagePtr image = _CreateImageFromHeaderInfo(info);
 
 			if (image != NULL) {
+				// to compare the pixel layouts, the memory and the time
+				int bitcount = image->getImage(0)->getBitCounts();
+				xl::CTimerLogger logger(_T("** Decode (%d-%d) into %d bpp frames (%d KB) cost"),
+					info.width, info.height, bitcount,
+					(int)((__int64)image->getImage(0)->getStride() * info.height * info.frame_count / 1024));
 				if ((*it)->load(image, data, pCallback)) {
 					return image;
 				}
@@ -133,7 +228,7 @@ CImagePtr CImageLoader::load (const xl::tstring &fileName, xl::ILongTimeRunCallb
 	return CImagePtr();
 }
 
-CImagePtr CImageLoader::loadSuitable (const xl::tstring &fileName, CSize *szImageRS, CSize szArea, xl::ILongTimeRunCallback *pCallback) {
+CImagePtr CImageLoader::_LoadSuitable (const xl::tstring &fileName, CSize *szImageRS, CSize szArea, xl::ILongTimeRunCallback *pCallback) {
 	assert(szImageRS != NULL);
 	std::string data;
 	if (!file_get_contents(fileName, data, 0, pCallback)) {
@@ -176,13 +271,13 @@ CImagePtr CImageLoader::loadSuitable (const xl::tstring &fileName, CSize *szImag
 	return CImagePtr();
 }
 
-CImagePtr CImageLoader::loadThumbnail (
-                                       const xl::tstring &fileName,
-                                       CSize &szImageRS,
-                                       CSize szThumbnail,
-                                       bool fastOnly,
-                                       xl::ILongTimeRunCallback *pCallback
-                                      ) {
+CImagePtr CImageLoader::_LoadThumbnail (
+                                        const xl::tstring &fileName,
+                                        CSize &szImageRS,
+                                        CSize szThumbnail,
+                                        bool fastOnly,
+                                        xl::ILongTimeRunCallback *pCallback
+                                       ) {
 	std::string data;
 	if (!file_get_contents(fileName, data, 0, pCallback)) {
 		return CImagePtr();
@@ -196,11 +291,11 @@ CImagePtr CImageLoader::loadThumbnail (
 			CImagePtr thumbnail = _CreateSuitableImageFromHeaderInfo(szThumbnail, info, false);
 			if ((*it)->loadThumbnail(thumbnail, data, pCallback)) {
 				return thumbnail;
-			} else if (!fastOnly) {
-				// xl::ui::CBoxFilter filter;
-				// xl::ui::CResizeEngine resizer(&filter);
+			} else if (!fastOnly && thumbnail) {
+				// streamed, the strips are reduced by the integer ratio kernels before
+				// the resizer (see CResampleStage), so the nearest neighbour is enough
 				xl::ui::CResizeEngine resizer(NULL);
-				if (thumbnail && (*it)->loadResize(thumbnail, data, &resizer, pCallback)) {
+				if ((*it)->loadResize(thumbnail, data, &resizer, pCallback)) {
 					return thumbnail;
 				}
 			}
@@ -211,3 +306,22 @@ CImagePtr CImageLoader::loadThumbnail (
 	return CImagePtr();
 }
 
+CImagePtr CImageLoader::load (const xl::tstring &fileName, xl::ILongTimeRunCallback *pCallback) {
+	return _LoadInFlight(CInFlightTable::KIND_IMAGE, fileName, NULL, CSize(0, 0), pCallback);
+}
+
+CImagePtr CImageLoader::loadSuitable (const xl::tstring &fileName, CSize *szImageRS, CSize szArea, xl::ILongTimeRunCallback *pCallback) {
+	assert(szImageRS != NULL);
+	return _LoadInFlight(CInFlightTable::KIND_SUITABLE, fileName, szImageRS, szArea, pCallback);
+}
+
+CImagePtr CImageLoader::loadThumbnail (
+                                       const xl::tstring &fileName,
+                                       CSize &szImageRS,
+                                       CSize szThumbnail,
+                                       bool fastOnly,
+                                       xl::ILongTimeRunCallback *pCallback
+                                      ) {
+	CInFlightTable::KIND kind = fastOnly ? CInFlightTable::KIND_FAST_THUMBNAIL : CInFlightTable::KIND_THUMBNAIL;
+	return _LoadInFlight(kind, fileName, &szImageRS, szThumbnail, pCallback);
+}
@@ -7,8 +7,9 @@
 #include "libxl/include/string.h"
 #include "libxl/include/ui/DIBResizer.h"
 #include "Image.h"
+#include "InFlightTable.h"
 
-typedef std::vector<xl::tchar *>                       ImageExts;
+typedef std::vector<const xl::tchar *>                 ImageExts;
 
 //////////////////////////////////////////////////////////////////////////
 // header information
@@ -27,6 +28,7 @@ struct ImageHeaderInfo {
 // loader for different image types
 class IImageLoaderPlugin {
 public:
+	virtual ~IImageLoaderPlugin () {}
 	virtual xl::tstring getPluginName () = 0;
 	virtual xl::tstring getFileTypeName () = 0;
 	virtual void registerExt (ImageExts &exts) = 0;
@@ -42,6 +44,16 @@ public:
 		XL_PARAMETER_NOT_USED(pCallback);
 		return false;
 	}
+	// load the very large image into tiles, the @image is empty and should call setTiledImage()
+	virtual bool loadTiled (
+	                        CImagePtr /*image*/,
+	                        const std::string &/*data*/,
+	                        const ImageHeaderInfo &/*info*/,
+	                        xl::ILongTimeRunCallback *pCallback = NULL
+	                       ) {
+		XL_PARAMETER_NOT_USED(pCallback);
+		return false;
+	}
 };
 typedef IImageLoaderPlugin                            *ImageLoaderPluginRawPtr;
 
@@ -50,21 +62,59 @@ typedef IImageLoaderPlugin                            *ImageLoaderPluginRawPtr;
 // Image loader
 class CImageLoader
 {
+public:
+	// the pixel layout of the decoded frames
+	enum PIXEL_LAYOUT {
+		PL_NATIVE,         // as the decoder reports (24 bpp for JPEG)
+		PL_BGRX32,         // always 32 bpp, the 24 bpp pixels are stored as BGRX (X = 255)
+	};
+
+protected:
 	typedef std::vector<ImageLoaderPluginRawPtr>   _Plugins;
 	_Plugins           m_plugins;
 	ImageExts          m_exts;
+	PIXEL_LAYOUT       m_layout;
+	CInFlightTable     m_inFlight;
 
 	CImageLoader ();
 	~CImageLoader ();
 
+	int _GetFrameBitCount (const ImageHeaderInfo &info) const;
 	CImagePtr _CreateImageFromHeaderInfo (ImageHeaderInfo &info);
 	CImagePtr _CreateSuitableImageFromHeaderInfo (CSize szArea, ImageHeaderInfo &info, bool dontEnlarge = true);
 
+	// the decoders, called by the first requester of the same file, kind and size
+	CImagePtr _Load (const xl::tstring &fileName, xl::ILongTimeRunCallback *pCallback);
+	CImagePtr _LoadSuitable (const xl::tstring &fileName, CSize *szImageReal, CSize szArea, xl::ILongTimeRunCallback *pCallback);
+	CImagePtr _LoadThumbnail (const xl::tstring &fileName, CSize &szImageRS, CSize szThumbnail, bool fastOnly, xl::ILongTimeRunCallback *pCallback);
+	CImagePtr _LoadInFlight (
+	                         CInFlightTable::KIND kind,
+	                         const xl::tstring &fileName,
+	                         CSize *szImageRS,
+	                         CSize szTarget,
+	                         xl::ILongTimeRunCallback *pCallback
+	                        );
+
 public:
 	static CImageLoader* getInstance ();
 
 	void registerPlugin (ImageLoaderPluginRawPtr);
+	/**
+	 * With PL_BGRX32 every pixel fills one 32 bits lane of the resize and blit
+	 * kernels, at the cost of 1/3 more memory for the 24 bpp images.
+	 * It is PL_NATIVE by default, set the option "PixelLayout" (see COptions)
+	 * to "bgrx" to use PL_BGRX32.
+	 */
+	void setPixelLayout (PIXEL_LAYOUT layout);
+	PIXEL_LAYOUT getPixelLayout () const { return m_layout; }
 	bool isFileSupported (const xl::tstring &fileName);
+	// the plugin which reads the header of @data, NULL if none (for the benchmarks)
+	ImageLoaderPluginRawPtr getPlugin (const std::string &data, ImageHeaderInfo &info);
+
+	/**
+	 * The same file, kind and size are never decoded twice at once (see
+	 * CInFlightTable), the later requesters get a clone of the result.
+	 */
 	CImagePtr load (const xl::tstring &fileName, xl::ILongTimeRunCallback *pCallback = NULL);
 	CImagePtr loadSuitable (const xl::tstring &fileName, CSize *szImageReal, CSize szArea, xl::ILongTimeRunCallback *pCallback = NULL);
 	CImagePtr loadThumbnail (
@@ -74,6 +124,9 @@ public:
 	                         bool fastOnly,
 	                         xl::ILongTimeRunCallback *pCallback = NULL
 	                        );
+
+	CInFlightTable::Stats getInFlightStats () const { return m_inFlight.getStats(); }
+	void traceInFlightStats () const { m_inFlight.traceStats(); }
 };
 
 
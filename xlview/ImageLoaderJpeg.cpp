@@ -1,9 +1,18 @@
 #include <stdio.h>
 #include <setjmp.h>
+#include <algorithm>
+#ifdef XLVIEW_SYSTEM_CODECS
+#include <jpeglib.h>
+#else
 #include <basetsd.h> // for re-definition for INT32, and so on (which defined in jmorecfg.h)
 #include "../libs/jpeglib.h"
+#endif
 #include "libxl/include/utilities.h"
 #include "ImageLoader.h"
+#include "ImageReducer.h"
+#include "PixelBufferPool.h"
+#include "TiledImage.h"
+#include "DecodePipeline.h"
 
 #pragma warning (push)
 #pragma warning (disable:4611)
@@ -26,18 +35,35 @@ void safe_jpeg_error_exit (j_common_ptr cinfo) {
 
 class CImageLoaderPluginJpeg : public IImageLoaderPlugin
 {
-	bool _ProcessLine (struct jpeg_decompress_struct &cinfo, 
-	                   unsigned char *dst, unsigned char *src) {
+	// @dst_bytes is 3 (24 bpp) or 4 (32 bpp, BGRX, X is written as 255)
+	static bool _ProcessLine (struct jpeg_decompress_struct &cinfo, 
+	                   unsigned char *dst, unsigned char *src, int dst_bytes) {
+		assert(dst_bytes == 3 || dst_bytes == 4);
 		int w = cinfo.output_width;
 		if (cinfo.out_color_space == JCS_GRAYSCALE) {
 			for (int i = 0; i < w; ++ i) {
 				unsigned char c = *src ++;
-				*dst ++ = c;
-				*dst ++ = c;
-				*dst ++ = c;
+				dst[0] = c;
+				dst[1] = c;
+				dst[2] = c;
+				if (dst_bytes == 4) {
+					dst[3] = 0xff;
+				}
+				dst += dst_bytes;
 			}
 		} else if (cinfo.out_color_space == JCS_RGB) {
-			memcpy (dst, src, w * 3);
+			if (dst_bytes == 3) {
+				memcpy (dst, src, w * 3);
+			} else {
+				for (int i = 0; i < w; ++ i) {
+					dst[0] = src[0];
+					dst[1] = src[1];
+					dst[2] = src[2];
+					dst[3] = 0xff;
+					src += 3;
+					dst += 4;
+				}
+			}
 		} else if (cinfo.out_color_space == JCS_CMYK) { // the process code copied from FreeImage
 			assert(cinfo.out_color_components == 4);
 			for (int i = 0; i < w; ++ i) {
@@ -45,8 +71,11 @@ class CImageLoaderPluginJpeg : public IImageLoaderPlugin
 				dst[2]   = (unsigned char)((K * src[0]) / 255);
 				dst[1] = (unsigned char)((K * src[1]) / 255);
 				dst[0]  = (unsigned char)((K * src[2]) / 255);
+				if (dst_bytes == 4) {
+					dst[3] = 0xff;
+				}
 				src += 4;
-				dst += 3;
+				dst += dst_bytes;
 			}
 		} else {
 			assert(false); // not supported
@@ -56,6 +85,89 @@ class CImageLoaderPluginJpeg : public IImageLoaderPlugin
 		return true;
 	}
 
+	//////////////////////////////////////////////////////////////////////////
+	// the stages of loadResize(), see CDecodePipeline
+
+	// the raw lines of libjpeg into the strips
+	class _DecodeStage : public CDecodeStage {
+		struct jpeg_decompress_struct *m_cinfo;
+		safe_jpeg_error_mgr *m_em;
+		CStripPtr          m_strip; // being decoded, kept for the longjmp()
+		int                m_decoded;
+	public:
+		_DecodeStage (struct jpeg_decompress_struct *cinfo, safe_jpeg_error_mgr *em, CStripQueue *out)
+			: CDecodeStage(NULL, out), m_cinfo(cinfo), m_em(em), m_decoded(0) {}
+
+		virtual STATE step (xl::ILongTimeRunCallback * /*pCallback*/) {
+			if (m_out->isFull()) {
+				return STATE_BLOCKED;
+			}
+			int height = (int)m_cinfo->output_height;
+			if (m_decoded >= height) {
+				return STATE_DONE;
+			}
+
+			// the error handler jumps here, in the thread running the stage
+			if (setjmp(m_em->setjmp_buffer)) {
+				int lines = m_decoded - m_strip->y;
+				if (lines > 0) { // try to get the partial image
+					m_strip->lines = lines;
+					m_out->push(m_strip);
+				}
+				m_strip.reset();
+				return m_decoded > 0 ? STATE_DONE : STATE_FAILED;
+			}
+
+			int lines = (std::min)((int)CDecodePipeline::STRIP_LINES, height - m_decoded);
+			m_strip.reset(new CStrip(m_decoded, lines));
+			if (!m_strip->allocate(m_cinfo->output_width * m_cinfo->output_components)) {
+				m_strip.reset();
+				return STATE_FAILED; // out of memory
+			}
+			for (int i = 0; i < lines; ++ i) {
+				JSAMPROW row = m_strip->data + i * m_strip->stride;
+				jpeg_read_scanlines(m_cinfo, &row, 1);
+				++ m_decoded;
+			}
+			m_out->push(m_strip);
+			m_strip.reset();
+			return STATE_PROGRESS;
+		}
+	};
+
+	// the raw lines into the DIB strips (RGB to BGR, gray, CMYK)
+	class _ConvertStage : public CDecodeStage {
+		struct jpeg_decompress_struct *m_cinfo;
+		int                m_bitcount;
+	public:
+		_ConvertStage (struct jpeg_decompress_struct *cinfo, CStripQueue *in, CStripQueue *out, int bitcount)
+			: CDecodeStage(in, out), m_cinfo(cinfo), m_bitcount(bitcount) {}
+
+		virtual STATE step (xl::ILongTimeRunCallback * /*pCallback*/) {
+			if (m_out->isFull()) {
+				return STATE_BLOCKED;
+			}
+			CStripPtr strip = m_in->pop();
+			if (strip == NULL) {
+				return m_in->isDrained() ? STATE_DONE : STATE_BLOCKED;
+			}
+
+			CStripPtr converted(new CStrip(strip->y, strip->lines));
+			converted->dib = CDIBSectionPool::getInstance()->create(m_cinfo->output_width, CDecodePipeline::STRIP_LINES, m_bitcount, false);
+			if (converted->dib == NULL) {
+				return STATE_FAILED; // out of memory
+			}
+			for (int i = 0; i < strip->lines; ++ i) {
+				if (!_ProcessLine(*m_cinfo, (unsigned char *)converted->dib->getLine(i), strip->data + i * strip->stride, m_bitcount / 8)) {
+					return STATE_FAILED;
+				}
+			}
+			strip.reset(); // back to the pool
+			m_out->push(converted);
+			return STATE_PROGRESS;
+		}
+	};
+
 public:
 	CImageLoaderPluginJpeg () {
 		XLTRACE(_T("Jpeg decoder created!\n"));
@@ -74,7 +186,7 @@ public:
 	}
 
 	virtual void registerExt (ImageExts &exts) {
-		static xl::tchar *extensions[] = {
+		static const xl::tchar *extensions[] = {
 			_T("jpg"),
 			_T("jpeg"),
 			_T("jif"),
@@ -82,7 +194,7 @@ public:
 			_T("jpe"),
 		};
 		exts.reserve(exts.size() + COUNT_OF(extensions));
-		for (int i = 0; i < COUNT_OF(extensions); ++ i) {
+		for (int i = 0; i < (int)COUNT_OF(extensions); ++ i) {
 			exts.push_back(extensions[i]);
 		}
 	}
@@ -120,14 +232,13 @@ public:
 	}
 
 	virtual bool load (CImagePtr image, const std::string &data, xl::ILongTimeRunCallback *pCallback = NULL) {
-		const int LINE_BLOCK = 32;
 		struct jpeg_decompress_struct cinfo;
 		safe_jpeg_error_mgr em;
 		JSAMPARRAY buffer;
 		int decoded_line_count = 0;
 
 		assert(image->getImageCount() == 1);
-		xl::ui::CDIBSectionPtr dibPtr = image->getImage(0);
+		xl::ui::CDIBSectionPtr dibPtr = image->getWritableImage(0);
 		xl::ui::CDIBSection *dib = dibPtr.get();
 		dibPtr.reset();
 
@@ -162,15 +273,13 @@ public:
 		unsigned char *dst_data = (unsigned char *)dib->getData();
 		unsigned char *src_data = buffer[0];
 		while (cinfo.output_scanline < cinfo.output_height) {
-			if (decoded_line_count % LINE_BLOCK == 1) {
-				if (pCallback && pCallback->shouldStop()) {
-					canceled = true;
-					break;
-				}
+			if (pCallback && pCallback->shouldStop()) { // cheap, see CCancelToken
+				canceled = true;
+				break;
 			}
 
 			jpeg_read_scanlines(&cinfo, buffer, 1);
-			if (!_ProcessLine(cinfo, dst_data, src_data)) {
+			if (!_ProcessLine(cinfo, dst_data, src_data, dib->getBitCounts() / 8)) {
 				canceled = true;
 				break;
 			}
@@ -191,35 +300,90 @@ public:
 
 	virtual bool loadResize (CImagePtr image, const std::string &data, xl::ui::CResizeEngine *pResizer, xl::ILongTimeRunCallback *pCallback = NULL) {
 		assert(pResizer != NULL);
-		const int LINE_BLOCK = 32;
+		assert(image->getImageCount() == 1);
+		struct jpeg_decompress_struct cinfo;
+		safe_jpeg_error_mgr em;
+
+		cinfo.err = jpeg_std_error(&em.pub);
+		em.pub.error_exit = safe_jpeg_error_exit;
+		if (setjmp(em.setjmp_buffer)) {
+			jpeg_destroy_decompress(&cinfo);
+			return false;
+		}
+
+		jpeg_create_decompress(&cinfo);
+		jpeg_mem_src(&cinfo, (unsigned char *)data.c_str(), data.length());
+		if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+			(void) jpeg_finish_decompress(&cinfo);
+			jpeg_destroy_decompress(&cinfo);
+			return false;
+		}
+
+		// let the IDCT do the coarse part, never below the target size
+		int tw = image->getImageWidth();
+		int th = image->getImageHeight();
+		cinfo.scale_num = 1;
+		cinfo.scale_denom = 1;
+		for (int denom = 8; denom > 1; denom /= 2) {
+			if ((int)cinfo.image_width / denom >= tw && (int)cinfo.image_height / denom >= th) {
+				cinfo.scale_denom = denom;
+				break;
+			}
+		}
+		jpeg_calc_output_dimensions(&cinfo);
+
+		int h = cinfo.output_height;
+		assert(cinfo.output_width > 0 && h > 0);
+		int bitcount = image->getImage(0)->getBitCounts();
+		int reduceShift = CResampleStage::getReduceShift(CSize(cinfo.output_width, h), CSize(tw, th), bitcount);
+		CDIBSectionPool *pool = CDIBSectionPool::getInstance();
+		xl::ui::CDIBSectionPtr dibTmp = pool->create(tw, h >> reduceShift, bitcount, false);
+		if (dibTmp == NULL) {
+			jpeg_destroy_decompress(&cinfo);
+			return false; // out of memory
+		}
+		(void) jpeg_start_decompress(&cinfo);
+
+		// decode -> convert -> resample -> publish
+		xl::ui::CDIBSectionPtr dib = image->getWritableImage(0);
+		CStripQueue decoded(CDecodePipeline::QUEUE_CAPACITY);
+		CStripQueue converted(CDecodePipeline::QUEUE_CAPACITY);
+		CStripQueue resampled(CDecodePipeline::QUEUE_CAPACITY);
+		_DecodeStage decodeStage(&cinfo, &em, &decoded);
+		_ConvertStage convertStage(&cinfo, &decoded, &converted, bitcount);
+		CResampleStage resampleStage(&converted, &resampled, pResizer, dibTmp.get(), reduceShift);
+		CPublishStage publishStage(&resampled, pResizer, dibTmp.get(), dib.get());
+		CDecodePipeline pipeline;
+		pipeline.addStage(&decodeStage);
+		pipeline.addStage(&convertStage);
+		pipeline.addStage(&resampleStage);
+		pipeline.addStage(&publishStage);
+		bool result = pipeline.run(pCallback);
+
+		jpeg_destroy_decompress(&cinfo); // aborts it if not finished
+		pool->recycle(dibTmp);
+		return result;
+	}
+
+	virtual bool loadTiled (CImagePtr image, const std::string &data, const ImageHeaderInfo &info, xl::ILongTimeRunCallback *pCallback) {
+		assert(image != NULL && image->getImageCount() == 0);
 		struct jpeg_decompress_struct cinfo;
 		safe_jpeg_error_mgr em;
 		JSAMPARRAY buffer;
 		int decoded_line_count = 0;
-		int zoomed_line_count = 0;
-
-		assert(image->getImageCount() == 1);
-		xl::ui::CDIBSectionPtr dib;
-		xl::ui::CDIBSectionPtr dibTmp;
+		int stored_line_count = 0;
+		CTiledImagePtr tiled;
+		xl::ui::CDIBSectionPtr strip;
 
 		cinfo.err = jpeg_std_error(&em.pub);
 		em.pub.error_exit = safe_jpeg_error_exit;
 		if (setjmp(em.setjmp_buffer)) {
 			jpeg_destroy_decompress(&cinfo);
-			if (decoded_line_count > 0) { // try to get the partial image
-				if (decoded_line_count > zoomed_line_count) {
-					if (!pResizer->horizontalFilter(dib.get(), LINE_BLOCK, dibTmp.get(),
-						zoomed_line_count, decoded_line_count - zoomed_line_count, 
-						pCallback))
-					{
-						return false;
-					}
-				}
-				dib = image->getImage(0);
-				if (pResizer->verticalFilter(dibTmp.get(), dib.get(), pCallback)) {
-					return true;
-				}
-
+			if (decoded_line_count > stored_line_count) { // keep the partial image
+				tiled->writeLines(stored_line_count, strip.get(), decoded_line_count - stored_line_count);
+			}
+			if (decoded_line_count > 0) {
+				image->setTiledImage(tiled);
 			}
 			return decoded_line_count > 0;
 		}
@@ -234,64 +398,53 @@ public:
 
 		int w = cinfo.image_width;
 		int h = cinfo.image_height;
-		assert((w != image->getImageWidth() || h != image->getImageHeight()));
-		dib = xl::ui::CDIBSection::createDIBSection(w, LINE_BLOCK, 24);
-		dibTmp = xl::ui::CDIBSection::createDIBSection(image->getImageWidth(), h, 24);
-		if (dib == NULL || dibTmp == NULL) {
+		assert(w == info.width && h == info.height);
+		tiled.reset(new CTiledImage(w, h, info.bitcount));
+		strip = xl::ui::CDIBSection::createDIBSection(w, CTileCache::TILE_SIZE, info.bitcount, false);
+		if (strip == NULL) {
+			jpeg_destroy_decompress(&cinfo);
 			return false; // out of memory
 		}
 
-		bool canceled = false;
 		(void) jpeg_start_decompress(&cinfo);
 		int src_row_stride = cinfo.output_width * cinfo.output_components;
-		int dst_row_stride = dib->getStride();
 		buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, src_row_stride, 1);
 
-		unsigned char *dst_data = (unsigned char *)dib->getData();
+		bool canceled = false;
 		unsigned char *src_data = buffer[0];
 		while (cinfo.output_scanline < cinfo.output_height) {
-			if (decoded_line_count % LINE_BLOCK == 0 && decoded_line_count > 0) {
-				if (pCallback && pCallback->shouldStop()) {
-					canceled = true;
-					break;
-				}
-
-				if (!pResizer->horizontalFilter(dib.get(), LINE_BLOCK, dibTmp.get(), zoomed_line_count, LINE_BLOCK, pCallback)) {
-					canceled = true;
-					break;
-				}
-				dst_data = (unsigned char *)dib->getData();
-				zoomed_line_count += LINE_BLOCK;
+			if (pCallback && pCallback->shouldStop()) { // cheap, see CCancelToken
+				canceled = true;
+				break;
 			}
+
 			jpeg_read_scanlines(&cinfo, buffer, 1);
-			if (!_ProcessLine(cinfo, dst_data, src_data)) {
+			if (!_ProcessLine(cinfo, strip->getLine(decoded_line_count - stored_line_count), src_data, info.bitcount / 8)) {
 				canceled = true;
 				break;
 			}
-			dst_data += dst_row_stride;
 			++ decoded_line_count;
+
+			// the strip is full, move it into the tiles
+			if (decoded_line_count - stored_line_count == CTileCache::TILE_SIZE
+				|| decoded_line_count == h)
+			{
+				if (!tiled->writeLines(stored_line_count, strip.get(), decoded_line_count - stored_line_count)) {
+					canceled = true; // out of memory
+					break;
+				}
+				stored_line_count = decoded_line_count;
+			}
 		}
 
 		if (canceled) {
 			jpeg_abort_decompress(&cinfo);
 		} else {
 			jpeg_finish_decompress(&cinfo);
+			image->setTiledImage(tiled);
 		}
 		jpeg_destroy_decompress(&cinfo);
 
-		if (!canceled) {
-			if (zoomed_line_count < (int)cinfo.output_height) {
-				if (!pResizer->horizontalFilter(dib.get(), LINE_BLOCK, dibTmp.get(), zoomed_line_count, cinfo.output_height - zoomed_line_count, pCallback)) {
-					return false;
-				}
-			}
-			dib = image->getImage(0);
-			if (!pResizer->verticalFilter(dibTmp.get(), dib.get(), pCallback))
-			{
-				return false;
-			}
-		}
-
 		return !canceled;
 	}
 
@@ -299,7 +452,6 @@ public:
 		assert(image != NULL);
 		assert(image->getImageCount() == 1);
 
-		const int LINE_BLOCK = 32;
 		struct jpeg_decompress_struct cinfo;
 		safe_jpeg_error_mgr em;
 		JSAMPARRAY buffer;
@@ -307,6 +459,11 @@ public:
 		xl::ui::CDIBSectionPtr dib;
 		double ratio;
 		int dst_width = image->getImageWidth();
+		// declared here, as they are skipped by the "goto onjpegerror"
+		int w, h, src_row_stride, dst_row_stride;
+		xl::uint scale_num;
+		unsigned char *dst_data, *src_data;
+		bool canceled = false;
 
 		cinfo.err = jpeg_std_error(&em.pub);
 		em.pub.error_exit = safe_jpeg_error_exit;
@@ -329,41 +486,38 @@ public:
 
 		// cinfo.dct_method = JDCT_ISLOW;
 		// cinfo.scale_num = 1;
-		int w = cinfo.image_width;
-		int h = cinfo.image_height;
+		w = cinfo.image_width;
+		h = cinfo.image_height;
 		w = w, h = h;
 		assert(w > 0 && h > 0);
 		ratio = (double)dst_width / (double)w;
-		xl::uint scale_num = (xl::uint)(8 * ratio + 0.5);
+		scale_num = (xl::uint)(8 * ratio + 0.5);
 		if (scale_num < 1) {
 			scale_num = 1;
 		}
 		cinfo.scale_num = scale_num;
 
 		(void) jpeg_start_decompress(&cinfo);
-		dib = xl::ui::CDIBSection::createDIBSection(cinfo.output_width, cinfo.output_height, 24, false);
+		dib = xl::ui::CDIBSection::createDIBSection(cinfo.output_width, cinfo.output_height, image->getImage(0)->getBitCounts(), false);
 		if (dib == NULL) {
 			jpeg_abort_decompress(&cinfo);
 			jpeg_destroy_decompress(&cinfo);
 			return false;
 		}
-		int src_row_stride = cinfo.output_width * cinfo.output_components;
-		int dst_row_stride = dib->getStride();
+		src_row_stride = cinfo.output_width * cinfo.output_components;
+		dst_row_stride = dib->getStride();
 
 		buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, src_row_stride, 1);
-		bool canceled = false;
-		unsigned char *dst_data = (unsigned char *)dib->getData();
-		unsigned char *src_data = buffer[0];
+		dst_data = (unsigned char *)dib->getData();
+		src_data = buffer[0];
 		while (cinfo.output_scanline < cinfo.output_height) {
-			if (decoded_line_count % LINE_BLOCK == 1) {
-				if (pCallback && pCallback->shouldStop()) {
-					canceled = true;
-					break;
-				}
+			if (pCallback && pCallback->shouldStop()) { // cheap, see CCancelToken
+				canceled = true;
+				break;
 			}
 
 			jpeg_read_scanlines(&cinfo, buffer, 1);
-			if (!_ProcessLine(cinfo, dst_data, src_data)) {
+			if (!_ProcessLine(cinfo, dst_data, src_data, dib->getBitCounts() / 8)) {
 				canceled = true;
 				break;
 			}
@@ -381,10 +535,11 @@ public:
 onjpegerror:
 		if (!canceled) {
 			CSize szSrc(dib->getWidth(), dib->getHeight());
-			xl::ui::CDIBSectionPtr dst = image->getImage(0);
+			xl::ui::CDIBSectionPtr dst = image->getWritableImage(0);
 			CSize szDst(dst->getWidth(), dst->getHeight());
 			if (szSrc != szDst) {
-				if (dib->resize(dst.get(), xl::ui::CDIBSection::RT_BOX, pCallback)) {
+				dib = reduceByIntegerRatio(dib, szDst.cx, szDst.cy, pCallback);
+				if (dib && dib->resize(dst.get(), xl::ui::CDIBSection::RT_BOX, pCallback)) {
 					return true;
 				} else {
 					return false;
@@ -1,8 +1,15 @@
 #include <assert.h>
 #include <setjmp.h>
+#include <algorithm>
+#ifdef XLVIEW_SYSTEM_CODECS
+#include <png.h>
+#else
 #include "../libs/png.h"
+#endif
 #include "libxl/include/utilities.h"
 #include "ImageLoader.h"
+#include "PixelBufferPool.h"
+#include "DecodePipeline.h"
 
 //////////////////////////////////////////////////////////////////////////
 // local functions
@@ -36,6 +43,10 @@ public:
 		m_position += count;
 	}
 
+	void setCallback (xl::ILongTimeRunCallback *callback) {
+		m_callback = callback;
+	}
+
 	bool shouldStop () {
 		return m_callback ? m_callback->shouldStop() : false;
 	}
@@ -70,6 +81,11 @@ static void _warning_handle (png_structp /*png_ptr*/, const char * /*warning*/)
 
 class CImageLoaderPluginPng : public IImageLoaderPlugin
 {
+	// the same as png_info::pixel_depth, which is not accessible since libpng 1.5
+	static int _GetPixelDepth (png_structp psp, png_infop infop) {
+		return png_get_channels(psp, infop) * png_get_bit_depth(psp, infop);
+	}
+
 	png_structp _CreateStructs (const std::string &data, png_infop *infop, png_infop *endp) {
 		assert(infop != NULL && endp != NULL);
 		xl::uint bufLength = data.length();
@@ -100,7 +116,8 @@ class CImageLoaderPluginPng : public IImageLoaderPlugin
 		return psp;
 	}
 
-	int _SetProperty (png_structp psp, png_infop infop) {
+	// @bitcount is of the destination bitmap, 32 bpp for the opaque image means BGRX
+	int _SetProperty (png_structp psp, png_infop infop, int bitcount) {
 		int color_type = png_get_color_type(psp, infop);
 		int bit_depth = png_get_bit_depth(psp, infop);
 
@@ -143,6 +160,10 @@ class CImageLoaderPluginPng : public IImageLoaderPlugin
 			png_set_bgr(psp);
 		}
 
+		if (bitcount == 32 && !(color_type & PNG_COLOR_MASK_ALPHA) && !png_get_valid(psp, infop, PNG_INFO_tRNS)) {
+			png_set_filler(psp, 0xff, PNG_FILLER_AFTER);
+		}
+
 // 		if (color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
 // 			png_set_swap_alpha(psp);
 // 		}
@@ -170,6 +191,52 @@ class CImageLoaderPluginPng : public IImageLoaderPlugin
 
 		return number_of_passes;
 	}
+
+	// the rows of a non-interlaced image into the strips, converted by libpng
+	// already (see _SetProperty()), so there is no convert stage
+	class _DecodeStage : public CDecodeStage {
+		png_structp        m_psp;
+		int                m_width;
+		int                m_height;
+		int                m_bitcount;
+		int                m_decoded;
+	public:
+		_DecodeStage (png_structp psp, int width, int height, int bitcount, CStripQueue *out)
+			: CDecodeStage(NULL, out), m_psp(psp), m_width(width), m_height(height), m_bitcount(bitcount), m_decoded(0) {}
+
+		virtual STATE step (xl::ILongTimeRunCallback * /*pCallback*/) {
+			if (m_out->isFull()) {
+				return STATE_BLOCKED;
+			}
+			if (m_decoded >= m_height) {
+				return STATE_DONE;
+			}
+
+			int lines = (std::min)((int)CDecodePipeline::STRIP_LINES, m_height - m_decoded);
+			CStripPtr strip(new CStrip(m_decoded, lines));
+			strip->dib = CDIBSectionPool::getInstance()->create(m_width, CDecodePipeline::STRIP_LINES, m_bitcount, false);
+			if (strip->dib == NULL) {
+				return STATE_FAILED; // out of memory
+			}
+			int i = 0;
+			try {
+				for (; i < lines; ++ i) {
+					png_read_row(m_psp, strip->dib->getLine(i), NULL);
+				}
+			} catch (...) {
+				if (i > 0) { // try to get the partial image
+					strip->lines = i;
+					m_out->push(strip);
+				}
+				m_decoded += i;
+				return m_decoded > 0 ? STATE_DONE : STATE_FAILED;
+			}
+			m_decoded += lines;
+			m_out->push(strip);
+			return STATE_PROGRESS;
+		}
+	};
+
 public:
 	CImageLoaderPluginPng () {
 		XLTRACE(_T("Png decoder created!\n"));
@@ -188,11 +255,11 @@ public:
 	}
 
 	virtual void registerExt (ImageExts &exts) {
-		static xl::tchar *extensions[] = {
+		static const xl::tchar *extensions[] = {
 			_T("png"),
 		};
 		exts.reserve(exts.size() + COUNT_OF(extensions));
-		for (int i = 0; i < COUNT_OF(extensions); ++ i) {
+		for (int i = 0; i < (int)COUNT_OF(extensions); ++ i) {
 			exts.push_back(extensions[i]);
 		}
 	}
@@ -215,7 +282,7 @@ public:
 
 			png_read_info(psp, infop);
 			png_get_IHDR(psp, infop, &width, &height, &bit_depth, &color_type, NULL, NULL, NULL);
-			pixel_depth = infop->pixel_depth;
+			pixel_depth = _GetPixelDepth(psp, infop);
 			tRNS = png_get_valid(psp, infop, PNG_INFO_tRNS);
 			png_destroy_read_struct(&psp, &infop, &endp);
 			info.width = (int)width;
@@ -239,14 +306,14 @@ public:
 
 	virtual bool load (CImagePtr image, const std::string &data, xl::ILongTimeRunCallback *pCallback = NULL) {
 		assert(image->getImageCount() == 1);
-		xl::ui::CDIBSectionPtr dibPtr = image->getImage(0);
+		xl::ui::CDIBSectionPtr dibPtr = image->getWritableImage(0);
 		xl::ui::CDIBSection *dib = dibPtr.get();
 		dibPtr.reset();
 		bool result = false;
 
 		xl::uint8* *lines = NULL;
 		xl::uint width, height;
-		int bit_depth, color_type, row_bytes, number_of_passes;
+		int bit_depth, color_type;
 		png_infop infop = NULL, endp = NULL;
 		png_structp psp = _CreateStructs(data, &infop, &endp);
 		if (!psp) {
@@ -260,11 +327,10 @@ public:
 			png_read_info(psp, infop);
 			png_get_IHDR(psp, infop, &width, &height, &bit_depth, &color_type, NULL, NULL, NULL);
 			assert((int)width == dib->getWidth() && (int)height == dib->getHeight());
-			number_of_passes = _SetProperty(psp, infop);
+			_SetProperty(psp, infop, dib->getBitCounts());
 
-			row_bytes = png_get_rowbytes(psp, infop);
 			bit_depth = png_get_bit_depth(psp, infop);
-			assert(infop->pixel_depth == dib->getBitCounts());
+			assert(_GetPixelDepth(psp, infop) == dib->getBitCounts());
 
 			lines = new xl::uint8 *[height];
 			for (xl::uint i = 0; i < height; ++ i) {
@@ -293,12 +359,12 @@ public:
 
 	virtual bool loadResize (CImagePtr image, const std::string &data, xl::ui::CResizeEngine *pResizer, xl::ILongTimeRunCallback *pCallback = NULL) {
 		assert(image->getImageCount() == 1);
-		xl::ui::CDIBSectionPtr dibPtr = image->getImage(0);
+		xl::ui::CDIBSectionPtr dibPtr = image->getWritableImage(0);
 		xl::ui::CDIBSection *dib = dibPtr.get();
 		dibPtr.reset();
 
 		xl::uint width, height;
-		int bit_depth, color_type, row_bytes, number_of_passes;
+		int bit_depth, color_type, number_of_passes;
 		png_infop infop = NULL, endp = NULL;
 		png_structp psp = _CreateStructs(data, &infop, &endp);
 		if (!psp) {
@@ -311,23 +377,52 @@ public:
 		try {
 			png_read_info(psp, infop);
 			png_get_IHDR(psp, infop, &width, &height, &bit_depth, &color_type, NULL, NULL, NULL);
-			number_of_passes = _SetProperty(psp, infop);
+			number_of_passes = _SetProperty(psp, infop, dib->getBitCounts());
 
-			row_bytes = png_get_rowbytes(psp, infop);
 			bit_depth = png_get_bit_depth(psp, infop);
-			assert(infop->pixel_depth == dib->getBitCounts());
+			assert(_GetPixelDepth(psp, infop) == dib->getBitCounts());
+
+			if (((int)width != dib->getWidth() || (int)height != dib->getHeight()) && number_of_passes == 1) {
+				// decode -> resample -> publish, the strips are polled by the stages
+				// (maybe in another thread) instead of _read_row_callback()
+				png_set_read_status_fn(psp, NULL);
+				ds.setCallback(NULL);
+				int reduceShift = CResampleStage::getReduceShift(CSize(width, height), CSize(dib->getWidth(), dib->getHeight()), dib->getBitCounts());
+				xl::ui::CDIBSectionPtr dibTmp = CDIBSectionPool::getInstance()->create(dib->getWidth(), height >> reduceShift, dib->getBitCounts(), false);
+				if (dibTmp == NULL) {
+					png_destroy_read_struct(&psp, &infop, &endp);
+					return false;
+				}
+				CStripQueue decoded(CDecodePipeline::QUEUE_CAPACITY);
+				CStripQueue resampled(CDecodePipeline::QUEUE_CAPACITY);
+				_DecodeStage decodeStage(psp, width, height, dib->getBitCounts(), &decoded);
+				CResampleStage resampleStage(&decoded, &resampled, pResizer, dibTmp.get(), reduceShift);
+				CPublishStage publishStage(&resampled, pResizer, dibTmp.get(), dib);
+				CDecodePipeline pipeline;
+				pipeline.addStage(&decodeStage);
+				pipeline.addStage(&resampleStage);
+				pipeline.addStage(&publishStage);
+				bool result = pipeline.run(pCallback);
+
+				png_destroy_read_struct(&psp, &infop, &endp);
+				CDIBSectionPool::getInstance()->recycle(dibTmp);
+				return result;
+			}
 			png_destroy_read_struct(&psp, &infop, &endp);
 
 			if ((int)width == dib->getWidth() && (int)height == dib->getHeight()) {
 				return load(image, data, pCallback);
 			} else {
 				CImagePtr tmp(new CImage());
-				xl::ui::CDIBSectionPtr tmpImg = xl::ui::CDIBSection::createDIBSection(width, height, dib->getBitCounts(), false);
+				xl::ui::CDIBSectionPtr tmpImg = CDIBSectionPool::getInstance()->create(width, height, dib->getBitCounts(), false);
 				if (tmp && tmpImg) {
 					tmp->insertImage(tmpImg, CImage::DELAY_INFINITE);
+					tmpImg.reset(); // or it is shared, and load() writes into a copy
 					if (load(tmp, data, pCallback)) {
 						assert(pResizer != NULL);
-						return pResizer->scale(tmpImg.get(), dib, pCallback);
+						bool result = pResizer->scale(tmp->getImage(0).get(), dib, pCallback);
+						CDIBSectionPool::getInstance()->recycle(tmp);
+						return result;
 					}
 				}
 			}
@@ -340,7 +435,7 @@ public:
 	}
 
 	virtual bool loadThumbnail (
-                                    CImagePtr image,
+                                    CImagePtr /*image*/,
                                     const std::string & /*data*/,
                                     xl::ILongTimeRunCallback *pCallback = NULL
                                    )
@@ -3,17 +3,23 @@
 #include <vector>
 #include <set>
 #include <algorithm>
+#include <new>
 #include "libxl/include/fs.h"
 #include "libxl/include/utilities.h"
+#include "Options.h"
 #include "ImageManager.h"
+#include "PixelBufferPool.h"
+#include "ThumbnailStore.h"
+#include "ImageCache.h"
+#include "DecodePipeline.h"
 
 
 //////////////////////////////////////////////////////////////////////////
-static const int PREFETCH_RANGE = 4;
-
 void CImageManager::_SetIndexNoLock (int index) {
 	assert(getLockLevel() > 0);
-	assert(index >= 0 && index < (int)m_cachedImages.size());
+	_CachedImagesPtr images = m_images.get();
+	assert(images != NULL && index >= 0 && index < (int)images->size());
+	int count = (int)images->size();
 	if ((int)m_currIndex != index) {
 		// XLTRACE(_T("--== change index from %d to %d ==--\n"), m_currIndex, index);
 		if ((int)m_currIndex < index) {
@@ -23,17 +29,28 @@ void CImageManager::_SetIndexNoLock (int index) {
 		}
 
 		// check marginal condition
-		if (m_currIndex == 0 && index == (int)m_cachedImages.size() - 1) {
+		if (m_currIndex == 0 && index == count - 1) {
 			m_direction = BACKWARD;
-		} else if (m_currIndex == m_cachedImages.size() - 1 && index == 0) {
+		} else if (m_currIndex == count - 1 && index == 0) {
 			m_direction = FORWARD;
 		}
 
-		if (m_currIndex == (xl::uint)-1) {
+		if (m_currIndex == -1) {
 			m_direction = FORWARD;
 		}
 
-		m_currIndex = index;
+		int step = 0; // jumped
+		if (m_currIndex != -1 && index == (m_currIndex + 1) % count) {
+			step = 1;
+		} else if (m_currIndex != -1 && index == (m_currIndex + count - 1) % count) {
+			step = -1;
+		}
+		m_prefetchPolicy.onNavigate(step);
+
+		::InterlockedExchange(&m_currIndex, index); // read without the lock
+		::InterlockedExchange(&m_fullImageIndex, -1);
+		m_indexGeneration.bump(); // stop the work for the previous one
+		CImageCache::getInstance()->setFocus(index, count, m_direction == FORWARD);
 
 		// start prefetch first
 		_BeginLoad();
@@ -48,8 +65,9 @@ void CImageManager::_SetIndexNoLock (int index) {
 #pragma warning (disable:4127)
 /**
  * the order is (for current index is N):
- * forward: [N + 1, N - 1, N + 2, N + 3, ... N - 2, N - 3, ...]
- * backward: [N -1, N + 1, N - 2, N - 3, ... N + 2, N + 3, ...]
+ * forward: [N + 1, N - 1, N + 2, N + 3, ... N + ahead, N - 2, ... N - behind]
+ * backward: [N -1, N + 1, N - 2, N - 3, ... N - ahead, N + 2, ... N + behind]
+ * N - 1 (or N + 1 for backward) is not included if @behind is 0
  */
 #define IM_CHECK_INDEX(index, count) \
 do {\
@@ -68,8 +86,9 @@ do {\
 	container.push_back(index);\
 	getcount ++;\
 } while (0)
-void CImageManager::_GetPrefetchIndexes (_Indexes &indexes, int currIndex, int count, DIRECTION direction, int range) {
-	indexes.reserve(2 * range);
+void CImageManager::_GetPrefetchIndexes (_Indexes &indexes, int currIndex, int count, DIRECTION direction, int ahead, int behind) {
+	assert(ahead >= 1 && behind >= 0);
+	indexes.reserve(ahead + behind);
 
 	int offset = direction == FORWARD ? 1 : -1;
 	int getcount = 0;
@@ -77,23 +96,24 @@ void CImageManager::_GetPrefetchIndexes (_Indexes &indexes, int currIndex, int c
 	int index = currIndex + offset;
 	IM_INSERT_INDEX(indexes, index, getcount, count); // N + 1
 
-	index = currIndex - offset;
-	IM_INSERT_INDEX(indexes, index, getcount, count); // N - 1
+	if (behind > 0) {
+		index = currIndex - offset;
+		IM_INSERT_INDEX(indexes, index, getcount, count); // N - 1
+	}
 
-	int r = range - 1;
-	for (int i = 0; i < r; ++ i) {
-		index = currIndex + offset * (i + 2);
-		IM_INSERT_INDEX(indexes, index, getcount, count); // N + 1
+	for (int i = 2; i <= ahead; ++ i) {
+		index = currIndex + offset * i;
+		IM_INSERT_INDEX(indexes, index, getcount, count); // N + i
 	}
 
 	offset = -offset;
-	for (int i = 0; i < r; ++ i) {
-		index = currIndex + offset * (i + 2);
-		IM_INSERT_INDEX(indexes, index, getcount, count); // N + 1
+	for (int i = 2; i <= behind; ++ i) {
+		index = currIndex + offset * i;
+		IM_INSERT_INDEX(indexes, index, getcount, count); // N - i
 	}
 
-	if (count > 2 * range + 1) {
-		assert((int)indexes.size() == 2 * range);
+	if (count > ahead + behind + 1) {
+		assert((int)indexes.size() == ahead + behind);
 	}
 }
 #undef IM_CHECK_INDEX
@@ -102,248 +122,415 @@ void CImageManager::_GetPrefetchIndexes (_Indexes &indexes, int currIndex, int c
 
 
 //////////////////////////////////////////////////////////////////////////
-// callbacks
-namespace {
-	class CLoadingCallback : public xl::ILongTimeRunCallback {
-	protected:
-		int m_currIndex;
-		CImageManager *m_pManager;
-	public:
-		CLoadingCallback (int index, CImageManager *pManager) 
-			: m_currIndex(index)
-			, m_pManager(pManager)
-		{
-			assert(m_pManager != NULL);
-		}
+// jobs
+void CImageManager::_LoadJob (CJob *job) {
+	CImageLoader *pImageLoader = CImageLoader::getInstance();
+
+	xl::CScopeLock lock(this);
+	if (m_exiting || getImageCount() == 0) {
+		return;
+	}
+	xl::tstring fileName = getCurrentFileName();
+	int currIndex = getCurrIndex();
+	CSize szPrefetch = m_szPrefetch;
+	CCancelToken callback(job, &m_indexGeneration, m_indexGeneration.get());
+	CCachedImagePtr cachedImage = getCurrentCachedImage();
+	bool preloadThumbnail = cachedImage->getCachedImage() == NULL;
+	lock.unlock();
 
-		virtual bool shouldStop () const {
-			return m_currIndex != m_pManager->getCurrIndex() || m_pManager->isExiting();
+	if (preloadThumbnail) {
+		xl::CTimerLogger logger(_T("Load thumbnail %s cost"), fileName.c_str());
+		if (cachedImage->loadThumbnail(true, &callback) && !callback.shouldStop()) {
+			preloadThumbnail = false;
+			_PostEvent(EVT_THUMBNAIL_LOADED, currIndex);
 		}
-	};
+	}
 
-	class CZoomingCallback : public CLoadingCallback {
-		CSize m_szPrefetch;
-	public:
-		CZoomingCallback (CSize szPrefetch, int index, CImageManager *pManager)
-			: m_szPrefetch(szPrefetch)
-			, CLoadingCallback(index, pManager)
-		{
+	// the suitable one is enough to be shown, publish it before the full one
+	bool suitable = cachedImage->getSuitableImage() != NULL;
+	if (!suitable && szPrefetch.cx >= MIN_ZOOM_WIDTH && szPrefetch.cy >= MIN_ZOOM_HEIGHT) {
+		xl::CTimerLogger logger(_T("Load suitable %s cost"), fileName.c_str());
+		if (cachedImage->loadSuitable(szPrefetch, &callback) && !callback.shouldStop()) {
+			suitable = true;
+			_PostEvent(EVT_SUITABLE_LOADED, currIndex);
 		}
+	}
+	cachedImage.reset();
+	if (callback.shouldStop()) {
+		return;
+	}
+	if (suitable && m_fullImageOnDemand && m_fullImageIndex != currIndex) {
+		return; // until loadFullImage()
+	}
 
-		virtual bool shouldStop () const {
-			return m_szPrefetch != m_pManager->getPrefetchSize() 
-				|| CLoadingCallback::shouldStop();
+	xl::CTimerLogger logger(_T("Load %s cost"), fileName.c_str());
+	CImagePtr image = pImageLoader->load(fileName, &callback);
+	if (image == NULL) {
+		// assert(callback.shouldStop());
+		XLTRACE(_T("**** load %s failed\n"), fileName.c_str());
+	} else {
+		if (!callback.shouldStop()) { // it's checked again when dispatched
+			_PostEvent(EVT_IMAGE_LOADED, currIndex, image);
 		}
-	};
+		image.reset();
+	}
 }
 
-//////////////////////////////////////////////////////////////////////////
-// thread
-unsigned __stdcall CImageManager::_LoadThread (void *param) {
-	CImageManager *pThis = (CImageManager *)param;
-	assert(pThis != NULL);
-	HANDLE hEvent = pThis->m_hEvents[THREAD_LOAD];
+void CImageManager::traceStats () {
+	CImageCache::getInstance()->traceStats();
+	CDIBSectionPool::getInstance()->traceStats();
+	CPixelBufferPool::getInstance()->traceStats();
+	CThumbnailAtlas::getInstance()->traceStats();
+	CJobScheduler::getInstance()->traceStats();
+	CImageLoader::getInstance()->traceInFlightStats();
+	CDecodePipeline::traceStats();
+	traceHoldStats(_T("image manager"));
+	XLTRACE(_T("** event queue: %d posted, %d dispatches, %d thumbnail notifications\n"),
+		(int)m_postedEvents, (int)m_dispatches, (int)m_thumbnailNotifications);
+	m_indexGeneration.traceStats(_T("index"));
+	m_sizeGeneration.traceStats(_T("prefetch size"));
+	m_visibleGeneration.traceStats(_T("visible thumbnails"));
+	m_prefetchPolicy.tracePlan();
+}
 
-	CImageLoader *pImageLoader = CImageLoader::getInstance();
+void CImageManager::_PrefetchJob (CJob *job) {
+	xl::CScopeLock lock(this);
+	CSize szPrefetch = m_szPrefetch;
+	_CachedImagesPtr cachedImages = m_images.get();
+	if (m_exiting || szPrefetch.cx <= 0 || szPrefetch.cy <= 0 || cachedImages == NULL || cachedImages->size() == 0) {
+		return;
+	}
 
-	for (;;) {
-		::WaitForSingleObject(hEvent, INFINITE);
-		if (pThis->m_exiting) {
-			break;
-		}
+	int currIndex = getCurrIndex();
+	size_t count = cachedImages->size();
+	CCancelToken callback(job, &m_indexGeneration, m_indexGeneration.get(), &m_sizeGeneration, m_sizeGeneration.get());
+
+	// 1. prefetch
+	// 1.1 get the image Ptrs, the window is sized by how the user browses
+	CPrefetchPolicy::Plan plan = m_prefetchPolicy.getPlan();
+	_Indexes indexes;
+	_CachedImages images;
+	_GetPrefetchIndexes(indexes, currIndex, count, m_direction, plan.ahead, plan.behind);
+	images.reserve(indexes.size());
+	for (_Indexes::iterator it = indexes.begin(); it != indexes.end(); ++ it) {
+		images.push_back((*cachedImages)[*it]);
+	}
+
+	// 1.2 unlock, the images far away are evicted by CImageCache when
+	// the budget is exceeded, not by the prefetch range any more
+	lock.unlock();
+	if (m_traceStats) {
+		traceStats();
+	}
 
-		xl::CScopeLock lock(pThis);
-		xl::tstring fileName = pThis->getCurrentFileName();
-		int currIndex = pThis->getCurrIndex();
-		CLoadingCallback callback(currIndex, pThis);
-		CCachedImagePtr cachedImage = pThis->getCurrentCachedImage();
-		bool preloadThumbnail = cachedImage->getCachedImage() == NULL;
-		if (!preloadThumbnail) {
-			cachedImage.reset();
+	// 1.3 load the images the user reaches soon (plan.first)
+	int prefetched_count = 0;
+	for (_CachedImages::iterator it = images.begin();
+		it != images.end() && prefetched_count < plan.first && !callback.shouldStop(); 
+		++ it)
+	{
+		if (_PrefetchImage(*it, szPrefetch, &callback)) {
+			++ prefetched_count;
 		}
+	}
+
+	// 1.4 the thumbnails are loaded by another job, at a lower priority,
+	// but not under memory pressure (only the current and the next images are loaded)
+	if (CMemoryGovernor::getInstance()->isUnderPressure()) {
+		XLTRACE(_T("** memory pressure, skip prefetching the thumbnails\n"));
+	} else if (!callback.shouldStop()) {
+		lock.lock(this);
+		_BeginThumbnails(currIndex, szPrefetch);
 		lock.unlock();
+	}
 
-		if (preloadThumbnail) {
-			xl::CTimerLogger logger(_T("Load thumbnail %s cost"), fileName.c_str());
-			if (cachedImage->loadThumbnail(true, &callback)) {
-				lock.lock(pThis);
-				if (!callback.shouldStop()) {
-					preloadThumbnail = false;
-					pThis->_TriggerEvent(EVT_THUMBNAIL_LOADED, &currIndex);
-				}
-				lock.unlock();
-			}
-		}
+	// 1.5 load the remaining prefetch images
+	for (_CachedImages::iterator it = images.begin();
+		it != images.end() && !callback.shouldStop() && !CMemoryGovernor::getInstance()->isUnderPressure(); 
+		++ it)
+	{
+		_PrefetchImage(*it, szPrefetch, &callback);
+	}
 
-		xl::CTimerLogger logger(_T("Load %s cost"), fileName.c_str());
-		CImagePtr image = pImageLoader->load(fileName, &callback);
-		if (image == NULL) {
-			// assert(callback.shouldStop());
-			XLTRACE(_T("**** load %s failed\n"), fileName.c_str());
-		} else {
-			lock.lock(pThis);
-			if (currIndex == pThis->getCurrIndex()) { // make sure the image is the "current" one
-				pThis->_TriggerEvent(EVT_IMAGE_LOADED, &image);
-			}
-			lock.unlock();
-			image.reset();
-		}
+	lock.lock(this);
+	for (_CachedImages::iterator it = images.begin(); it != images.end(); ++ it) {
+		(*it).reset();
+	}
+	lock.unlock();
+}
+
+bool CImageManager::_PrefetchImage (CCachedImagePtr image, CSize szPrefetch, xl::ILongTimeRunCallback *pCallback) {
+	if (image->getSuitableImage() != NULL) {
+		return image->loadSuitable(szPrefetch, pCallback); // touch it in the cache
 	}
 
-	return 0;
+	// measure the decoding cost for the prefetch window
+	DWORD begin = ::GetTickCount();
+	if (image->loadSuitable(szPrefetch, pCallback)) {
+		m_prefetchPolicy.onDecoded(::GetTickCount() - begin);
+		return true;
+	}
+	return false;
 }
 
+void CImageManager::_SweepThumbnails (CJob *job, _ThumbnailSweepPtr sweep) {
+	if (m_exiting) {
+		return;
+	}
+	CCancelToken callback(job, &m_indexGeneration, sweep->indexGeneration, &m_sizeGeneration, sweep->sizeGeneration);
+	int count = (int)sweep->count;
+	_CachedImagesPtr cachedImages = m_images.get();
+	assert(cachedImages != NULL && cachedImages->size() == sweep->count);
+
+	// the job returns to the scheduler regularly, so the delayed jobs are not
+	// left behind it, the rest of the sweep goes on in a new job
+	int batch = 0;
 
-unsigned __stdcall CImageManager::_PrefetchThread (void *param) {
-	CImageManager *pThis = (CImageManager *)param;
-	assert(pThis != NULL);
-	HANDLE hEvent = pThis->m_hEvents[THREAD_PREFETCH];
+	// 1. the thumbnails saved in the store, no decoding at all
 	for (;;) {
-		::WaitForSingleObject(hEvent, INFINITE);
-		if (pThis->m_exiting) {
+		if (++ batch > THUMBNAIL_SWEEP_BATCH * 8 && sweep->storedCursor < count) { // the stored ones are cheap
+			if (_ResubmitSweep(job, sweep, callback)) {
+				return; // the sweep is not finished
+			}
 			break;
 		}
-		// continue;
-
-		xl::CScopeLock lock(pThis);
-		CSize szPrefetch = pThis->m_szPrefetch;
-		if (szPrefetch.cx <= 0 || szPrefetch.cy <= 0 || pThis->m_cachedImages.size() == 0) {
-			continue;
+		int i = (int)::InterlockedIncrement(&sweep->storedCursor) - 1;
+		if (i >= count || callback.shouldStop()) {
+			break;
 		}
-
-		int currIndex = pThis->getCurrIndex();
-		size_t count = pThis->getImageCount();
-
-		// 1. prefetch
-		// 1.1 get the image Ptrs
-		_Indexes indexes;
-		_CachedImages images;
-		pThis->_GetPrefetchIndexes(indexes, currIndex, count, pThis->m_direction, PREFETCH_RANGE);
-		images.reserve(indexes.size());
-		for (_Indexes::iterator it = indexes.begin(); it != indexes.end(); ++ it) {
-			images.push_back(pThis->m_cachedImages[*it]);
+		CCachedImagePtr cachedImage = (*cachedImages)[i];
+		if (!cachedImage->hasThumbnail() && cachedImage->loadStoredThumbnail() && !callback.shouldStop()) {
+			_PostEvent(EVT_THUMBNAIL_LOADED, i);
 		}
+	}
 
-		// 1.2 clear the useless zoomed images, and unlock
-		// note that 1.1 and 1.2 should be fast enough for a lock operation
-		for (xl::uint i = 0; i < pThis->m_cachedImages.size(); ++ i) {
-			bool removed = true;
-			if ((int)i == currIndex) {
-				removed = false;
-			} else {
-				if (std::find(indexes.begin(), indexes.end(), i) != indexes.end()) {
-					removed = false;
-				}
-			}
-			if (removed) {
-				pThis->m_cachedImages[i]->clear(false); // remain the thumbnail
+	// 2. load the thumbnails, the nearest first (forward first), the current one is
+	// checked too, because if the image loader doesn't support load thumbnail fast
+	// (such as the PNG loader), it thumbnail is not ready for display even if the
+	// image itself it loaded completely.
+	batch = 0;
+	while (!callback.shouldStop()) {
+		if (job->shouldYield() || ++ batch > THUMBNAIL_SWEEP_BATCH) {
+			// give the worker to the more important job, and continue later
+			if (_ResubmitSweep(job, sweep, callback)) {
+				return; // the sweep is not finished
 			}
+			break;
 		}
-		lock.unlock();
 
-		CZoomingCallback callback(szPrefetch, currIndex, pThis);
+		int pos = (int)::InterlockedIncrement(&sweep->cursor) - 1;
+		if (pos >= count) {
+			break;
+		}
+		int offset = (pos + 1) / 2;
+		int index = sweep->center + (pos % 2 == 1 ? offset : -offset);
+		index = (index % count + count) % count;
 
-		// 1.3 load most 2 zoomed images
-		int prefetched_count = 0;
-		for (_CachedImages::iterator it = images.begin();
-			it != images.end() && prefetched_count < 2 && !callback.shouldStop(); 
-			++ it)
-		{
-			CCachedImagePtr image = *it;
-			if (image->loadSuitable(szPrefetch, &callback)) {
-				++ prefetched_count;
-			}
+		CCachedImagePtr cachedImage = (*cachedImages)[index];
+		if (cachedImage->loadThumbnail(false, &callback) && !callback.shouldStop()) {
+			_PostEvent(EVT_THUMBNAIL_LOADED, index);
 		}
+	}
 
-		// 1.4 load the thumbnail
-		size_t processed_count = 1;
-		int offset = 0; // 0 to check the current, because if the image loader doesn't support
-				// load thumbnail fast (such as the PNG loader), it thumbnail is not 
-				// ready for display even if the image itself it loaded completely.
-		xl::CTimerLogger logger(_T("** process %d thumbnails cost"), count);
-		while (processed_count < count && !callback.shouldStop()) {
-			// forward
-			int index = currIndex + offset;
-			lock.lock(pThis);
-			count = pThis->m_cachedImages.size();
-			if (index >= (int)count) {
-				index %= count;
-			}
-			CCachedImagePtr cachedImage = pThis->m_cachedImages.at(index);
-			lock.unlock();
+	// the last one logs the cost
+	if (::InterlockedDecrement(&sweep->running) == 0) {
+		XLTRACE(_T("** process %d thumbnails by %d workers cost %d ms\n"),
+			count, sweep->workers, ::GetTickCount() - sweep->beginTime);
+	}
+}
 
-			if (cachedImage->loadThumbnail(false, &callback)) {
-				lock.lock(pThis);
-				if (!callback.shouldStop()) {
-					pThis->_TriggerEvent(EVT_THUMBNAIL_LOADED, &index);
-				}
-				lock.unlock();
-			}
-			++ processed_count;
-
-			// backward
-			index = currIndex - offset;
-			lock.lock(pThis);
-			count = pThis->m_cachedImages.size();
-			while (index < 0) {
-				index += count;
-			}
-			cachedImage = pThis->m_cachedImages.at(index);
-			lock.unlock();
+bool CImageManager::_ResubmitSweep (CJob *job, _ThumbnailSweepPtr sweep, const xl::ILongTimeRunCallback &callback) {
+	xl::CScopeLock lock(this);
+	if (callback.shouldStop() || sweep != m_thumbnailSweep) {
+		return false;
+	}
+	CJobPtr next(new _ThumbnailJob(this, sweep));
+	for (_Jobs::iterator it = m_thumbnailJobs.begin(); it != m_thumbnailJobs.end(); ++ it) {
+		if (it->get() == job) {
+			m_thumbnailJobs.erase(it); // replaced by the next one
+			break;
+		}
+	}
+	m_thumbnailJobs.push_back(next);
+	CJobScheduler::getInstance()->submit(next);
+	return true;
+}
 
-			if (cachedImage->loadThumbnail(false, &callback)) {
-				lock.lock(pThis);
-				if (!callback.shouldStop()) {
-					pThis->_TriggerEvent(EVT_THUMBNAIL_LOADED, &index);
+void CImageManager::_GetVisibleIndexes (_Indexes &indexes, const _VisibleRange &visible) {
+	// the target range first (where the scrolling ends), then the visible one,
+	// both from the center to the sides
+	std::set<int> added;
+	const int ranges[2][2] = {
+		{visible.targetFirst, visible.targetLast},
+		{visible.first, visible.last}
+	};
+	for (int r = 0; r < 2; ++ r) {
+		int first = ranges[r][0], last = ranges[r][1];
+		int center = (first + last) / 2;
+		for (int offset = 0; center - offset >= first || center + offset <= last; ++ offset) {
+			int candidates[2] = {center + offset, center - offset};
+			for (int i = 0; i < (offset == 0 ? 1 : 2); ++ i) {
+				int index = candidates[i];
+				if (index >= first && index <= last && added.insert(index).second) {
+					indexes.push_back(index);
 				}
-				lock.unlock();
 			}
-			++ processed_count;
-			++ offset;
 		}
-		logger.log();
+	}
+}
 
-		// 1.5 load the remaining prefetch images
-		for (_CachedImages::iterator it = images.begin();
-			it != images.end() && !callback.shouldStop(); 
-			++ it)
+void CImageManager::_VisibleThumbnailsJob (CJob *job) {
+	xl::CScopeLock lock(this);
+	_CachedImagesPtr cachedImages = m_images.get();
+	if (m_exiting || cachedImages == NULL) {
+		return;
+	}
+	_Indexes indexes;
+	_GetVisibleIndexes(indexes, m_visible);
+	CCancelToken callback(job, &m_visibleGeneration, m_visibleGeneration.get());
+	lock.unlock();
+
+	int loaded = 0;
+	for (_Indexes::iterator it = indexes.begin(); it != indexes.end() && !callback.shouldStop(); ++ it) {
+		int index = (int)*it;
+		if (index < 0 || index >= (int)cachedImages->size()) {
+			continue;
+		}
+		CCachedImagePtr cachedImage = (*cachedImages)[index];
+		if (cachedImage->hasThumbnail()) {
+			continue;
+		}
+		// the one decoded by the sweep (or by a canceled visible job) is joined, see CInFlightTable
+		if ((cachedImage->loadStoredThumbnail() || cachedImage->loadThumbnail(false, &callback))
+			&& !callback.shouldStop())
 		{
-			CCachedImagePtr image = *it;
-			if (image->loadSuitable(szPrefetch, &callback)) {
-			}
+			_PostEvent(EVT_THUMBNAIL_LOADED, index);
+			++ loaded;
 		}
+	}
+	XLTRACE(_T("** %d visible thumbnails loaded%s\n"), loaded, callback.shouldStop() ? _T(", canceled by scrolling") : _T(""));
+}
 
-		lock.lock(pThis);
-		for (_CachedImages::iterator it = images.begin(); it != images.end(); ++ it) {
-			(*it).reset();
+void CImageManager::_PostEvent (int evt, int index, CImagePtr image) {
+	void *p = _aligned_malloc(sizeof(_QueuedEvent), MEMORY_ALLOCATION_ALIGNMENT);
+	if (p == NULL) {
+		return;
+	}
+	_QueuedEvent *e = new (p) _QueuedEvent();
+	e->evt = evt;
+	e->index = index;
+	e->image = image;
+	::InterlockedPushEntrySList(m_events, &e->entry);
+	::InterlockedIncrement(&m_postedEvents);
+
+	// only one message for all the events queued before it's dispatched
+	if (::InterlockedExchange(&m_eventsPosted, 1) == 0) {
+		HWND hWnd = m_hEventWnd;
+		if (hWnd == NULL || !::PostMessage(hWnd, m_eventMsg, 0, 0)) {
+			::InterlockedExchange(&m_eventsPosted, 0);
 		}
-		lock.unlock();
 	}
+}
 
-	return 0;
+void CALLBACK CImageManager::_OnDispatchTimer (HWND hWnd, UINT /*msg*/, UINT_PTR id, DWORD /*time*/) {
+	::KillTimer(hWnd, id);
+	((CImageManager *)id)->dispatchEvents();
 }
 
+void CImageManager::_GetEvents (PSLIST_ENTRY entry, _QueuedEvents &events) {
+	for (; entry != NULL; entry = entry->Next) {
+		events.push_back(CONTAINING_RECORD(entry, _QueuedEvent, entry));
+	}
+	std::reverse(events.begin(), events.end()); // the list is LIFO
+}
 
 void CImageManager::_BeginLoad () {
-	_RunThread(THREAD_LOAD);
+	assert(getLockLevel() > 0);
+	if (m_loadJob != NULL) {
+		m_loadJob->cancel();
+	}
+	m_loadJob.reset(new CJobT<CImageManager>(this, &CImageManager::_LoadJob, CJob::PRIORITY_CURRENT));
+	CJobScheduler::getInstance()->submit(m_loadJob);
 }
 
 void CImageManager::_BeginPrefetch () {
-	_RunThread(THREAD_PREFETCH);
+	assert(getLockLevel() > 0);
+	if (m_prefetchJob != NULL) {
+		m_prefetchJob->cancel();
+	}
+	m_prefetchJob.reset(new CJobT<CImageManager>(this, &CImageManager::_PrefetchJob, CJob::PRIORITY_PREFETCH));
+	CJobScheduler::getInstance()->submit(m_prefetchJob);
+}
+
+void CImageManager::_BeginThumbnails (int currIndex, CSize szPrefetch) {
+	assert(getLockLevel() > 0);
+	for (_Jobs::iterator it = m_thumbnailJobs.begin(); it != m_thumbnailJobs.end(); ++ it) {
+		(*it)->cancel();
+	}
+	m_thumbnailJobs.clear();
+
+	CJobScheduler *scheduler = CJobScheduler::getInstance();
+	int workers = (int)scheduler->getWorkerCount() - 1; // the one left for the loading and zooming
+	if (workers < 1) {
+		workers = 1;
+	}
+	const xl::tchar *limit = _tgetenv(_T("xlview_thumbnail_workers")); // to measure the speedup
+	if (limit != NULL && _ttoi(limit) > 0 && _ttoi(limit) < workers) {
+		workers = _ttoi(limit);
+	}
+
+	_ThumbnailSweepPtr sweep(new _ThumbnailSweep());
+	sweep->center = currIndex;
+	sweep->size = szPrefetch;
+	sweep->indexGeneration = m_indexGeneration.get();
+	sweep->sizeGeneration = m_sizeGeneration.get();
+	sweep->count = getImageCount();
+	sweep->storedCursor = 0;
+	sweep->cursor = 0;
+	sweep->running = workers;
+	sweep->workers = workers;
+	sweep->beginTime = ::GetTickCount();
+	m_thumbnailSweep = sweep;
+	for (int i = 0; i < workers; ++ i) {
+		CJobPtr job(new _ThumbnailJob(this, sweep));
+		m_thumbnailJobs.push_back(job);
+		scheduler->submit(job);
+	}
 }
 
 
 //////////////////////////////////////////////////////////////////////////
 
 CImageManager::CImageManager ()
-	: m_currIndex((xl::uint)-1)
+	: m_currIndex(-1)
 	, m_direction(CImageManager::FORWARD)
 	, m_szPrefetch(-1, -1)//MIN_VIEW_WIDTH, MIN_VIEW_HEIGHT)
+	, m_fullImageOnDemand(false)
+	, m_fullImageIndex(-1)
+	, m_traceStats(false)
 	, m_exiting(false)
+	, m_eventsPosted(0)
+	, m_hEventWnd(NULL)
+	, m_eventMsg(0)
+	, m_lastDispatch(0)
+	, m_postedEvents(0)
+	, m_dispatches(0)
+	, m_thumbnailNotifications(0)
 {
-	_CreateThreads();
+	m_visible.first = m_visible.last = -1;
+	m_visible.targetFirst = m_visible.targetLast = -1;
+
+	m_fullImageOnDemand = COptions::getInstance()->isFullImageOnDemand();
+	const xl::tchar *traceStats = _tgetenv(_T("xlview_trace_stats"));
+	m_traceStats = traceStats != NULL && _ttoi(traceStats) != 0;
+
+	m_events = (PSLIST_HEADER)_aligned_malloc(sizeof(SLIST_HEADER), MEMORY_ALLOCATION_ALIGNMENT);
+	assert(m_events != NULL);
+	::InitializeSListHead(m_events);
 
-	::SetThreadPriority(m_hThreads[THREAD_PREFETCH], THREAD_PRIORITY_BELOW_NORMAL);
+	CThumbnailStore::getInstance()->open();
+	CMemoryGovernor::getInstance()->addShedder(this);
+	CMemoryGovernor::getInstance()->start();
 }
 
 CImageManager::~CImageManager () {
@@ -351,7 +538,22 @@ CImageManager::~CImageManager () {
 	_TriggerEvent(EVT_I_AM_DEAD, NULL);
 	unlock();
 	m_exiting = true;
-	_TerminateThreads();
+	m_indexGeneration.bump();
+	m_sizeGeneration.bump();
+	m_visibleGeneration.bump();
+	CJobScheduler::getInstance()->cancel(this, true);
+	CMemoryGovernor::getInstance()->stop();
+	CMemoryGovernor::getInstance()->removeShedder(this);
+	CThumbnailStore::getInstance()->close();
+
+	// the events not dispatched
+	_QueuedEvents events;
+	_GetEvents(::InterlockedFlushSList(m_events), events);
+	for (_QueuedEvents::iterator it = events.begin(); it != events.end(); ++ it) {
+		(*it)->~_QueuedEvent();
+		_aligned_free(*it);
+	}
+	_aligned_free(m_events);
 }
 
 int CImageManager::getCurrIndex () const {
@@ -359,21 +561,26 @@ int CImageManager::getCurrIndex () const {
 }
 
 size_t CImageManager::getImageCount () const {
-	xl::CScopeLock lock(this);
-	return m_cachedImages.size();
+	_CachedImagesPtr images = m_images.get();
+	return images != NULL ? images->size() : 0;
 }
 
 bool CImageManager::setFile (const xl::tstring &file) {
 	xl::CScopeLock lock(this);
 
-	assert(m_cachedImages.size() == 0);
+	assert(getImageCount() == 0);
 	xl::tstring fileName = xl::file_get_name(file);
 	m_directory = xl::file_get_directory(file);
+#ifdef _WIN32
 	m_directory += _T("\\");
+#else
+	m_directory += _T("/");
+#endif
 	xl::tstring pattern = m_directory + _T("*.*");
 	xl::CTimerLogger logger(_T("Searching images cost"));
 
 	int new_index = -1;
+	std::tr1::shared_ptr<_CachedImages> cachedImages(new _CachedImages());
 
 	// find the files
 	WIN32_FIND_DATA wfd;
@@ -389,22 +596,23 @@ bool CImageManager::setFile (const xl::tstring &file) {
 			xl::tstring name = m_directory + wfd.cFileName;
 			if (pLoader->isFileSupported(name)) {
 				if (_tcsicmp(wfd.cFileName, fileName) == 0) {
-					new_index = (int)m_cachedImages.size();
+					new_index = (int)cachedImages->size();
 				}
-				m_cachedImages.push_back(CCachedImagePtr(new CCachedImage(name)));
+				cachedImages->push_back(CCachedImagePtr(new CCachedImage(name, (int)cachedImages->size())));
 			}
 		} while (::FindNextFile(hFind, &wfd));
 		::FindClose(hFind);
 
-		xl::trace(_T("get %d files\n"), m_cachedImages.size());
+		xl::trace(_T("get %d files\n"), cachedImages->size());
 	}
 
-	if (m_cachedImages.size() == 0) {
+	if (cachedImages->size() == 0) {
 		::MessageBox(NULL, _T("Can not find any image files"), 0, MB_OK);
 		return false;
 	}
 
-	size_t count = m_cachedImages.size();
+	m_images.publish(cachedImages);
+	size_t count = cachedImages->size();
 	_TriggerEvent(EVT_FILELIST_READY, &count);
 
 	if (new_index == -1 && count > 0) {
@@ -414,72 +622,160 @@ bool CImageManager::setFile (const xl::tstring &file) {
 	return true;
 }
 
-void CImageManager::setIndex (int index) {
-	xl::CScopeLock lock(this);
-	_SetIndexNoLock(index);
+void CImageManager::setEventWindow (HWND hWnd, UINT msg) {
+	m_eventMsg = msg;
+	m_hEventWnd = hWnd;
+	if (hWnd != NULL && ::InterlockedExchange(&m_eventsPosted, 1) == 0) {
+		::PostMessage(hWnd, msg, 0, 0); // the events queued before
+	}
 }
 
-void CImageManager::setSuitableImage (CImagePtr image, CSize szImage, int index) {
+void CImageManager::dispatchEvents () {
+	if (m_hEventWnd == NULL) {
+		return; // exiting
+	}
+	DWORD now = ::GetTickCount();
+	DWORD elapsed = now - m_lastDispatch;
+	if (elapsed < (DWORD)EVENT_FRAME_TIME) {
+		// at most once a frame, the later events are merged (m_eventsPosted is still set)
+		::SetTimer(m_hEventWnd, (UINT_PTR)this, EVENT_FRAME_TIME - elapsed, _OnDispatchTimer);
+		return;
+	}
+	m_lastDispatch = now;
+
+	// the events queued from now on post another message
+	::InterlockedExchange(&m_eventsPosted, 0);
+	_QueuedEvents events;
+	_GetEvents(::InterlockedFlushSList(m_events), events);
+	if (events.empty()) {
+		return;
+	}
+
+	// the observers expect the lock
 	xl::CScopeLock lock(this);
-	if ((int)m_currIndex == index) {
-		m_cachedImages[index]->setSuitableImage(image, szImage);
+	int currIndex = getCurrIndex();
+	Indexes thumbnails;
+	CImagePtr image;
+	bool suitable = false;
+	for (_QueuedEvents::iterator it = events.begin(); it != events.end(); ++ it) {
+		_QueuedEvent *e = *it;
+		if (e->evt == EVT_THUMBNAIL_LOADED) {
+			thumbnails.push_back(e->index);
+		} else if (e->evt == EVT_SUITABLE_LOADED && e->index == currIndex) {
+			suitable = true;
+		} else if (e->evt == EVT_IMAGE_LOADED && e->index == currIndex) {
+			image = e->image; // make sure the image is the "current" one
+		}
+		e->~_QueuedEvent();
+		_aligned_free(e);
+	}
+
+	m_dispatches ++;
+	if (!thumbnails.empty()) {
+		m_thumbnailNotifications ++;
+		_TriggerEvent(EVT_THUMBNAIL_LOADED, &thumbnails);
+	}
+	if (suitable) {
+		_TriggerEvent(EVT_SUITABLE_LOADED, &currIndex);
+	}
+	if (image != NULL) {
+		_TriggerEvent(EVT_IMAGE_LOADED, &image);
 	}
 }
 
-CCachedImagePtr CImageManager::getCurrentCachedImage () {
-	xl::CScopeLock lock(this);
-	assert(m_currIndex >= 0 && m_currIndex < getImageCount());
-	CCachedImagePtr cachedImage = m_cachedImages[m_currIndex];
-	lock.unlock();
-	return cachedImage;
+void CImageManager::loadFullImage () {
+	// without the lock, the view may call it in its own lock
+	int index = getCurrIndex();
+	if (!m_fullImageOnDemand || index == -1 || m_exiting) {
+		return; // loaded already, or being loaded
+	}
+	if (::InterlockedExchange(&m_fullImageIndex, index) == index) {
+		return; // requested already
+	}
+
+	// the one loading the suitable image may load it too, they are joined by the loader
+	CJobPtr job(new CJobT<CImageManager>(this, &CImageManager::_LoadJob, CJob::PRIORITY_CURRENT));
+	CJobScheduler::getInstance()->submit(job);
 }
 
-CCachedImagePtr CImageManager::getCachedImage (int index) {
+void CImageManager::setVisibleThumbnails (int first, int last, int targetFirst, int targetLast) {
+	assert(first <= last && targetFirst <= targetLast);
 	xl::CScopeLock lock(this);
-	assert(index >= 0 && index < (int)getImageCount());
-	CCachedImagePtr cachedImage = m_cachedImages[index];
-	lock.unlock();
-	return cachedImage;
+	if (m_visible.first == first && m_visible.last == last
+		&& m_visible.targetFirst == targetFirst && m_visible.targetLast == targetLast)
+	{
+		return;
+	}
+	m_visible.first = first;
+	m_visible.last = last;
+	m_visible.targetFirst = targetFirst;
+	m_visible.targetLast = targetLast;
+
+	// the thumbnails off the screen now are not wanted any more
+	m_visibleGeneration.bump();
+	if (m_visibleJob != NULL) {
+		m_visibleJob->cancel();
+	}
+	m_visibleJob.reset(new CJobT<CImageManager>(this, &CImageManager::_VisibleThumbnailsJob, CJob::PRIORITY_VISIBLE_THUMBNAIL));
+	CJobScheduler::getInstance()->submit(m_visibleJob);
 }
 
-CImagePtr CImageManager::getThumbnail (int index) {
+void CImageManager::setIndex (int index) {
 	xl::CScopeLock lock(this);
-	assert(index >= 0 && index < (int)m_cachedImages.size());
-	CCachedImagePtr cachedImage = m_cachedImages[index];
-	CImagePtr thumbnail = cachedImage->getThumbnailImage();
-	cachedImage.reset();
-	lock.unlock();
-	return thumbnail;
+	_SetIndexNoLock(index);
 }
 
-xl::tstring CImageManager::getCurrentFileName () {
+void CImageManager::setSuitableImage (CImagePtr image, CSize szImage, int index) {
 	xl::CScopeLock lock(this);
-	assert(m_currIndex >= 0 && m_currIndex < getImageCount());
-	CCachedImagePtr cachedImage = m_cachedImages[m_currIndex];
-	lock.unlock();
-	return cachedImage->getFileName();
+	if ((int)m_currIndex == index) {
+		getCachedImage(index)->setSuitableImage(image, szImage);
+	}
 }
 
-const xl::tchar* CImageManager::_GetThreadName() {
-	return _T("xlview::ImageManager");
+CCachedImagePtr CImageManager::getCurrentCachedImage () {
+	return getCachedImage(getCurrIndex());
 }
 
-
-void CImageManager::_MarkThreadExit () {
-	m_exiting = true;
+CCachedImagePtr CImageManager::getCachedImage (int index) {
+	_CachedImagesPtr images = m_images.get();
+	assert(images != NULL && index >= 0 && index < (int)images->size());
+	return (*images)[index];
 }
 
-void CImageManager::_AssignThreadProc () {
-	m_procThreads[THREAD_LOAD] = &_LoadThread;
-	m_procThreads[THREAD_PREFETCH] = &_PrefetchThread;
+ThumbnailHandle CImageManager::getThumbnail (int index) {
+	return getCachedImage(index)->getThumbnail();
 }
 
-void CImageManager::_Lock () {
-	lock();
+xl::tstring CImageManager::getCurrentFileName () {
+	return getCurrentCachedImage()->getFileName();
 }
 
-void CImageManager::_Unlock () {
-	unlock();
+size_t CImageManager::shed (int tier) {
+	if (tier != CMemoryGovernor::TIER_THUMBNAILS) {
+		return 0;
+	}
+
+	_CachedImagesPtr cachedImages = m_images.get();
+	int count = cachedImages != NULL ? (int)cachedImages->size() : 0;
+	int currIndex = getCurrIndex();
+	if (count == 0 || currIndex < 0 || currIndex >= count) {
+		return 0;
+	}
+	_CachedImages images;
+	for (int i = 0; i < count; ++ i) {
+		int distance = abs(i - currIndex);
+		if (distance > count - distance) {
+			distance = count - distance;
+		}
+		if (distance > THUMBNAIL_KEEP_RANGE && (*cachedImages)[i]->hasThumbnail()) {
+			images.push_back((*cachedImages)[i]);
+		}
+	}
+
+	for (_CachedImages::iterator it = images.begin(); it != images.end(); ++ it) {
+		(*it)->clear(true);
+	}
+	return images.size() * CThumbnailAtlas::getInstance()->getStats().slotBytes;
 }
 
 void CImageManager::onViewSizeChanged (CRect rc) {
@@ -491,5 +787,6 @@ void CImageManager::onViewSizeChanged (CRect rc) {
 		return;
 	}
 	m_szPrefetch = sz;
+	m_sizeGeneration.bump();
 	_BeginPrefetch();
 }
@@ -6,18 +6,22 @@
 #include "libxl/include/string.h"
 #include "libxl/include/utilities.h"
 #include "libxl/include/dp/Observable.h"
-#include "ClassWithThreads.h"
+#include "JobScheduler.h"
+#include "CancelToken.h"
+#include "Snapshot.h"
+#include "TimedLock.h"
+#include "PrefetchPolicy.h"
 #include "ImageConfig.h"
 #include "CachedImage.h"
 #include "ImageLoader.h"
+#include "MemoryGovernor.h"
 
 
 class CImageManager 
 	: public xl::dp::CObserableT<CImageManager>
-	, public xl::CUserLock
-	, public ClassWithThreadT<CImageManager, 2>
+	, public CTimedUserLock
+	, public IMemoryShedder
 {
-	friend class ClassWithThreadT<CImageManager, 2>;
 
 protected:
 	enum DIRECTION {
@@ -27,47 +31,130 @@ protected:
 	typedef std::vector<xl::uint>                  _Indexes;
 	typedef std::vector<CCachedImagePtr>           _CachedImages;
 	typedef _CachedImages::iterator                _CachedImageIter;
+	typedef CSnapshotT<_CachedImages>::Ptr         _CachedImagesPtr;
 	xl::tstring        m_directory; // include the last '\\'
-	_CachedImages      m_cachedImages;
-	xl::uint           m_currIndex;
+
+	// the readers (the views, the jobs) get them without the lock,
+	// the changes are still made in the lock
+	CSnapshotT<_CachedImages> m_images;
+	volatile LONG      m_currIndex;
 	DIRECTION          m_direction;
 
 	CSize              m_szPrefetch;
 
+	// the current image is loaded in the suitable size first, and in the real size
+	// then, or only when the view zooms in if on demand (see COptions)
+	bool               m_fullImageOnDemand;
+	volatile LONG      m_fullImageIndex; // the index requested by loadFullImage()
+
+	// the stats of the caches, pools and jobs are traced by every prefetching
+	// only if xlview_trace_stats=1, see traceStats()
+	bool               m_traceStats;
+
+	// bumped when the index or the prefetch size changes, see CCancelToken
+	CGeneration        m_indexGeneration;
+	CGeneration        m_sizeGeneration;
+
 	void _SetIndexNoLock (int index); // called when already locked
 
 	// static
-	static void _GetPrefetchIndexes (_Indexes &indexes, int currIndex, int count, DIRECTION direction, int range);
+	static void _GetPrefetchIndexes (_Indexes &indexes, int currIndex, int count, DIRECTION direction, int ahead, int behind);
+	CPrefetchPolicy    m_prefetchPolicy;
 
 	//////////////////////////////////////////////////////////////////////////
-	// thread related
-	enum {
-		THREAD_LOAD     = 0,
-		THREAD_PREFETCH = 1,
-		THREAD_COUNT
-	};
+	// jobs (see CJobScheduler), a new one cancels the old one of the same kind
 	bool                                           m_exiting;
-	static unsigned __stdcall _LoadThread (void *);
-	static unsigned __stdcall _PrefetchThread (void *);
+	CJobPtr            m_loadJob;
+	CJobPtr            m_prefetchJob;
+
+	// the thumbnails are loaded by some jobs in parallel (one for each worker),
+	// they share the cursors of one sweep, and the loaded ones are notified in batch
+	struct _ThumbnailSweep {
+		int            center;
+		CSize          size;
+		LONG           indexGeneration; // when the sweep begins
+		LONG           sizeGeneration;
+		size_t         count;
+		volatile LONG  storedCursor; // the index of the next one to check the store
+		volatile LONG  cursor;       // the position of the next one, in the near-first order
+		volatile LONG  running;      // the jobs not finished
+		int            workers;
+		DWORD          beginTime;
+	};
+	typedef std::tr1::shared_ptr<_ThumbnailSweep>  _ThumbnailSweepPtr;
+	typedef std::vector<CJobPtr>                   _Jobs;
+
+	class _ThumbnailJob : public CJob {
+		CImageManager *m_pManager;
+		_ThumbnailSweepPtr m_sweep;
+	public:
+		_ThumbnailJob (CImageManager *pManager, _ThumbnailSweepPtr sweep)
+			: CJob(PRIORITY_THUMBNAIL, pManager), m_pManager(pManager), m_sweep(sweep) {}
+		virtual void run () { m_pManager->_SweepThumbnails(this, m_sweep); }
+	};
+
+	_ThumbnailSweepPtr m_thumbnailSweep;
+	_Jobs              m_thumbnailJobs;
+
+	// the thumbnails shown by the thumbnail view, and where it's scrolling to,
+	// loaded by a job of a higher priority than the sweep
+	struct _VisibleRange {
+		int            first;
+		int            last;
+		int            targetFirst;
+		int            targetLast;
+	};
+	_VisibleRange      m_visible;
+	CGeneration        m_visibleGeneration;
+	CJobPtr            m_visibleJob;
+
+	void _LoadJob (CJob *job);
+	void _PrefetchJob (CJob *job);
+	bool _PrefetchImage (CCachedImagePtr image, CSize szPrefetch, xl::ILongTimeRunCallback *pCallback);
+	void _SweepThumbnails (CJob *job, _ThumbnailSweepPtr sweep);
+	// submit the rest of @sweep as a new job instead of @job, returns false if it is stopped
+	bool _ResubmitSweep (CJob *job, _ThumbnailSweepPtr sweep, const xl::ILongTimeRunCallback &callback);
 	void _BeginLoad ();
 	void _BeginPrefetch ();
+	void _BeginThumbnails (int currIndex, CSize szPrefetch);
+	void _VisibleThumbnailsJob (CJob *job);
+	static void _GetVisibleIndexes (_Indexes &indexes, const _VisibleRange &visible);
 
 	//////////////////////////////////////////////////////////////////////////
-	// for ClassWithThreads
-	const xl::tchar* _GetThreadName (); 
-	void _MarkThreadExit ();
-	void _AssignThreadProc ();
-	void _Lock ();
-	void _Unlock ();
+	// the events of the jobs are queued without any lock, and dispatched by the
+	// UI thread at most once a frame, all the thumbnails loaded in one event
+	struct _QueuedEvent {
+		SLIST_ENTRY    entry;
+		int            evt;
+		int            index;
+		CImagePtr      image;        // EVT_IMAGE_LOADED only
+	};
+	typedef std::vector<_QueuedEvent *>            _QueuedEvents;
+
+	PSLIST_HEADER      m_events;
+	volatile LONG      m_eventsPosted; // a message is posted, and not dispatched yet
+	HWND               m_hEventWnd;
+	UINT               m_eventMsg;
+	DWORD              m_lastDispatch;
+	volatile LONG      m_postedEvents;
+	LONG               m_dispatches;
+	LONG               m_thumbnailNotifications;
+
+	void _PostEvent (int evt, int index, CImagePtr image = CImagePtr());
+	static void _GetEvents (PSLIST_ENTRY entry, _QueuedEvents &events);
+	static void CALLBACK _OnDispatchTimer (HWND hWnd, UINT msg, UINT_PTR id, DWORD time);
 
 public:
+	typedef std::vector<int>                       Indexes;
+
 	// event
 	enum EVENT 
 	{
 		EVT_FILELIST_READY,                    // param (pointer to total count)
 		EVT_INDEX_CHANGED,                     // param (pointer to the current index)
 		EVT_IMAGE_LOADED,                      // param (pointer to the CImagePtr)
-		EVT_THUMBNAIL_LOADED,                  // param (pointer to the current index)
+		EVT_THUMBNAIL_LOADED,                  // param (pointer to the Indexes loaded)
+		EVT_SUITABLE_LOADED,                   // param (pointer to the current index)
 		EVT_I_AM_DEAD,                         // param (not used)
 		EVT_NUM
 	};
@@ -82,19 +169,34 @@ public:
 	void setIndex (int index);
 
 	void setSuitableImage (CImagePtr image, CSize szImage, int index);
+	// called by the view when the suitable image is not enough (zooming in)
+	void loadFullImage ();
+	// called by the thumbnail view, [@targetFirst, @targetLast] is the range to
+	// be shown when the scrolling ends, the same as the visible one if not scrolling
+	void setVisibleThumbnails (int first, int last, int targetFirst, int targetLast);
+
+	// EVT_IMAGE_LOADED, EVT_SUITABLE_LOADED and EVT_THUMBNAIL_LOADED are triggered by dispatchEvents(),
+	// in the UI thread, when @msg is received by @hWnd
+	void setEventWindow (HWND hWnd, UINT msg);
+	void dispatchEvents ();
 
 	CCachedImagePtr getCurrentCachedImage ();
 	CCachedImagePtr getCachedImage (int index);
-	CImagePtr getThumbnail (int index);
+	ThumbnailHandle getThumbnail (int index);
 	xl::tstring getCurrentFileName ();
 
 	//////////////////////////////////////////////////////////////////////////
 	// To be notified
 	void onViewSizeChanged (CRect rc); // called by the view to notify its size changed
 
-	// used for zoom callback test
+	// IMemoryShedder, release the thumbnails far from the current one
+	virtual size_t shed (int tier);
+
 	bool isExiting () const { return m_exiting; }
 	CSize getPrefetchSize () const { return m_szPrefetch; }
+	// for the zooming of the view, to stop when the index changes
+	CGeneration* getIndexGeneration () { return &m_indexGeneration; }
+	void traceStats ();
 };
 
 #endif
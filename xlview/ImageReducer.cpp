@@ -0,0 +1,106 @@
+#include <assert.h>
+#include <vector>
+#include <emmintrin.h>
+#include "ImageReducer.h"
+#include "PixelBufferPool.h"
+
+
+//////////////////////////////////////////////////////////////////////////
+// local functions
+
+// dst = (a + b + 1) / 2, byte by byte
+static void _AverageLines (xl::uint8 *dst, const xl::uint8 *a, const xl::uint8 *b, int bytes) {
+	int i = 0;
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_avg_epu8(va, vb));
+	}
+	for (; i < bytes; ++ i) {
+		dst[i] = (xl::uint8)((a[i] + b[i] + 1) >> 1);
+	}
+}
+
+// dst = (p[2x] + p[2x + 1]) / 2, the rounding is downward, so with the
+// upward rounding of _AverageLines(), there is no bias after many passes
+static void _HalveLine32 (xl::uint8 *dst, const xl::uint8 *src, int dst_width) {
+	const __m128i one = _mm_set1_epi8(1);
+	int x = 0;
+	for (; x + 4 <= dst_width; x += 4) {
+		__m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(src + x * 8)));      // p0 p1 p2 p3
+		__m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(src + x * 8 + 16))); // p4 p5 p6 p7
+		__m128i even = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));   // p0 p2 p4 p6
+		__m128i odd = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));    // p1 p3 p5 p7
+		__m128i avg = _mm_sub_epi8(_mm_avg_epu8(even, odd), _mm_and_si128(_mm_xor_si128(even, odd), one));
+		_mm_storeu_si128((__m128i *)(dst + x * 4), avg);
+	}
+	for (; x < dst_width; ++ x) {
+		const xl::uint8 *p = src + x * 8;
+		for (int c = 0; c < 4; ++ c) {
+			dst[x * 4 + c] = (xl::uint8)((p[c] + p[c + 4]) >> 1);
+		}
+	}
+}
+
+static void _HalveLine24 (xl::uint8 *dst, const xl::uint8 *src, int dst_width) {
+	for (int x = 0; x < dst_width; ++ x) {
+		const xl::uint8 *p = src + x * 6;
+		*dst ++ = (xl::uint8)((p[0] + p[3]) >> 1);
+		*dst ++ = (xl::uint8)((p[1] + p[4]) >> 1);
+		*dst ++ = (xl::uint8)((p[2] + p[5]) >> 1);
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// exported functions
+
+bool reduceHalf (xl::ui::CDIBSection *src, xl::ui::CDIBSection *dst, xl::ILongTimeRunCallback *pCallback) {
+	assert(src != NULL && dst != NULL);
+	assert(src->getBitCounts() == dst->getBitCounts());
+	assert(dst->getWidth() == src->getWidth() / 2 && dst->getHeight() == src->getHeight() / 2);
+	int bitcount = src->getBitCounts();
+	if (bitcount != 24 && bitcount != 32) {
+		assert(false); // not supported
+		return false;
+	}
+
+	int width = dst->getWidth();
+	int height = dst->getHeight();
+	int bytes = width * 2 * (bitcount / 8);
+	std::vector<xl::uint8> line(bytes + 16);
+	for (int y = 0; y < height; ++ y) {
+		if (pCallback && pCallback->shouldStop()) {
+			return false;
+		}
+
+		_AverageLines(&line[0], src->getLine(y * 2), src->getLine(y * 2 + 1), bytes);
+		if (bitcount == 32) {
+			_HalveLine32(dst->getLine(y), &line[0], width);
+		} else {
+			_HalveLine24(dst->getLine(y), &line[0], width);
+		}
+	}
+
+	return true;
+}
+
+xl::ui::CDIBSectionPtr reduceByIntegerRatio (xl::ui::CDIBSectionPtr src, int width, int height, xl::ILongTimeRunCallback *pCallback) {
+	assert(src != NULL);
+	assert(width > 0 && height > 0);
+	if (src->getBitCounts() != 24 && src->getBitCounts() != 32) {
+		return src;
+	}
+
+	CDIBSectionPool *pool = CDIBSectionPool::getInstance();
+	while (src->getWidth() / 2 >= width && src->getHeight() / 2 >= height) {
+		xl::ui::CDIBSectionPtr dst = pool->create(src->getWidth() / 2, src->getHeight() / 2, src->getBitCounts(), false);
+		if (dst == NULL || !reduceHalf(src.get(), dst.get(), pCallback)) {
+			return xl::ui::CDIBSectionPtr();
+		}
+		pool->recycle(src); // only the intermediate ones, the caller still holds the source
+		src = dst;
+	}
+
+	return src;
+}
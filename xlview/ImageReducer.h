@@ -0,0 +1,27 @@
+#ifndef XL_VIEW_IMAGE_REDUCER_H
+#define XL_VIEW_IMAGE_REDUCER_H
+#include "libxl/include/common.h"
+#include "libxl/include/interfaces.h"
+#include "libxl/include/ui/DIBSection.h"
+
+/**
+ * Fast reducing for the integer ratios (2x, 4x, 8x, ...), each 2x2 pixels
+ * are averaged into one, by the pairwise SIMD averaging.
+ */
+
+/**
+ * Reduce @src to 1/2, @dst should be of (src.width / 2, src.height / 2),
+ * the last column (row) is dropped if the width (height) is odd.
+ */
+bool reduceHalf (xl::ui::CDIBSection *src, xl::ui::CDIBSection *dst, xl::ILongTimeRunCallback *pCallback = NULL);
+
+/**
+ * Reduce @src by 2 repeatedly while the result is still not smaller than
+ * (@width, @height), the caller then resizes the result to the final size
+ * (the fractional step). Returns @src itself if it is less than twice of
+ * the target size, or NULL if canceled (or out of memory).
+ */
+xl::ui::CDIBSectionPtr reduceByIntegerRatio (xl::ui::CDIBSectionPtr src, int width, int height, xl::ILongTimeRunCallback *pCallback = NULL);
+
+
+#endif
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <algorithm>
 #include <Windows.h>
 #include "libxl/include/utilities.h"
 #include "libxl/include/Language.h"
@@ -8,93 +9,219 @@
 #include "MainWindow.h"
 #include "NavView.h"
 #include "InfoView.h"
+#include "PixelBufferPool.h"
+#include "JobScheduler.h"
 
 //////////////////////////////////////////////////////////////////////////
 // callback when zooming
 namespace {
-	class CZoomingCallback : public xl::ILongTimeRunCallback {
-		CSize m_szZoom;
-		int m_index;
+	// the zoom sizes differ slightly (within @tolerance)
+	bool IsNearSize (CSize szZoom, CSize szOther, double tolerance) {
+		double dx = (double)szZoom.cx / szOther.cx - 1.0;
+		double dy = (double)szZoom.cy / szOther.cy - 1.0;
+		return abs(dx) <= tolerance && abs(dy) <= tolerance;
+	}
+
+	class CZoomingCallback : public CCancelToken {
+		CSize m_szZoom; // (-1, -1) for any zoom size
+		double m_tolerance;
 		CImageView *m_pView;
-		CImageManager *m_pManager;
 	public:
-		CZoomingCallback (CSize szZoom, int index, CImageView *pView, CImageManager *pManager) 
-			: m_szZoom(szZoom), m_index(index)
-			, m_pView(pView), m_pManager(pManager) 
+		// the generations are of the index (of the manager) and the zoom size (of the view)
+		CZoomingCallback (CSize szZoom, CImageView *pView, CJob *job, 
+		                  CGeneration *indexGeneration, LONG indexValue,
+		                  CGeneration *zoomGeneration, LONG zoomValue,
+		                  double tolerance = 0.0) 
+			: CCancelToken(job, indexGeneration, indexValue, zoomGeneration, zoomValue)
+			, m_szZoom(szZoom), m_tolerance(tolerance), m_pView(pView)
 		{
-			assert(m_pView != NULL && m_pManager != NULL);
+			assert(m_pView != NULL && job != NULL);
+		}
+
+	protected:
+		virtual bool _IsStillWanted (int which) const {
+			return which == 1 && _IsZoomSizeAcceptable();
 		}
 
-		virtual bool shouldStop () const {
-			return m_szZoom != m_pView->getZoomSize()
-				|| m_index != m_pManager->getCurrIndex()
-				|| m_pView->isExiting();
+		bool _IsZoomSizeAcceptable () const {
+			CSize szZoom = m_pView->getZoomSize();
+			if (m_szZoom == CSize(-1, -1) || m_szZoom == szZoom) {
+				return true;
+			}
+			// a slight change doesn't waste the work done, the result is
+			// stretched to the new size (see _BeginZoom())
+			return IsNearSize(szZoom, m_szZoom, m_tolerance);
 		}
 	};
 }
 
 //////////////////////////////////////////////////////////////////////////
-// static
-unsigned __stdcall CImageView::_ZoomThread (void *param) {
-	CImageView *pThis = (CImageView *)param;
-	assert(pThis != NULL);
-	HANDLE hEvent = pThis->m_hEvents[0];
-	assert(hEvent != NULL);
-	for (;;) {
-		::WaitForSingleObject(hEvent, INFINITE);
-		if (pThis->m_exiting) {
-			break;
-		}
+// jobs
+void CImageView::_ZoomJob (CJob *job) {
+	if (m_exiting) {
+		return;
+	}
 
-		CScopeMultiLock lock(pThis, true);
-		if (pThis->m_imageRealSize == NULL) {
-			continue; // no source
-		}
-		bool suitable = pThis->m_suitable;
-		CSize szRS = pThis->m_imageRealSize->getImageSize();
-		CSize szZoomTo = pThis->m_szZoom;
-		// 1. if ratio > 1, use original
-		// 2. if image size > 2500 * 2000, and ratio > 0.7, use the original
-		double ratio = (double)szZoomTo.cx / (double)szRS.cx;
-		__int64 pixel_count = szRS.cx * szRS.cy;
-		if (ratio >= 0.99 || (pixel_count > 2500 * 2000 && ratio > 0.7))
+	CScopeMultiLock lock(this, true);
+	if (m_imageRealSize == NULL) {
+		return; // no source
+	}
+	CGeneration *indexGeneration = m_pImageManager->getIndexGeneration();
+	LONG indexValue = indexGeneration->get();
+	bool suitable = m_suitable;
+	CSize szRS = m_imageRealSize->getImageSize();
+	bool tiled = m_imageRealSize->isTiled();
+
+	// 0. build the pyramid for the image once, it is built only when all the
+	// levels are done, a canceled one is discarded and built by the next job
+	if (!m_pyramidBuilt && !m_pyramidBuilding) {
+		CRect rc = getClientRect();
+		if (!tiled && m_imageRealSize->getImageCount() == 1
+			&& rc.Width() > 0 && rc.Height() > 0 && (szRS.cx > rc.Width() || szRS.cy > rc.Height()))
 		{
-			pThis->m_imageZoomed = pThis->m_imageRealSize;
-			pThis->invalidate();
-			continue; // zoom to a too large size, so we use the real size image instead
+			CSize szSuitable = CImage::getSuitableSize(CSize(rc.Width(), rc.Height()), szRS);
+			CImagePtr level = m_imageRealSize;
+			CImagePtr source = m_imageRealSize;
+			int index = m_pImageManager->getCurrIndex();
+			m_pyramidBuilding = true;
+			lock.unlock();
+
+			xl::CTimerLogger logger(_T("** Build pyramid for (%d-%d) cost"), szRS.cx, szRS.cy);
+			CZoomingCallback callback(CSize(-1, -1), this, job, indexGeneration, indexValue, &m_zoomGeneration, m_zoomGeneration.get());
+			_Pyramid pyramid;
+			while (level != NULL && level->getImageWidth() >= szSuitable.cx && level->getImageHeight() >= szSuitable.cy
+				&& level->getImageWidth() >= MIN_ZOOM_WIDTH * 2 && level->getImageHeight() >= MIN_ZOOM_HEIGHT * 2)
+			{
+				level = level->resize(level->getImageWidth() / 2, level->getImageHeight() / 2, true, &callback);
+				if (level == NULL) {
+					pyramid.clear(); // canceled, the partial levels are useless
+					break;
+				}
+				pyramid.push_back(level);
+			}
+			bool canceled = level == NULL;
+			level.reset();
+			logger.log();
+
+			lock.lock(this, true);
+			m_pyramidBuilding = false;
+			if (canceled || index != m_pImageManager->getCurrIndex() || m_imageRealSize != source) {
+				return;
+			}
+			m_pyramid.swap(pyramid);
+			pyramid.clear();
+			m_pyramidBuilt = true;
+			invalidate(); // the preview may be better now
+		} else {
+			m_pyramidBuilt = true; // nothing to build
 		}
-		if (pThis->m_imageZoomed && pThis->m_imageZoomed->getImageSize() == szZoomTo) {
-			continue; // zoom not needed
+	}
+	CSize szZoomTo = m_szZoom;
+	indexValue = indexGeneration->get();
+	LONG zoomValue = m_zoomGeneration.get();
+	// 1. if ratio > 1, use original
+	// 2. if image size > 2500 * 2000, and ratio > 0.7, use the original
+	// 3. if the zoomed image is larger than the view, resize the visible area only
+	// 4. the tiled image can only be resized (by the viewport, or to a small size)
+	double ratio = (double)szZoomTo.cx / (double)szRS.cx;
+	__int64 pixel_count = szRS.cx * szRS.cy;
+	if (ratio >= 0.99 && !tiled) {
+		m_imageZoomed = m_imageRealSize;
+		m_imageViewport.reset();
+		invalidate();
+		return; // zoom to a too large size, so we use the real size image instead
+	}
+
+	int index = m_pImageManager->getCurrIndex();
+	if (_IsViewportZoom(szZoomTo, szRS, tiled)) {
+		CRect rcVisible = _GetVisibleRect(szZoomTo);
+		if (m_imageViewport && m_szViewport == szZoomTo) {
+			CRect rc;
+			rc.IntersectRect(rcVisible, m_rcViewport);
+			if (rc == rcVisible) {
+				return; // the visible area is covered
+			}
 		}
+		CRect rcViewport = rcVisible;
+		rcViewport.InflateRect(VIEWPORT_MARGIN, VIEWPORT_MARGIN);
+		rcViewport.IntersectRect(rcViewport, CRect(0, 0, szZoomTo.cx, szZoomTo.cy));
 
-		int index = pThis->m_pImageManager->getCurrIndex();
-		CImagePtr imageRS = pThis->m_imageRealSize;
-		pThis->m_zooming = true;
+		CImagePtr imageRS = _GetPyramidLevel(szZoomTo);
+		if (imageRS == NULL) {
+			imageRS = m_imageRealSize; // tiled
+		}
+		CSize szSrc = imageRS->getImageSize();
+		m_zooming = true;
 		lock.unlock();
 
-		xl::CTimerLogger logger(_T("** Resize image (%d-%d) to (%d-%d) cost"), 
-			szRS.cx, szRS.cy, szZoomTo.cx, szZoomTo.cy);
-		CZoomingCallback callback(szZoomTo, index, pThis, pThis->m_pImageManager);
-		CImagePtr imageZoomed = imageRS->resize(szZoomTo.cx, szZoomTo.cy, true, &callback);
-		imageRS.reset(); // no use now, save memory
+		xl::CTimerLogger logger(_T("** Resize image (%d-%d) to (%d-%d) [%d, %d, %d, %d] cost"), 
+			szSrc.cx, szSrc.cy, szZoomTo.cx, szZoomTo.cy,
+			rcViewport.left, rcViewport.top, rcViewport.right, rcViewport.bottom);
+		CZoomingCallback callback(szZoomTo, this, job, indexGeneration, indexValue, &m_zoomGeneration, zoomValue);
+		CImagePtr imageViewport = imageRS->resizeRect(szZoomTo, rcViewport, true, &callback);
+		imageRS.reset();
 		logger.log();
 
-		lock.lock(pThis, true);
-		pThis->m_zooming = false;
-		if (imageZoomed != NULL && index == pThis->m_pImageManager->getCurrIndex()) {
-			pThis->m_imageZoomed = imageZoomed;
-			pThis->invalidate();
-			lock.unlock();
-
-			if (suitable) {
-				pThis->m_pImageManager->setSuitableImage(imageZoomed, szRS, index);
-			}
-		} else {
-			lock.unlock();
+		lock.lock(this, true);
+		m_zooming = false;
+		if (imageViewport != NULL && index == m_pImageManager->getCurrIndex()
+			&& szZoomTo == m_szZoom)
+		{
+			m_imageViewport = imageViewport;
+			m_szViewport = szZoomTo;
+			m_rcViewport = rcViewport;
+			_CheckViewport(); // the user may have dragged away during the resizing
+			invalidate();
 		}
+		lock.unlock();
+		return;
+	}
+
+	m_imageViewport.reset();
+	if (pixel_count > 2500 * 2000 && ratio > 0.7 && !tiled) {
+		m_imageZoomed = m_imageRealSize;
+		invalidate();
+		return; // resize a large image costs too much, so we use the real size image instead
+	}
+	if (m_imageZoomed && m_imageZoomed->getImageSize() == szZoomTo) {
+		return; // zoom not needed
 	}
 
-	return 0;
+	// refine from the nearest pyramid level, the reducing is shared by all the zoom sizes
+	CImagePtr imageRS = _GetPyramidLevel(szZoomTo);
+	if (imageRS == NULL) {
+		imageRS = m_imageRealSize; // tiled
+	}
+	CSize szSrc = imageRS->getImageSize();
+	m_zooming = true;
+	m_szRefining = szZoomTo;
+	lock.unlock();
+
+	xl::CTimerLogger logger(_T("** Resize image (%d-%d) to (%d-%d) cost"), 
+		szSrc.cx, szSrc.cy, szZoomTo.cx, szZoomTo.cy);
+	CZoomingCallback callback(szZoomTo, this, job, indexGeneration, indexValue, &m_zoomGeneration, zoomValue, ZOOM_TOLERANCE);
+	CImagePtr imageZoomed = imageRS->resize(szZoomTo.cx, szZoomTo.cy, true, &callback);
+	imageRS.reset(); // no use now, save memory
+	logger.log();
+
+	lock.lock(this, true);
+	m_zooming = false;
+	if (m_szRefining == szZoomTo) {
+		m_szRefining = CSize(-1, -1);
+	}
+	if (imageZoomed != NULL && index == m_pImageManager->getCurrIndex()) {
+		CImagePtr imageOld = m_imageZoomed;
+		m_imageZoomed = imageZoomed;
+		invalidate();
+		lock.unlock();
+		CDIBSectionPool::getInstance()->recycle(imageOld);
+
+		if (suitable && szZoomTo == m_szZoom) {
+			m_pImageManager->setSuitableImage(imageZoomed, szRS, index);
+		}
+	} else {
+		lock.unlock();
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -131,6 +258,8 @@ void CImageView::_OnImageLoaded (CImagePtr image) {
 
 	m_imageRealSize = image;
 	m_szReal = image->getImageSize();
+	m_pyramid.clear();
+	m_pyramidBuilt = false;
 	if (m_szDisplay == CSize(-1, -1)) {
 		CRect rc = getClientRect();
 		// xl::trace(_T("rc: %d %d"), rc.Width(), rc.Height());
@@ -147,11 +276,27 @@ void CImageView::_OnImageLoaded (CImagePtr image) {
 	_SetZoomSize(m_szDisplay);
 }
 
-void CImageView::_OnThumbnailLoaded (int index) {
+void CImageView::_OnSuitableLoaded (int index) {
 	assert(m_pImageManager != NULL && m_pImageManager->getLockLevel() > 0);
 	assert(getLockLevel() > 0); // must be called in lock
 
-	if (index != m_pImageManager->getCurrIndex()) {
+	if (index != m_pImageManager->getCurrIndex() || m_imageRealSize != NULL) {
+		return; // the real size one is better
+	}
+	if (m_suitable || m_imageZoomed == NULL) {
+		_OnIndexChanged(index); // replace the thumbnail
+	} else {
+		m_imageZoomed = m_pImageManager->getCurrentCachedImage()->getCachedImage();
+		invalidate();
+	}
+}
+
+void CImageView::_OnThumbnailLoaded (const CImageManager::Indexes &indexes) {
+	assert(m_pImageManager != NULL && m_pImageManager->getLockLevel() > 0);
+	assert(getLockLevel() > 0); // must be called in lock
+
+	int index = m_pImageManager->getCurrIndex();
+	if (std::find(indexes.begin(), indexes.end(), index) == indexes.end()) {
 		return;
 	} else {
 		if (m_imageRealSize == NULL && m_imageZoomed == NULL) {
@@ -235,6 +380,12 @@ void CImageView::_SetZoomSize (CSize szZoom) {
 	assert(getLockLevel() > 0);
 	CHECK_ZOOM_SIZE(szZoom);
 	m_szZoom = szZoom;
+	m_zoomGeneration.bump();
+	if (m_imageRealSize == NULL && m_imageZoomed != NULL
+		&& (szZoom.cx > m_imageZoomed->getImageWidth() || szZoom.cy > m_imageZoomed->getImageHeight()))
+	{
+		m_pImageManager->loadFullImage(); // the suitable one is not enough
+	}
 	_BeginZoom();
 }
 
@@ -248,6 +399,12 @@ void CImageView::_ResetDisplayInfo () {
 	m_ptSrc = CPoint(0, 0);
 	m_imageRealSize.reset();
 	m_imageZoomed.reset();
+	m_imageViewport.reset();
+	m_szViewport = CSize(-1, -1);
+	m_rcViewport = CRect(0, 0, 0, 0);
+	m_pyramid.clear();
+	m_pyramidBuilt = false;
+	m_szRefining = CSize(-1, -1);
 #ifdef PROGRESS_ZOOMING
 	m_ptCurSaved = CPoint(-1, -1);
 #endif
@@ -300,6 +457,61 @@ void CImageView::_NotifyDisplayChanged () {
 	}
 }
 
+bool CImageView::_IsViewportZoom (CSize szZoom, CSize szReal, bool tiled) {
+	CRect rc = getClientRect();
+	if (rc.Width() <= 0 || rc.Height() <= 0 || (szZoom.cx >= szReal.cx && !tiled)) {
+		return false;
+	}
+	return szZoom.cx > rc.Width() || szZoom.cy > rc.Height();
+}
+
+CRect CImageView::_GetVisibleRect (CSize szZoom) {
+	assert(getLockLevel() > 0);
+	CRect rc = getClientRect();
+	CPoint ptSrc = m_ptSrc;
+	if (m_szDisplay != szZoom && m_szDisplay.cx > 0 && m_szDisplay.cy > 0) {
+		// m_ptSrc is in the display area, which is not of the zoom size yet
+		ptSrc.x = (int)((double)ptSrc.x * szZoom.cx / m_szDisplay.cx);
+		ptSrc.y = (int)((double)ptSrc.y * szZoom.cy / m_szDisplay.cy);
+	}
+	CRect rcVisible(ptSrc.x, ptSrc.y, ptSrc.x + rc.Width(), ptSrc.y + rc.Height());
+	rcVisible.IntersectRect(rcVisible, CRect(0, 0, szZoom.cx, szZoom.cy));
+	return rcVisible;
+}
+
+void CImageView::_CheckViewport () {
+	CScopeMultiLock lock(this, false);
+	if (m_imageViewport == NULL || m_szViewport != m_szZoom) {
+		return; // not in viewport zooming, or the zooming is on going
+	}
+
+	// refill the viewport before the user drags out of it
+	CRect rcWanted = _GetVisibleRect(m_szZoom);
+	rcWanted.InflateRect(VIEWPORT_MARGIN / 2, VIEWPORT_MARGIN / 2);
+	rcWanted.IntersectRect(rcWanted, CRect(0, 0, m_szZoom.cx, m_szZoom.cy));
+	CRect rc;
+	rc.IntersectRect(rcWanted, m_rcViewport);
+	if (rc != rcWanted) {
+		_BeginZoom(true);
+	}
+}
+
+CImagePtr CImageView::_GetPyramidLevel (CSize szZoom) {
+	assert(getLockLevel() > 0);
+	CImagePtr level;
+	if (m_imageRealSize != NULL && !m_imageRealSize->isTiled()) {
+		level = m_imageRealSize;
+	}
+	for (_Pyramid::iterator it = m_pyramid.begin(); it != m_pyramid.end(); ++ it) {
+		CSize sz = (*it)->getImageSize();
+		if (sz.cx < szZoom.cx || sz.cy < szZoom.cy) {
+			break;
+		}
+		level = *it;
+	}
+	return level;
+}
+
 void CImageView::_CalculateZoomedSize (CSize &szDisplay, CSize szReal, bool isZoomin, double factor) {
 	double x, y;
 	if (szReal.cx > szReal.cy) {
@@ -425,10 +637,28 @@ bool CImageView::_CalcStepedDisplaySize (CSize &szDisplay, CSize szZoom) {
 }
 #endif
 
-void CImageView::_BeginZoom () {
+void CImageView::_BeginZoom (bool pan) {
 	assert(getLockLevel() > 0);
 	CHECK_ZOOM_SIZE(m_szZoom);
-	_RunThread(0);
+
+	// the zoom size changes are debounced, the preview is drawn (from the pyramid)
+	// before the zoom size keeps still, and the running one is not canceled, it
+	// stops itself if the change is not slight; the refill of the viewport when
+	// panning starts at once, the previous refill (of the old area) is useless
+	//
+	// a slight change while refining doesn't start another refine, the result
+	// of the running one is stretched to the new size when it is drawn
+	if (!pan && m_szRefining != CSize(-1, -1) && IsNearSize(m_szZoom, m_szRefining, ZOOM_TOLERANCE)) {
+		if (m_zoomJob != NULL && !m_zoomJob->isStarted()) {
+			m_zoomJob->cancel(); // submitted for a larger change, which is undone
+		}
+		return;
+	}
+	if (m_zoomJob != NULL && (pan || !m_zoomJob->isStarted())) {
+		m_zoomJob->cancel();
+	}
+	m_zoomJob.reset(new CJobT<CImageView>(this, &CImageView::_ZoomJob, CJob::PRIORITY_ZOOM));
+	CJobScheduler::getInstance()->submit(m_zoomJob, pan ? 0 : ZOOM_DEBOUNCE_TIME);
 }
 
 
@@ -449,6 +679,11 @@ CImageView::CImageView (CImageManager *pImageManager)
 	, m_ptSrc(0, 0)
 	, m_suitable(true)
 	, m_zooming(false)
+	, m_szRefining(-1, -1)
+	, m_szViewport(-1, -1)
+	, m_rcViewport(0, 0, 0, 0)
+	, m_pyramidBuilt(false)
+	, m_pyramidBuilding(false)
 	, m_ptCapture(-1, -1)
 #ifdef PROGRESS_ZOOMING
 	, m_ptCurSaved(-1, -1)
@@ -461,12 +696,12 @@ CImageView::CImageView (CImageManager *pImageManager)
 	// setStyle(_T("background-color:#202020;"));
 
 	m_pImageManager->subscribe(this);
-
-	_CreateThreads();
 }
 
 CImageView::~CImageView (void) {
-	_TerminateThreads();
+	m_exiting = true;
+	m_zoomGeneration.bump();
+	CJobScheduler::getInstance()->cancel(this, true);
 }
 
 void CImageView::showSuitable (CPoint /*ptCur*/) {
@@ -561,6 +796,7 @@ void CImageView::showTop (CPoint ptCur) {
 
 	m_ptSrc.y = 0;
 	_NotifyDisplayChanged();
+	_CheckViewport();
 	invalidate();
 }
 
@@ -578,6 +814,7 @@ void CImageView::showBottom (CPoint ptCur) {
 	if (ptSrc != m_ptSrc) {
 		m_ptSrc = ptSrc;
 		_NotifyDisplayChanged();
+		_CheckViewport();
 		invalidate();
 	}
 }
@@ -591,6 +828,7 @@ void CImageView::showLeft (CPoint ptCur) {
 
 	m_ptSrc.x = 0;
 	_NotifyDisplayChanged();
+	_CheckViewport();
 	invalidate();
 }
 
@@ -608,6 +846,7 @@ void CImageView::showRight (CPoint ptCur) {
 	if (ptSrc != m_ptSrc) {
 		m_ptSrc = ptSrc;
 		_NotifyDisplayChanged();
+		_CheckViewport();
 		invalidate();
 	}
 }
@@ -620,6 +859,7 @@ void CImageView::setPtSrc (int x, int y) {
 		m_ptSrc = ptSrc;
 
 		_NotifyDisplayChanged();
+		_CheckViewport();
 
 		invalidate();
 	}
@@ -660,6 +900,7 @@ void CImageView::onSize () {
 		} else {
 			_CheckPtSrc(m_ptSrc);
 			_NotifyDisplayChanged();
+			_CheckViewport();
 		}
 	}
 	lock.unlock();
@@ -684,16 +925,38 @@ void CImageView::drawMe (HDC hdc) {
 	m_dirty = false;
 	CScopeMultiLock lock(this, false);
 	CImagePtr image = m_imageZoomed;
-	if (image == NULL) {
+	bool preview = false;
+	if (image == NULL || (image->getImageSize() != szDisplay && !IsNearSize(image->getImageSize(), szDisplay, ZOOM_TOLERANCE))) {
+		// not refined yet, the nearest pyramid level (not smaller than the display size) is faster to stretch
+		CImagePtr level = _GetPyramidLevel(szDisplay);
+		if (level != NULL && level != image && level->getImageWidth() >= szDisplay.cx
+			&& (image == NULL || image->getImageWidth() < szDisplay.cx || level->getImageWidth() < image->getImageWidth()))
+		{
+			image = level;
+			preview = true;
+		}
+	}
+	CImagePtr imageViewport;
+	CRect rcViewport;
+	if (m_imageViewport != NULL && m_szViewport == szDisplay) {
+		imageViewport = m_imageViewport;
+		rcViewport = m_rcViewport;
+	}
+	if (image == NULL && imageViewport == NULL) {
 		return;
 	}
-	xl::ui::CDIBSectionPtr dib = image->getImage(0);
-	assert(dib != NULL);
-	CSize szImage = image->getImageSize();
 	CPoint ptSrc = m_ptSrc;
 	lock.unlock();
 
 	CRect rcDisplayArea = _CalcDisplayArea(rc, szDisplay, ptSrc);
+	CRect rcVisible(ptSrc.x, ptSrc.y, ptSrc.x + rcDisplayArea.Width(), ptSrc.y + rcDisplayArea.Height());
+	CRect rcCovered(0, 0, 0, 0);
+	if (imageViewport != NULL) {
+		rcCovered.IntersectRect(rcVisible, rcViewport);
+		if (rcCovered == rcVisible) {
+			image.reset(); // the viewport covers all, no need to draw the zoomed image
+		}
+	}
 
 	xl::ui::CDCHandle dc(hdc);
 	xl::ui::CDC cdc;
@@ -707,25 +970,43 @@ void CImageView::drawMe (HDC hdc) {
 	// xl::ui::CDIBSectionHelper dibHelper(dib, mdc);
 	// I don't use ::StretchBlt() in the back thread for zooming, 
 	// so BitBlt or StretchBlt without lock is safe.
-	dib->attachToDC(mdc);
+	xl::ui::CDIBSectionPtr dib;
+	if (image != NULL) {
+		dib = image->getImage(0);
+		assert(dib != NULL);
+		CSize szImage = image->getImageSize();
+		dib->attachToDC(mdc);
+
+		if (szImage == szDisplay) {
+			cdc.BitBlt(rcDisplayArea.left, rcDisplayArea.top, rcDisplayArea.Width(), rcDisplayArea.Height(), 
+				mdc, ptSrc.x, ptSrc.y, SRCCOPY);
+		} else {
+			// use StretchBlt
+			int sx = (int)(0.5 + (double)szImage.cx * (double)ptSrc.x / (double)szDisplay.cx);
+			int sy = (int)(0.5 + (double)szImage.cy * (double)ptSrc.y / (double)szDisplay.cy);
+			int sw = (int)(0.5 + (double)szImage.cx * (double)rcDisplayArea.Width() / (double)szDisplay.cx);
+			int sh = (int)(0.5 + (double)szImage.cy * (double)rcDisplayArea.Height() / (double)szDisplay.cy);
+			CScopeMultiLock lock(this, false);
+			int oldMode = cdc.SetStretchBltMode(preview ? COLORONCOLOR : HALFTONE);
+			cdc.StretchBlt(rcDisplayArea.left, rcDisplayArea.top, rcDisplayArea.Width(), rcDisplayArea.Height(),
+				mdc, sx, sy, sw, sh, SRCCOPY);
+			cdc.SetStretchBltMode(oldMode);
+			lock.unlock();
+		}
+		dib->detachFromDC(mdc);
+	}
 
-	if (szImage == szDisplay) {
-		cdc.BitBlt(rcDisplayArea.left, rcDisplayArea.top, rcDisplayArea.Width(), rcDisplayArea.Height(), 
-			mdc, ptSrc.x, ptSrc.y, SRCCOPY);
-	} else {
-		// use StretchBlt
-		int sx = (int)(0.5 + (double)szImage.cx * (double)ptSrc.x / (double)szDisplay.cx);
-		int sy = (int)(0.5 + (double)szImage.cy * (double)ptSrc.y / (double)szDisplay.cy);
-		int sw = (int)(0.5 + (double)szImage.cx * (double)rcDisplayArea.Width() / (double)szDisplay.cx);
-		int sh = (int)(0.5 + (double)szImage.cy * (double)rcDisplayArea.Height() / (double)szDisplay.cy);
-		CScopeMultiLock lock(this, false);
-		int oldMode = cdc.SetStretchBltMode(HALFTONE);
-		cdc.StretchBlt(rcDisplayArea.left, rcDisplayArea.top, rcDisplayArea.Width(), rcDisplayArea.Height(),
-			mdc, sx, sy, sw, sh, SRCCOPY);
-		cdc.SetStretchBltMode(oldMode);
-		lock.unlock();
+	// the resampled viewport (maybe partial) over the zoomed image
+	xl::ui::CDIBSectionPtr dibViewport;
+	if (!rcCovered.IsRectEmpty()) {
+		dibViewport = imageViewport->getImage(0);
+		assert(dibViewport != NULL);
+		dibViewport->attachToDC(mdc);
+		cdc.BitBlt(rcDisplayArea.left + rcCovered.left - ptSrc.x, rcDisplayArea.top + rcCovered.top - ptSrc.y,
+			rcCovered.Width(), rcCovered.Height(),
+			mdc, rcCovered.left - rcViewport.left, rcCovered.top - rcViewport.top, SRCCOPY);
+		dibViewport->detachFromDC(mdc);
 	}
-	dib->detachFromDC(mdc);
 	m_cachedBitmap->detachFromDC(cdc);
 
 //	_SetCachedBitmap(hdc);
@@ -748,6 +1029,8 @@ void CImageView::drawMe (HDC hdc) {
 	m_pImageManager->lock();
 	dib.reset();
 	image.reset();
+	dibViewport.reset();
+	imageViewport.reset();
 	m_pImageManager->unlock();
 }
 
@@ -781,7 +1064,8 @@ void CImageView::onMouseMove (CPoint pt, xl::uint /*key*/) {
 			m_ptSrc = ptSrc;
 
 			_NotifyDisplayChanged();
-			
+			_CheckViewport();
+
 			invalidate();
 		}
 	} else {
@@ -839,9 +1123,13 @@ void CImageView::onEvent (EVT evt, void *param) {
 		assert(param);
 		_OnImageLoaded(*(CImagePtr *)param);
 		break;
+	case CImageManager::EVT_SUITABLE_LOADED:
+		assert(param);
+		_OnSuitableLoaded(*(int *)param);
+		break;
 	case CImageManager::EVT_THUMBNAIL_LOADED:
 		assert(param);
-		_OnThumbnailLoaded(*(int *)param);
+		_OnThumbnailLoaded(*(CImageManager::Indexes *)param);
 		break;
 	case CImageManager::EVT_FILELIST_READY:
 		break;
@@ -853,26 +1141,3 @@ void CImageView::onEvent (EVT evt, void *param) {
 		break;
 	}
 }
-
-
-//////////////////////////////////////////////////////////////////////////
-// used by ClassWithThreads
-const xl::tchar* CImageView::_GetThreadName () {
-	return _T("xlview::CImageView");
-}
-
-void CImageView::_AssignThreadProc () {
-	m_procThreads[THREAD_ZOOM] = &_ZoomThread;
-}
-
-void CImageView::_MarkThreadExit () {
-	m_exiting = true;
-}
-
-void CImageView::_Lock () {
-	lockMe();
-}
-
-void CImageView::_Unlock () {
-	unlockMe();
-}
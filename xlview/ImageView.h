@@ -1,7 +1,8 @@
 #ifndef XLVIEW_IMAGE_VIEW_H
 #define XLVIEW_IMAGE_VIEW_H
+#include <vector>
 #include "libxl/include/ui/Control.h"
-#include "ClassWithThreads.h"
+#include "JobScheduler.h"
 #include "ImageConfig.h"
 #include "ImageLoader.h"
 #include "ImageManager.h"
@@ -17,9 +18,7 @@ class CImageView
 	: public xl::ui::CControl
 	, public CImageManager::IObserver
 	, public CMultiLock
-	, public ClassWithThreadT<CImageView, 1>
 {
-	friend class ClassWithThreadT<CImageView, 1>;
 protected:
 	CImageManager     *m_pImageManager;
 	CNavView          *m_pNavView;
@@ -39,12 +38,26 @@ protected:
 	CPoint             m_ptSrc; // in zoomed area
 	bool               m_suitable;
 	bool               m_zooming;
+	CSize              m_szRefining; // the zoom size being refined (the whole image), (-1, -1) if none
 	CImagePtr          m_imageZoomed;
 	CImagePtr          m_imageRealSize;
 
+	// when the zoomed image is larger than the view, only part of it is resampled
+	CImagePtr          m_imageViewport;
+	CSize              m_szViewport; // the zoom size which m_imageViewport belongs to
+	CRect              m_rcViewport; // the area m_imageViewport covers (in zoomed area)
+
+	// the reduced images (1/2, 1/4, ...) of m_imageRealSize, the preview when
+	// zooming is drawn from the nearest level, and the refining starts from it
+	typedef std::vector<CImagePtr>                 _Pyramid;
+	_Pyramid           m_pyramid;
+	bool               m_pyramidBuilt;
+	bool               m_pyramidBuilding; // by a zoom job, out of the lock
+
 	void _OnIndexChanged (int index);
 	void _OnImageLoaded (CImagePtr);
-	void _OnThumbnailLoaded (int index);
+	void _OnSuitableLoaded (int index);
+	void _OnThumbnailLoaded (const CImageManager::Indexes &indexes);
 
 	CPoint             m_ptCapture;
 	CPoint             m_ptCaptureSrc;
@@ -71,6 +84,11 @@ protected:
 	void _CheckPtSrc (CPoint &ptSrc);
 	void _NotifyDisplayChanged ();
 
+	bool _IsViewportZoom (CSize szZoom, CSize szReal, bool tiled);
+	CRect _GetVisibleRect (CSize szZoom);
+	void _CheckViewport ();
+	CImagePtr _GetPyramidLevel (CSize szZoom);
+
 	void _CalculateZoomedSize (CSize &szDisplay, CSize szReal, bool isZoomin, double factor);
 
 	void _CreateCachedBitmap ();
@@ -81,21 +99,13 @@ protected:
 	bool _CalcStepedDisplaySize (CSize &szDisplay, CSize szZoom);
 #endif
 	//////////////////////////////////////////////////////////////////////////
-	// thread related
+	// jobs (see CJobScheduler)
 	bool m_exiting;
-	static unsigned __stdcall _ZoomThread (void *);
-	void _BeginZoom ();
-
-	// used by ClassWithThreads
-	enum {
-		THREAD_ZOOM,
-		THREAD_COUNT
-	};
-	const xl::tchar* _GetThreadName();
-	void _AssignThreadProc();
-	void _MarkThreadExit();
-	void _Lock();
-	void _Unlock();
+	CJobPtr            m_zoomJob;
+	CGeneration        m_zoomGeneration; // bumped by _SetZoomSize(), see CCancelToken
+	void _ZoomJob (CJob *job);
+	// @pan is true for refilling the viewport, which is not debounced
+	void _BeginZoom (bool pan = false);
 
 public:
 	CImageView(CImageManager *pImageManager);
@@ -0,0 +1,132 @@
+#include <assert.h>
+#include <tchar.h>
+#include "libxl/include/utilities.h"
+#include "InFlightTable.h"
+#include "CancelToken.h"
+
+static const DWORD WAIT_STEP = 20; // to check the callback of the waiter, if it has no cancel event
+
+
+CInFlightTable::_Request::_Request () : szImage(-1, -1) {
+	hDone = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+	assert(hDone != NULL);
+}
+
+CInFlightTable::_Request::~_Request () {
+	::CloseHandle(hDone);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CInFlightTable
+
+CInFlightTable::CInFlightTable () {
+}
+
+CInFlightTable::~CInFlightTable () {
+	assert(m_requests.empty());
+}
+
+CInFlightTable::_RequesterPtr CInFlightTable::_FindRequester (RequestPtr request, xl::ILongTimeRunCallback *pCallback) {
+	xl::CScopeLock lock(this);
+	for (_Requesters::iterator it = request->requesters.begin(); it != request->requesters.end(); ++ it) {
+		if ((*it)->callback == pCallback) {
+			return *it;
+		}
+	}
+	return _RequesterPtr();
+}
+
+bool CInFlightTable::_ShouldStop (RequestPtr request) {
+	xl::CScopeLock lock(this);
+	for (_Requesters::iterator it = request->requesters.begin(); it != request->requesters.end(); ++ it) {
+		if ((*it)->stopped == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+xl::tstring CInFlightTable::getKey (const xl::tstring &fileName, KIND kind, CSize szTarget) {
+	xl::tchar buf[64];
+	_stprintf_s(buf, 64, _T("%d:%d:%d:"), kind, szTarget.cx, szTarget.cy);
+	xl::tstring key = buf;
+	for (size_t i = 0; i < fileName.length(); ++ i) {
+		key += (xl::tchar)_totlower(fileName.at(i));
+	}
+	return key;
+}
+
+bool CInFlightTable::join (const xl::tstring &key, RequestPtr &request, xl::ILongTimeRunCallback *pCallback) {
+	_RequesterPtr requester(new _Requester());
+	requester->callback = pCallback;
+	requester->stopped = 0;
+
+	xl::CScopeLock lock(this);
+	_Requests::iterator it = m_requests.find(key);
+	if (it != m_requests.end()) {
+		request = it->second;
+		request->requesters.push_back(requester);
+		m_stats.coalesced ++;
+		return false;
+	}
+
+	request.reset(new _Request());
+	request->key = key;
+	request->requesters.push_back(requester);
+	m_requests[key] = request;
+	m_stats.started ++;
+	return true;
+}
+
+void CInFlightTable::complete (RequestPtr request, CImagePtr image, CSize szImage) {
+	xl::CScopeLock lock(this);
+	request->image = image;
+	request->szImage = szImage;
+	m_requests.erase(request->key);
+	::SetEvent(request->hDone);
+}
+
+bool CInFlightTable::wait (RequestPtr request, xl::ILongTimeRunCallback *pCallback, CImagePtr &image, CSize &szImage) {
+	// the cancel event wakes the waiter up at once, the other callbacks are polled
+	CCancelToken *token = dynamic_cast<CCancelToken *>(pCallback);
+	HANDLE handles[] = {request->hDone, token != NULL ? token->getCancelEvent() : NULL};
+	DWORD count = handles[1] != NULL ? 2 : 1;
+	DWORD timeout = handles[1] != NULL || pCallback == NULL ? INFINITE : WAIT_STEP;
+	while (pCallback == NULL || !pCallback->shouldStop()) {
+		if (::WaitForMultipleObjects(count, handles, FALSE, timeout) == WAIT_OBJECT_0) {
+			break;
+		}
+	}
+
+	// the waiter leaves (done or stopped), so the decoder never waits for it
+	xl::CScopeLock lock(this);
+	for (_Requesters::iterator it = request->requesters.begin(); it != request->requesters.end(); ++ it) {
+		if ((*it)->callback == pCallback) {
+			request->requesters.erase(it);
+			break;
+		}
+	}
+	if (::WaitForSingleObject(request->hDone, 0) != WAIT_OBJECT_0) {
+		return false; // stopped
+	}
+	if (request->image == NULL) {
+		m_stats.retried ++;
+		return false;
+	}
+	image = request->image->clone(); // the frames are shared, copied on write
+	szImage = request->szImage;
+	return true;
+}
+
+CInFlightTable::Stats CInFlightTable::getStats () const {
+	xl::CScopeLock lock(this);
+	return m_stats;
+}
+
+void CInFlightTable::traceStats () const {
+	Stats stats = getStats();
+	XLTRACE(_T("** in-flight decodes: %d started, %d coalesced, %d retried\n"),
+		(int)stats.started, (int)stats.coalesced, (int)stats.retried);
+	XL_PARAMETER_NOT_USED(stats);
+}
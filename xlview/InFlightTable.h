@@ -0,0 +1,116 @@
+#ifndef XL_VIEW_IN_FLIGHT_TABLE_H
+#define XL_VIEW_IN_FLIGHT_TABLE_H
+#include <map>
+#include <vector>
+#include <memory>
+#include <Windows.h>
+#include <atltypes.h>
+#include "libxl/include/common.h"
+#include "libxl/include/string.h"
+#include "libxl/include/interfaces.h"
+#include "libxl/include/lockable.h"
+#include "Image.h"
+
+/**
+ * The decodes in progress, keyed by (file, kind, target size). The first
+ * requester decodes, the later ones of the same key wait for its result (the
+ * shared future) instead of decoding the same image again.
+ *
+ * The decoding stops only when all the requesters stop, so the load of the
+ * current image can take over a prefetching of the same file which is canceled.
+ * If it fails (or stops anyway), the waiters decode by themselves.
+ */
+class CInFlightTable : public xl::CUserLock
+{
+public:
+	enum KIND {
+		KIND_IMAGE,
+		KIND_SUITABLE,
+		KIND_THUMBNAIL,
+		KIND_FAST_THUMBNAIL
+	};
+
+	struct Stats {
+		size_t         started;
+		size_t         coalesced;     // the requests served by the in-flight ones
+		size_t         retried;       // the in-flight one failed, the waiter decoded itself
+
+		Stats () {
+			memset(this, 0, sizeof(*this));
+		}
+	};
+
+protected:
+	// the callback is polled by the thread of its requester only, which then
+	// sets the flag, the others just read the flags
+	struct _Requester {
+		xl::ILongTimeRunCallback *callback;
+		volatile LONG  stopped;
+	};
+	typedef std::tr1::shared_ptr<_Requester>       _RequesterPtr;
+	typedef std::vector<_RequesterPtr>             _Requesters;
+
+	struct _Request {
+		xl::tstring    key;
+		HANDLE         hDone;    // manual reset
+		CImagePtr      image;
+		CSize          szImage;
+		_Requesters    requesters;
+
+		_Request ();
+		~_Request ();
+	};
+
+public:
+	typedef std::tr1::shared_ptr<_Request>         RequestPtr;
+
+	// the callback for the decoding, stops if all the requesters stop, the
+	// callbacks of the other requesters are never called by the decoder
+	class CCallback : public xl::ILongTimeRunCallback {
+		CInFlightTable *m_table;
+		RequestPtr m_request;
+		xl::ILongTimeRunCallback *m_owner;
+		_RequesterPtr m_self;
+	public:
+		CCallback (CInFlightTable *table, RequestPtr request, xl::ILongTimeRunCallback *owner)
+			: m_table(table), m_request(request), m_owner(owner), m_self(table->_FindRequester(request, owner)) {}
+		virtual bool shouldStop () const {
+			// lock only if the owner stops, it's polled by every line
+			if (m_owner == NULL || !m_owner->shouldStop()) {
+				return false;
+			}
+			if (m_self != NULL) {
+				::InterlockedExchange(&m_self->stopped, 1);
+			}
+			return m_table->_ShouldStop(m_request);
+		}
+	};
+
+protected:
+	typedef std::map<xl::tstring, RequestPtr>      _Requests;
+
+	_Requests          m_requests;
+	Stats              m_stats;
+
+	_RequesterPtr _FindRequester (RequestPtr request, xl::ILongTimeRunCallback *pCallback);
+	bool _ShouldStop (RequestPtr request);
+
+public:
+	CInFlightTable ();
+	~CInFlightTable ();
+
+	static xl::tstring getKey (const xl::tstring &fileName, KIND kind, CSize szTarget);
+
+	// returns true if the caller should decode and complete() the @request,
+	// otherwise wait() for it
+	bool join (const xl::tstring &key, RequestPtr &request, xl::ILongTimeRunCallback *pCallback);
+	void complete (RequestPtr request, CImagePtr image, CSize szImage);
+	// returns false if the in-flight one failed (or @pCallback stops)
+	bool wait (RequestPtr request, xl::ILongTimeRunCallback *pCallback, CImagePtr &image, CSize &szImage);
+
+	Stats getStats () const;
+	void traceStats () const;
+};
+
+
+#endif
@@ -86,6 +86,8 @@ void CInfoView::onEvent (EVT evt, void *param) {
 			invalidate();
 		}
 		break;
+	case CImageManager::EVT_SUITABLE_LOADED:
+		break;
 	case CImageManager::EVT_THUMBNAIL_LOADED:
 		assert(param);
 		break;
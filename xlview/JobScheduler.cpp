@@ -0,0 +1,347 @@
+#include <assert.h>
+#include <tchar.h>
+#include <process.h>
+#include "libxl/include/utilities.h"
+#include "JobScheduler.h"
+
+// the index of the worker of the current thread, -1 for the other threads
+static __declspec(thread) int s_worker = -1;
+
+// guards CJob::m_hWaiter of all the jobs, it's seldom used
+static xl::CUserLock s_waiterLock;
+
+
+//////////////////////////////////////////////////////////////////////////
+// CJob
+
+CJob::CJob (PRIORITY priority, void *owner)
+	: m_priority(priority)
+	, m_owner(owner)
+	, m_canceled(false)
+	, m_started(false)
+	, m_hWaiter(NULL)
+{
+	assert(priority >= 0 && priority < PRIORITY_COUNT);
+}
+
+CJob::~CJob () {
+	assert(m_hWaiter == NULL);
+}
+
+void CJob::cancel () {
+	m_canceled = true;
+	if (m_hWaiter != NULL) {
+		xl::CScopeLock lock(&s_waiterLock);
+		if (m_hWaiter != NULL) {
+			::SetEvent(m_hWaiter);
+		}
+	}
+}
+
+void CJob::setWaiter (HANDLE hEvent) {
+	xl::CScopeLock lock(&s_waiterLock);
+	m_hWaiter = hEvent;
+}
+
+bool CJob::shouldYield () const {
+	return CJobScheduler::getInstance()->shouldYield(m_priority);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CJobScheduler
+
+unsigned __stdcall CJobScheduler::_WorkerThread (void *param) {
+	_Worker *worker = (_Worker *)param;
+	assert(worker != NULL);
+	CJobScheduler *pThis = worker->scheduler;
+	int index = worker->index;
+	s_worker = index;
+
+	for (;;) {
+		DWORD timeout = pThis->_PromoteDelayed();
+		::InterlockedIncrement(&pThis->m_idle);
+		DWORD ret = ::WaitForSingleObject(pThis->m_hSemaphore, timeout);
+		::InterlockedDecrement(&pThis->m_idle);
+		if (pThis->m_exiting) {
+			break;
+		}
+		if (ret != WAIT_OBJECT_0) {
+			continue; // a delayed job may be due
+		}
+
+		CJobPtr job = pThis->_Take(index);
+		if (job == NULL) {
+			continue;
+		}
+
+		worker->lock.lock();
+		worker->running = job;
+		worker->lock.unlock();
+
+		// the prefetching and the thumbnails never slow the UI down
+		int priority = job->getPriority() >= CJob::PRIORITY_PREFETCH ? THREAD_PRIORITY_BELOW_NORMAL : THREAD_PRIORITY_NORMAL;
+		::SetThreadPriority(::GetCurrentThread(), priority);
+		job->m_started = true;
+		job->run();
+
+		worker->lock.lock();
+		worker->running.reset();
+		worker->lock.unlock();
+		job.reset();
+	}
+
+	return 0;
+}
+
+CJobScheduler::CJobScheduler ()
+	: m_delayedCount(0)
+	, m_nextDue(0)
+	, m_hSemaphore(NULL)
+	, m_idle(0)
+	, m_next(0)
+	, m_exiting(false)
+{
+	memset((void *)m_pending, 0, sizeof(m_pending));
+
+	SYSTEM_INFO si;
+	::GetSystemInfo(&si);
+	int count = (int)si.dwNumberOfProcessors;
+	const xl::tchar *workers = _tgetenv(_T("xlview_worker_count"));
+	if (workers != NULL && _ttoi(workers) > 0) {
+		count = _ttoi(workers);
+	}
+	if (count < 2) {
+		count = 2; // the current image is never blocked by the only one prefetching
+	}
+
+	m_hSemaphore = ::CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+	assert(m_hSemaphore != NULL);
+	for (int i = 0; i < count; ++ i) {
+		_Worker *worker = new _Worker();
+		worker->scheduler = this;
+		worker->index = i;
+		worker->hThread = INVALID_HANDLE_VALUE;
+		m_workers.push_back(worker);
+	}
+	for (int i = 0; i < count; ++ i) {
+		m_workers[i]->hThread = (HANDLE)_beginthreadex(NULL, 0, &_WorkerThread, m_workers[i], 0, NULL);
+		assert(m_workers[i]->hThread != INVALID_HANDLE_VALUE);
+	}
+	m_stats.workers = count;
+}
+
+CJobScheduler::~CJobScheduler () {
+}
+
+void CJobScheduler::_Push (CJobPtr job) {
+	int index = s_worker;
+	if (index < 0 || index >= (int)m_workers.size()) {
+		index = (int)((DWORD)::InterlockedIncrement(&m_next) % m_workers.size());
+	}
+	_Worker *worker = m_workers[index];
+	worker->lock.lock();
+	worker->queues[job->getPriority()].push_back(job);
+	::InterlockedIncrement(&m_pending[job->getPriority()]);
+	worker->lock.unlock();
+
+	::ReleaseSemaphore(m_hSemaphore, 1, NULL);
+}
+
+CJobPtr CJobScheduler::_Take (int index) {
+	int count = (int)m_workers.size();
+	for (int p = 0; p < CJob::PRIORITY_COUNT; ++ p) {
+		if (m_pending[p] == 0) {
+			continue;
+		}
+
+		// the own queue first (the newest), then steal from the others (the oldest)
+		for (int i = 0; i < count; ++ i) {
+			_Worker *worker = m_workers[(index + i) % count];
+			xl::CScopeLock lock(&worker->lock);
+			_Queue &queue = worker->queues[p];
+			while (!queue.empty()) {
+				CJobPtr job;
+				if (i == 0) {
+					job = queue.back();
+					queue.pop_back();
+				} else {
+					job = queue.front();
+					queue.pop_front();
+				}
+				::InterlockedDecrement(&m_pending[p]);
+				lock.unlock();
+
+				xl::CScopeLock lockStats(this);
+				if (job->isCanceled()) {
+					m_stats.canceled ++;
+					lockStats.unlock();
+					lock.lock(&worker->lock);
+					continue;
+				}
+				m_stats.run ++;
+				if (i != 0) {
+					m_stats.stolen ++;
+				}
+				return job;
+			}
+		}
+	}
+	return CJobPtr();
+}
+
+DWORD CJobScheduler::_PromoteDelayed () {
+	_DelayedJobs due;
+	DWORD timeout = INFINITE;
+	xl::CScopeLock lock(this);
+	DWORD now = ::GetTickCount();
+	for (_DelayedJobs::iterator it = m_delayed.begin(); it != m_delayed.end(); ) {
+		int left = (int)(it->due - now);
+		if (left <= 0) {
+			due.push_back(*it);
+			it = m_delayed.erase(it);
+		} else {
+			if ((DWORD)left < timeout) {
+				timeout = (DWORD)left;
+			}
+			++ it;
+		}
+	}
+	m_nextDue = now + timeout;
+	m_delayedCount = (LONG)m_delayed.size();
+	lock.unlock();
+
+	for (_DelayedJobs::iterator it = due.begin(); it != due.end(); ++ it) {
+		if (!it->job->isCanceled()) {
+			_Push(it->job);
+		}
+	}
+	return timeout;
+}
+
+CJobScheduler* CJobScheduler::getInstance () {
+	// never destroyed, see CPixelBufferPool::getInstance()
+	static CJobScheduler *scheduler = new CJobScheduler();
+	return scheduler;
+}
+
+void CJobScheduler::submit (CJobPtr job, DWORD delay) {
+	assert(job != NULL);
+	xl::CScopeLock lock(this);
+	if (m_exiting) {
+		return;
+	}
+	m_stats.submitted ++;
+	if (delay == 0) {
+		lock.unlock();
+		_Push(job);
+		return;
+	}
+
+	_Delayed delayed = {job, ::GetTickCount() + delay};
+	if (m_delayedCount == 0 || (int)(delayed.due - m_nextDue) < 0) {
+		m_nextDue = delayed.due;
+	}
+	m_delayed.push_back(delayed);
+	m_delayedCount = (LONG)m_delayed.size();
+	LONG idle = m_idle;
+	lock.unlock();
+
+	// wake the idle workers up, to wait for the new due time
+	::ReleaseSemaphore(m_hSemaphore, idle > 0 ? idle : 1, NULL);
+}
+
+void CJobScheduler::cancel (void *owner, bool wait) {
+	xl::CScopeLock lock(this);
+	for (_DelayedJobs::iterator it = m_delayed.begin(); it != m_delayed.end(); ++ it) {
+		if (it->job->getOwner() == owner) {
+			it->job->cancel();
+		}
+	}
+	lock.unlock();
+
+	for (_Workers::iterator it = m_workers.begin(); it != m_workers.end(); ++ it) {
+		_Worker *worker = *it;
+		xl::CScopeLock lockWorker(&worker->lock);
+		for (int p = 0; p < CJob::PRIORITY_COUNT; ++ p) {
+			for (_Queue::iterator itJob = worker->queues[p].begin(); itJob != worker->queues[p].end(); ++ itJob) {
+				if ((*itJob)->getOwner() == owner) {
+					(*itJob)->cancel(); // dropped when taken
+				}
+			}
+		}
+		if (worker->running != NULL && worker->running->getOwner() == owner) {
+			worker->running->cancel();
+		}
+	}
+
+	if (!wait) {
+		return;
+	}
+	assert(s_worker == -1); // a job can't wait for the jobs of its owner
+	for (;;) {
+		bool running = false;
+		for (_Workers::iterator it = m_workers.begin(); it != m_workers.end() && !running; ++ it) {
+			_Worker *worker = *it;
+			xl::CScopeLock lockWorker(&worker->lock);
+			running = worker->running != NULL && worker->running->getOwner() == owner;
+		}
+		if (!running) {
+			break;
+		}
+		::Sleep(1);
+	}
+}
+
+void CJobScheduler::stop () {
+	xl::CScopeLock lock(this);
+	if (m_exiting) {
+		return;
+	}
+	m_exiting = true;
+	lock.unlock();
+
+	std::vector<HANDLE> threads;
+	for (_Workers::iterator it = m_workers.begin(); it != m_workers.end(); ++ it) {
+		threads.push_back((*it)->hThread);
+	}
+	::ReleaseSemaphore(m_hSemaphore, (LONG)threads.size(), NULL);
+	if (::WaitForMultipleObjects((DWORD)threads.size(), &threads[0], TRUE, 3000) == WAIT_TIMEOUT) {
+		XLTRACE(_T("** some workers do not exit normally\n"));
+	}
+	for (_Workers::iterator it = m_workers.begin(); it != m_workers.end(); ++ it) {
+		_Worker *worker = *it;
+		for (int p = 0; p < CJob::PRIORITY_COUNT; ++ p) {
+			worker->queues[p].clear();
+		}
+	}
+}
+
+bool CJobScheduler::shouldYield (CJob::PRIORITY priority) {
+	// the workers promote the delayed jobs only between the jobs, so a due one
+	// would wait for a long running job without this
+	if (m_delayedCount > 0 && (int)(::GetTickCount() - m_nextDue) >= 0) {
+		_PromoteDelayed();
+	}
+	if (m_idle > 0) {
+		return false;
+	}
+	for (int p = 0; p < priority; ++ p) {
+		if (m_pending[p] > 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+CJobScheduler::Stats CJobScheduler::getStats () const {
+	xl::CScopeLock lock(this);
+	return m_stats;
+}
+
+void CJobScheduler::traceStats () const {
+	Stats stats = getStats();
+	XLTRACE(_T("** job scheduler: %d workers, %d submitted, %d run (%d stolen), %d canceled\n"),
+		(int)stats.workers, (int)stats.submitted, (int)stats.run, (int)stats.stolen, (int)stats.canceled);
+	XL_PARAMETER_NOT_USED(stats);
+}
@@ -0,0 +1,150 @@
+#ifndef XL_VIEW_JOB_SCHEDULER_H
+#define XL_VIEW_JOB_SCHEDULER_H
+#include <vector>
+#include <deque>
+#include <memory>
+#include <Windows.h>
+#include "libxl/include/common.h"
+#include "libxl/include/lockable.h"
+
+/**
+ * All the loading, prefetching and zooming are jobs run by one shared pool of
+ * workers (one for each core), instead of the dedicated threads.
+ *
+ * Each worker has its own queues (one for each priority), a job submitted by
+ * a worker goes to its own queues (and is taken LIFO), the others are spread
+ * over the workers; an idle worker steals (FIFO) from the others. The highest
+ * priority is always taken first, from the own queue or by stealing.
+ *
+ * A job is canceled by cancel(), the queued one is dropped, and the running one
+ * should check isCanceled() (usually by its xl::ILongTimeRunCallback). A long
+ * running job of a low priority checks shouldYield(), and gives the worker up
+ * (and submits the rest of the work again) if a more important job is waiting.
+ */
+class CJob;
+typedef std::tr1::shared_ptr<CJob>             CJobPtr;
+
+class CJob
+{
+public:
+	enum PRIORITY {
+		PRIORITY_CURRENT,              // the current image
+		PRIORITY_ZOOM,
+		PRIORITY_PREFETCH,             // the images near the current one
+		PRIORITY_VISIBLE_THUMBNAIL,
+		PRIORITY_THUMBNAIL,            // all the other thumbnails
+		PRIORITY_COUNT
+	};
+
+protected:
+	PRIORITY           m_priority;
+	void              *m_owner;
+	volatile bool      m_canceled;
+	volatile bool      m_started;
+	HANDLE             m_hWaiter; // set by cancel(), see setWaiter()
+
+	friend class CJobScheduler;
+
+public:
+	CJob (PRIORITY priority, void *owner);
+	virtual ~CJob ();
+
+	virtual void run () = 0;
+
+	PRIORITY getPriority () const { return m_priority; }
+	void* getOwner () const { return m_owner; }
+	void cancel ();
+	bool isCanceled () const { return m_canceled; }
+	// the event (of the thread running the job) set by cancel(), NULL to remove
+	void setWaiter (HANDLE hEvent);
+	bool isStarted () const { return m_started; }
+	// a more important job is waiting, and all the workers are busy
+	bool shouldYield () const;
+};
+
+// calls @T::*fn (the protected one is OK if created by T)
+template <class T>
+class CJobT : public CJob
+{
+	typedef void (T::*_Fn) (CJob *);
+	T                 *m_p;
+	_Fn                m_fn;
+public:
+	CJobT (T *p, _Fn fn, PRIORITY priority) : CJob(priority, p), m_p(p), m_fn(fn) {}
+	virtual void run () { (m_p->*m_fn)(this); }
+};
+
+
+class CJobScheduler : public xl::CUserLock
+{
+public:
+	struct Stats {
+		size_t         workers;
+		size_t         submitted;
+		size_t         run;
+		size_t         stolen;
+		size_t         canceled;      // dropped before running
+
+		Stats () {
+			memset(this, 0, sizeof(*this));
+		}
+	};
+
+protected:
+	typedef std::deque<CJobPtr>                    _Queue;
+
+	struct _Worker {
+		CJobScheduler *scheduler;
+		int            index;
+		xl::CUserLock  lock;
+		_Queue         queues[CJob::PRIORITY_COUNT];
+		CJobPtr        running;
+		HANDLE         hThread;
+	};
+	typedef std::vector<_Worker *>                 _Workers;
+
+	struct _Delayed {
+		CJobPtr        job;
+		DWORD          due;
+	};
+	typedef std::vector<_Delayed>                  _DelayedJobs;
+
+	_Workers           m_workers;
+	_DelayedJobs       m_delayed;
+	volatile LONG      m_delayedCount;
+	volatile DWORD     m_nextDue;    // of the first delayed job, if m_delayedCount > 0
+	HANDLE             m_hSemaphore; // one count for each job queued
+	volatile LONG      m_idle;
+	volatile LONG      m_pending[CJob::PRIORITY_COUNT];
+	volatile LONG      m_next;       // the worker for the next job submitted by the other threads
+	volatile bool      m_exiting;
+	Stats              m_stats;
+
+	CJobScheduler ();
+	~CJobScheduler ();
+
+	static unsigned __stdcall _WorkerThread (void *);
+	void _Push (CJobPtr job);
+	CJobPtr _Take (int worker);
+	DWORD _PromoteDelayed ();
+
+public:
+	static CJobScheduler* getInstance ();
+
+	// run @job after @delay (ms), the queued one of the same owner is NOT replaced
+	void submit (CJobPtr job, DWORD delay = 0);
+	// cancel all the jobs of @owner, and wait for the running ones if @wait
+	void cancel (void *owner, bool wait);
+	void stop ();
+
+	// the delayed jobs which are due are queued first, so they count too
+	bool shouldYield (CJob::PRIORITY priority);
+	bool hasIdleWorker () const { return m_idle > 0; }
+	size_t getWorkerCount () const { return m_workers.size(); }
+
+	Stats getStats () const;
+	void traceStats () const;
+};
+
+
+#endif
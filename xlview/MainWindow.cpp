@@ -96,6 +96,7 @@ xl::tstring CMainWindow::onGesture (const xl::tstring &gesture, CPoint ptDown, b
 LRESULT CMainWindow::OnCreate (UINT /*msg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL &bHandled) {
 	bHandled = false;
 	subscribe(this);
+	setEventWindow(m_hWnd, WM_XLVIEW_EVENTS);
 
 	SetWindowText(MAIN_TITLE);
 
@@ -203,6 +204,7 @@ LRESULT CMainWindow::OnCreate (UINT /*msg*/, WPARAM /*wParam*/, LPARAM /*lParam*
 
 LRESULT CMainWindow::OnDestroy (UINT, WPARAM, LPARAM, BOOL &bHandled) {
 	bHandled = FALSE;
+	setEventWindow(NULL, 0);
 	unsubscribe(this);
 
 	delete m_pDispatch;
@@ -258,6 +260,11 @@ LRESULT CMainWindow::OnXLViewExit (UINT, WPARAM, LPARAM, BOOL &) {
 	return 0;
 }
 
+LRESULT CMainWindow::OnXLViewEvents (UINT, WPARAM, LPARAM, BOOL &) {
+	dispatchEvents();
+	return 0;
+}
+
 void CMainWindow::onEvent (CImageManager::IObserver::EVT evt, void *param) {
 	xl::ui::CCtrlSlider *pSlider = (xl::ui::CCtrlSlider *)m_slider.get();
 	assert(pSlider != NULL);
@@ -277,7 +284,7 @@ void CMainWindow::onEvent (CImageManager::IObserver::EVT evt, void *param) {
 	case CImageManager::EVT_INDEX_CHANGED:
 		{
 			assert(param != NULL);
-			int _min = 0, _max = m_cachedImages.size() - 1, _curr = *(int *)param;
+			int _min = 0, _max = (int)getImageCount() - 1, _curr = *(int *)param;
 			assert(_curr == (int)m_currIndex);
 			TCHAR buf[128];
 			_stprintf_s(buf, 128, _T("slider: %d %d %d; disable:false;"), _min, _max, _curr);
@@ -285,14 +292,16 @@ void CMainWindow::onEvent (CImageManager::IObserver::EVT evt, void *param) {
 
 			xl::tstring title = MAIN_TITLE;
 			_stprintf_s(buf, 128, _T(" (%d/%d)"), _curr + 1, _max + 1);
-			// title += _T(" - ") + m_cachedImages[_curr]->getFileName();
-			title += _T(" - ") + file_get_name(m_cachedImages[_curr]->getFileName());
+			// title += _T(" - ") + getCachedImage(_curr)->getFileName();
+			title += _T(" - ") + file_get_name(getCachedImage(_curr)->getFileName());
 			title += buf;
 			SetWindowText(title);
 		}
 		break;
 	case CImageManager::EVT_IMAGE_LOADED:
 		break;
+	case CImageManager::EVT_SUITABLE_LOADED:
+		break;
 	case CImageManager::EVT_THUMBNAIL_LOADED:
 		break;
 	case CImageManager::EVT_I_AM_DEAD:
@@ -311,7 +320,7 @@ void CMainWindow::cmdExit () {
 void CMainWindow::cmdPrev () {
 	int new_index = m_currIndex;
 	if (new_index == 0) {
-		new_index = m_cachedImages.size() - 1;
+		new_index = (int)getImageCount() - 1;
 	} else {
 		new_index --;
 	}
@@ -320,7 +329,7 @@ void CMainWindow::cmdPrev () {
 
 void CMainWindow::cmdNext () {
 	xl::uint new_index = m_currIndex + 1;
-	if (new_index == m_cachedImages.size()) {
+	if (new_index == getImageCount()) {
 		new_index = 0;
 	}
 	setIndex((int)new_index);
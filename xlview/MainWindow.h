@@ -10,6 +10,7 @@
 #define WM_XLVIEW_IMAGE_LOADED                         (WM_XL_END + 1)
 #define WM_XLVIEW_INVALIDE                             (WM_XL_END + 2)
 #define WM_XLVIEW_EXIT                                 (WM_XL_END + 3)
+#define WM_XLVIEW_EVENTS                               (WM_XL_END + 4)
 
 // forward declaration
 class CDispatch;
@@ -44,6 +45,7 @@ public:
 		MESSAGE_HANDLER (WM_SIZE, OnSize)
 		MESSAGE_HANDLER (WM_KEYDOWN, OnKeyDown)
 		MESSAGE_HANDLER (WM_XLVIEW_EXIT, OnXLViewExit)
+		MESSAGE_HANDLER (WM_XLVIEW_EVENTS, OnXLViewEvents)
 		CHAIN_MSG_MAP(CMainWindowT)
 	END_MSG_MAP ()
 
@@ -52,6 +54,7 @@ public:
 	LRESULT OnSize (UINT msg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
 	LRESULT OnKeyDown (UINT msg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
 	LRESULT OnXLViewExit (UINT msg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
+	LRESULT OnXLViewEvents (UINT msg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
 
 	// CImageManager::IObserver
 	virtual void onEvent (CImageManager::IObserver::EVT evt, void *param);
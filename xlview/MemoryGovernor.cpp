@@ -0,0 +1,243 @@
+#include <assert.h>
+#include <tchar.h>
+#include <process.h>
+#include <algorithm>
+#include <Psapi.h>
+#include "libxl/include/utilities.h"
+#include "ImageConfig.h"
+#include "Options.h"
+#include "MemoryGovernor.h"
+#include "ImageCache.h"
+#include "PixelBufferPool.h"
+#include "TiledImage.h"
+
+#pragma comment (lib, "psapi.lib")
+
+
+//////////////////////////////////////////////////////////////////////////
+// thread
+
+unsigned __stdcall CMemoryGovernor::_CheckThread (void *param) {
+	CMemoryGovernor *pThis = (CMemoryGovernor *)param;
+	assert(pThis != NULL);
+	HANDLE hEvent = pThis->m_hEvents[THREAD_CHECK];
+	for (;;) {
+		::WaitForSingleObject(hEvent, MEMORY_CHECK_INTERVAL);
+		if (pThis->m_exiting) {
+			break;
+		}
+		pThis->_Check();
+	}
+
+	return 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// protected
+
+CMemoryGovernor::CMemoryGovernor ()
+	: m_workingSetLimit((size_t)COptions::getInstance()->getMemoryLimitMB() * 1024 * 1024)
+	, m_pressure(false)
+	, m_exiting(false)
+{
+}
+
+CMemoryGovernor::~CMemoryGovernor () {
+}
+
+bool CMemoryGovernor::_IsUnderPressure (const Status &status, bool pressure) const {
+	// under pressure, it must be above the thresholds by MEMORY_RELIEF_PERCENT to be relieved
+	int relief = pressure ? 100 + MEMORY_RELIEF_PERCENT : 100;
+
+	// the (32 bit) address space and the working set are all of xlview itself
+	if (status.availVirtual < (unsigned __int64)MEMORY_LOW_VIRTUAL * relief / 100) {
+		return true;
+	}
+	if (m_workingSetLimit > 0 && (unsigned __int64)status.workingSet * relief / 100 > m_workingSetLimit) {
+		return true;
+	}
+
+	// the physical memory might be taken by the others, shedding the caches
+	// doesn't help unless xlview holds a meaningful share of it
+	unsigned __int64 lowPhys = status.totalPhys * MEMORY_LOW_PERCENT / 100 * relief / 100;
+	if (status.availPhys < lowPhys && status.workingSet > MEMORY_FOOTPRINT_FLOOR) {
+		unsigned __int64 usedPhys = status.totalPhys - status.availPhys;
+		if ((unsigned __int64)status.workingSet * 100 > usedPhys * MEMORY_FOOTPRINT_SHARE) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void CMemoryGovernor::_Check () {
+	Status status = getStatus();
+	bool pressure = _IsUnderPressure(status, m_pressure);
+
+	xl::CScopeLock lock(this);
+	m_stats.checks ++;
+	if (pressure) {
+		m_stats.pressures ++;
+	}
+	lock.unlock();
+
+	for (int tier = 0; pressure && tier < TIER_COUNT; ++ tier) {
+		XLTRACE(_T("** memory pressure: available %d MB of %d MB, address space %d MB, working set %d MB, shed tier %d\n"),
+			(int)(status.availPhys >> 20), (int)(status.totalPhys >> 20), (int)(status.availVirtual >> 20),
+			(int)(status.workingSet >> 20), tier);
+		shed((TIER)tier);
+		status = getStatus();
+		pressure = _IsUnderPressure(status, true);
+	}
+	m_pressure = pressure;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// public
+
+CMemoryGovernor* CMemoryGovernor::getInstance () {
+	// never destroyed, see CPixelBufferPool::getInstance()
+	static CMemoryGovernor *governor = new CMemoryGovernor();
+	return governor;
+}
+
+CMemoryGovernor::Status CMemoryGovernor::getStatus () {
+	Status status;
+	memset(&status, 0, sizeof(status));
+
+	MEMORYSTATUSEX ms;
+	ms.dwLength = sizeof(ms);
+	if (::GlobalMemoryStatusEx(&ms)) {
+		status.totalPhys = ms.ullTotalPhys;
+		status.availPhys = ms.ullAvailPhys;
+		status.availVirtual = ms.ullAvailVirtual;
+	}
+
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (::GetProcessMemoryInfo(::GetCurrentProcess(), &pmc, sizeof(pmc))) {
+		status.workingSet = pmc.WorkingSetSize;
+	}
+	return status;
+}
+
+void CMemoryGovernor::start () {
+	m_exiting = false;
+	_CreateThreads();
+	::SetThreadPriority(m_hThreads[THREAD_CHECK], THREAD_PRIORITY_BELOW_NORMAL);
+}
+
+void CMemoryGovernor::stop () {
+	_TerminateThreads();
+}
+
+void CMemoryGovernor::addShedder (IMemoryShedder *shedder) {
+	xl::CScopeLock lock(this);
+	assert(std::find(m_shedders.begin(), m_shedders.end(), shedder) == m_shedders.end());
+	m_shedders.push_back(shedder);
+}
+
+void CMemoryGovernor::removeShedder (IMemoryShedder *shedder) {
+	xl::CScopeLock lock(this);
+	_Shedders::iterator it = std::find(m_shedders.begin(), m_shedders.end(), shedder);
+	if (it != m_shedders.end()) {
+		m_shedders.erase(it);
+	}
+}
+
+size_t CMemoryGovernor::shed (TIER tier) {
+	assert(tier >= 0 && tier < TIER_COUNT);
+	xl::CScopeLock lock(this); // one shedding at a time
+	size_t released = 0;
+	switch (tier) {
+	case TIER_FAR_IMAGES:
+		{
+			CDIBSectionPool *pool = CDIBSectionPool::getInstance();
+			released += pool->getStats().freeBytes;
+			pool->setBudget(0);
+			pool->setBudget(DIB_POOL_BUDGET);
+			released += CImageCache::getInstance()->shed(1);
+		}
+		break;
+	case TIER_IMAGES:
+		released += CImageCache::getInstance()->shed(0);
+		break;
+	case TIER_THUMBNAILS:
+		break; // by the shedders
+	case TIER_TILES:
+		{
+			CTileCache *cache = CTileCache::getInstance();
+			size_t budget = cache->getBudget();
+			released += cache->getUsedBytes();
+			cache->setBudget(0);
+			cache->setBudget(budget);
+		}
+		break;
+	default:
+		assert(false);
+		break;
+	}
+
+	for (_Shedders::iterator it = m_shedders.begin(); it != m_shedders.end(); ++ it) {
+		released += (*it)->shed(tier);
+	}
+
+	m_stats.sheds[tier] ++;
+	m_stats.shedBytes += released;
+	return released;
+}
+
+bool CMemoryGovernor::retry (int &tier) {
+	if (tier >= TIER_COUNT) {
+		xl::CScopeLock lock(this);
+		m_stats.failures ++;
+		return false;
+	}
+
+	shed((TIER)tier);
+	++ tier;
+
+	xl::CScopeLock lock(this);
+	m_stats.retries ++;
+	return true;
+}
+
+void CMemoryGovernor::setWorkingSetLimit (size_t bytes) {
+	xl::CScopeLock lock(this);
+	m_workingSetLimit = bytes;
+}
+
+CMemoryGovernor::Stats CMemoryGovernor::getStats () const {
+	xl::CScopeLock lock(this);
+	return m_stats;
+}
+
+void CMemoryGovernor::traceStats () const {
+	Stats stats = getStats();
+	XLTRACE(_T("** memory governor: %d checks, %d under pressure, shed %d/%d/%d/%d times (%d KB), %d retries, %d failures\n"),
+		(int)stats.checks, (int)stats.pressures,
+		(int)stats.sheds[TIER_FAR_IMAGES], (int)stats.sheds[TIER_IMAGES],
+		(int)stats.sheds[TIER_THUMBNAILS], (int)stats.sheds[TIER_TILES],
+		(int)(stats.shedBytes / 1024), (int)stats.retries, (int)stats.failures);
+	XL_PARAMETER_NOT_USED(stats);
+}
+
+const xl::tchar* CMemoryGovernor::_GetThreadName () {
+	return _T("xlview::MemoryGovernor");
+}
+
+void CMemoryGovernor::_AssignThreadProc () {
+	m_procThreads[THREAD_CHECK] = &_CheckThread;
+}
+
+void CMemoryGovernor::_MarkThreadExit () {
+	m_exiting = true;
+}
+
+void CMemoryGovernor::_Lock () {
+	lock();
+}
+
+void CMemoryGovernor::_Unlock () {
+	unlock();
+}
@@ -0,0 +1,123 @@
+#ifndef XL_VIEW_MEMORY_GOVERNOR_H
+#define XL_VIEW_MEMORY_GOVERNOR_H
+#include <vector>
+#include <Windows.h>
+#include "libxl/include/common.h"
+#include "libxl/include/lockable.h"
+#include "ClassWithThreads.h"
+
+/**
+ * The memory governor checks the available memory (and the working set of the
+ * process) periodically, and sheds the caches tier by tier under pressure, until
+ * the pressure is relieved:
+ *
+ * TIER_FAR_IMAGES:  the pooled bitmaps, and the decoded images not adjacent to the current one
+ * TIER_IMAGES:      all the decoded images, but the current one
+ * TIER_THUMBNAILS:  the thumbnails far from the current one (they are in CThumbnailStore)
+ * TIER_TILES:       the tiles of the very large images, swapped out to the disk
+ *
+ * The low physical memory is the pressure only if xlview holds a meaningful share
+ * of it, and the pressure is relieved with a margin (see ImageConfig.h), so the
+ * caches are not shed again and again when the others take the memory.
+ *
+ * The failed allocation of a bitmap sheds the tiers the same way and retries.
+ */
+class CMemoryGovernor;
+
+class IMemoryShedder {
+public:
+	// returns the bytes released (estimated)
+	virtual size_t shed (int tier) = 0;
+};
+
+class CMemoryGovernor
+	: public xl::CUserLock
+	, public ClassWithThreadT<CMemoryGovernor, 1>
+{
+	friend class ClassWithThreadT<CMemoryGovernor, 1>;
+public:
+	enum TIER {
+		TIER_FAR_IMAGES,
+		TIER_IMAGES,
+		TIER_THUMBNAILS,
+		TIER_TILES,
+		TIER_COUNT
+	};
+
+	struct Status {
+		unsigned __int64 totalPhys;
+		unsigned __int64 availPhys;
+		unsigned __int64 availVirtual;
+		size_t         workingSet;
+	};
+
+	struct Stats {
+		size_t         checks;
+		size_t         pressures;     // the checks under pressure
+		size_t         sheds[TIER_COUNT];
+		size_t         shedBytes;
+		size_t         retries;       // the failed allocations retried after shedding
+		size_t         failures;      // still failed after all the tiers were shed
+
+		Stats () {
+			memset(this, 0, sizeof(*this));
+		}
+	};
+
+protected:
+	typedef std::vector<IMemoryShedder *>          _Shedders;
+
+	_Shedders          m_shedders;
+	size_t             m_workingSetLimit; // 0 for no limit
+	volatile bool      m_pressure;
+	Stats              m_stats;
+
+	CMemoryGovernor ();
+	~CMemoryGovernor ();
+
+	// @pressure: if it is under pressure now, see MEMORY_RELIEF_PERCENT
+	bool _IsUnderPressure (const Status &status, bool pressure) const;
+	void _Check ();
+
+	//////////////////////////////////////////////////////////////////////////
+	// thread related
+	bool m_exiting;
+	static unsigned __stdcall _CheckThread (void *);
+
+	// used by ClassWithThreads
+	enum {
+		THREAD_CHECK,
+		THREAD_COUNT
+	};
+	const xl::tchar* _GetThreadName();
+	void _AssignThreadProc();
+	void _MarkThreadExit();
+	void _Lock();
+	void _Unlock();
+
+public:
+	static CMemoryGovernor* getInstance ();
+	static Status getStatus ();
+
+	void start ();
+	void stop ();
+
+	void addShedder (IMemoryShedder *shedder);
+	void removeShedder (IMemoryShedder *shedder);
+
+	// shed one tier, returns the bytes released (estimated)
+	size_t shed (TIER tier);
+	// called when an allocation failed, shed the next tier (from 0) and returns
+	// true to retry, or false if all the tiers are shed
+	bool retry (int &tier);
+
+	bool isUnderPressure () const { return m_pressure; }
+	// the working set limit in bytes, 0 for no limit
+	void setWorkingSetLimit (size_t bytes);
+
+	Stats getStats () const;
+	void traceStats () const;
+};
+
+
+#endif
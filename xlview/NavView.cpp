@@ -3,6 +3,7 @@
 #include "NavView.h"
 #include "ImageManager.h"
 #include "ImageView.h"
+#include "ThumbnailAtlas.h"
 
 void CNavView::_CreateDisplayInfo () {
 	if (m_currIndex == -1) {
@@ -100,17 +101,11 @@ void CNavView::drawMe (HDC hdc) {
 	xl::ui::CDC mdc;
 	mdc.CreateCompatibleDC(dc);
 
-	xl::CScopeLock lock(m_pImageManager);
-	CCachedImagePtr cachedImage = m_pImageManager->getCachedImage(m_currIndex);
-	CImagePtr image = cachedImage->getThumbnailImage();
-	if (image == NULL) {
-		cachedImage.reset();
+	ThumbnailHandle thumbnail = m_pImageManager->getThumbnail(m_currIndex);
+	CThumbnailAtlas *atlas = CThumbnailAtlas::getInstance();
+	if (!atlas->isValid(thumbnail)) {
 		return;
 	}
-	xl::ui::CDIBSectionPtr dib = image->getImage(0);
-	lock.unlock();
-
-	CSize szImage = image->getImageSize();
 
 	// draw text
 	CRect rcText = m_rect;
@@ -120,44 +115,35 @@ void CNavView::drawMe (HDC hdc) {
 	dc.drawTransparentTextWithDefaultFont(m_ratio, -1, rcText, DT_LEFT);
 	dc.SetTextColor(oldColor);
 
-	int oldMode = dc.SetStretchBltMode(HALFTONE);
-	if (!m_dragable) {
-		CRect rcView = m_rcView;
-		rcView.OffsetRect(rc.left, rc.top);
+	CRect rcImage = m_rcImage;
+	rcImage.OffsetRect(rc.left, rc.top);
+	CRect rcView = m_rcView;
+	rcView.OffsetRect(rc.left, rc.top);
+	auto blendView = [&] () {
 		m_dibView->attachToDC(mdc);
 		BLENDFUNCTION bf = {AC_SRC_OVER, 0, 75, 0};
 		dc.AlphaBlend(rcView.left, rcView.top, rcView.Width(), rcView.Height(), mdc, 0, 0, 1, 1, bf);
 		m_dibView->detachFromDC(mdc);
+	};
 
-		CRect rcImage = m_rcImage;
-		rcImage.OffsetRect(rc.left, rc.top);
-
-		dib->attachToDC(mdc);
-		dc.StretchBlt(rcImage.left, rcImage.top, rcImage.Width(), rcImage.Height(), mdc, 0, 0, dib->getWidth(), dib->getHeight(), SRCCOPY);
-		dib->detachFromDC(mdc);
-	} else {
-		CRect rcImage = m_rcImage;
-		rcImage.OffsetRect(rc.left, rc.top);
+	// the view area is under the image if the whole image is visible, or
+	// over it (with the edges) to be dragged
+	if (!m_dragable) {
+		blendView();
+	}
 
-		dib->attachToDC(mdc);
-		int oldMode = dc.SetStretchBltMode(HALFTONE);
-		dc.StretchBlt(rcImage.left, rcImage.top, rcImage.Width(), rcImage.Height(), mdc, 0, 0, dib->getWidth(), dib->getHeight(), SRCCOPY);
-		dc.SetStretchBltMode(oldMode);
-		dib->detachFromDC(mdc);
+	int oldMode = dc.SetStretchBltMode(HALFTONE);
+	atlas->draw(thumbnail, dc, rcImage);
+	dc.SetStretchBltMode(oldMode);
 
-		CRect rcView = m_rcView;
-		rcView.OffsetRect(rc.left, rc.top);
-		m_dibView->attachToDC(mdc);
-		BLENDFUNCTION bf = {AC_SRC_OVER, 0, 75, 0};
-		dc.AlphaBlend(rcView.left, rcView.top, rcView.Width(), rcView.Height(), mdc, 0, 0, 1, 1, bf);
-		m_dibView->detachFromDC(mdc);
+	if (m_dragable) {
+		blendView();
 
 		CRect rcEdge = rcView;
 		dc.drawRectangle(rcEdge, 1, RGB(32,32,32), PS_SOLID);
 		rcEdge.DeflateRect(1, 1, 1, 1);
 		dc.drawRectangle(rcEdge, 1, RGB(200,200,200), PS_SOLID);
 	}
-	dc.SetStretchBltMode(oldMode);
 }
 
 void CNavView::onMouseMove (CPoint pt, xl::uint) {
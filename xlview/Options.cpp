@@ -0,0 +1,104 @@
+#include <assert.h>
+#include <tchar.h>
+#include "libxl/include/ini.h"
+#include "ImageConfig.h"
+#include "Options.h"
+#include "ImageCache.h"
+#include "MemoryGovernor.h"
+
+static const xl::tchar *KEY_FULL_IMAGE = _T("FullImage");             // "demand" or "always"
+static const xl::tchar *KEY_THUMBNAIL_FORMAT = _T("ThumbnailFormat"); // "rgb565" or "bgr24"
+static const xl::tchar *KEY_PIXEL_LAYOUT = _T("PixelLayout");         // "bgrx" or "native"
+static const xl::tchar *KEY_IMAGE_CACHE_MB = _T("ImageCacheMB");
+static const xl::tchar *KEY_MEMORY_LIMIT_MB = _T("MemoryLimitMB");
+
+
+//////////////////////////////////////////////////////////////////////////
+// protected
+
+COptions::COptions ()
+	: m_fullImageOnDemand(false)
+	, m_thumbnailRgb565(false)
+	, m_pixelLayoutBgrx(false)
+	, m_imageCacheMB((int)(IMAGE_CACHE_BUDGET / (1024 * 1024)))
+	, m_memoryLimitMB(0)
+{
+	_Load();
+}
+
+void COptions::_Load () {
+	xl::CIni ini(getIniPathName());
+	for (auto it = ini.begin(_T("")); it != ini.end(_T("")); ++ it) {
+		const xl::tchar *key = it->first.c_str();
+		const xl::tchar *value = it->second.c_str();
+		if (_tcsicmp(key, KEY_FULL_IMAGE) == 0) {
+			m_fullImageOnDemand = _tcsicmp(value, _T("demand")) == 0;
+		} else if (_tcsicmp(key, KEY_THUMBNAIL_FORMAT) == 0) {
+			m_thumbnailRgb565 = _tcsicmp(value, _T("rgb565")) == 0;
+		} else if (_tcsicmp(key, KEY_PIXEL_LAYOUT) == 0) {
+			m_pixelLayoutBgrx = _tcsicmp(value, _T("bgrx")) == 0;
+		} else if (_tcsicmp(key, KEY_IMAGE_CACHE_MB) == 0) {
+			if (_ttoi(value) > 0) {
+				m_imageCacheMB = _ttoi(value);
+			}
+		} else if (_tcsicmp(key, KEY_MEMORY_LIMIT_MB) == 0) {
+			if (_ttoi(value) >= 0) {
+				m_memoryLimitMB = _ttoi(value);
+			}
+		}
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// public
+
+COptions* COptions::getInstance () {
+	// never destroyed, the caches read it when they are created
+	static COptions *options = new COptions();
+	return options;
+}
+
+void COptions::save () {
+	xl::tchar buf[32];
+	xl::CIni ini(getIniPathName());
+	ini.set(_T(""), KEY_FULL_IMAGE, m_fullImageOnDemand ? _T("demand") : _T("always"));
+	ini.set(_T(""), KEY_THUMBNAIL_FORMAT, m_thumbnailRgb565 ? _T("rgb565") : _T("bgr24"));
+	ini.set(_T(""), KEY_PIXEL_LAYOUT, m_pixelLayoutBgrx ? _T("bgrx") : _T("native"));
+	_stprintf_s(buf, 32, _T("%d"), m_imageCacheMB);
+	ini.set(_T(""), KEY_IMAGE_CACHE_MB, buf);
+	_stprintf_s(buf, 32, _T("%d"), m_memoryLimitMB);
+	ini.set(_T(""), KEY_MEMORY_LIMIT_MB, buf);
+	ini.write();
+}
+
+xl::tstring COptions::getIniPathName () const {
+	xl::tstring pathName;
+	xl::tchar *profileDir = NULL;
+	size_t len = 0;
+	if (!_tdupenv_s(&profileDir, &len, _T("USERPROFILE")) && profileDir != NULL) {
+		pathName = profileDir;
+		free(profileDir);
+		profileDir = NULL;
+		xl::tchar lastChar = pathName.empty() ? 0 : pathName.at(pathName.length() - 1);
+		if (lastChar != _T('\\') && lastChar != _T('/')) {
+			pathName += _T("\\xlview-options.ini");
+		} else {
+			pathName += _T("xlview-options.ini");
+		}
+	}
+
+	return pathName;
+}
+
+void COptions::setImageCacheMB (int mb) {
+	assert(mb > 0);
+	m_imageCacheMB = mb;
+	CImageCache::getInstance()->setBudget((size_t)mb * 1024 * 1024);
+}
+
+void COptions::setMemoryLimitMB (int mb) {
+	assert(mb >= 0);
+	m_memoryLimitMB = mb;
+	CMemoryGovernor::getInstance()->setWorkingSetLimit((size_t)mb * 1024 * 1024);
+}
@@ -0,0 +1,42 @@
+#ifndef XL_VIEW_OPTIONS_H
+#define XL_VIEW_OPTIONS_H
+/**
+ * The user options of the loading and the caching, edited in the "Options"
+ * tab of the setting dialog and saved in the profile directory (the same way
+ * as CGestureMap does).
+ *
+ * The memory budgets are applied at once, the others are applied to the
+ * images (and thumbnails) loaded after xlview is restarted.
+ */
+#include "libxl/include/common.h"
+#include "libxl/include/string.h"
+
+class COptions {
+	bool               m_fullImageOnDemand; // decode the full image only when zoomed in
+	bool               m_thumbnailRgb565;   // the thumbnails in RGB565 instead of BGR24
+	bool               m_pixelLayoutBgrx;   // decode the images to 32 bpp BGRX
+	int                m_imageCacheMB;      // the budget of CImageCache
+	int                m_memoryLimitMB;     // the working set limit of CMemoryGovernor, 0 for no limit
+
+	COptions ();
+	void _Load ();
+
+public:
+	static COptions* getInstance ();
+
+	void save ();
+	xl::tstring getIniPathName () const;
+
+	bool isFullImageOnDemand () const { return m_fullImageOnDemand; }
+	void setFullImageOnDemand (bool onDemand) { m_fullImageOnDemand = onDemand; }
+	bool isThumbnailRgb565 () const { return m_thumbnailRgb565; }
+	void setThumbnailRgb565 (bool rgb565) { m_thumbnailRgb565 = rgb565; }
+	bool isPixelLayoutBgrx () const { return m_pixelLayoutBgrx; }
+	void setPixelLayoutBgrx (bool bgrx) { m_pixelLayoutBgrx = bgrx; }
+	int getImageCacheMB () const { return m_imageCacheMB; }
+	void setImageCacheMB (int mb);
+	int getMemoryLimitMB () const { return m_memoryLimitMB; }
+	void setMemoryLimitMB (int mb);
+};
+
+#endif
@@ -0,0 +1,275 @@
+#include <assert.h>
+#include <tchar.h>
+#include "libxl/include/utilities.h"
+#include "ImageConfig.h"
+#include "PixelBufferPool.h"
+#include "MemoryGovernor.h"
+
+
+//////////////////////////////////////////////////////////////////////////
+// CPixelBufferPool
+
+CPixelBufferPool::CPixelBufferPool ()
+	: m_slabCursor(NULL)
+	, m_slabLeft(0)
+	, m_slabSize(SLAB_SIZE)
+	, m_largePages(false)
+{
+	const xl::tchar *largePages = _tgetenv(_T("xlview_large_pages"));
+	if (largePages != NULL && _tcscmp(largePages, _T("1")) == 0) {
+		size_t pageSize = ::GetLargePageMinimum();
+		if (pageSize > 0 && _EnableLockMemoryPrivilege()) {
+			m_largePages = true;
+			m_slabSize = (SLAB_SIZE + pageSize - 1) / pageSize * pageSize;
+		}
+	}
+	m_stats.largePages = m_largePages;
+}
+
+CPixelBufferPool::~CPixelBufferPool () {
+	for (_Blocks::iterator it = m_slabs.begin(); it != m_slabs.end(); ++ it) {
+		::VirtualFree(*it, 0, MEM_RELEASE);
+	}
+}
+
+int CPixelBufferPool::_GetClass (size_t bytes) {
+	for (int i = 0; i < CLASS_COUNT; ++ i) {
+		if (bytes <= ((size_t)1 << (i + MIN_CLASS_SHIFT))) {
+			return i;
+		}
+	}
+	return -1; // too large
+}
+
+bool CPixelBufferPool::_EnableLockMemoryPrivilege () {
+	HANDLE hToken = NULL;
+	if (!::OpenProcessToken(::GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken)) {
+		return false;
+	}
+
+	TOKEN_PRIVILEGES tp;
+	tp.PrivilegeCount = 1;
+	tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool ok = ::LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid)
+		&& ::AdjustTokenPrivileges(hToken, FALSE, &tp, 0, NULL, NULL)
+		&& ::GetLastError() == ERROR_SUCCESS; // ERROR_NOT_ALL_ASSIGNED if not granted
+	::CloseHandle(hToken);
+	return ok;
+}
+
+void* CPixelBufferPool::_AllocSlab (size_t bytes) {
+	void *p = NULL;
+	if (m_largePages) {
+		p = ::VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+	}
+	if (p == NULL) {
+		p = ::VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+	return p;
+}
+
+CPixelBufferPool* CPixelBufferPool::getInstance () {
+	// never destroyed, the buffers may be released by the other static objects at exit
+	static CPixelBufferPool *pool = new CPixelBufferPool();
+	return pool;
+}
+
+void* CPixelBufferPool::allocate (size_t bytes) {
+	assert(bytes > 0);
+	xl::CScopeLock lock(this);
+	int cls = _GetClass(bytes);
+	if (cls < 0) {
+		void *p = ::VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (p != NULL) {
+			m_stats.misses ++;
+			m_stats.usedBytes += bytes;
+		}
+		return p;
+	}
+
+	size_t blockSize = (size_t)1 << (cls + MIN_CLASS_SHIFT);
+	void *p = NULL;
+	if (!m_free[cls].empty()) {
+		p = m_free[cls].back();
+		m_free[cls].pop_back();
+		m_stats.hits ++;
+	} else {
+		if (m_slabLeft < blockSize) {
+			void *slab = _AllocSlab(m_slabSize);
+			if (slab == NULL) {
+				return NULL;
+			}
+			// the rest of the last slab goes to the smaller classes
+			for (int i = cls - 1; i >= 0 && m_slabLeft > 0; -- i) {
+				size_t size = (size_t)1 << (i + MIN_CLASS_SHIFT);
+				while (m_slabLeft >= size) {
+					m_free[i].push_back(m_slabCursor);
+					m_slabCursor += size;
+					m_slabLeft -= size;
+				}
+			}
+			m_slabs.push_back(slab);
+			m_slabCursor = (xl::uint8 *)slab;
+			m_slabLeft = m_slabSize;
+			m_stats.slabBytes += m_slabSize;
+		}
+		p = m_slabCursor;
+		m_slabCursor += blockSize;
+		m_slabLeft -= blockSize;
+		m_stats.misses ++;
+	}
+
+	m_stats.usedBytes += blockSize;
+	if (m_stats.usedBytes > m_stats.peakUsedBytes) {
+		m_stats.peakUsedBytes = m_stats.usedBytes;
+	}
+	return p;
+}
+
+void CPixelBufferPool::release (void *p, size_t bytes) {
+	if (p == NULL) {
+		return;
+	}
+	xl::CScopeLock lock(this);
+	int cls = _GetClass(bytes);
+	if (cls < 0) {
+		::VirtualFree(p, 0, MEM_RELEASE);
+		m_stats.usedBytes -= bytes;
+	} else {
+		m_free[cls].push_back(p);
+		m_stats.usedBytes -= (size_t)1 << (cls + MIN_CLASS_SHIFT);
+	}
+}
+
+CPixelBufferPool::Stats CPixelBufferPool::getStats () const {
+	xl::CScopeLock lock(this);
+	return m_stats;
+}
+
+void CPixelBufferPool::resetPeak () {
+	xl::CScopeLock lock(this);
+	m_stats.peakUsedBytes = m_stats.usedBytes;
+}
+
+void CPixelBufferPool::traceStats () const {
+	Stats stats = getStats();
+	XLTRACE(_T("** pixel buffer pool: slabs %d KB, used %d KB (peak %d KB), hits %d, misses %d%s\n"),
+		(int)(stats.slabBytes / 1024), (int)(stats.usedBytes / 1024), (int)(stats.peakUsedBytes / 1024),
+		(int)stats.hits, (int)stats.misses, stats.largePages ? _T(", large pages") : _T(""));
+	XL_PARAMETER_NOT_USED(stats);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CDIBSectionPool
+
+CDIBSectionPool::CDIBSectionPool () : m_budget(DIB_POOL_BUDGET) {
+}
+
+CDIBSectionPool::~CDIBSectionPool () {
+}
+
+size_t CDIBSectionPool::_GetBytes (xl::ui::CDIBSection *dib) {
+	return (size_t)dib->getStride() * dib->getHeight();
+}
+
+CDIBSectionPool* CDIBSectionPool::getInstance () {
+	// never destroyed, see CPixelBufferPool::getInstance()
+	static CDIBSectionPool *pool = new CDIBSectionPool();
+	return pool;
+}
+
+void CDIBSectionPool::setBudget (size_t bytes) {
+	xl::CScopeLock lock(this);
+	m_budget = bytes;
+	while (m_stats.freeBytes > m_budget) {
+		m_stats.freeBytes -= _GetBytes(m_free.back().get());
+		m_stats.dropped ++;
+		m_free.pop_back();
+	}
+}
+
+xl::ui::CDIBSectionPtr CDIBSectionPool::create (int width, int height, int bitcount, bool clear) {
+	xl::CScopeLock lock(this);
+	for (_DIBs::iterator it = m_free.begin(); it != m_free.end(); ++ it) {
+		xl::ui::CDIBSectionPtr dib = *it;
+		if (dib->getWidth() == width && dib->getHeight() == height && dib->getBitCounts() == bitcount) {
+			m_free.erase(it);
+			m_stats.freeBytes -= _GetBytes(dib.get());
+			m_stats.hits ++;
+			lock.unlock();
+
+			if (clear) {
+				memset(dib->getData(), 0, _GetBytes(dib.get()));
+			}
+			return dib;
+		}
+	}
+	m_stats.misses ++;
+	lock.unlock();
+
+	xl::ui::CDIBSectionPtr dib = xl::ui::CDIBSection::createDIBSection(width, height, bitcount, false);
+	int tier = 0; // shed the caches tier by tier, and try again
+	while (dib == NULL && CMemoryGovernor::getInstance()->retry(tier)) {
+		dib = xl::ui::CDIBSection::createDIBSection(width, height, bitcount, false);
+	}
+	return dib;
+}
+
+void CDIBSectionPool::recycle (xl::ui::CDIBSectionPtr &dib) {
+	if (dib == NULL || !dib.unique()) {
+		dib.reset();
+		return;
+	}
+
+	size_t bytes = _GetBytes(dib.get());
+	xl::CScopeLock lock(this);
+	if (bytes > m_budget) {
+		m_stats.dropped ++;
+		lock.unlock();
+		dib.reset();
+		return;
+	}
+
+	m_free.push_front(dib);
+	dib.reset();
+	m_stats.freeBytes += bytes;
+	if (m_stats.freeBytes > m_stats.peakFreeBytes) {
+		m_stats.peakFreeBytes = m_stats.freeBytes;
+	}
+	while (m_stats.freeBytes > m_budget) {
+		m_stats.freeBytes -= _GetBytes(m_free.back().get());
+		m_stats.dropped ++;
+		m_free.pop_back();
+	}
+}
+
+void CDIBSectionPool::recycle (CImagePtr &image) {
+	if (image == NULL || !image.unique() || image->isTiled()) {
+		image.reset();
+		return;
+	}
+
+	std::vector<xl::ui::CDIBSectionPtr> dibs;
+	for (xl::uint i = 0; i < image->getImageCount(); ++ i) {
+		dibs.push_back(image->getImage(i));
+	}
+	image.reset();
+
+	for (size_t i = 0; i < dibs.size(); ++ i) {
+		recycle(dibs[i]);
+	}
+}
+
+CDIBSectionPool::Stats CDIBSectionPool::getStats () const {
+	xl::CScopeLock lock(this);
+	return m_stats;
+}
+
+void CDIBSectionPool::traceStats () const {
+	Stats stats = getStats();
+	XLTRACE(_T("** DIB section pool: free %d KB (peak %d KB), hits %d, misses %d, dropped %d\n"),
+		(int)(stats.freeBytes / 1024), (int)(stats.peakFreeBytes / 1024),
+		(int)stats.hits, (int)stats.misses, (int)stats.dropped);
+	XL_PARAMETER_NOT_USED(stats);
+}
@@ -0,0 +1,128 @@
+#ifndef XL_VIEW_PIXEL_BUFFER_POOL_H
+#define XL_VIEW_PIXEL_BUFFER_POOL_H
+#include <vector>
+#include <list>
+#include <Windows.h>
+#include "libxl/include/common.h"
+#include "libxl/include/lockable.h"
+#include "libxl/include/ui/DIBSection.h"
+#include "Image.h"
+
+/**
+ * Browsing a folder allocates and frees many large pixel buffers, which
+ * fragments the heap in a long session. The buffers are pooled here:
+ *
+ * CPixelBufferPool: the raw buffers (the tiles, ...) in power-of-2 size classes,
+ *   carved from large VirtualAlloc()ed slabs (with large pages if enabled).
+ * CDIBSectionPool: the DIB sections, the pixels of which are allocated by GDI,
+ *   so they are recycled as a whole, by (width, height, bitcount). Most of the
+ *   photos in one folder are of the same size, so are their suitable images.
+ */
+
+//////////////////////////////////////////////////////////////////////////
+// CPixelBufferPool
+
+class CPixelBufferPool : public xl::CUserLock
+{
+public:
+	enum {
+		MIN_CLASS_SHIFT = 16, // 64 KB
+		MAX_CLASS_SHIFT = 22, // 4 MB, the larger buffers are VirtualAlloc()ed directly
+		CLASS_COUNT = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1,
+		SLAB_SIZE = 16 * 1024 * 1024
+	};
+
+	struct Stats {
+		size_t         slabBytes;     // reserved by the slabs
+		size_t         usedBytes;     // in use (the size classes rounded up)
+		size_t         peakUsedBytes;
+		size_t         hits;          // allocated from the free lists
+		size_t         misses;        // a new block carved, or allocated directly
+		bool           largePages;
+
+		Stats () {
+			memset(this, 0, sizeof(*this));
+		}
+	};
+
+protected:
+	typedef std::vector<void *>                    _Blocks;
+
+	_Blocks            m_free[CLASS_COUNT];
+	_Blocks            m_slabs;
+	xl::uint8         *m_slabCursor;  // the rest of the last slab
+	size_t             m_slabLeft;
+	size_t             m_slabSize;
+	bool               m_largePages;
+	Stats              m_stats;
+
+	CPixelBufferPool ();
+	~CPixelBufferPool ();
+
+	static int _GetClass (size_t bytes);
+	static bool _EnableLockMemoryPrivilege ();
+	void* _AllocSlab (size_t bytes);
+
+public:
+	static CPixelBufferPool* getInstance ();
+
+	// returns NULL if out of memory, the buffer is NOT zeroed
+	void* allocate (size_t bytes);
+	// @bytes must be the same as allocate()
+	void release (void *p, size_t bytes);
+
+	Stats getStats () const;
+	// the peak starts from the bytes in use now (to measure one decoding)
+	void resetPeak ();
+	void traceStats () const;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// CDIBSectionPool
+
+class CDIBSectionPool : public xl::CUserLock
+{
+public:
+	struct Stats {
+		size_t         freeBytes;     // kept in the pool
+		size_t         peakFreeBytes;
+		size_t         hits;
+		size_t         misses;
+		size_t         dropped;       // released to GDI because of the budget
+
+		Stats () {
+			memset(this, 0, sizeof(*this));
+		}
+	};
+
+protected:
+	typedef std::list<xl::ui::CDIBSectionPtr>      _DIBs;
+
+	_DIBs              m_free; // the front is the most recently recycled
+	size_t             m_budget;
+	Stats              m_stats;
+
+	CDIBSectionPool ();
+	~CDIBSectionPool ();
+
+	static size_t _GetBytes (xl::ui::CDIBSection *dib);
+
+public:
+	static CDIBSectionPool* getInstance ();
+
+	void setBudget (size_t bytes);
+
+	// if @clear, the reused bitmap is zeroed as a new one
+	xl::ui::CDIBSectionPtr create (int width, int height, int bitcount, bool clear = true);
+	// the @dib is kept only if no one else uses it
+	void recycle (xl::ui::CDIBSectionPtr &dib);
+	// recycle all the frames of @image, if no one else uses it
+	void recycle (CImagePtr &image);
+
+	Stats getStats () const;
+	void traceStats () const;
+};
+
+
+#endif
@@ -0,0 +1,83 @@
+#include <assert.h>
+#include <math.h>
+#include "libxl/include/utilities.h"
+#include "ImageConfig.h"
+#include "PrefetchPolicy.h"
+
+static const double AVERAGE_WEIGHT = 0.3; // of the latest sample
+static const double DEFAULT_DECODE_COST = 100.0;
+
+
+CPrefetchPolicy::CPrefetchPolicy ()
+	: m_lastTime(0)
+	, m_interval(PREFETCH_IDLE_TIME)
+	, m_cost(DEFAULT_DECODE_COST)
+	, m_lastStep(0)
+	, m_oneWaySteps(0)
+	, m_decodes(0)
+{
+}
+
+void CPrefetchPolicy::onNavigate (int step) {
+	xl::CScopeLock lock(this);
+	DWORD now = ::GetTickCount();
+	DWORD interval = now - m_lastTime;
+	m_lastTime = now;
+
+	if (step == 0) { // jumped, by the slider or the thumbnails
+		m_lastStep = 0;
+		m_oneWaySteps = 0;
+		return;
+	}
+
+	if (interval > (DWORD)PREFETCH_IDLE_TIME) {
+		interval = PREFETCH_IDLE_TIME; // the first step after a pause
+	}
+	m_interval = m_interval * (1.0 - AVERAGE_WEIGHT) + interval * AVERAGE_WEIGHT;
+
+	m_oneWaySteps = step == m_lastStep ? m_oneWaySteps + 1 : 1;
+	m_lastStep = step;
+}
+
+void CPrefetchPolicy::onDecoded (DWORD cost) {
+	xl::CScopeLock lock(this);
+	if (m_decodes == 0) {
+		m_cost = cost;
+	} else {
+		m_cost = m_cost * (1.0 - AVERAGE_WEIGHT) + cost * AVERAGE_WEIGHT;
+	}
+	m_decodes ++;
+}
+
+CPrefetchPolicy::Plan CPrefetchPolicy::getPlan () const {
+	xl::CScopeLock lock(this);
+	Plan plan;
+	plan.idle = m_lastStep == 0 || ::GetTickCount() - m_lastTime > (DWORD)PREFETCH_IDLE_TIME;
+	if (plan.idle) {
+		plan.ahead = PREFETCH_RANGE;
+		plan.behind = PREFETCH_RANGE;
+		plan.first = 2; // the next and the previous ones
+		return plan;
+	}
+
+	// the images the user passes while one is being decoded
+	int passed = (int)ceil(m_cost / (m_interval > 1.0 ? m_interval : 1.0));
+	plan.ahead = 1 + 2 * passed;
+	if (plan.ahead < PREFETCH_RANGE) {
+		plan.ahead = PREFETCH_RANGE;
+	} else if (plan.ahead > PREFETCH_MAX_AHEAD) {
+		plan.ahead = PREFETCH_MAX_AHEAD;
+	}
+	plan.first = passed + 1 < plan.ahead ? passed + 1 : plan.ahead;
+	plan.behind = m_oneWaySteps >= PREFETCH_ONE_WAY_STEPS ? 0 : 1;
+	return plan;
+}
+
+void CPrefetchPolicy::tracePlan () const {
+	Plan plan = getPlan();
+	xl::CScopeLock lock(this);
+	XLTRACE(_T("** prefetch: %d ahead, %d behind, %d first (%s, %.0f ms per step, %.0f ms per decode, %d steps one way)\n"),
+		plan.ahead, plan.behind, plan.first, plan.idle ? _T("idle") : _T("browsing"),
+		m_interval, m_cost, m_oneWaySteps);
+	XL_PARAMETER_NOT_USED(plan);
+}
@@ -0,0 +1,49 @@
+#ifndef XL_VIEW_PREFETCH_POLICY_H
+#define XL_VIEW_PREFETCH_POLICY_H
+#include <Windows.h>
+#include "libxl/include/common.h"
+#include "libxl/include/lockable.h"
+
+/**
+ * Sizes the prefetch window by how the user browses. It tracks the interval
+ * between the navigations and the cost to decode one (suitable) image, both
+ * by the exponential moving average:
+ *
+ *   ahead = 1 + 2 * ceil(cost / interval)
+ *
+ * so the next image is ready before the expected keypress, and the window
+ * grows when the user flicks faster than the images can be decoded. The
+ * images behind are not prefetched when the user keeps going one way.
+ * When the user stops browsing, it falls back to PREFETCH_RANGE both ways.
+ */
+class CPrefetchPolicy : public xl::CUserLock
+{
+public:
+	struct Plan {
+		int            ahead;     // in the browsing direction
+		int            behind;
+		int            first;     // decoded before the thumbnails
+		bool           idle;
+	};
+
+protected:
+	DWORD              m_lastTime;
+	double             m_interval; // ms between the navigations
+	double             m_cost;     // ms to decode one image
+	int                m_lastStep; // +1 or -1
+	int                m_oneWaySteps;
+	size_t             m_decodes;
+
+public:
+	CPrefetchPolicy ();
+
+	// the current index changed by one step (+1 / -1, after wrapping), or jumped (0)
+	void onNavigate (int step);
+	void onDecoded (DWORD cost);
+
+	Plan getPlan () const;
+	void tracePlan () const;
+};
+
+
+#endif
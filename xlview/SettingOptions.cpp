@@ -0,0 +1,136 @@
+#include <assert.h>
+#include <Windows.h>
+#include <WindowsX.h>
+#include "libxl/include/Language.h"
+#include "libxl/include/utilities.h"
+#include "Options.h"
+#include "SettingOptions.h"
+
+static const int MAX_MEMORY_MB = 64 * 1024;
+
+bool COptionsDialog::_IsChanged () {
+	COptions *options = COptions::getInstance();
+	BOOL ok = FALSE;
+	if ((IsDlgButtonChecked(IDC_CHECKBOX_FULL_IMAGE) == BST_CHECKED) != options->isFullImageOnDemand()
+		|| (IsDlgButtonChecked(IDC_CHECKBOX_THUMBNAIL_RGB565) == BST_CHECKED) != options->isThumbnailRgb565()
+		|| (IsDlgButtonChecked(IDC_CHECKBOX_PIXEL_BGRX) == BST_CHECKED) != options->isPixelLayoutBgrx()) {
+		return true;
+	}
+	int cacheMB = (int)GetDlgItemInt(IDC_EDIT_IMAGE_CACHE, &ok, FALSE);
+	if (ok && cacheMB != options->getImageCacheMB()) {
+		return true;
+	}
+	int limitMB = (int)GetDlgItemInt(IDC_EDIT_MEMORY_LIMIT, &ok, FALSE);
+	if (ok && limitMB != options->getMemoryLimitMB()) {
+		return true;
+	}
+	return false;
+}
+
+void COptionsDialog::_Load () {
+	COptions *options = COptions::getInstance();
+	CheckDlgButton(IDC_CHECKBOX_FULL_IMAGE, options->isFullImageOnDemand() ? BST_CHECKED : BST_UNCHECKED);
+	CheckDlgButton(IDC_CHECKBOX_THUMBNAIL_RGB565, options->isThumbnailRgb565() ? BST_CHECKED : BST_UNCHECKED);
+	CheckDlgButton(IDC_CHECKBOX_PIXEL_BGRX, options->isPixelLayoutBgrx() ? BST_CHECKED : BST_UNCHECKED);
+	SetDlgItemInt(IDC_EDIT_IMAGE_CACHE, options->getImageCacheMB(), FALSE);
+	SetDlgItemInt(IDC_EDIT_MEMORY_LIMIT, options->getMemoryLimitMB(), FALSE);
+}
+
+void COptionsDialog::_OnChange () {
+	HWND hWnd = GetDlgItem(IDC_BUTTON_OPTIONS_APPLY);
+	::EnableWindow(hWnd, _IsChanged());
+}
+
+void COptionsDialog::_OnApply () {
+	COptions *options = COptions::getInstance();
+	options->setFullImageOnDemand(IsDlgButtonChecked(IDC_CHECKBOX_FULL_IMAGE) == BST_CHECKED);
+	options->setThumbnailRgb565(IsDlgButtonChecked(IDC_CHECKBOX_THUMBNAIL_RGB565) == BST_CHECKED);
+	options->setPixelLayoutBgrx(IsDlgButtonChecked(IDC_CHECKBOX_PIXEL_BGRX) == BST_CHECKED);
+
+	BOOL ok = FALSE;
+	int cacheMB = (int)GetDlgItemInt(IDC_EDIT_IMAGE_CACHE, &ok, FALSE);
+	if (ok && cacheMB > 0 && cacheMB <= MAX_MEMORY_MB) {
+		options->setImageCacheMB(cacheMB);
+	}
+	int limitMB = (int)GetDlgItemInt(IDC_EDIT_MEMORY_LIMIT, &ok, FALSE);
+	if (ok && limitMB <= MAX_MEMORY_MB) {
+		options->setMemoryLimitMB(limitMB);
+	}
+	options->save();
+
+	// the invalid numbers are restored
+	_Load();
+	HWND hWnd = GetDlgItem(IDC_BUTTON_OPTIONS_APPLY);
+	::EnableWindow(hWnd, false);
+}
+
+
+COptionsDialog::COptionsDialog () {
+}
+
+COptionsDialog::~COptionsDialog () {
+}
+
+LRESULT COptionsDialog::OnInitDialog (UINT, WPARAM, LPARAM, BOOL &) {
+	UINT ids[] = {
+		IDC_CHECKBOX_FULL_IMAGE,
+		IDC_CHECKBOX_THUMBNAIL_RGB565,
+		IDC_CHECKBOX_PIXEL_BGRX,
+		IDC_STATIC_IMAGE_CACHE,
+		IDC_STATIC_MEMORY_LIMIT,
+		IDC_STATIC_OPTIONS_RESTART,
+		IDC_BUTTON_OPTIONS_APPLY,
+	};
+
+	xl::tchar text[MAX_PATH];
+	xl::CLanguage *pLanguage = xl::CLanguage::getInstance();
+	for (int i = 0; i < COUNT_OF(ids); ++ i) {
+		HWND hWnd = GetDlgItem(ids[i]);
+		assert(hWnd != NULL);
+		if (hWnd != NULL) {
+			::GetWindowText(hWnd, text, MAX_PATH);
+			xl::tstring lang = pLanguage->getString(text);
+			::SetWindowText(hWnd, lang.c_str());
+		}
+	}
+
+	_Load();
+	return TRUE;
+}
+
+LRESULT COptionsDialog::OnCommand (UINT, WPARAM wParam, LPARAM, BOOL &bHandled) {
+	WORD id = LOWORD(wParam);
+	WORD code = HIWORD(wParam);
+	switch (id) {
+	case IDC_CHECKBOX_FULL_IMAGE:
+	case IDC_CHECKBOX_THUMBNAIL_RGB565:
+	case IDC_CHECKBOX_PIXEL_BGRX:
+		if (code == BN_CLICKED) {
+			_OnChange();
+		}
+		break;
+	case IDC_EDIT_IMAGE_CACHE:
+	case IDC_EDIT_MEMORY_LIMIT:
+		if (code == EN_CHANGE) {
+			_OnChange();
+		}
+		break;
+	case IDC_BUTTON_OPTIONS_APPLY:
+		_OnApply();
+		break;
+	default:
+		bHandled = false;
+		break;
+	}
+	return 0;
+}
+
+LRESULT COptionsDialog::OnEraseBkGnd (UINT, WPARAM, LPARAM, BOOL &) {
+	return TRUE;
+}
+
+LRESULT COptionsDialog::OnCtlColorStatic (UINT, WPARAM wParam, LPARAM, BOOL &) {
+	HDC hdc = (HDC)wParam;
+	::SetBkMode(hdc, TRANSPARENT);
+	return (LRESULT)::GetStockObject(NULL_BRUSH);
+}
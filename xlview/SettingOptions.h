@@ -0,0 +1,39 @@
+#ifndef XL_VIEW_SETTING_OPTIONS_H
+#define XL_VIEW_SETTING_OPTIONS_H
+#include <atlbase.h>
+#include <atltypes.h>
+#include <atlapp.h>
+#include <atlwin.h>
+#include "resource.h"
+
+/////////////////////////////////////////////////////////////////////
+// the options of the loading and the caching (see COptions)
+class COptionsDialog : public CDialogImpl<COptionsDialog>
+{
+	bool _IsChanged ();
+	void _Load ();
+	void _OnChange ();
+	void _OnApply ();
+
+public:
+	enum {
+		IDD = IDD_SETTING_OPTIONS,
+	};
+
+	BEGIN_MSG_MAP (COptionsDialog)
+		MESSAGE_HANDLER (WM_ERASEBKGND, OnEraseBkGnd)
+		MESSAGE_HANDLER (WM_CTLCOLORSTATIC, OnCtlColorStatic)
+		MESSAGE_HANDLER (WM_COMMAND, OnCommand)
+		MESSAGE_HANDLER (WM_INITDIALOG, OnInitDialog)
+	END_MSG_MAP ()
+
+	COptionsDialog ();
+	virtual ~COptionsDialog ();
+
+	LRESULT OnInitDialog (UINT msg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
+	LRESULT OnCommand (UINT msg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
+	LRESULT OnEraseBkGnd (UINT msg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
+	LRESULT OnCtlColorStatic (UINT msg, WPARAM wParam, LPARAM lParam, BOOL &bHandled);
+};
+
+#endif
@@ -8,8 +8,8 @@
 
 ///////////////////////////////////////////////////////////////////////
 // static
-static TCHAR *tabNames[] = {_T("Gesture"), _T("Keypad"), _T("FileAssociation"), _T("About"), };
-static HWND tabWindow[] = {0, 0, 0, 0,};
+static TCHAR *tabNames[] = {_T("Gesture"), _T("Keypad"), _T("FileAssociation"), _T("Options"), _T("About"), };
+static HWND tabWindow[] = {0, 0, 0, 0, 0,};
 
 
 
@@ -61,6 +61,10 @@ void CSettingDialog::_CreateTabs () {
 	::SetWindowPos(hWnd, HWND_TOP, rc.left, rc.top, rc.Width(), rc.Height(), SWP_HIDEWINDOW | SWP_NOACTIVATE | SWP_NOZORDER);
 	tabWindow[idx ++] = hWnd;
 
+	hWnd = m_dlgOptions.Create(m_hWnd);
+	::SetWindowPos(hWnd, HWND_TOP, rc.left, rc.top, rc.Width(), rc.Height(), SWP_HIDEWINDOW | SWP_NOACTIVATE | SWP_NOZORDER);
+	tabWindow[idx ++] = hWnd;
+
 	hWnd = m_dlgAbout.Create(m_hWnd);
 	::SetWindowPos(hWnd, HWND_TOP, rc.left, rc.top, rc.Width(), rc.Height(), SWP_HIDEWINDOW | SWP_NOACTIVATE | SWP_NOZORDER);
 	tabWindow[idx ++] = hWnd;
@@ -10,6 +10,7 @@
 #include "SettingGesture.h"
 #include "SettingKeypad.h"
 #include "SettingFileAssoc.h"
+#include "SettingOptions.h"
 #include "SettingAbout.h"
 
 class CGestureMap;
@@ -24,6 +25,7 @@ class CSettingDialog : public CDialogImpl<CSettingDialog>
 	// std::auto_ptr<CDialogImpl>                     m_pDlgFileAssoc;
 	CFileAssociationDialogXp                       m_dlgFileAssocXp;
 	CFileAssociationDialogVista                    m_dlgFileAssocVista;
+	COptionsDialog                                 m_dlgOptions;
 	CAboutDialog                                   m_dlgAbout;
 
 	void _CreateTabs ();
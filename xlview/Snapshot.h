@@ -0,0 +1,54 @@
+#ifndef XL_VIEW_SNAPSHOT_H
+#define XL_VIEW_SNAPSHOT_H
+#include <memory>
+#include <Windows.h>
+
+/**
+ * An immutable object published to the readers without the lock of the
+ * writer (RCU like). The writer builds a new one and publish() it, the
+ * readers get() a reference and keep using it even if a newer one is
+ * published; the old one is freed when the last reader releases it.
+ *
+ * The guard is held only for copying the shared pointer (one interlocked
+ * increment), so a reader never waits for the writer's work.
+ */
+template <class T>
+class CSnapshotT
+{
+public:
+	typedef std::tr1::shared_ptr<const T>          Ptr;
+
+protected:
+	Ptr                m_current;
+	mutable volatile LONG m_guard;
+
+	void _Acquire () const {
+		while (::InterlockedCompareExchange(&m_guard, 1, 0) != 0) {
+			::YieldProcessor();
+		}
+	}
+
+	void _Release () const {
+		::InterlockedExchange(&m_guard, 0);
+	}
+
+public:
+	CSnapshotT () : m_guard(0) {}
+
+	Ptr get () const {
+		_Acquire();
+		Ptr p = m_current;
+		_Release();
+		return p;
+	}
+
+	void publish (Ptr p) {
+		_Acquire();
+		m_current.swap(p);
+		_Release();
+		// the old one (in @p) is released here, out of the guard
+	}
+};
+
+
+#endif
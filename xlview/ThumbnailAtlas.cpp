@@ -0,0 +1,300 @@
+#include <assert.h>
+#include <tchar.h>
+#include <emmintrin.h>
+#include "libxl/include/utilities.h"
+#include "Options.h"
+#include "ThumbnailAtlas.h"
+#include "PixelBufferPool.h"
+
+
+//////////////////////////////////////////////////////////////////////////
+// CThumbnailAtlas
+
+CThumbnailAtlas::CThumbnailAtlas () : m_format(FORMAT_BGR24) {
+	if (COptions::getInstance()->isThumbnailRgb565()) {
+		m_format = FORMAT_RGB565;
+	}
+	m_slotBytes = _GetStride(THUMBNAIL_WIDTH) * THUMBNAIL_HEIGHT;
+	// the pages fill the largest class of the pool, so the smaller RGB565
+	// slots pack more thumbnails into each page instead of wasting the rest
+	m_pageBytes = (size_t)1 << CPixelBufferPool::MAX_CLASS_SHIFT;
+	m_slotsPerPage = (int)(m_pageBytes / m_slotBytes);
+	assert(m_slotsPerPage > 0);
+	m_stats.bitcount = m_format == FORMAT_RGB565 ? 16 : 24;
+	m_stats.slotBytes = m_slotBytes;
+}
+
+CThumbnailAtlas::~CThumbnailAtlas () {
+	CPixelBufferPool *pool = CPixelBufferPool::getInstance();
+	for (_Pages::iterator it = m_pages.begin(); it != m_pages.end(); ++ it) {
+		pool->release(*it, m_pageBytes);
+	}
+}
+
+int CThumbnailAtlas::_GetSlot (ThumbnailHandle thumbnail) const {
+	assert(getLockLevel() > 0);
+	if (thumbnail < 0) {
+		return -1;
+	}
+	int slot = thumbnail & INDEX_MASK;
+	int generation = (thumbnail >> INDEX_BITS) & GENERATION_MASK;
+	if (slot >= (int)m_slots.size() || !m_slots[slot].used || m_slots[slot].generation != generation) {
+		return -1;
+	}
+	return slot;
+}
+
+xl::uint8* CThumbnailAtlas::_GetData (int slot) const {
+	assert(slot >= 0 && slot < (int)m_slots.size());
+	return m_pages[slot / m_slotsPerPage] + (slot % m_slotsPerPage) * m_slotBytes;
+}
+
+int CThumbnailAtlas::_GetStride (int width) const {
+	if (m_format == FORMAT_RGB565) {
+		return (width * 2 + 3) & ~3;
+	}
+	return (width * 3 + 3) & ~3;
+}
+
+const xl::uint8* CThumbnailAtlas::_Expand (int slot) const {
+	assert(getLockLevel() > 0);
+	assert(m_format == FORMAT_RGB565);
+	LARGE_INTEGER begin, end, freq;
+	::QueryPerformanceCounter(&begin);
+
+	const Slot &s = m_slots[slot];
+	if (m_expanded.length() < (size_t)THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT * 4) {
+		m_expanded.resize(THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT * 4);
+	}
+	xl::uint8 *dst = (xl::uint8 *)&m_expanded[0];
+	const xl::uint8 *src = _GetData(slot);
+	int stride = _GetStride(s.width);
+	for (int y = 0; y < s.height; ++ y) {
+		_ExpandLine565(dst + y * s.width * 4, (const WORD *)(src + y * stride), s.width);
+	}
+
+	::QueryPerformanceCounter(&end);
+	::QueryPerformanceFrequency(&freq);
+	m_stats.expanded ++;
+	m_stats.expandTime += (double)(end.QuadPart - begin.QuadPart) * 1000 / freq.QuadPart;
+	return dst;
+}
+
+void CThumbnailAtlas::_PackLine565 (WORD *dst, const xl::uint8 *src, int width, int bytes) {
+	for (int x = 0; x < width; ++ x) {
+		// rounded, 8 bits -> 5 / 6 bits
+		WORD b = (WORD)((src[0] * 249 + 1014) >> 11);
+		WORD g = (WORD)((src[1] * 253 + 505) >> 10);
+		WORD r = (WORD)((src[2] * 249 + 1014) >> 11);
+		dst[x] = (r << 11) | (g << 5) | b;
+		src += bytes;
+	}
+}
+
+void CThumbnailAtlas::_ExpandLine565 (xl::uint8 *dst, const WORD *src, int width) {
+	// 5 / 6 bits -> 8 bits by replicating the high bits, so 0x1f is 0xff
+	int x = 0;
+	const __m128i mask5 = _mm_set1_epi16(0x1f);
+	const __m128i mask6 = _mm_set1_epi16(0x3f);
+	const __m128i alpha = _mm_set1_epi16((short)0xff00);
+	for (; x + 8 <= width; x += 8) {
+		__m128i p = _mm_loadu_si128((const __m128i *)(src + x));
+		__m128i r = _mm_srli_epi16(p, 11);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), mask6);
+		__m128i b = _mm_and_si128(p, mask5);
+		r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+		g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+		b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+		__m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+		__m128i ra = _mm_or_si128(r, alpha);
+		_mm_storeu_si128((__m128i *)(dst + x * 4), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128((__m128i *)(dst + x * 4 + 16), _mm_unpackhi_epi16(bg, ra));
+	}
+	for (; x < width; ++ x) {
+		int p = src[x];
+		int r = p >> 11, g = (p >> 5) & 0x3f, b = p & 0x1f;
+		xl::uint8 *d = dst + x * 4;
+		d[0] = (xl::uint8)((b << 3) | (b >> 2));
+		d[1] = (xl::uint8)((g << 2) | (g >> 4));
+		d[2] = (xl::uint8)((r << 3) | (r >> 2));
+		d[3] = 0xff;
+	}
+}
+
+CThumbnailAtlas* CThumbnailAtlas::getInstance () {
+	// never destroyed, the thumbnails may be released by the other static objects at exit
+	static CThumbnailAtlas *atlas = new CThumbnailAtlas();
+	return atlas;
+}
+
+ThumbnailHandle CThumbnailAtlas::store (CImagePtr image) {
+	if (image == NULL || image->getImageCount() == 0) {
+		return INVALID_THUMBNAIL;
+	}
+	xl::ui::CDIBSectionPtr dib = image->getImage(0);
+	int width = dib->getWidth();
+	int height = dib->getHeight();
+	int bytes = dib->getBitCounts() / 8;
+	if (width > THUMBNAIL_WIDTH || height > THUMBNAIL_HEIGHT || (bytes != 3 && bytes != 4)) {
+		assert(false);
+		return INVALID_THUMBNAIL;
+	}
+
+	xl::CScopeLock lock(this);
+	int slot = -1;
+	if (!m_freeSlots.empty()) {
+		slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+	} else {
+		if (m_slots.size() > INDEX_MASK) {
+			return INVALID_THUMBNAIL;
+		}
+		if (m_slots.size() == m_pages.size() * m_slotsPerPage) {
+			xl::uint8 *page = (xl::uint8 *)CPixelBufferPool::getInstance()->allocate(m_pageBytes);
+			if (page == NULL) {
+				return INVALID_THUMBNAIL;
+			}
+			m_pages.push_back(page);
+			m_stats.pageBytes += m_pageBytes;
+		}
+		Slot s = {0, 0, 0, false};
+		m_slots.push_back(s);
+		slot = (int)m_slots.size() - 1;
+	}
+
+	Slot &s = m_slots[slot];
+	s.width = (short)width;
+	s.height = (short)height;
+	s.generation = (WORD)((s.generation + 1) & GENERATION_MASK);
+	s.used = true;
+
+	// the slot is top-down
+	xl::uint8 *data = _GetData(slot);
+	int stride = _GetStride(width);
+	for (int y = 0; y < height; ++ y) {
+		xl::uint8 *dst = data + y * stride;
+		xl::uint8 *src = dib->getLine(y);
+		if (m_format == FORMAT_RGB565) {
+			_PackLine565((WORD *)dst, src, width, bytes);
+		} else if (bytes == 3) {
+			memcpy(dst, src, width * 3);
+		} else {
+			for (int x = 0; x < width; ++ x) {
+				dst[0] = src[0];
+				dst[1] = src[1];
+				dst[2] = src[2];
+				dst += 3;
+				src += 4;
+			}
+		}
+	}
+
+	return (s.generation << INDEX_BITS) | slot;
+}
+
+void CThumbnailAtlas::release (ThumbnailHandle thumbnail) {
+	xl::CScopeLock lock(this);
+	int slot = _GetSlot(thumbnail);
+	if (slot != -1) {
+		m_slots[slot].used = false;
+		m_freeSlots.push_back(slot);
+	}
+}
+
+bool CThumbnailAtlas::isValid (ThumbnailHandle thumbnail) const {
+	xl::CScopeLock lock(this);
+	return _GetSlot(thumbnail) != -1;
+}
+
+CSize CThumbnailAtlas::getSize (ThumbnailHandle thumbnail) const {
+	xl::CScopeLock lock(this);
+	int slot = _GetSlot(thumbnail);
+	if (slot == -1) {
+		return CSize(-1, -1);
+	}
+	return CSize(m_slots[slot].width, m_slots[slot].height);
+}
+
+bool CThumbnailAtlas::draw (ThumbnailHandle thumbnail, HDC hdc, CRect rcDst) const {
+	xl::CScopeLock lock(this);
+	int slot = _GetSlot(thumbnail);
+	if (slot == -1) {
+		return false;
+	}
+
+	const Slot &s = m_slots[slot];
+	const xl::uint8 *data = NULL;
+	BITMAPINFO bmi;
+	memset(&bmi, 0, sizeof(bmi));
+	bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bmi.bmiHeader.biWidth = s.width;
+	bmi.bmiHeader.biHeight = -s.height; // top-down
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biCompression = BI_RGB;
+	if (m_format == FORMAT_RGB565) {
+		data = _Expand(slot);
+		bmi.bmiHeader.biBitCount = 32;
+	} else {
+		data = _GetData(slot);
+		bmi.bmiHeader.biBitCount = 24;
+	}
+	return ::StretchDIBits(hdc, rcDst.left, rcDst.top, rcDst.Width(), rcDst.Height(),
+		0, 0, s.width, s.height, data, &bmi, DIB_RGB_COLORS, SRCCOPY) != 0;
+}
+
+CImagePtr CThumbnailAtlas::createImage (ThumbnailHandle thumbnail) const {
+	xl::CScopeLock lock(this);
+	int slot = _GetSlot(thumbnail);
+	if (slot == -1) {
+		return CImagePtr();
+	}
+
+	const Slot &s = m_slots[slot];
+	int bitcount = m_format == FORMAT_RGB565 ? 32 : 24;
+	xl::ui::CDIBSectionPtr dib = xl::ui::CDIBSection::createDIBSection(s.width, s.height, bitcount, false);
+	if (dib == NULL) {
+		return CImagePtr();
+	}
+	if (m_format == FORMAT_RGB565) {
+		const xl::uint8 *data = _Expand(slot);
+		for (int y = 0; y < s.height; ++ y) {
+			memcpy(dib->getLine(y), data + y * s.width * 4, s.width * 4);
+		}
+	} else {
+		xl::uint8 *data = _GetData(slot);
+		int stride = _GetStride(s.width);
+		for (int y = 0; y < s.height; ++ y) {
+			memcpy(dib->getLine(y), data + y * stride, s.width * 3);
+		}
+	}
+	lock.unlock();
+
+	CImagePtr image(new CImage());
+	image->insertImage(dib, CImage::DELAY_INFINITE);
+	return image;
+}
+
+size_t CThumbnailAtlas::getSlotCount () const {
+	xl::CScopeLock lock(this);
+	return m_slots.size();
+}
+
+size_t CThumbnailAtlas::getUsedSlotCount () const {
+	xl::CScopeLock lock(this);
+	return m_slots.size() - m_freeSlots.size();
+}
+
+CThumbnailAtlas::Stats CThumbnailAtlas::getStats () const {
+	xl::CScopeLock lock(this);
+	Stats stats = m_stats;
+	stats.usedSlots = m_slots.size() - m_freeSlots.size();
+	return stats;
+}
+
+void CThumbnailAtlas::traceStats () const {
+	Stats stats = getStats();
+	XLTRACE(_T("** thumbnail atlas: %d bpp, %d bytes per thumbnail, %d used, %d KB of pages, %d expanded in %.3f ms\n"),
+		stats.bitcount, (int)stats.slotBytes, (int)stats.usedSlots, (int)(stats.pageBytes / 1024),
+		(int)stats.expanded, stats.expandTime);
+	XL_PARAMETER_NOT_USED(stats);
+}
@@ -0,0 +1,109 @@
+#ifndef XL_VIEW_THUMBNAIL_ATLAS_H
+#define XL_VIEW_THUMBNAIL_ATLAS_H
+#include <vector>
+#include <string>
+#include <Windows.h>
+#include <atltypes.h>
+#include "libxl/include/common.h"
+#include "libxl/include/lockable.h"
+#include "ImageConfig.h"
+#include "Image.h"
+
+/**
+ * All the thumbnails are stored in the fixed-size slots of some large pages,
+ * instead of one CImage (and one DIB section) for each. A thumbnail is referred
+ * by its handle, which is the slot index with a generation, so a handle of a
+ * released (and maybe reused) slot is simply invalid.
+ *
+ * The slots are 24 bpp, or 16 bpp RGB565 if the option "ThumbnailFormat" (see
+ * COptions) is "rgb565", which takes 2/3 of the memory, and the
+ * pixels are expanded (SSE2) to 32 bpp when the thumbnail is drawn.
+ */
+typedef int                                            ThumbnailHandle;
+static const ThumbnailHandle INVALID_THUMBNAIL = -1;
+
+class CThumbnailAtlas : public xl::CUserLock
+{
+public:
+	enum FORMAT {
+		FORMAT_BGR24,
+		FORMAT_RGB565
+	};
+
+	struct Stats {
+		int            bitcount;      // of the slots
+		size_t         slotBytes;     // the footprint of one thumbnail
+		size_t         pageBytes;     // committed for all the pages
+		size_t         usedSlots;
+		size_t         expanded;      // the RGB565 thumbnails expanded for drawing
+		double         expandTime;    // ms
+
+		Stats () {
+			memset(this, 0, sizeof(*this));
+		}
+	};
+
+protected:
+	enum {
+		INDEX_BITS = 20,
+		INDEX_MASK = (1 << INDEX_BITS) - 1,
+		GENERATION_MASK = (1 << (31 - INDEX_BITS)) - 1,
+	};
+
+	struct Slot {
+		short          width;
+		short          height;
+		WORD           generation;
+		bool           used;
+	};
+	typedef std::vector<Slot>                      _Slots;
+	typedef std::vector<xl::uint8 *>               _Pages;
+	typedef std::vector<int>                       _FreeSlots;
+
+	FORMAT             m_format;
+	size_t             m_slotBytes;
+	size_t             m_pageBytes;   // one size class of CPixelBufferPool
+	int                m_slotsPerPage;
+	_Slots             m_slots;
+	_Pages             m_pages;
+	_FreeSlots         m_freeSlots;
+	mutable std::string m_expanded; // the 32 bpp pixels for drawing an RGB565 slot
+	mutable Stats      m_stats;
+
+	CThumbnailAtlas ();
+	~CThumbnailAtlas ();
+
+	// returns -1 if @thumbnail is invalid, must be called in lock
+	int _GetSlot (ThumbnailHandle thumbnail) const;
+	xl::uint8* _GetData (int slot) const;
+	int _GetStride (int width) const;
+	// expand the RGB565 slot to 32 bpp (top-down) in m_expanded, must be called in lock
+	const xl::uint8* _Expand (int slot) const;
+
+	static void _PackLine565 (WORD *dst, const xl::uint8 *src, int width, int bytes);
+	static void _ExpandLine565 (xl::uint8 *dst, const WORD *src, int width);
+
+public:
+	static CThumbnailAtlas* getInstance ();
+
+	// copy the first frame of @image (24 or 32 bpp, not larger than the thumbnail size)
+	ThumbnailHandle store (CImagePtr image);
+	void release (ThumbnailHandle thumbnail);
+	bool isValid (ThumbnailHandle thumbnail) const;
+
+	CSize getSize (ThumbnailHandle thumbnail) const;
+	// stretch the thumbnail to @rcDst, with the stretch mode of @hdc
+	bool draw (ThumbnailHandle thumbnail, HDC hdc, CRect rcDst) const;
+	// a new CImage of the thumbnail, for the one which needs a bitmap
+	CImagePtr createImage (ThumbnailHandle thumbnail) const;
+
+	FORMAT getFormat () const { return m_format; }
+	size_t getSlotCount () const;
+	size_t getUsedSlotCount () const;
+
+	Stats getStats () const;
+	void traceStats () const;
+};
+
+
+#endif
@@ -0,0 +1,505 @@
+#include <assert.h>
+#include <process.h>
+#include <algorithm>
+#include "libxl/include/utilities.h"
+#include "ImageConfig.h"
+#include "ThumbnailStore.h"
+#include "PixelBufferPool.h"
+
+static const DWORD INDEX_MAGIC = ((DWORD)'I' << 24) | ((DWORD)'T' << 16) | ((DWORD)'L' << 8) | (DWORD)'X';
+static const DWORD INDEX_VERSION = 1;
+static const xl::tchar *INDEX_NAME = _T("xlview-thumbnails.idx");
+static const xl::tchar *DATA_NAME = _T("xlview-thumbnails.dat");
+static const xl::tchar *MUTEX_NAME = _T("xlview::ThumbnailStore");
+
+
+//////////////////////////////////////////////////////////////////////////
+// thread
+
+unsigned __stdcall CThumbnailStore::_WriteThread (void *param) {
+	CThumbnailStore *pThis = (CThumbnailStore *)param;
+	assert(pThis != NULL);
+	HANDLE hEvent = pThis->m_hEvents[THREAD_WRITE];
+	for (;;) {
+		::WaitForSingleObject(hEvent, INFINITE);
+		pThis->_WritePending();
+		if (pThis->m_exiting) {
+			break;
+		}
+	}
+
+	return 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// protected
+
+CThumbnailStore::CThumbnailStore ()
+	: m_hMutex(NULL)
+	, m_hIndexFile(INVALID_HANDLE_VALUE)
+	, m_hIndexMapping(NULL)
+	, m_mappedIndex(NULL)
+	, m_hDataFile(INVALID_HANDLE_VALUE)
+	, m_dataSize(0)
+	, m_opened(false)
+	, m_exiting(false)
+{
+}
+
+CThumbnailStore::~CThumbnailStore () {
+	assert(!m_opened);
+}
+
+xl::tstring CThumbnailStore::_GetPathName (const xl::tchar *name) {
+	xl::tstring pathName;
+	xl::tchar *profileDir = NULL;
+	size_t len = 0;
+	if (!_tdupenv_s(&profileDir, &len, _T("USERPROFILE")) && profileDir != NULL) {
+		pathName = profileDir;
+		free(profileDir);
+		profileDir = NULL;
+		xl::tchar lastChar = pathName.at(pathName.length() - 1);
+		if (lastChar != _T('\\') && lastChar != _T('/')) {
+			pathName += _T("\\");
+		}
+		pathName += name;
+	}
+
+	return pathName;
+}
+
+unsigned __int64 CThumbnailStore::_GetKey (const xl::tstring &fileName) {
+	// FNV-1a
+	unsigned __int64 key = 14695981039346656037ULL;
+	for (size_t i = 0; i < fileName.length(); ++ i) {
+		unsigned __int64 c = (unsigned __int64)_totlower(fileName.at(i));
+		key ^= c;
+		key *= 1099511628211ULL;
+	}
+	return key;
+}
+
+bool CThumbnailStore::_GetFileInfo (const xl::tstring &fileName, unsigned __int64 &fileTime, unsigned __int64 &fileSize) {
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!::GetFileAttributesEx(fileName.c_str(), GetFileExInfoStandard, &data)) {
+		return false;
+	}
+	fileTime = ((unsigned __int64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+	fileSize = ((unsigned __int64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	return true;
+}
+
+bool CThumbnailStore::_OpenFiles () {
+	assert(getLockLevel() > 0);
+	if (m_hMutex == NULL) {
+		m_hMutex = ::CreateMutex(NULL, FALSE, MUTEX_NAME);
+		if (m_hMutex == NULL) {
+			return false;
+		}
+	}
+
+	::WaitForSingleObject(m_hMutex, INFINITE);
+	bool opened = _OpenFiles(true);
+	::ReleaseMutex(m_hMutex);
+	return opened;
+}
+
+bool CThumbnailStore::_OpenFiles (bool compact) {
+	xl::tstring indexName = _GetPathName(INDEX_NAME);
+	xl::tstring dataName = _GetPathName(DATA_NAME);
+	if (indexName.length() == 0) {
+		return false;
+	}
+
+	m_hIndexFile = ::CreateFile(indexName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	m_hDataFile = ::CreateFile(dataName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_hIndexFile == INVALID_HANDLE_VALUE || m_hDataFile == INVALID_HANDLE_VALUE) {
+		XLTRACE(_T("** open the thumbnail store failed (%d)\n"), ::GetLastError());
+		_CloseFiles();
+		return false;
+	}
+
+	LARGE_INTEGER indexSize, dataSize;
+	::GetFileSizeEx(m_hIndexFile, &indexSize);
+	::GetFileSizeEx(m_hDataFile, &dataSize);
+	m_dataSize = dataSize.QuadPart;
+
+	// check the header, or start a new store
+	bool valid = false;
+	if (indexSize.QuadPart >= (LONGLONG)sizeof(IndexHeader)) {
+		m_hIndexMapping = ::CreateFileMapping(m_hIndexFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_hIndexMapping != NULL) {
+			m_mappedIndex = (const xl::uint8 *)::MapViewOfFile(m_hIndexMapping, FILE_MAP_READ, 0, 0, 0);
+		}
+		if (m_mappedIndex != NULL) {
+			const IndexHeader *header = (const IndexHeader *)m_mappedIndex;
+			valid = header->magic == INDEX_MAGIC && header->version == INDEX_VERSION
+				&& header->entrySize == sizeof(IndexEntry);
+		}
+	}
+
+	if (valid) {
+		size_t count = (size_t)((indexSize.QuadPart - sizeof(IndexHeader)) / sizeof(IndexEntry));
+		const IndexEntry *entries = (const IndexEntry *)(m_mappedIndex + sizeof(IndexHeader));
+		m_index.rehash(count);
+		for (size_t i = 0; i < count; ++ i) {
+			const IndexEntry *entry = entries + i;
+			unsigned __int64 bytes = (unsigned __int64)entry->width * entry->height * 3;
+			if (entry->offset + bytes <= m_dataSize) { // the later one replaces the earlier one
+				m_index[entry->key] = entry;
+			}
+		}
+		XLTRACE(_T("** thumbnail store opened, %d entries\n"), (int)m_index.size());
+		if (compact && _IsCompactNeeded(count)) {
+			_Compact();
+			return _OpenFiles(false);
+		}
+	} else {
+		if (m_mappedIndex != NULL) {
+			::UnmapViewOfFile(m_mappedIndex);
+			m_mappedIndex = NULL;
+		}
+		if (m_hIndexMapping != NULL) {
+			::CloseHandle(m_hIndexMapping);
+			m_hIndexMapping = NULL;
+		}
+
+		IndexHeader header = {INDEX_MAGIC, INDEX_VERSION, sizeof(IndexEntry), 0};
+		DWORD written = 0;
+		LARGE_INTEGER zero;
+		zero.QuadPart = 0;
+		::SetFilePointerEx(m_hIndexFile, zero, NULL, FILE_BEGIN);
+		::SetEndOfFile(m_hIndexFile);
+		::SetFilePointerEx(m_hDataFile, zero, NULL, FILE_BEGIN);
+		::SetEndOfFile(m_hDataFile);
+		m_dataSize = 0;
+		if (!::WriteFile(m_hIndexFile, &header, sizeof(header), &written, NULL) || written != sizeof(header)) {
+			_CloseFiles();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool CThumbnailStore::_IsCompactNeeded (size_t count) const {
+	assert(count >= m_index.size());
+	size_t dead = count - m_index.size();
+	return (dead >= (size_t)THUMBNAIL_STORE_DEAD_MIN && dead * 100 >= count * THUMBNAIL_STORE_DEAD_PERCENT)
+		|| m_dataSize > THUMBNAIL_STORE_MAX_BYTES;
+}
+
+// copy the newest live entries to the new files and replace the old ones, the
+// files are closed; the replacing fails if another instance has them opened
+bool CThumbnailStore::_Compact () {
+	typedef std::pair<unsigned __int64, const IndexEntry *> _Entry;
+	std::vector<_Entry> entries;
+	entries.reserve(m_index.size());
+	for (_Index::const_iterator it = m_index.begin(); it != m_index.end(); ++ it) {
+		entries.push_back(_Entry(it->second->offset, it->second));
+	}
+	std::sort(entries.begin(), entries.end()); // by the offset, the oldest first
+	unsigned __int64 keep = THUMBNAIL_STORE_MAX_BYTES * THUMBNAIL_STORE_KEEP_PERCENT / 100;
+	unsigned __int64 total = 0;
+	size_t first = entries.size();
+	while (first > 0) {
+		const IndexEntry *entry = entries[first - 1].second;
+		total += (unsigned __int64)entry->width * entry->height * 3;
+		if (total > keep) {
+			break;
+		}
+		-- first;
+	}
+
+	xl::tstring indexName = _GetPathName(INDEX_NAME);
+	xl::tstring dataName = _GetPathName(DATA_NAME);
+	xl::tstring indexTemp = indexName + _T(".tmp");
+	xl::tstring dataTemp = dataName + _T(".tmp");
+	HANDLE hIndex = ::CreateFile(indexTemp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	HANDLE hData = ::CreateFile(dataTemp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	bool ok = hIndex != INVALID_HANDLE_VALUE && hData != INVALID_HANDLE_VALUE;
+
+	IndexHeader header = {INDEX_MAGIC, INDEX_VERSION, sizeof(IndexEntry), 0};
+	DWORD written = 0;
+	ok = ok && ::WriteFile(hIndex, &header, sizeof(header), &written, NULL) && written == sizeof(header);
+	std::string pixels;
+	unsigned __int64 offset = 0;
+	for (size_t i = first; ok && i < entries.size(); ++ i) {
+		IndexEntry entry = *entries[i].second;
+		pixels.resize((size_t)entry.width * entry.height * 3);
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = (DWORD)entry.offset;
+		ov.OffsetHigh = (DWORD)(entry.offset >> 32);
+		DWORD read = 0;
+		ok = ::ReadFile(m_hDataFile, &pixels[0], (DWORD)pixels.length(), &read, &ov) && read == pixels.length()
+			&& ::WriteFile(hData, pixels.c_str(), (DWORD)pixels.length(), &written, NULL) && written == pixels.length();
+		entry.offset = offset;
+		offset += pixels.length();
+		ok = ok && ::WriteFile(hIndex, &entry, sizeof(entry), &written, NULL) && written == sizeof(entry);
+	}
+	if (hIndex != INVALID_HANDLE_VALUE) {
+		::CloseHandle(hIndex);
+	}
+	if (hData != INVALID_HANDLE_VALUE) {
+		::CloseHandle(hData);
+	}
+	_CloseFiles();
+
+	// the data first, and if the index can't be replaced then, it's deleted,
+	// so the old entries never refer to the new data
+	if (ok) {
+		ok = ::MoveFileEx(dataTemp.c_str(), dataName.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+		if (ok && !::MoveFileEx(indexTemp.c_str(), indexName.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+			::DeleteFile(indexName.c_str());
+			ok = false;
+		}
+	}
+	::DeleteFile(indexTemp.c_str());
+	::DeleteFile(dataTemp.c_str());
+	XLTRACE(_T("** thumbnail store compacted (%d), %d of %d entries kept\n"),
+		(int)ok, (int)(entries.size() - first), (int)entries.size());
+	return ok;
+}
+
+void CThumbnailStore::_CloseFiles () {
+	m_index.clear();
+	m_added.clear();
+	if (m_mappedIndex != NULL) {
+		::UnmapViewOfFile(m_mappedIndex);
+		m_mappedIndex = NULL;
+	}
+	if (m_hIndexMapping != NULL) {
+		::CloseHandle(m_hIndexMapping);
+		m_hIndexMapping = NULL;
+	}
+	if (m_hIndexFile != INVALID_HANDLE_VALUE) {
+		::CloseHandle(m_hIndexFile);
+		m_hIndexFile = INVALID_HANDLE_VALUE;
+	}
+	if (m_hDataFile != INVALID_HANDLE_VALUE) {
+		::CloseHandle(m_hDataFile);
+		m_hDataFile = INVALID_HANDLE_VALUE;
+	}
+}
+
+void CThumbnailStore::_WritePending () {
+	xl::CScopeLock lock(this);
+	_PendingEntries pending;
+	pending.swap(m_pending);
+	lock.unlock();
+	if (pending.empty()) {
+		return;
+	}
+
+	// only this thread writes the files of this instance, the other instances
+	// write them too, so the writes are serialized and always at the ends, the
+	// pixels first; the offsets are explicit because lookup() reads the data
+	// file at the same time; nothing is written over the cap
+	::WaitForSingleObject(m_hMutex, INFINITE);
+	LARGE_INTEGER li;
+	li.QuadPart = m_dataSize;
+	::GetFileSizeEx(m_hDataFile, &li);
+	unsigned __int64 offset = li.QuadPart;
+	size_t written_count = 0;
+	for (; written_count < pending.size() && offset < THUMBNAIL_STORE_MAX_BYTES; ++ written_count) {
+		PendingEntry &p = pending[written_count];
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = (DWORD)offset;
+		ov.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD written = 0;
+		if (!::WriteFile(m_hDataFile, p.pixels.c_str(), (DWORD)p.pixels.length(), &written, &ov)
+			|| written != p.pixels.length())
+		{
+			XLTRACE(_T("** write the thumbnail store failed (%d)\n"), ::GetLastError());
+			break;
+		}
+		p.entry.offset = offset;
+		offset += p.pixels.length();
+	}
+
+	li.QuadPart = 0;
+	::SetFilePointerEx(m_hIndexFile, li, NULL, FILE_END);
+	for (size_t i = 0; i < written_count; ++ i) {
+		DWORD written = 0;
+		if (!::WriteFile(m_hIndexFile, &pending[i].entry, sizeof(IndexEntry), &written, NULL)
+			|| written != sizeof(IndexEntry))
+		{
+			written_count = i;
+			break;
+		}
+	}
+	::ReleaseMutex(m_hMutex);
+
+	lock.lock(this);
+	m_dataSize = offset;
+	for (size_t i = 0; i < written_count; ++ i) {
+		m_added.push_back(pending[i].entry);
+		m_index[pending[i].entry.key] = &m_added.back();
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// public
+
+CThumbnailStore* CThumbnailStore::getInstance () {
+	static CThumbnailStore store;
+	return &store;
+}
+
+bool CThumbnailStore::open () {
+	xl::CScopeLock lock(this);
+	if (m_opened) {
+		return true;
+	}
+	if (!_OpenFiles()) {
+		return false;
+	}
+	m_opened = true;
+	m_exiting = false;
+	lock.unlock();
+
+	_CreateThreads();
+	return true;
+}
+
+void CThumbnailStore::close () {
+	xl::CScopeLock lock(this);
+	if (!m_opened) {
+		return;
+	}
+	lock.unlock();
+
+	_TerminateThreads(); // the pending thumbnails are written before the thread exits
+
+	lock.lock(this);
+	_CloseFiles();
+	m_pending.clear();
+	m_opened = false;
+	if (m_hMutex != NULL) {
+		::CloseHandle(m_hMutex);
+		m_hMutex = NULL;
+	}
+}
+
+CImagePtr CThumbnailStore::lookup (const xl::tstring &fileName, CSize &szImage) {
+	unsigned __int64 fileTime, fileSize;
+	if (!_GetFileInfo(fileName, fileTime, fileSize)) {
+		return CImagePtr();
+	}
+
+	xl::CScopeLock lock(this);
+	if (!m_opened) {
+		return CImagePtr();
+	}
+	_Index::iterator it = m_index.find(_GetKey(fileName));
+	if (it == m_index.end() || it->second->fileTime != fileTime || it->second->fileSize != fileSize) {
+		return CImagePtr();
+	}
+	IndexEntry entry = *it->second;
+	lock.unlock();
+
+	xl::ui::CDIBSectionPtr dib = CDIBSectionPool::getInstance()->create(entry.width, entry.height, 24, false);
+	if (dib == NULL) {
+		return CImagePtr();
+	}
+	size_t bytes = entry.width * 3;
+	std::string pixels;
+	pixels.resize(bytes * entry.height);
+	OVERLAPPED ov;
+	memset(&ov, 0, sizeof(ov));
+	ov.Offset = (DWORD)entry.offset;
+	ov.OffsetHigh = (DWORD)(entry.offset >> 32);
+	DWORD read = 0;
+	if (!::ReadFile(m_hDataFile, &pixels[0], (DWORD)pixels.length(), &read, &ov) || read != pixels.length()) {
+		return CImagePtr();
+	}
+	for (int y = 0; y < entry.height; ++ y) {
+		memcpy(dib->getLine(y), &pixels[y * bytes], bytes);
+	}
+
+	CImagePtr thumbnail(new CImage());
+	thumbnail->insertImage(dib, CImage::DELAY_INFINITE);
+	szImage = CSize(entry.imageWidth, entry.imageHeight);
+	return thumbnail;
+}
+
+void CThumbnailStore::add (const xl::tstring &fileName, CImagePtr thumbnail, CSize szImage) {
+	if (thumbnail == NULL || thumbnail->getImageCount() == 0 || szImage.cx <= 0 || szImage.cy <= 0) {
+		return;
+	}
+
+	PendingEntry p;
+	memset(&p.entry, 0, sizeof(p.entry));
+	if (!_GetFileInfo(fileName, p.entry.fileTime, p.entry.fileSize)) {
+		return;
+	}
+	xl::ui::CDIBSectionPtr dib = thumbnail->getImage(0);
+	int width = dib->getWidth();
+	int height = dib->getHeight();
+	int bytes = dib->getBitCounts() / 8;
+	if (bytes != 3 && bytes != 4) {
+		return;
+	}
+	p.entry.key = _GetKey(fileName);
+	p.entry.imageWidth = szImage.cx;
+	p.entry.imageHeight = szImage.cy;
+	p.entry.width = (WORD)width;
+	p.entry.height = (WORD)height;
+
+	// packed 24 bpp
+	p.pixels.resize(width * height * 3);
+	xl::uint8 *dst = (xl::uint8 *)&p.pixels[0];
+	for (int y = 0; y < height; ++ y) {
+		xl::uint8 *src = dib->getLine(y);
+		if (bytes == 3) {
+			memcpy(dst, src, width * 3);
+			dst += width * 3;
+		} else {
+			for (int x = 0; x < width; ++ x) {
+				*dst ++ = src[0];
+				*dst ++ = src[1];
+				*dst ++ = src[2];
+				src += 4;
+			}
+		}
+	}
+
+	xl::CScopeLock lock(this);
+	if (!m_opened) {
+		return;
+	}
+	m_pending.push_back(p);
+	lock.unlock();
+	_RunThread(THREAD_WRITE);
+}
+
+size_t CThumbnailStore::getEntryCount () const {
+	xl::CScopeLock lock(this);
+	return m_index.size();
+}
+
+const xl::tchar* CThumbnailStore::_GetThreadName () {
+	return _T("xlview::ThumbnailStore");
+}
+
+void CThumbnailStore::_AssignThreadProc () {
+	m_procThreads[THREAD_WRITE] = &_WriteThread;
+}
+
+void CThumbnailStore::_MarkThreadExit () {
+	m_exiting = true;
+}
+
+void CThumbnailStore::_Lock () {
+	lock();
+}
+
+void CThumbnailStore::_Unlock () {
+	unlock();
+}
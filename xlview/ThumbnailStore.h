@@ -0,0 +1,124 @@
+#ifndef XL_VIEW_THUMBNAIL_STORE_H
+#define XL_VIEW_THUMBNAIL_STORE_H
+#include <vector>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <Windows.h>
+#include <atltypes.h>
+#include "libxl/include/common.h"
+#include "libxl/include/string.h"
+#include "libxl/include/lockable.h"
+#include "ClassWithThreads.h"
+#include "Image.h"
+
+/**
+ * The thumbnails are saved in two files in the user profile directory, so
+ * they are not decoded again when a folder is reopened:
+ *
+ * xlview-thumbnails.idx: a header and the fixed-size entries, memory-mapped when opened
+ * xlview-thumbnails.dat: the packed pixels (24 bpp, no padding) of the thumbnails
+ *
+ * An entry is keyed by the hash of the path name, with the size and the last
+ * write time of the file, so a changed file is simply a miss. Both files are
+ * append-only, the new thumbnails are written by a background thread, the
+ * pixels before the entry, so an entry always refers to complete data.
+ *
+ * The files are shared by all the instances of xlview, the opening and the
+ * writing are serialized by a named mutex, and the writes are always at the
+ * ends of the files. When the store is opened and no other instance has it,
+ * it is compacted (see THUMBNAIL_STORE_DEAD_PERCENT), and nothing is added
+ * once the data file is over THUMBNAIL_STORE_MAX_BYTES.
+ */
+
+class CThumbnailStore
+	: public xl::CUserLock
+	, public ClassWithThreadT<CThumbnailStore, 1>
+{
+	friend class ClassWithThreadT<CThumbnailStore, 1>;
+protected:
+	struct IndexHeader {
+		DWORD          magic;
+		DWORD          version;
+		DWORD          entrySize;
+		DWORD          reserved;
+	};
+
+	struct IndexEntry {
+		unsigned __int64 key;         // hash of the path name (lower case)
+		unsigned __int64 fileTime;    // the last write time
+		unsigned __int64 fileSize;
+		unsigned __int64 offset;      // in the data file
+		DWORD          imageWidth;
+		DWORD          imageHeight;
+		WORD           width;         // of the thumbnail
+		WORD           height;
+		DWORD          reserved;
+	};
+
+	struct PendingEntry {
+		IndexEntry     entry;
+		std::string    pixels;
+	};
+
+	typedef std::tr1::unordered_map<unsigned __int64, const IndexEntry *>  _Index;
+	typedef std::list<IndexEntry>                  _AddedEntries;
+	typedef std::vector<PendingEntry>              _PendingEntries;
+
+	HANDLE             m_hMutex;  // among the instances
+	HANDLE             m_hIndexFile;
+	HANDLE             m_hIndexMapping;
+	const xl::uint8   *m_mappedIndex;
+	HANDLE             m_hDataFile;
+	unsigned __int64   m_dataSize;
+	_Index             m_index;
+	_AddedEntries      m_added;   // written after the index file is mapped
+	_PendingEntries    m_pending; // to be written
+	bool               m_opened;
+
+	CThumbnailStore ();
+	~CThumbnailStore ();
+
+	static xl::tstring _GetPathName (const xl::tchar *name);
+	static unsigned __int64 _GetKey (const xl::tstring &fileName);
+	static bool _GetFileInfo (const xl::tstring &fileName, unsigned __int64 &fileTime, unsigned __int64 &fileSize);
+
+	bool _OpenFiles ();
+	bool _OpenFiles (bool compact);
+	bool _IsCompactNeeded (size_t count) const;
+	bool _Compact ();
+	void _CloseFiles ();
+	void _WritePending ();
+
+	//////////////////////////////////////////////////////////////////////////
+	// thread related
+	bool m_exiting;
+	static unsigned __stdcall _WriteThread (void *);
+
+	// used by ClassWithThreads
+	enum {
+		THREAD_WRITE,
+		THREAD_COUNT
+	};
+	const xl::tchar* _GetThreadName();
+	void _AssignThreadProc();
+	void _MarkThreadExit();
+	void _Lock();
+	void _Unlock();
+
+public:
+	static CThumbnailStore* getInstance ();
+
+	// open the files and start the writer, close() writes the pending thumbnails
+	bool open ();
+	void close ();
+
+	// returns a 24 bpp thumbnail, and the size of the image
+	CImagePtr lookup (const xl::tstring &fileName, CSize &szImage);
+	void add (const xl::tstring &fileName, CImagePtr thumbnail, CSize szImage);
+
+	size_t getEntryCount () const;
+};
+
+
+#endif
@@ -1,9 +1,12 @@
 #include <assert.h>
+#include <algorithm>
+#include "libxl/include/utilities.h"
 #include "libxl/include/ui/Gdi.h"
 #include "libxl/include/ui/CtrlMain.h"
 #include "libxl/include/ui/CtrlTarget.h"
 #include "CommandId.h"
 #include "ThumbnailView.h"
+#include "ThumbnailAtlas.h"
 
 static const int TV_WIDTH = 60;
 static const int TV_HEIGHT = 80;
@@ -13,7 +16,7 @@ static const int TV_PADDING_ACTIVE = 4;
 
 //////////////////////////////////////////////////////////////////////////
 // 
-CThumbnailView::_CThumbnail::_CThumbnail (int index, CRect rc, CImagePtr thumbnail)
+CThumbnailView::_CThumbnail::_CThumbnail (int index, CRect rc, ThumbnailHandle thumbnail)
 	: m_index(index), m_rect(rc), m_thumbnail(thumbnail)
 {
 
@@ -32,20 +35,19 @@ CRect CThumbnailView::_CThumbnail::getRect () const {
 }
 
 bool CThumbnailView::_CThumbnail::hasThumbnail () const {
-	return m_thumbnail != NULL;
+	return CThumbnailAtlas::getInstance()->isValid(m_thumbnail);
 }
 
-void CThumbnailView::_CThumbnail::setThumbnail (CImagePtr thumbnail) {
+void CThumbnailView::_CThumbnail::setThumbnail (ThumbnailHandle thumbnail) {
 	m_thumbnail = thumbnail;
 }
 
 void CThumbnailView::_CThumbnail::draw (HDC hdc, int currIndex, int hoverIndex) {
-	if (m_thumbnail == NULL) {
-		return;
+	CThumbnailAtlas *atlas = CThumbnailAtlas::getInstance();
+	CSize szImage = atlas->getSize(m_thumbnail);
+	if (szImage.cx <= 0 || szImage.cy <= 0) {
+		return; // not loaded, or released
 	}
-	xl::ui::CDIBSectionPtr thumbnail = m_thumbnail->getImage(0);
-	assert(thumbnail != NULL);
-	CSize szImage = m_thumbnail->getImageSize();
 	CRect rc = m_rect;
 	if (currIndex != m_index && hoverIndex != m_index) {
 		rc.DeflateRect(TV_PADDING, TV_PADDING, TV_PADDING, TV_PADDING);
@@ -59,15 +61,9 @@ void CThumbnailView::_CThumbnail::draw (HDC hdc, int currIndex, int hoverIndex)
 	int y = rc.top + (rc.Height() - szDraw.cy) / 2;
 
 	xl::ui::CDCHandle dc(hdc);
-	xl::ui::CDC mdc;
-	mdc.CreateCompatibleDC(dc);
-
-	xl::ui::CDIBSectionHelper helper(thumbnail, mdc);
 	int oldMode = dc.SetStretchBltMode(HALFTONE);
-	dc.StretchBlt(x, y, szDraw.cx, szDraw.cy,
-		mdc, 0, 0, thumbnail->getWidth(), thumbnail->getHeight(), SRCCOPY);
+	atlas->draw(m_thumbnail, dc, CRect(x, y, x + szDraw.cx, y + szDraw.cy));
 	dc.SetStretchBltMode(oldMode);
-	helper.detach();
 
 	if (currIndex == m_index || hoverIndex == m_index) {
 		rc = m_rect;
@@ -99,14 +95,14 @@ void CThumbnailView::_CreateThumbnailList () {
 	int x2 = x1;
 	int y2 = rc.bottom;
 	int index = -1;
-	CImagePtr thumbnail;
+	ThumbnailHandle thumbnail;
 
 	// 1. current
 	x1 -= TV_WIDTH / 2;
 	x2 = x1 + TV_WIDTH;
 	index = m_currIndex;
 	thumbnail = m_pImageManager->getThumbnail(index);
-	m_thumbnails.push_back(_CThumbnailPtr(new _CThumbnail(index, CRect(x1, y1, x2, y2), thumbnail)));
+	m_thumbnails.push_back(_CThumbnail(index, CRect(x1, y1, x2, y2), thumbnail));
 
 	// 2. left
 	while (x2 > rc.left && index > 0) {
@@ -114,7 +110,7 @@ void CThumbnailView::_CreateThumbnailList () {
 		x1 -= TV_WIDTH;
 		index --;
 		thumbnail = m_pImageManager->getThumbnail(index);
-		m_thumbnails.push_back(_CThumbnailPtr(new _CThumbnail(index, CRect(x1, y1, x2, y2), thumbnail)));
+		m_thumbnails.push_back(_CThumbnail(index, CRect(x1, y1, x2, y2), thumbnail));
 	}
 
 	// 3. right
@@ -127,25 +123,37 @@ void CThumbnailView::_CreateThumbnailList () {
 		x1 = x2 + TV_MARGIN;
 		x2 = x1 + TV_WIDTH;
 		thumbnail = m_pImageManager->getThumbnail(index);
-		m_thumbnails.push_back(_CThumbnailPtr(new _CThumbnail(index, CRect(x1, y1, x2, y2), thumbnail)));
+		m_thumbnails.push_back(_CThumbnail(index, CRect(x1, y1, x2, y2), thumbnail));
 		index ++;
 	}
+
+	// 4. the visible ones are loaded first, and the ones where the sliding
+	// ends, the others (off the screen now) are canceled
+	int first = m_currIndex, last = m_currIndex;
+	for (_Thumbnails::iterator it = m_thumbnails.begin(); it != m_thumbnails.end(); ++ it) {
+		first = min(first, it->getIndex());
+		last = max(last, it->getIndex());
+	}
+	int targetFirst = max(0, m_targetIndex - (m_currIndex - first));
+	int targetLast = min(count - 1, m_targetIndex + (last - m_currIndex));
+	m_pImageManager->setVisibleThumbnails(first, last, targetFirst, targetLast);
 }
 
-void CThumbnailView::_OnThumbnailLoaded (int index) {
+void CThumbnailView::_OnThumbnailLoaded (const CImageManager::Indexes &indexes) {
 	assert(m_pImageManager->getLockLevel() > 0);
 	assert(getLockLevel() > 0);
 
+	bool changed = false;
 	for (_Thumbnails::iterator it = m_thumbnails.begin(); it != m_thumbnails.end(); ++ it) {
-		if ((*it)->getIndex() == index) {
-			if (!(*it)->hasThumbnail()) {
-				CImagePtr thumbnail = m_pImageManager->getThumbnail(index);
-				(*it)->setThumbnail(thumbnail);
-				invalidate();
-			}
-			break;
+		int index = it->getIndex();
+		if (!it->hasThumbnail() && std::find(indexes.begin(), indexes.end(), index) != indexes.end()) {
+			it->setThumbnail(m_pImageManager->getThumbnail(index));
+			changed = true;
 		}
 	}
+	if (changed) {
+		invalidate();
+	}
 }
 
 void CThumbnailView::_ProcessSlide () {
@@ -184,9 +192,19 @@ void CThumbnailView::drawMe (HDC hdc) {
 	CRect rc = getClientRect();
 	xl::ui::CDCHandle dc(hdc);
 
-	CScopeMultiLock lock(this, true);
+	CThumbnailAtlas *atlas = CThumbnailAtlas::getInstance();
+	CThumbnailAtlas::Stats stats = atlas->getStats();
+	xl::CTimerLogger logger(_T("** draw %d thumbnails cost"), m_thumbnails.size());
+
+	CScopeMultiLock lock(this, false); // don't wait for the manager, the atlas has its own lock
 	for (_Thumbnails::iterator it = m_thumbnails.begin(); it != m_thumbnails.end(); ++ it) {
-		(*it)->draw(hdc, m_targetIndex, m_hoverIndex);
+		it->draw(hdc, m_targetIndex, m_hoverIndex);
+	}
+
+	if (atlas->getFormat() == CThumbnailAtlas::FORMAT_RGB565) {
+		CThumbnailAtlas::Stats now = atlas->getStats();
+		XLTRACE(_T("** expand %d RGB565 thumbnails cost %.3f ms\n"),
+			(int)(now.expanded - stats.expanded), now.expandTime - stats.expandTime);
 	}
 }
 
@@ -203,8 +221,8 @@ void CThumbnailView::onLButtonDown (CPoint pt, xl::uint) {
 	}
 	int currIndex = m_currIndex;
 	for (_Thumbnails::iterator it = m_thumbnails.begin(); it != m_thumbnails.end(); ++ it) {
-		if ((*it)->getRect().PtInRect(pt)) {
-			index = (*it)->getIndex();
+		if (it->getRect().PtInRect(pt)) {
+			index = it->getIndex();
 			break;
 		}
 	}
@@ -231,8 +249,8 @@ void CThumbnailView::onMouseMove (CPoint pt, xl::uint) {
 	CScopeMultiLock lock(this, false);
 	int hover = -1;
 	for (_Thumbnails::iterator it = m_thumbnails.begin(); it != m_thumbnails.end(); ++ it) {
-		if ((*it)->getRect().PtInRect(pt)) {
-			hover = (*it)->getIndex();
+		if (it->getRect().PtInRect(pt)) {
+			hover = it->getIndex();
 			break;
 		}
 	}
@@ -284,9 +302,11 @@ void CThumbnailView::onEvent (EVT evt, void *param) {
 		break;
 	case CImageManager::EVT_IMAGE_LOADED:
 		break;
+	case CImageManager::EVT_SUITABLE_LOADED:
+		break;
 	case CImageManager::EVT_THUMBNAIL_LOADED:
 		assert(param);
-		_OnThumbnailLoaded(*(int *)param);
+		_OnThumbnailLoaded(*(CImageManager::Indexes *)param);
 		break;
 	case CImageManager::EVT_FILELIST_READY:
 		break;
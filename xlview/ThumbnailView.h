@@ -17,19 +17,18 @@ class CThumbnailView
 	class _CThumbnail {
 		int        m_index;
 		CRect      m_rect;
-		CImagePtr  m_thumbnail;
+		ThumbnailHandle m_thumbnail; // read from the atlas when drawing
 	public:
-		_CThumbnail (int index, CRect rc, CImagePtr thumbnail);
+		_CThumbnail (int index, CRect rc, ThumbnailHandle thumbnail);
 		~_CThumbnail ();
 		int getIndex () const;
 		CRect getRect () const;
 		bool hasThumbnail () const;
-		void setThumbnail (CImagePtr);
+		void setThumbnail (ThumbnailHandle);
 
 		void draw (HDC hdc, int currIndex, int hoverIndex);
 	};
-	typedef std::tr1::shared_ptr<_CThumbnail>      _CThumbnailPtr;
-	typedef std::vector<_CThumbnailPtr>            _Thumbnails;
+	typedef std::vector<_CThumbnail>               _Thumbnails;
 
 	CImageManager     *m_pImageManager;
 	int                m_targetIndex;
@@ -39,7 +38,7 @@ class CThumbnailView
 	_Thumbnails        m_thumbnails;
 
 	void _CreateThumbnailList ();
-	void _OnThumbnailLoaded (int);
+	void _OnThumbnailLoaded (const CImageManager::Indexes &indexes);
 	void _ProcessSlide ();
 
 public:
@@ -0,0 +1,364 @@
+#include <assert.h>
+#include <math.h>
+#include <Windows.h>
+#include "libxl/include/utilities.h"
+#include "ImageConfig.h"
+#include "PixelBufferPool.h"
+#include "TiledImage.h"
+
+
+//////////////////////////////////////////////////////////////////////////
+// CTileCache::Tile
+CTileCache::Tile::Tile ()
+	: data(NULL)
+	, bytes(0)
+	, offset(-1)
+	, dirty(false)
+	, cached(false)
+{
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CTileCache
+
+CTileCache::CTileCache ()
+	: m_budget(TILE_CACHE_BUDGET)
+	, m_used(0)
+	, m_hSwapFile(INVALID_HANDLE_VALUE)
+	, m_swapSize(0)
+{
+}
+
+CTileCache::~CTileCache () {
+	assert(m_lru.size() == 0);
+	if (m_hSwapFile != INVALID_HANDLE_VALUE) {
+		::CloseHandle(m_hSwapFile); // FILE_FLAG_DELETE_ON_CLOSE
+		m_hSwapFile = INVALID_HANDLE_VALUE;
+	}
+}
+
+bool CTileCache::_OpenSwapFile () {
+	if (m_hSwapFile != INVALID_HANDLE_VALUE) {
+		return true;
+	}
+
+	xl::tchar path[MAX_PATH], name[MAX_PATH];
+	if (::GetTempPath(MAX_PATH, path) == 0 || ::GetTempFileName(path, _T("xlv"), 0, name) == 0) {
+		return false;
+	}
+	m_hSwapFile = ::CreateFile(name, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	return m_hSwapFile != INVALID_HANDLE_VALUE;
+}
+
+bool CTileCache::_SwapOut (Tile *tile) {
+	assert(getLockLevel() > 0);
+	assert(tile->data != NULL);
+	if (tile->dirty || tile->offset == -1) {
+		if (!_OpenSwapFile()) {
+			return false;
+		}
+		if (tile->offset == -1) {
+			if (m_freeOffsets.size() > 0) {
+				tile->offset = m_freeOffsets.back();
+				m_freeOffsets.pop_back();
+			} else {
+				// the slots are all TILE_BYTES, so the freed ones fit any tile
+				tile->offset = m_swapSize;
+				m_swapSize += TILE_BYTES;
+			}
+		}
+
+		LARGE_INTEGER li;
+		li.QuadPart = tile->offset;
+		DWORD written = 0;
+		if (!::SetFilePointerEx(m_hSwapFile, li, NULL, FILE_BEGIN)
+			|| !::WriteFile(m_hSwapFile, tile->data, (DWORD)tile->bytes, &written, NULL)
+			|| written != tile->bytes)
+		{
+			XLTRACE(_T("** swap out tile failed (%d)\n"), ::GetLastError());
+			return false;
+		}
+		tile->dirty = false;
+	}
+
+	CPixelBufferPool::getInstance()->release(tile->data, tile->bytes);
+	tile->data = NULL;
+	m_used -= tile->bytes;
+	return true;
+}
+
+bool CTileCache::_SwapIn (Tile *tile) {
+	assert(getLockLevel() > 0);
+	assert(tile->data != NULL && tile->offset != -1);
+	LARGE_INTEGER li;
+	li.QuadPart = tile->offset;
+	DWORD read = 0;
+	return ::SetFilePointerEx(m_hSwapFile, li, NULL, FILE_BEGIN)
+		&& ::ReadFile(m_hSwapFile, tile->data, (DWORD)tile->bytes, &read, NULL)
+		&& read == tile->bytes;
+}
+
+void CTileCache::_Shrink (Tile *except) {
+	assert(getLockLevel() > 0);
+	_Tiles::iterator it = m_lru.end();
+	while (m_used > m_budget && it != m_lru.begin()) {
+		-- it;
+		Tile *tile = *it;
+		if (tile == except) {
+			continue;
+		}
+		if (!_SwapOut(tile)) {
+			break; // keep it in memory, and we are over the budget
+		}
+		tile->cached = false;
+		it = m_lru.erase(it);
+	}
+}
+
+CTileCache* CTileCache::getInstance () {
+	static CTileCache cache;
+	return &cache;
+}
+
+void CTileCache::setBudget (size_t bytes) {
+	xl::CScopeLock lock(this);
+	m_budget = bytes;
+	_Shrink(NULL);
+}
+
+size_t CTileCache::getBudget () const {
+	xl::CScopeLock lock(this);
+	return m_budget;
+}
+
+size_t CTileCache::getUsedBytes () const {
+	xl::CScopeLock lock(this);
+	return m_used;
+}
+
+xl::uint8* CTileCache::acquire (Tile *tile, bool forWrite) {
+	assert(getLockLevel() > 0);
+	assert(tile != NULL && tile->bytes > 0 && tile->bytes <= TILE_BYTES);
+	if (tile->data == NULL) {
+		CPixelBufferPool *pool = CPixelBufferPool::getInstance();
+		tile->data = (xl::uint8 *)pool->allocate(tile->bytes);
+		if (tile->data == NULL) {
+			_Shrink(NULL);
+			tile->data = (xl::uint8 *)pool->allocate(tile->bytes);
+			if (tile->data == NULL) {
+				return NULL;
+			}
+		}
+
+		if (tile->offset == -1) {
+			memset(tile->data, 0, tile->bytes);
+		} else if (!_SwapIn(tile)) {
+			// the pixels are lost, fail the reading instead of showing a black tile
+			XLTRACE(_T("** swap in tile failed (%d)\n"), ::GetLastError());
+			pool->release(tile->data, tile->bytes);
+			tile->data = NULL;
+			return NULL;
+		}
+		m_used += tile->bytes;
+	}
+
+	if (tile->cached) {
+		m_lru.erase(tile->it);
+	}
+	m_lru.push_front(tile);
+	tile->it = m_lru.begin();
+	tile->cached = true;
+	if (forWrite) {
+		tile->dirty = true;
+	}
+
+	_Shrink(tile);
+	return tile->data;
+}
+
+void CTileCache::remove (Tile *tile) {
+	xl::CScopeLock lock(this);
+	if (tile->cached) {
+		m_lru.erase(tile->it);
+		tile->cached = false;
+	}
+	if (tile->data != NULL) {
+		CPixelBufferPool::getInstance()->release(tile->data, tile->bytes);
+		tile->data = NULL;
+		m_used -= tile->bytes;
+	}
+	if (tile->offset != -1) {
+		m_freeOffsets.push_back(tile->offset);
+		tile->offset = -1;
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CTiledImage
+
+CRect CTiledImage::_GetTileRect (int col, int row) const {
+	int x = col * CTileCache::TILE_SIZE;
+	int y = row * CTileCache::TILE_SIZE;
+	int w = m_width - x < CTileCache::TILE_SIZE ? m_width - x : CTileCache::TILE_SIZE;
+	int h = m_height - y < CTileCache::TILE_SIZE ? m_height - y : CTileCache::TILE_SIZE;
+	return CRect(x, y, x + w, y + h);
+}
+
+CTiledImage::CTiledImage (int width, int height, int bitcount)
+	: m_width(width)
+	, m_height(height)
+	, m_bitcount(bitcount)
+{
+	assert(width > 0 && height > 0);
+	assert(bitcount == 24 || bitcount == 32);
+	m_cols = (width + CTileCache::TILE_SIZE - 1) / CTileCache::TILE_SIZE;
+	m_rows = (height + CTileCache::TILE_SIZE - 1) / CTileCache::TILE_SIZE;
+	m_tiles.resize(m_cols * m_rows);
+	// the 24 bpp tiles take 3/4 of the budget of the 32 bpp ones
+	size_t bytes = CTileCache::TILE_SIZE * CTileCache::TILE_SIZE * (bitcount / 8);
+	for (_Tiles::iterator it = m_tiles.begin(); it != m_tiles.end(); ++ it) {
+		it->bytes = bytes;
+	}
+}
+
+CTiledImage::~CTiledImage () {
+	CTileCache *pCache = CTileCache::getInstance();
+	for (_Tiles::iterator it = m_tiles.begin(); it != m_tiles.end(); ++ it) {
+		pCache->remove(&*it);
+	}
+}
+
+bool CTiledImage::writeLines (int y, xl::ui::CDIBSection *src, int lines) {
+	assert(src != NULL && src->getWidth() == m_width && src->getBitCounts() == m_bitcount);
+	assert(y >= 0 && lines > 0 && y + lines <= m_height && lines <= src->getHeight());
+	const int bytes = m_bitcount / 8;
+	const int tile_stride = CTileCache::TILE_SIZE * bytes;
+	CTileCache *pCache = CTileCache::getInstance();
+
+	xl::CScopeLock lock(pCache);
+	int row_begin = y / CTileCache::TILE_SIZE;
+	int row_end = (y + lines - 1) / CTileCache::TILE_SIZE;
+	for (int row = row_begin; row <= row_end; ++ row) {
+		for (int col = 0; col < m_cols; ++ col) {
+			CRect rcTile = _GetTileRect(col, row);
+			int y0 = rcTile.top > y ? rcTile.top : y;
+			int y1 = rcTile.bottom < y + lines ? rcTile.bottom : y + lines;
+			xl::uint8 *data = pCache->acquire(&m_tiles[row * m_cols + col], true);
+			if (data == NULL) {
+				return false;
+			}
+			for (int line = y0; line < y1; ++ line) {
+				xl::uint8 *dst_line = data + (line - rcTile.top) * tile_stride;
+				xl::uint8 *src_line = src->getLine(line - y) + rcTile.left * bytes;
+				memcpy(dst_line, src_line, rcTile.Width() * bytes);
+			}
+		}
+	}
+
+	return true;
+}
+
+bool CTiledImage::readRect (xl::ui::CDIBSection *dst, int dx, int dy, CRect rcSrc) {
+	assert(dst != NULL && dst->getBitCounts() == m_bitcount);
+	rcSrc.IntersectRect(rcSrc, CRect(0, 0, m_width, m_height));
+	if (rcSrc.IsRectEmpty()) {
+		return false;
+	}
+	assert(dx + rcSrc.Width() <= dst->getWidth() && dy + rcSrc.Height() <= dst->getHeight());
+	const int bytes = m_bitcount / 8;
+	const int tile_stride = CTileCache::TILE_SIZE * bytes;
+	CTileCache *pCache = CTileCache::getInstance();
+
+	xl::CScopeLock lock(pCache);
+	for (int row = rcSrc.top / CTileCache::TILE_SIZE; row <= (rcSrc.bottom - 1) / CTileCache::TILE_SIZE; ++ row) {
+		for (int col = rcSrc.left / CTileCache::TILE_SIZE; col <= (rcSrc.right - 1) / CTileCache::TILE_SIZE; ++ col) {
+			CRect rcTile = _GetTileRect(col, row);
+			CRect rc;
+			rc.IntersectRect(rcTile, rcSrc);
+			xl::uint8 *data = pCache->acquire(&m_tiles[row * m_cols + col], false);
+			if (data == NULL) {
+				return false;
+			}
+			for (int line = rc.top; line < rc.bottom; ++ line) {
+				xl::uint8 *src_line = data + (line - rcTile.top) * tile_stride + (rc.left - rcTile.left) * bytes;
+				xl::uint8 *dst_line = dst->getLine(dy + line - rcSrc.top) + (dx + rc.left - rcSrc.left) * bytes;
+				memcpy(dst_line, src_line, rc.Width() * bytes);
+			}
+		}
+	}
+
+	return true;
+}
+
+CImagePtr CTiledImage::resize (int width, int height, bool highQuality, xl::ILongTimeRunCallback *pCallback) {
+	assert(width > 0 && height > 0);
+	CDIBSectionPool *pool = CDIBSectionPool::getInstance();
+	xl::ui::CDIBSectionPtr dib = pool->create(width, height, m_bitcount, false);
+	if (!dib) {
+		return CImagePtr();
+	}
+
+	const int bytes = m_bitcount / 8;
+	double sx = (double)width / (double)m_width;
+	double sy = (double)height / (double)m_height;
+	xl::ui::CDIBSection::RESIZE_TYPE rt = xl::ui::CDIBSection::RT_FAST;
+	if (highQuality) {
+		rt = sx > 0.33 ? xl::ui::CDIBSection::RT_BICUBIC : xl::ui::CDIBSection::RT_BOX;
+	}
+	// the filter radius (2 of the bicubic) in the result, so the pixels near the
+	// tile edges are filtered with their neighbours in the other tiles
+	int mx = (int)ceil(2 * (sx > 1 ? sx : 1)) + 1;
+	int my = (int)ceil(2 * (sy > 1 ? sy : 1)) + 1;
+	for (int row = 0; row < m_rows; ++ row) {
+		for (int col = 0; col < m_cols; ++ col) {
+			if (pCallback && pCallback->shouldStop()) {
+				pool->recycle(dib);
+				return CImagePtr();
+			}
+
+			// the edges are floor(x * scale) of the same scale for all the tiles,
+			// so the areas of the neighbours never overlap or leave a gap
+			CRect rcTile = _GetTileRect(col, row);
+			CRect rcDst((int)((__int64)rcTile.left * width / m_width), (int)((__int64)rcTile.top * height / m_height),
+			            (int)((__int64)rcTile.right * width / m_width), (int)((__int64)rcTile.bottom * height / m_height));
+			if (rcDst.IsRectEmpty()) {
+				continue;
+			}
+
+			// resize the tile with the margin, and keep the inner part only
+			CRect rcPiece(rcDst);
+			rcPiece.InflateRect(mx, my);
+			rcPiece.IntersectRect(rcPiece, CRect(0, 0, width, height));
+			CRect rcSrc((int)((__int64)rcPiece.left * m_width / width), (int)((__int64)rcPiece.top * m_height / height),
+			            (int)(((__int64)rcPiece.right * m_width + width - 1) / width),
+			            (int)(((__int64)rcPiece.bottom * m_height + height - 1) / height));
+			xl::ui::CDIBSectionPtr src = pool->create(rcSrc.Width(), rcSrc.Height(), m_bitcount, false);
+			xl::ui::CDIBSectionPtr piece = pool->create(rcPiece.Width(), rcPiece.Height(), m_bitcount, false);
+			bool ok = src && piece && readRect(src.get(), 0, 0, rcSrc) && src->resize(piece.get(), rt, pCallback);
+			if (ok) {
+				int dx = rcDst.left - rcPiece.left;
+				int dy = rcDst.top - rcPiece.top;
+				for (int y = 0; y < rcDst.Height(); ++ y) {
+					memcpy(dib->getLine(rcDst.top + y) + rcDst.left * bytes, piece->getLine(dy + y) + dx * bytes, rcDst.Width() * bytes);
+				}
+			}
+			if (src) {
+				pool->recycle(src);
+			}
+			if (piece) {
+				pool->recycle(piece);
+			}
+			if (!ok) {
+				pool->recycle(dib);
+				return CImagePtr();
+			}
+		}
+	}
+
+	CImagePtr image(new CImage());
+	image->insertImage(dib, CImage::DELAY_INFINITE);
+	return image;
+}
@@ -0,0 +1,110 @@
+#ifndef XL_VIEW_TILED_IMAGE_H
+#define XL_VIEW_TILED_IMAGE_H
+#include <vector>
+#include <list>
+#include <memory>
+#include <Windows.h>
+#include <atltypes.h>
+#include "libxl/include/common.h"
+#include "libxl/include/interfaces.h"
+#include "libxl/include/lockable.h"
+#include "libxl/include/ui/DIBSection.h"
+#include "Image.h"
+
+/**
+ * For the very large images (panoramas, scans, ...), the pixels are stored in
+ * fixed-size tiles instead of one contiguous DIB section. All the tiles share
+ * one memory budget (see CTileCache), the least recently used ones are swapped
+ * out to a temporary file and read back on demand.
+ */
+
+//////////////////////////////////////////////////////////////////////////
+// CTileCache
+
+class CTileCache : public xl::CUserLock
+{
+public:
+	struct Tile {
+		xl::uint8     *data;      // NULL if not in memory
+		size_t         bytes;     // TILE_SIZE * TILE_SIZE pixels of the bitcount of the image
+		__int64        offset;    // offset in the swap file, -1 if never swapped out
+		bool           dirty;     // changed since the last swapping out
+		bool           cached;    // in the LRU list
+		std::list<Tile *>::iterator it;
+
+		Tile ();
+	};
+
+protected:
+	typedef std::list<Tile *>                      _Tiles;
+	typedef std::vector<__int64>                   _Offsets;
+
+	size_t             m_budget;
+	size_t             m_used;
+	_Tiles             m_lru; // the front is the most recently used
+	HANDLE             m_hSwapFile;
+	__int64            m_swapSize;
+	_Offsets           m_freeOffsets;
+
+	CTileCache ();
+	~CTileCache ();
+
+	bool _OpenSwapFile ();
+	bool _SwapOut (Tile *tile);
+	bool _SwapIn (Tile *tile);
+	void _Shrink (Tile *except);
+
+public:
+	enum {
+		TILE_SIZE = 256,
+		TILE_BYTES = TILE_SIZE * TILE_SIZE * 4 // the max bytes of one tile (32 bpp), and of one slot in the swap file
+	};
+
+	static CTileCache* getInstance ();
+
+	void setBudget (size_t bytes);
+	size_t getBudget () const;
+	size_t getUsedBytes () const;
+
+	// must be called in lock, returns the tile data (tile->bytes), or NULL if out
+	// of memory, or the tile can't be read back from the swap file
+	xl::uint8* acquire (Tile *tile, bool forWrite);
+	void remove (Tile *tile);
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// CTiledImage
+
+class CTiledImage
+{
+	typedef std::vector<CTileCache::Tile>          _Tiles;
+
+	int                m_width;
+	int                m_height;
+	int                m_bitcount;
+	int                m_cols;
+	int                m_rows;
+	_Tiles             m_tiles;
+
+	CRect _GetTileRect (int col, int row) const;
+
+public:
+	CTiledImage (int width, int height, int bitcount);
+	~CTiledImage ();
+
+	int getWidth () const { return m_width; }
+	int getHeight () const { return m_height; }
+	int getBitCounts () const { return m_bitcount; }
+
+	// copy @lines lines from @src (starting from line 0) to the line @y of the image
+	bool writeLines (int y, xl::ui::CDIBSection *src, int lines);
+	// copy the area @rcSrc of the image to (@dx, @dy) of @dst
+	bool readRect (xl::ui::CDIBSection *dst, int dx, int dy, CRect rcSrc);
+
+	// resize the whole image tile by tile, the result is a normal (not tiled) image
+	CImagePtr resize (int width, int height, bool highQuality, xl::ILongTimeRunCallback *pCallback = NULL);
+};
+
+
+#endif
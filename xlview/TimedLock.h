@@ -0,0 +1,85 @@
+#ifndef XL_VIEW_TIMED_LOCK_H
+#define XL_VIEW_TIMED_LOCK_H
+#include <Windows.h>
+#include "libxl/include/common.h"
+#include "libxl/include/lockable.h"
+#include "libxl/include/utilities.h"
+
+/**
+ * xl::CUserLock which measures how long it is held (from the outermost
+ * lock() to the last unlock()), to find the paths holding it too long.
+ */
+class CTimedUserLock : public xl::CUserLock
+{
+public:
+	struct HoldStats {
+		size_t         count;
+		double         total;     // in milliseconds
+		double         max;
+		size_t         slow;      // held longer than SLOW_HOLD_TIME
+
+		HoldStats () {
+			memset(this, 0, sizeof(*this));
+		}
+	};
+
+	enum {
+		SLOW_HOLD_TIME = 16 // ms, one frame
+	};
+
+protected:
+	mutable LONGLONG   m_lockTime;
+	mutable HoldStats  m_holdStats; // changed in lock
+
+	static double _GetElapsed (LONGLONG from) {
+		LARGE_INTEGER now, frequency;
+		::QueryPerformanceCounter(&now);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)(now.QuadPart - from) * 1000.0 / frequency.QuadPart;
+	}
+
+public:
+	CTimedUserLock () : m_lockTime(0) {}
+
+	virtual void lock () const {
+		xl::CUserLock::lock();
+		if (getLockLevel() == 1) {
+			LARGE_INTEGER now;
+			::QueryPerformanceCounter(&now);
+			m_lockTime = now.QuadPart;
+		}
+	}
+
+	virtual void unlock () const {
+		if (getLockLevel() == 1) {
+			double elapsed = _GetElapsed(m_lockTime);
+			m_holdStats.count ++;
+			m_holdStats.total += elapsed;
+			if (elapsed > m_holdStats.max) {
+				m_holdStats.max = elapsed;
+			}
+			if (elapsed > SLOW_HOLD_TIME) {
+				m_holdStats.slow ++;
+				XLTRACE(_T("** the lock is held for %.2f ms by thread %d\n"), elapsed, ::GetCurrentThreadId());
+			}
+		}
+		xl::CUserLock::unlock();
+	}
+
+	HoldStats getHoldStats () const {
+		xl::CScopeLock lock(this);
+		return m_holdStats;
+	}
+
+	void traceHoldStats (const xl::tchar *name) const {
+		HoldStats stats = getHoldStats();
+		XLTRACE(_T("** %s lock: held %d times, avg %.3f ms, max %.2f ms, %d slow\n"),
+			name, (int)stats.count, stats.count > 0 ? stats.total / stats.count : 0.0,
+			stats.max, (int)stats.slow);
+		XL_PARAMETER_NOT_USED(stats);
+		XL_PARAMETER_NOT_USED(name);
+	}
+};
+
+
+#endif
@@ -0,0 +1,322 @@
+#include <assert.h>
+#include <stdio.h>
+#include <setjmp.h>
+#include <math.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+#ifdef XLVIEW_SYSTEM_CODECS
+#include <jpeglib.h>
+#include <png.h>
+#else
+#include <basetsd.h>
+#include "../../libs/jpeglib.h"
+#include "../../libs/png.h"
+#endif
+#include "BenchCorpus.h"
+
+#pragma warning (push)
+#pragma warning (disable:4611)
+
+static const int MEGAPIXELS[] = {1, 12, 24, 50, 100};
+static const unsigned int SEED = 0x786c7677; // "xlvw"
+
+static const char *KIND_NAMES[BenchImageSpec::KIND_COUNT] = {
+	"jpeg-baseline",
+	"jpeg-progressive",
+	"jpeg-cmyk",
+	"jpeg-gray",
+	"png-rgb",
+	"png-rgba",
+	"png-palette",
+	"png-rgb16",
+	"png-interlaced",
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// the pixels
+
+static unsigned int _Hash (unsigned int x, unsigned int y, unsigned int c) {
+	unsigned int h = (x * 0x9e3779b1u) ^ (y * 0x85ebca77u) ^ (c * 0xc2b2ae3du) ^ SEED;
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	h *= 0x297a2d39u;
+	h ^= h >> 15;
+	return h;
+}
+
+// 8 bits, the gradients with some edges and a little noise, integers only
+static int _Sample (int width, int height, int x, int y, int c) {
+	int v = x * 160 / width + y * 96 / height + c * 40;
+	v += ((x / 64 + y / 48 + c) % 5) * 12;
+	v += (int)(_Hash(x, y, c) & 15) - 8;
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+void CBenchCorpus::fillLine (int width, int height, int y, unsigned char *line, int channels, int bitDepth) {
+	assert(width > 0 && y >= 0 && y < height);
+	assert(bitDepth == 8 || bitDepth == 16);
+	for (int x = 0; x < width; ++ x) {
+		for (int c = 0; c < channels; ++ c) {
+			int v = _Sample(width, height, x, y, c);
+			if (bitDepth == 16) {
+				v = v * 257 ^ (int)(_Hash(x, y, c + 8) & 0xff);
+				*line ++ = (unsigned char)(v >> 8);
+				*line ++ = (unsigned char)(v & 0xff);
+			} else {
+				*line ++ = (unsigned char)v;
+			}
+		}
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// BenchImageSpec
+
+BenchImageSpec::BenchImageSpec (KIND kind, int megapixels)
+	: kind(kind)
+	, megapixels(megapixels)
+{
+	assert(kind >= 0 && kind < KIND_COUNT && megapixels > 0);
+	width = (int)sqrt(megapixels * 1000000.0 * 3 / 2) & ~1;
+	height = width * 2 / 3;
+}
+
+const char* BenchImageSpec::getKindName () const {
+	return KIND_NAMES[kind];
+}
+
+std::string BenchImageSpec::getFileName () const {
+	char name[64];
+	sprintf(name, "%s-%dmp.%s", getKindName(), megapixels, isJpeg() ? "jpg" : "png");
+	return name;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// JPEG
+
+struct _JpegError {
+	struct jpeg_error_mgr pub;
+	jmp_buf            jump;
+};
+
+static void _JpegErrorExit (j_common_ptr cinfo) {
+	longjmp(((_JpegError *)cinfo->err)->jump, 1);
+}
+
+bool CBenchCorpus::_WriteJpeg (const BenchImageSpec &spec, const std::string &path) {
+	assert(spec.isJpeg());
+	FILE *fp = fopen(path.c_str(), "wb");
+	if (fp == NULL) {
+		return false;
+	}
+
+	std::vector<unsigned char> line;
+	struct jpeg_compress_struct cinfo;
+	_JpegError em;
+	cinfo.err = jpeg_std_error(&em.pub);
+	em.pub.error_exit = _JpegErrorExit;
+	if (setjmp(em.jump)) {
+		jpeg_destroy_compress(&cinfo);
+		fclose(fp);
+		return false;
+	}
+
+	jpeg_create_compress(&cinfo);
+	jpeg_stdio_dest(&cinfo, fp);
+	cinfo.image_width = spec.width;
+	cinfo.image_height = spec.height;
+	if (spec.kind == BenchImageSpec::JPEG_GRAY) {
+		cinfo.input_components = 1;
+		cinfo.in_color_space = JCS_GRAYSCALE;
+	} else if (spec.kind == BenchImageSpec::JPEG_CMYK) {
+		cinfo.input_components = 4;
+		cinfo.in_color_space = JCS_CMYK;
+	} else {
+		cinfo.input_components = 3;
+		cinfo.in_color_space = JCS_RGB;
+	}
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 90, TRUE);
+	if (spec.kind == BenchImageSpec::JPEG_PROGRESSIVE) {
+		jpeg_simple_progression(&cinfo);
+	}
+
+	jpeg_start_compress(&cinfo, TRUE);
+	line.resize(spec.width * cinfo.input_components);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		fillLine(spec.width, spec.height, cinfo.next_scanline, &line[0], cinfo.input_components, 8);
+		JSAMPROW row = &line[0];
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+
+	return fclose(fp) == 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// PNG
+
+static void _PngWrite (png_structp psp, png_bytep data, png_size_t length) {
+	FILE *fp = (FILE *)png_get_io_ptr(psp);
+	if (fwrite(data, 1, length, fp) != length) {
+		png_error(psp, "PNG IO failed!");
+	}
+}
+
+static void _PngFlush (png_structp /*psp*/) {
+}
+
+static void _PngError (png_structp /*psp*/, const char *error) {
+	throw error;
+}
+
+static void _PngWarning (png_structp /*psp*/, const char * /*warning*/) {
+}
+
+bool CBenchCorpus::_WritePng (const BenchImageSpec &spec, const std::string &path) {
+	assert(!spec.isJpeg());
+	FILE *fp = fopen(path.c_str(), "wb");
+	if (fp == NULL) {
+		return false;
+	}
+
+	png_structp psp = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, _PngError, _PngWarning);
+	png_infop infop = psp ? png_create_info_struct(psp) : NULL;
+	if (infop == NULL) {
+		png_destroy_write_struct(&psp, NULL);
+		fclose(fp);
+		return false;
+	}
+
+	bool ok = true;
+	try {
+		png_set_write_fn(psp, fp, _PngWrite, _PngFlush);
+
+		int colorType = PNG_COLOR_TYPE_RGB;
+		int channels = 3;
+		int bitDepth = 8;
+		int interlace = PNG_INTERLACE_NONE;
+		switch (spec.kind) {
+		case BenchImageSpec::PNG_RGBA:
+			colorType = PNG_COLOR_TYPE_RGB_ALPHA;
+			channels = 4;
+			break;
+		case BenchImageSpec::PNG_PALETTE:
+			colorType = PNG_COLOR_TYPE_PALETTE;
+			channels = 1;
+			break;
+		case BenchImageSpec::PNG_RGB16:
+			bitDepth = 16;
+			break;
+		case BenchImageSpec::PNG_INTERLACED:
+			interlace = PNG_INTERLACE_ADAM7;
+			break;
+		default:
+			break;
+		}
+		png_set_IHDR(psp, infop, spec.width, spec.height, bitDepth, colorType,
+			interlace, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+		if (colorType == PNG_COLOR_TYPE_PALETTE) {
+			png_color palette[256];
+			for (int i = 0; i < 256; ++ i) {
+				palette[i].red = (png_byte)i;
+				palette[i].green = (png_byte)(255 - i);
+				palette[i].blue = (png_byte)((i * 7) & 0xff);
+			}
+			png_set_PLTE(psp, infop, palette, 256);
+		}
+		png_write_info(psp, infop);
+
+		// all the rows are written for each pass of the interlaced image
+		int passes = png_set_interlace_handling(psp);
+		std::vector<unsigned char> line(spec.width * channels * bitDepth / 8);
+		for (int pass = 0; pass < passes; ++ pass) {
+			for (int y = 0; y < spec.height; ++ y) {
+				fillLine(spec.width, spec.height, y, &line[0], channels, bitDepth);
+				png_write_row(psp, &line[0]);
+			}
+		}
+		png_write_end(psp, NULL);
+	} catch (...) {
+		ok = false;
+	}
+
+	png_destroy_write_struct(&psp, &infop);
+	return fclose(fp) == 0 && ok;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CBenchCorpus
+
+CBenchCorpus::CBenchCorpus (const std::string &dir) : m_dir(dir) {
+	assert(!dir.empty());
+}
+
+void CBenchCorpus::getSpecs (BenchImageSpecs &specs, int maxMegapixels, const char *kinds) {
+	for (int k = 0; k < BenchImageSpec::KIND_COUNT; ++ k) {
+		if (kinds != NULL) {
+			bool found = false;
+			std::string list = std::string(kinds) + ",";
+			for (size_t begin = 0, end; (end = list.find(',', begin)) != list.npos; begin = end + 1) {
+				std::string name = list.substr(begin, end - begin);
+				if (!name.empty() && strncmp(KIND_NAMES[k], name.c_str(), name.length()) == 0) {
+					found = true;
+					break;
+				}
+			}
+			if (!found) {
+				continue;
+			}
+		}
+
+		for (int i = 0; i < (int)(sizeof(MEGAPIXELS) / sizeof(MEGAPIXELS[0])); ++ i) {
+			if (MEGAPIXELS[i] <= maxMegapixels) {
+				specs.push_back(BenchImageSpec((BenchImageSpec::KIND)k, MEGAPIXELS[i]));
+			}
+		}
+	}
+}
+
+bool CBenchCorpus::prepare (const BenchImageSpec &spec, std::string &path) {
+#ifdef _WIN32
+	_mkdir(m_dir.c_str());
+#else
+	mkdir(m_dir.c_str(), 0755);
+#endif
+	path = m_dir + "/" + spec.getFileName();
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (fp != NULL) {
+		fclose(fp);
+		return true;
+	}
+
+	// renamed when done, so a broken one is never used
+	std::string tmp = path + ".tmp";
+	fprintf(stderr, "generating %s (%d x %d) ...\n", spec.getFileName().c_str(), spec.width, spec.height);
+	bool ok = spec.isJpeg() ? _WriteJpeg(spec, tmp) : _WritePng(spec, tmp);
+	if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+std::string CBenchCorpus::getCodecVersions () {
+	char versions[128];
+	sprintf(versions, "libjpeg %d, libpng %s", JPEG_LIB_VERSION, PNG_LIBPNG_VER_STRING);
+	return versions;
+}
+
+#pragma warning (pop)
@@ -0,0 +1,75 @@
+#ifndef XL_VIEW_BENCH_CORPUS_H
+#define XL_VIEW_BENCH_CORPUS_H
+#include <string>
+#include <vector>
+
+/**
+ * The images decoded by the benchmarks, generated (once) into a directory.
+ *
+ * The pixels are computed from the position only (the gradients, some edges
+ * and a hashed noise, like a photo to the codecs), so the same corpus is
+ * generated everywhere for the same libjpeg and libpng, and nothing large
+ * is kept in the repository.
+ */
+
+//////////////////////////////////////////////////////////////////////////
+// BenchImageSpec
+
+struct BenchImageSpec {
+	enum KIND {
+		JPEG_BASELINE,
+		JPEG_PROGRESSIVE,
+		JPEG_CMYK,
+		JPEG_GRAY,
+		PNG_RGB,
+		PNG_RGBA,
+		PNG_PALETTE,
+		PNG_RGB16,
+		PNG_INTERLACED,
+		KIND_COUNT
+	};
+
+	KIND               kind;
+	int                megapixels;
+	int                width;    // 3:2
+	int                height;
+
+	BenchImageSpec (KIND kind, int megapixels);
+
+	bool isJpeg () const { return kind <= JPEG_GRAY; }
+	const char* getKindName () const;  // "jpeg-baseline", ...
+	std::string getFileName () const;  // "jpeg-baseline-12mp.jpg", ...
+};
+typedef std::vector<BenchImageSpec>            BenchImageSpecs;
+
+
+//////////////////////////////////////////////////////////////////////////
+// CBenchCorpus
+
+class CBenchCorpus
+{
+	std::string        m_dir;
+
+	bool _WriteJpeg (const BenchImageSpec &spec, const std::string &path);
+	bool _WritePng (const BenchImageSpec &spec, const std::string &path);
+
+public:
+	CBenchCorpus (const std::string &dir);
+
+	// all the images not larger than @maxMegapixels, @kinds is a comma separated
+	// list of the kind names (or their prefixes, "png"), NULL for all
+	static void getSpecs (BenchImageSpecs &specs, int maxMegapixels, const char *kinds = NULL);
+
+	// the path of the image, which is generated if not found
+	bool prepare (const BenchImageSpec &spec, std::string &path);
+
+	// "libjpeg 80, libpng 1.6.37", the corpus depends on them
+	static std::string getCodecVersions ();
+
+	// the pixels of the line @y of the image of (@width, @height), @channels samples
+	// for each pixel, 2 bytes (big endian) for a 16 bits sample
+	static void fillLine (int width, int height, int y, unsigned char *line, int channels, int bitDepth);
+};
+
+
+#endif
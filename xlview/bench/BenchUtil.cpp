@@ -0,0 +1,242 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <new>
+#include <algorithm>
+#include "BenchUtil.h"
+
+static volatile LONGLONG s_heapBytes = 0;
+static volatile LONGLONG s_heapCount = 0;
+
+// counted in all the threads, and never freed by the size
+void* operator new (size_t bytes) {
+	::InterlockedExchangeAdd64(&s_heapBytes, (LONGLONG)bytes);
+	::InterlockedExchangeAdd64(&s_heapCount, 1);
+	void *p = malloc(bytes == 0 ? 1 : bytes);
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete (void *p) throw () {
+	free(p);
+}
+
+// called instead of the one above for the sized types (C++14)
+void operator delete (void *p, size_t /*bytes*/) throw () {
+	free(p);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CBenchTimer
+
+CBenchTimer::CBenchTimer () {
+	restart();
+}
+
+void CBenchTimer::restart () {
+	::QueryPerformanceCounter(&m_start);
+}
+
+double CBenchTimer::getMs () const {
+	LARGE_INTEGER now, freq;
+	::QueryPerformanceCounter(&now);
+	::QueryPerformanceFrequency(&freq);
+	return (double)(now.QuadPart - m_start.QuadPart) * 1000.0 / (double)freq.QuadPart;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CBenchSamples
+
+void CBenchSamples::add (double ms) {
+	m_ms.push_back(ms);
+}
+
+void CBenchSamples::add (const CBenchSamples &samples) {
+	m_ms.insert(m_ms.end(), samples.m_ms.begin(), samples.m_ms.end());
+}
+
+void CBenchSamples::clear () {
+	m_ms.clear();
+}
+
+double CBenchSamples::getTotal () const {
+	double total = 0;
+	for (size_t i = 0; i < m_ms.size(); ++ i) {
+		total += m_ms[i];
+	}
+	return total;
+}
+
+double CBenchSamples::getMin () const {
+	return m_ms.empty() ? 0 : *std::min_element(m_ms.begin(), m_ms.end());
+}
+
+double CBenchSamples::getPercentile (double p) const {
+	assert(p >= 0 && p <= 100);
+	if (m_ms.empty()) {
+		return 0;
+	}
+	std::vector<double> sorted(m_ms);
+	std::sort(sorted.begin(), sorted.end());
+	size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+	return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CBenchHeap
+
+LONGLONG CBenchHeap::getBytes () {
+	return s_heapBytes;
+}
+
+LONGLONG CBenchHeap::getCount () {
+	return s_heapCount;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CBenchJson
+
+CBenchJson::CBenchJson () {
+}
+
+void CBenchJson::_Indent () {
+	m_text += '\n';
+	m_text.append(m_empty.size(), '\t');
+}
+
+void CBenchJson::_Key (const char *key) {
+	if (!m_empty.empty()) {
+		if (!m_empty.back()) {
+			m_text += ',';
+		}
+		m_empty.back() = false;
+		_Indent();
+	}
+	if (key != NULL) {
+		m_text += '"';
+		m_text += key;
+		m_text += "\": ";
+	}
+}
+
+void CBenchJson::beginObject (const char *key) {
+	_Key(key);
+	m_text += '{';
+	m_empty.push_back(true);
+}
+
+void CBenchJson::endObject () {
+	assert(!m_empty.empty());
+	bool empty = m_empty.back();
+	m_empty.pop_back();
+	if (!empty) {
+		_Indent();
+	}
+	m_text += '}';
+	if (m_empty.empty()) {
+		m_text += '\n';
+	}
+}
+
+void CBenchJson::beginArray (const char *key) {
+	_Key(key);
+	m_text += '[';
+	m_empty.push_back(true);
+}
+
+void CBenchJson::endArray () {
+	assert(!m_empty.empty());
+	bool empty = m_empty.back();
+	m_empty.pop_back();
+	if (!empty) {
+		_Indent();
+	}
+	m_text += ']';
+}
+
+void CBenchJson::add (const char *key, const char *value) {
+	_Key(key);
+	m_text += '"';
+	for (const char *p = value; *p != '\0'; ++ p) {
+		if (*p == '"' || *p == '\\') {
+			m_text += '\\';
+		}
+		m_text += *p;
+	}
+	m_text += '"';
+}
+
+void CBenchJson::add (const char *key, const std::string &value) {
+	add(key, value.c_str());
+}
+
+void CBenchJson::add (const char *key, double value) {
+	_Key(key);
+	if (value != value || value > 1e300 || value < -1e300) {
+		m_text += "null"; // NaN or infinite
+	} else {
+		char buf[64];
+		sprintf(buf, "%.6g", value);
+		m_text += buf;
+	}
+}
+
+void CBenchJson::add (const char *key, LONGLONG value) {
+	_Key(key);
+	char buf[64];
+	sprintf(buf, "%lld", (long long)value);
+	m_text += buf;
+}
+
+void CBenchJson::add (const char *key, int value) {
+	add(key, (LONGLONG)value);
+}
+
+void CBenchJson::add (const char *key, bool value) {
+	_Key(key);
+	m_text += value ? "true" : "false";
+}
+
+void CBenchJson::addEnvironment () {
+	SYSTEM_INFO si;
+	::GetSystemInfo(&si);
+	add("cpus", (int)si.dwNumberOfProcessors);
+	add("time", (LONGLONG)time(NULL));
+#if defined(_MSC_VER)
+	add("compiler", "msvc");
+	add("compiler_version", (int)_MSC_VER);
+#elif defined(__clang__)
+	add("compiler", "clang");
+	add("compiler_version", __clang_version__);
+#elif defined(__GNUC__)
+	add("compiler", "gcc");
+	add("compiler_version", __VERSION__);
+#endif
+#ifdef NDEBUG
+	add("build", "release");
+#else
+	add("build", "debug");
+#endif
+}
+
+bool CBenchJson::save (const std::string &fileName) const {
+	if (fileName == "-") {
+		fputs(m_text.c_str(), stdout);
+		return true;
+	}
+	FILE *fp = fopen(fileName.c_str(), "wb");
+	if (fp == NULL) {
+		return false;
+	}
+	bool ok = fwrite(m_text.c_str(), 1, m_text.length(), fp) == m_text.length();
+	fclose(fp);
+	return ok;
+}
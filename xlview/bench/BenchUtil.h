@@ -0,0 +1,94 @@
+#ifndef XL_VIEW_BENCH_UTIL_H
+#define XL_VIEW_BENCH_UTIL_H
+#include <string>
+#include <vector>
+#include <Windows.h>
+
+/**
+ * The helpers shared by the benchmarks (see CMakeLists.txt): the timer, the
+ * samples, the heap counter, and the JSON writer of the results, so the runs
+ * of two releases can be compared by a script.
+ */
+
+//////////////////////////////////////////////////////////////////////////
+// CBenchTimer
+
+class CBenchTimer
+{
+	LARGE_INTEGER      m_start;
+
+public:
+	CBenchTimer ();
+	void restart ();
+	double getMs () const;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// CBenchSamples, the time (ms) of the iterations
+
+class CBenchSamples
+{
+	std::vector<double> m_ms;
+
+public:
+	void add (double ms);
+	void add (const CBenchSamples &samples);
+	void clear ();
+	size_t getCount () const { return m_ms.size(); }
+	double getTotal () const;
+	double getMin () const;
+	// by the nearest rank, @p is in [0, 100]
+	double getPercentile (double p) const;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// CBenchHeap, the bytes allocated by operator new in all the threads (the
+// malloc() of libjpeg and libpng is not counted)
+
+class CBenchHeap
+{
+public:
+	static LONGLONG getBytes ();
+	static LONGLONG getCount ();
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// CBenchJson
+
+class CBenchJson
+{
+	std::string        m_text;
+	std::vector<bool>  m_empty;  // of the open objects and arrays
+
+	void _Key (const char *key);
+	void _Indent ();
+
+public:
+	CBenchJson ();
+
+	// @key is NULL in the arrays
+	void beginObject (const char *key = NULL);
+	void endObject ();
+	void beginArray (const char *key = NULL);
+	void endArray ();
+
+	void add (const char *key, const char *value);
+	void add (const char *key, const std::string &value);
+	void add (const char *key, double value);
+	void add (const char *key, LONGLONG value);
+	void add (const char *key, int value);
+	void add (const char *key, bool value);
+
+	// the machine and the build, in the object opened
+	void addEnvironment ();
+
+	const std::string& getText () const { return m_text; }
+	// "-" for stdout
+	bool save (const std::string &fileName) const;
+};
+
+
+#endif
@@ -0,0 +1,397 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "../ImageConfig.h"
+#include "../ImageLoader.h"
+#include "../JobScheduler.h"
+#include "../PixelBufferPool.h"
+#include "BenchCorpus.h"
+#include "BenchUtil.h"
+
+/**
+ * The throughput of the decoders: readHeader(), load(), loadResize() and
+ * loadThumbnail() of each plugin, on the images of CBenchCorpus.
+ *
+ * The plugin is called directly (not by CImageLoader, so there is no file IO
+ * and no in-flight table), the destination image is created from the pools
+ * before the timer starts, as CImageLoader does.
+ */
+
+enum OP {
+	OP_READ_HEADER,
+	OP_LOAD,
+	OP_LOAD_RESIZE,
+	OP_LOAD_THUMBNAIL,
+	OP_COUNT
+};
+
+static const char *OP_NAMES[OP_COUNT] = {
+	"readHeader",
+	"load",
+	"loadResize",
+	"loadThumbnail",
+};
+
+struct Options {
+	std::string        corpus;
+	int                maxMegapixels;
+	const char        *kinds;
+	bool               ops[OP_COUNT];
+	int                iterations;   // at least
+	int                maxIterations;
+	double             minMs;        // each measurement runs at least
+	CSize              szArea;       // of loadResize()
+	std::string        json;
+	bool               generateOnly;
+
+	Options ()
+		: corpus("bench-corpus")
+		, maxMegapixels(24)
+		, kinds(NULL)
+		, iterations(10)
+		, maxIterations(200)
+		, minMs(2000)
+		, szArea(1920, 1080)
+		, generateOnly(false)
+	{
+		for (int i = 0; i < OP_COUNT; ++ i) {
+			ops[i] = true;
+		}
+	}
+};
+
+struct Result {
+	int                iterations;
+	double             p50;
+	double             p99;
+	double             min;
+	LONGLONG           heapBytes;     // of one call, the largest
+	LONGLONG           heapCount;
+	LONGLONG           poolPeakBytes; // CPixelBufferPool
+	LONGLONG           imageBytes;    // the result
+	CSize              szTarget;
+
+	Result ()
+		: iterations(0)
+		, p50(0)
+		, p99(0)
+		, min(0)
+		, heapBytes(0)
+		, heapCount(0)
+		, poolPeakBytes(0)
+		, imageBytes(0)
+		, szTarget(0, 0)
+	{
+	}
+};
+
+static void _Usage () {
+	fprintf(stderr,
+		"usage: xlview_decode_bench [options]\n"
+		"  --corpus <dir>       where the images are generated once (bench-corpus)\n"
+		"  --max-mp <n>         the largest images in megapixels, 1 to 100 (24)\n"
+		"  --kinds <list>       jpeg-baseline,jpeg-progressive,jpeg-cmyk,jpeg-gray,\n"
+		"                       png-rgb,png-rgba,png-palette,png-rgb16,png-interlaced\n"
+		"                       or the prefixes (\"jpeg\"), all by default\n"
+		"  --ops <list>         readHeader,load,loadResize,loadThumbnail (all)\n"
+		"  --iterations <n>     at least (10), up to 200 in --min-time\n"
+		"  --min-time <ms>      each measurement runs at least (2000)\n"
+		"  --area <w>x<h>       the screen of loadResize() (1920x1080)\n"
+		"  --json <file>        the results, \"-\" for stdout\n"
+		"  --generate-only      generate the corpus and exit\n");
+}
+
+static bool _ParseOptions (int argc, char *argv[], Options &options) {
+	for (int i = 1; i < argc; ++ i) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (strcmp(arg, "--generate-only") == 0) {
+			options.generateOnly = true;
+			continue;
+		} else if (value == NULL) {
+			return false;
+		}
+
+		++ i;
+		if (strcmp(arg, "--corpus") == 0) {
+			options.corpus = value;
+		} else if (strcmp(arg, "--max-mp") == 0) {
+			options.maxMegapixels = atoi(value);
+		} else if (strcmp(arg, "--kinds") == 0) {
+			options.kinds = value;
+		} else if (strcmp(arg, "--ops") == 0) {
+			std::string list = std::string(",") + value + ",";
+			for (int op = 0; op < OP_COUNT; ++ op) {
+				options.ops[op] = list.find(std::string(",") + OP_NAMES[op] + ",") != list.npos;
+			}
+		} else if (strcmp(arg, "--iterations") == 0) {
+			options.iterations = atoi(value);
+			options.maxIterations = (std::max)(options.maxIterations, options.iterations);
+		} else if (strcmp(arg, "--min-time") == 0) {
+			options.minMs = atof(value);
+		} else if (strcmp(arg, "--area") == 0) {
+			int w = 0, h = 0;
+			if (sscanf(value, "%dx%d", &w, &h) != 2) {
+				return false;
+			}
+			options.szArea = CSize(w, h);
+		} else if (strcmp(arg, "--json") == 0) {
+			options.json = value;
+		} else {
+			return false;
+		}
+	}
+	return options.maxMegapixels > 0 && options.iterations > 0
+		&& options.szArea.cx >= MIN_ZOOM_WIDTH && options.szArea.cy >= MIN_ZOOM_HEIGHT;
+}
+
+static bool _ReadFile (const std::string &path, std::string &data) {
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (fp == NULL) {
+		return false;
+	}
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	data.resize(size);
+	bool ok = size > 0 && fread(&data[0], 1, size, fp) == (size_t)size;
+	fclose(fp);
+	return ok;
+}
+
+static std::string _Narrow (const xl::tstring &s) {
+	std::string narrow;
+	for (size_t i = 0; i < s.length(); ++ i) {
+		narrow += (char)s[i];
+	}
+	return narrow;
+}
+
+// the destination of @op, the same as CImageLoader, NULL for OP_READ_HEADER
+static CImagePtr _CreateImage (OP op, const ImageHeaderInfo &info, CSize szTarget) {
+	if (op == OP_READ_HEADER) {
+		return CImagePtr();
+	}
+	CImageLoader *loader = CImageLoader::getInstance();
+	int bitcount = loader->getPixelLayout() == CImageLoader::PL_BGRX32 ? 32 : info.bitcount;
+	CImagePtr image(new CImage());
+	for (int i = 0; i < info.frame_count; ++ i) {
+		xl::ui::CDIBSectionPtr dib = CDIBSectionPool::getInstance()->create(szTarget.cx, szTarget.cy, bitcount);
+		if (dib == NULL) {
+			return CImagePtr();
+		}
+		image->insertImage(dib, CImage::DELAY_INFINITE);
+	}
+	return image;
+}
+
+static bool _Call (OP op, IImageLoaderPlugin *plugin, const std::string &data, CImagePtr image) {
+	switch (op) {
+	case OP_READ_HEADER:
+		{
+			ImageHeaderInfo info;
+			return plugin->readHeader(data, info);
+		}
+	case OP_LOAD:
+		return plugin->load(image, data);
+	case OP_LOAD_RESIZE:
+		{
+			// the same filters as CImageLoader::_LoadSuitable()
+			ImageHeaderInfo info;
+			plugin->readHeader(data, info);
+			double ratio = (double)image->getImageWidth() / (double)info.width;
+			if (ratio > 0.5) {
+				xl::ui::CBicubicFilter filter;
+				xl::ui::CResizeEngine resizer(&filter);
+				return plugin->loadResize(image, data, &resizer);
+			} else {
+				xl::ui::CBoxFilter filter;
+				xl::ui::CResizeEngine resizer(&filter);
+				return plugin->loadResize(image, data, &resizer);
+			}
+		}
+	case OP_LOAD_THUMBNAIL:
+		return plugin->loadThumbnail(image, data);
+	default:
+		assert(false);
+		return false;
+	}
+}
+
+// returns false if the plugin fails, or doesn't support @op (or it is not needed, the
+// image is not larger than the area of loadResize())
+static bool _Measure (OP op, IImageLoaderPlugin *plugin, const std::string &data, const ImageHeaderInfo &info,
+                      const Options &options, Result &result) {
+	CSize szImage(info.width, info.height);
+	switch (op) {
+	case OP_LOAD_RESIZE:
+		result.szTarget = CImage::getSuitableSize(options.szArea, szImage, true);
+		if (result.szTarget == szImage) {
+			return false; // CImageLoader calls load()
+		}
+		break;
+	case OP_LOAD_THUMBNAIL:
+		result.szTarget = CImage::getSuitableSize(CSize(THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT), szImage, false);
+		break;
+	default:
+		result.szTarget = szImage;
+		break;
+	}
+
+	CPixelBufferPool *pool = CPixelBufferPool::getInstance();
+	CBenchSamples samples;
+	CBenchTimer total;
+	// the first one is not counted, it fills the pools
+	for (int i = -1; i < options.maxIterations; ++ i) {
+		if (i >= options.iterations && total.getMs() >= options.minMs) {
+			break;
+		}
+
+		CImagePtr image = _CreateImage(op, info, result.szTarget);
+		if (op != OP_READ_HEADER && image == NULL) {
+			return false;
+		}
+		pool->resetPeak();
+		size_t poolBytes = pool->getStats().usedBytes;
+		LONGLONG heapBytes = CBenchHeap::getBytes();
+		LONGLONG heapCount = CBenchHeap::getCount();
+
+		CBenchTimer timer;
+		bool ok = _Call(op, plugin, data, image);
+		double ms = timer.getMs();
+		if (!ok) {
+			return false;
+		}
+
+		if (i < 0) {
+			total.restart();
+			continue;
+		}
+		samples.add(ms);
+		result.heapBytes = (std::max)(result.heapBytes, CBenchHeap::getBytes() - heapBytes);
+		result.heapCount = (std::max)(result.heapCount, CBenchHeap::getCount() - heapCount);
+		result.poolPeakBytes = (std::max)(result.poolPeakBytes, (LONGLONG)(pool->getStats().peakUsedBytes - poolBytes));
+		if (image != NULL) {
+			result.imageBytes = image->getMemorySize();
+			CDIBSectionPool::getInstance()->recycle(image);
+		}
+	}
+
+	result.iterations = (int)samples.getCount();
+	result.p50 = samples.getPercentile(50);
+	result.p99 = samples.getPercentile(99);
+	result.min = samples.getMin();
+	return true;
+}
+
+int main (int argc, char *argv[]) {
+	Options options;
+	if (!_ParseOptions(argc, argv, options)) {
+		_Usage();
+		return 2;
+	}
+
+	BenchImageSpecs specs;
+	CBenchCorpus::getSpecs(specs, options.maxMegapixels, options.kinds);
+	if (specs.empty()) {
+		_Usage();
+		return 2;
+	}
+
+	CBenchCorpus corpus(options.corpus);
+	CBenchJson json;
+	json.beginObject();
+	json.add("benchmark", "decode");
+	json.add("format", 1);
+	json.beginObject("environment");
+	json.addEnvironment();
+	json.add("codecs", CBenchCorpus::getCodecVersions());
+	json.add("workers", (int)CJobScheduler::getInstance()->getWorkerCount());
+	json.add("pixel_layout", CImageLoader::getInstance()->getPixelLayout() == CImageLoader::PL_BGRX32 ? "bgrx" : "native");
+	json.endObject();
+	json.beginArray("results");
+
+	// the table goes to stderr if the JSON is written to stdout
+	FILE *out = options.json == "-" ? stderr : stdout;
+	fprintf(out, "%-30s %-14s %11s %4s %10s %10s %9s %12s %12s\n",
+		"image", "op", "target", "n", "p50 ms", "p99 ms", "MP/s", "heap KB", "pool KB");
+
+	int failures = 0;
+	for (size_t s = 0; s < specs.size(); ++ s) {
+		const BenchImageSpec &spec = specs[s];
+		std::string path, data;
+		if (!corpus.prepare(spec, path) || !_ReadFile(path, data)) {
+			fprintf(stderr, "%s: can't generate or read\n", spec.getFileName().c_str());
+			++ failures;
+			continue;
+		}
+		if (options.generateOnly) {
+			continue;
+		}
+
+		ImageHeaderInfo info;
+		IImageLoaderPlugin *plugin = CImageLoader::getInstance()->getPlugin(data, info);
+		if (plugin == NULL) {
+			fprintf(stderr, "%s: no plugin\n", spec.getFileName().c_str());
+			++ failures;
+			continue;
+		}
+
+		for (int op = 0; op < OP_COUNT; ++ op) {
+			if (!options.ops[op]) {
+				continue;
+			}
+			Result result;
+			bool ok = _Measure((OP)op, plugin, data, info, options, result);
+			double mp = (double)info.width * info.height / 1000000.0;
+			double mpps = ok && result.p50 > 0 ? mp / (result.p50 / 1000.0) : 0;
+
+			json.beginObject();
+			json.add("plugin", _Narrow(plugin->getFileTypeName()));
+			json.add("image", spec.getFileName());
+			json.add("kind", spec.getKindName());
+			json.add("width", info.width);
+			json.add("height", info.height);
+			json.add("file_bytes", (LONGLONG)data.length());
+			json.add("op", OP_NAMES[op]);
+			json.add("ok", ok); // false if not supported (or not needed)
+			if (ok) {
+				json.add("target_width", (int)result.szTarget.cx);
+				json.add("target_height", (int)result.szTarget.cy);
+				json.add("iterations", result.iterations);
+				json.add("ms_p50", result.p50);
+				json.add("ms_p99", result.p99);
+				json.add("ms_min", result.min);
+				json.add("mp_per_s", mpps);
+				json.add("heap_bytes", result.heapBytes);
+				json.add("heap_allocs", result.heapCount);
+				json.add("pool_peak_bytes", result.poolPeakBytes);
+				json.add("image_bytes", result.imageBytes);
+			}
+			json.endObject();
+
+			if (ok) {
+				char target[32];
+				sprintf(target, "%dx%d", (int)result.szTarget.cx, (int)result.szTarget.cy);
+				fprintf(out, "%-30s %-14s %11s %4d %10.2f %10.2f %9.1f %12d %12d\n",
+					spec.getFileName().c_str(), OP_NAMES[op], target, result.iterations,
+					result.p50, result.p99, mpps, (int)(result.heapBytes / 1024), (int)(result.poolPeakBytes / 1024));
+			} else {
+				fprintf(out, "%-30s %-14s %11s\n", spec.getFileName().c_str(), OP_NAMES[op], "-");
+			}
+			fflush(out);
+		}
+	}
+
+	json.endArray();
+	json.endObject();
+	if (!options.json.empty() && !json.save(options.json)) {
+		fprintf(stderr, "can't write %s\n", options.json.c_str());
+		++ failures;
+	}
+
+	CJobScheduler::getInstance()->stop();
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,669 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <process.h>
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include "libxl/include/ui/DIBSection.h"
+#include "libxl/include/ui/DIBResizer.h"
+#include "../Image.h"
+#include "../JobScheduler.h"
+#include "../PixelBufferPool.h"
+#include "BenchCorpus.h"
+#include "BenchUtil.h"
+
+/**
+ * The speed and the quality of the resizing, swept by the source size, the
+ * ratio, the filter and the bit count:
+ *
+ *   dib:    CDIBSection::resize(), RT_FAST, RT_BOX and RT_BICUBIC
+ *   scale:  CResizeEngine::scale(), the box and the bicubic filters
+ *   passes: horizontalFilter() and verticalFilter() timed one by one
+ *   image:  CImage::resize(), "fast" and "hq" (reduced by the integer ratio first)
+ *
+ * Each is run by 1 thread and by N threads at once (on their own results),
+ * to see how it scales. The result of the single thread run is compared to
+ * the one resampled in double by the filter of the same kind (see _Reference),
+ * the PSNR is to be compared between the releases, a faster kernel which
+ * loses precision shows as a lower PSNR.
+ */
+
+enum API {
+	API_DIB,
+	API_SCALE,
+	API_PASSES,
+	API_IMAGE,
+	API_COUNT
+};
+
+enum FILTER {
+	FILTER_FAST,
+	FILTER_BOX,
+	FILTER_BICUBIC,
+	FILTER_HQ,      // CImage::resize(), the box or the bicubic by the ratio
+	FILTER_COUNT
+};
+
+static const char *API_NAMES[API_COUNT] = {"dib", "scale", "passes", "image"};
+static const char *FILTER_NAMES[FILTER_COUNT] = {"fast", "box", "bicubic", "hq"};
+
+static const double RATIOS[] = {0.05, 0.1, 0.25, 0.33, 0.5, 0.75, 1.5, 2, 4};
+static const double PSNR_IDENTICAL = 99.0;
+
+struct Options {
+	std::vector<int>   megapixels;   // of the sources
+	std::vector<double> ratios;
+	std::vector<int>   bitcounts;
+	std::vector<int>   threads;
+	bool               apis[API_COUNT];
+	bool               filters[FILTER_COUNT];
+	int                iterations;   // of each thread
+	int                maxDstMegapixels;
+	bool               psnr;
+	std::string        json;
+
+	Options ()
+		: iterations(5)
+		, maxDstMegapixels(100)
+		, psnr(true)
+	{
+		megapixels.push_back(1);
+		megapixels.push_back(12);
+		megapixels.push_back(24);
+		ratios.assign(RATIOS, RATIOS + sizeof(RATIOS) / sizeof(RATIOS[0]));
+		bitcounts.push_back(24);
+		bitcounts.push_back(32);
+		SYSTEM_INFO si;
+		::GetSystemInfo(&si);
+		threads.push_back(1);
+		if (si.dwNumberOfProcessors > 1) {
+			threads.push_back((int)si.dwNumberOfProcessors);
+		}
+		for (int i = 0; i < API_COUNT; ++ i) {
+			apis[i] = true;
+		}
+		for (int i = 0; i < FILTER_COUNT; ++ i) {
+			filters[i] = true;
+		}
+	}
+};
+
+// one measurement
+struct Case {
+	API                api;
+	FILTER             filter;
+	xl::ui::CDIBSectionPtr src;
+	CImagePtr          srcImage;   // of @src, for API_IMAGE
+	int                dstWidth;
+	int                dstHeight;
+	int                iterations;
+};
+
+struct Result {
+	int                threads;
+	CBenchSamples      samples;    // of all the threads
+	CBenchSamples      hSamples;   // API_PASSES
+	CBenchSamples      vSamples;
+	double             wallMs;
+	xl::ui::CDIBSectionPtr dst;    // of the first thread
+};
+
+static void _Usage () {
+	fprintf(stderr,
+		"usage: xlview_resize_bench [options]\n"
+		"  --sizes <list>       the sources in megapixels (1,12,24)\n"
+		"  --ratios <list>      of the width and the height (0.05,0.1,0.25,0.33,0.5,0.75,1.5,2,4)\n"
+		"  --bits <list>        24,32\n"
+		"  --apis <list>        dib,scale,passes,image\n"
+		"  --filters <list>     fast,box,bicubic,hq\n"
+		"  --threads <list>     1,<cpus>\n"
+		"  --iterations <n>     of each thread (5)\n"
+		"  --max-dst-mp <n>     the larger results are skipped (100)\n"
+		"  --no-psnr            skip the quality check\n"
+		"  --json <file>        the results, \"-\" for stdout\n");
+}
+
+static bool _ParseList (const char *value, std::vector<double> &list) {
+	list.clear();
+	for (const char *p = value; *p != '\0'; ) {
+		char *end = NULL;
+		double v = strtod(p, &end);
+		if (end == p || v <= 0) {
+			return false;
+		}
+		list.push_back(v);
+		p = *end == ',' ? end + 1 : end;
+	}
+	return !list.empty();
+}
+
+static bool _ParseList (const char *value, std::vector<int> &list) {
+	std::vector<double> values;
+	if (!_ParseList(value, values)) {
+		return false;
+	}
+	list.clear();
+	for (size_t i = 0; i < values.size(); ++ i) {
+		list.push_back((int)values[i]);
+	}
+	return true;
+}
+
+static bool _ParseNames (const char *value, const char **names, int count, bool *selected) {
+	std::string list = std::string(",") + value + ",";
+	bool any = false;
+	for (int i = 0; i < count; ++ i) {
+		selected[i] = list.find(std::string(",") + names[i] + ",") != list.npos;
+		any = any || selected[i];
+	}
+	return any;
+}
+
+static bool _ParseOptions (int argc, char *argv[], Options &options) {
+	for (int i = 1; i < argc; ++ i) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (strcmp(arg, "--no-psnr") == 0) {
+			options.psnr = false;
+			continue;
+		} else if (value == NULL) {
+			return false;
+		}
+
+		++ i;
+		bool ok = true;
+		if (strcmp(arg, "--sizes") == 0) {
+			ok = _ParseList(value, options.megapixels);
+		} else if (strcmp(arg, "--ratios") == 0) {
+			ok = _ParseList(value, options.ratios);
+		} else if (strcmp(arg, "--bits") == 0) {
+			ok = _ParseList(value, options.bitcounts);
+			for (size_t b = 0; b < options.bitcounts.size(); ++ b) {
+				ok = ok && (options.bitcounts[b] == 24 || options.bitcounts[b] == 32);
+			}
+		} else if (strcmp(arg, "--apis") == 0) {
+			ok = _ParseNames(value, API_NAMES, API_COUNT, options.apis);
+		} else if (strcmp(arg, "--filters") == 0) {
+			ok = _ParseNames(value, FILTER_NAMES, FILTER_COUNT, options.filters);
+		} else if (strcmp(arg, "--threads") == 0) {
+			ok = _ParseList(value, options.threads);
+		} else if (strcmp(arg, "--iterations") == 0) {
+			options.iterations = atoi(value);
+		} else if (strcmp(arg, "--max-dst-mp") == 0) {
+			options.maxDstMegapixels = atoi(value);
+		} else if (strcmp(arg, "--json") == 0) {
+			options.json = value;
+		} else {
+			ok = false;
+		}
+		if (!ok) {
+			return false;
+		}
+	}
+	return options.iterations > 0 && options.maxDstMegapixels > 0;
+}
+
+// the filters of each API
+static bool _IsSupported (API api, FILTER filter) {
+	switch (api) {
+	case API_DIB:
+		return filter == FILTER_FAST || filter == FILTER_BOX || filter == FILTER_BICUBIC;
+	case API_SCALE:
+	case API_PASSES:
+		return filter == FILTER_BOX || filter == FILTER_BICUBIC;
+	case API_IMAGE:
+		return filter == FILTER_FAST || filter == FILTER_HQ;
+	default:
+		assert(false);
+		return false;
+	}
+}
+
+static xl::ui::CDIBSectionPtr _CreateSource (int width, int height, int bitcount) {
+	xl::ui::CDIBSectionPtr dib = CDIBSectionPool::getInstance()->create(width, height, bitcount, false);
+	if (dib == NULL) {
+		return dib;
+	}
+	int channels = bitcount / 8;
+	for (int y = 0; y < height; ++ y) {
+		xl::uint8 *line = dib->getLine(y);
+		CBenchCorpus::fillLine(width, height, y, line, channels, 8);
+		if (channels == 4) {
+			for (int x = 0; x < width; ++ x) {
+				line[x * 4 + 3] = 0xff;
+			}
+		}
+	}
+	return dib;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// the runs
+
+// @dst and @tmp are of the thread, the result of API_IMAGE replaces @dst
+static bool _RunOnce (const Case &c, xl::ui::CDIBSectionPtr &dst, xl::ui::CDIBSection *tmp, double &hMs, double &vMs) {
+	switch (c.api) {
+	case API_DIB:
+		{
+			xl::ui::CDIBSection::RESIZE_TYPE rt = c.filter == FILTER_FAST ? xl::ui::CDIBSection::RT_FAST
+				: c.filter == FILTER_BOX ? xl::ui::CDIBSection::RT_BOX : xl::ui::CDIBSection::RT_BICUBIC;
+			return c.src->resize(dst.get(), rt);
+		}
+	case API_SCALE:
+	case API_PASSES:
+		{
+			xl::ui::CBoxFilter box;
+			xl::ui::CBicubicFilter bicubic;
+			xl::ui::CResizeEngine engine(c.filter == FILTER_BOX ? (xl::ui::CFilter *)&box : (xl::ui::CFilter *)&bicubic);
+			if (c.api == API_SCALE) {
+				return engine.scale(c.src.get(), dst.get());
+			}
+			CBenchTimer timer;
+			int height = c.src->getHeight();
+			if (!engine.horizontalFilter(c.src.get(), height, tmp, 0, height)) {
+				return false;
+			}
+			hMs = timer.getMs();
+			timer.restart();
+			bool ok = engine.verticalFilter(tmp, dst.get());
+			vMs = timer.getMs();
+			return ok;
+		}
+	case API_IMAGE:
+		{
+			CImagePtr image = c.srcImage->resize(c.dstWidth, c.dstHeight, c.filter == FILTER_HQ);
+			if (image == NULL) {
+				return false;
+			}
+			CDIBSectionPool::getInstance()->recycle(dst);
+			dst = image->getImage(0);
+			return true;
+		}
+	default:
+		assert(false);
+		return false;
+	}
+}
+
+struct _Worker {
+	const Case        *c;
+	HANDLE             hStart;
+	CBenchSamples      samples;
+	CBenchSamples      hSamples;
+	CBenchSamples      vSamples;
+	xl::ui::CDIBSectionPtr dst;
+	xl::ui::CDIBSectionPtr tmp;
+	bool               ok;
+	HANDLE             hThread;
+
+	_Worker () : c(NULL), hStart(NULL), ok(true), hThread(NULL) {}
+};
+
+static unsigned __stdcall _WorkerThread (void *param) {
+	_Worker *worker = (_Worker *)param;
+	const Case &c = *worker->c;
+	::WaitForSingleObject(worker->hStart, INFINITE);
+	for (int i = 0; i < c.iterations; ++ i) {
+		double hMs = 0, vMs = 0;
+		CBenchTimer timer;
+		if (!_RunOnce(c, worker->dst, worker->tmp.get(), hMs, vMs)) {
+			worker->ok = false;
+			break;
+		}
+		worker->samples.add(timer.getMs());
+		if (c.api == API_PASSES) {
+			worker->hSamples.add(hMs);
+			worker->vSamples.add(vMs);
+		}
+	}
+	return 0;
+}
+
+// all the threads start at once, returns false if any fails
+static bool _Run (const Case &c, int threads, Result &result) {
+	assert(threads > 0);
+	CDIBSectionPool *pool = CDIBSectionPool::getInstance();
+	int bitcount = c.src->getBitCounts();
+	std::deque<_Worker> workers(threads);
+	HANDLE hStart = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+	bool ok = true;
+	for (int i = 0; i < threads && ok; ++ i) {
+		_Worker &worker = workers[i];
+		worker.c = &c;
+		worker.hStart = hStart;
+		worker.dst = pool->create(c.dstWidth, c.dstHeight, bitcount, false);
+		if (c.api == API_PASSES) {
+			worker.tmp = pool->create(c.dstWidth, c.src->getHeight(), bitcount, false);
+		}
+		ok = worker.dst != NULL && (c.api != API_PASSES || worker.tmp != NULL);
+	}
+
+	// once in this thread first, not counted
+	if (ok) {
+		double hMs, vMs;
+		ok = _RunOnce(c, workers[0].dst, workers[0].tmp.get(), hMs, vMs);
+	}
+
+	for (int i = 0; i < threads && ok; ++ i) {
+		workers[i].hThread = (HANDLE)_beginthreadex(NULL, 0, &_WorkerThread, &workers[i], 0, NULL);
+		ok = workers[i].hThread != NULL;
+	}
+	CBenchTimer wall;
+	::SetEvent(hStart);
+	for (int i = 0; i < threads; ++ i) {
+		if (workers[i].hThread != NULL) {
+			::WaitForSingleObject(workers[i].hThread, INFINITE);
+			::CloseHandle(workers[i].hThread);
+			ok = ok && workers[i].ok;
+		}
+	}
+	result.wallMs = wall.getMs();
+	::CloseHandle(hStart);
+
+	result.threads = threads;
+	for (int i = 0; i < threads; ++ i) {
+		_Worker &worker = workers[i];
+		result.samples.add(worker.samples);
+		result.hSamples.add(worker.hSamples);
+		result.vSamples.add(worker.vSamples);
+		if (i == 0) {
+			result.dst = worker.dst;
+		} else {
+			pool->recycle(worker.dst);
+		}
+		pool->recycle(worker.tmp);
+	}
+	return ok;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// the quality
+
+enum REF_FILTER {
+	REF_NEAREST,
+	REF_BOX,
+	REF_BICUBIC
+};
+
+static double _FilterWidth (REF_FILTER filter) {
+	return filter == REF_BICUBIC ? 2.0 : 0.5;
+}
+
+// Mitchell-Netravali, B = C = 1/3
+static double _FilterValue (REF_FILTER filter, double x) {
+	x = fabs(x);
+	if (filter == REF_BOX) {
+		return x <= 0.5 ? 1.0 : 0.0;
+	}
+	assert(filter == REF_BICUBIC);
+	const double B = 1.0 / 3, C = 1.0 / 3;
+	if (x < 1) {
+		return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6;
+	} else if (x < 2) {
+		return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x + (-12 * B - 48 * C) * x + (8 * B + 24 * C)) / 6;
+	}
+	return 0;
+}
+
+// the source pixels (and their weights) of each destination pixel in one dimension
+struct _Contrib {
+	int                first;
+	std::vector<double> weights;
+};
+typedef std::vector<_Contrib>                  _Contribs;
+
+static void _GetContribs (int srcLength, int dstLength, REF_FILTER filter, _Contribs &contribs) {
+	double scale = (double)dstLength / srcLength;
+	double fscale = scale < 1 ? scale : 1; // the filter is widened when reducing
+	double width = _FilterWidth(filter) / fscale;
+	contribs.resize(dstLength);
+	for (int u = 0; u < dstLength; ++ u) {
+		_Contrib &contrib = contribs[u];
+		double center = (u + 0.5) / scale;
+		if (filter == REF_NEAREST) {
+			contrib.first = (std::min)((int)center, srcLength - 1);
+			contrib.weights.assign(1, 1.0);
+			continue;
+		}
+
+		int left = (std::max)(0, (int)floor(center - width));
+		int right = (std::min)(srcLength - 1, (int)ceil(center + width));
+		contrib.first = left;
+		contrib.weights.clear();
+		double total = 0;
+		for (int j = left; j <= right; ++ j) {
+			double w = _FilterValue(filter, (j + 0.5 - center) * fscale);
+			contrib.weights.push_back(w);
+			total += w;
+		}
+		if (total != 0) {
+			for (size_t i = 0; i < contrib.weights.size(); ++ i) {
+				contrib.weights[i] /= total;
+			}
+		}
+	}
+}
+
+/**
+ * The PSNR (dB) of @dst against @src resampled in double by the separable
+ * @filter, the lines are resampled horizontally when needed, so only the taps
+ * of one destination line are in memory.
+ */
+static double _Reference (xl::ui::CDIBSection *src, xl::ui::CDIBSection *dst, REF_FILTER filter) {
+	int sw = src->getWidth(), sh = src->getHeight();
+	int dw = dst->getWidth(), dh = dst->getHeight();
+	int bpp = src->getBitCounts() / 8;
+	assert(bpp == dst->getBitCounts() / 8);
+	_Contribs hContribs, vContribs;
+	_GetContribs(sw, dw, filter, hContribs);
+	_GetContribs(sh, dh, filter, vContribs);
+
+	std::deque<std::vector<double> > rows; // the horizontally resampled, from the line @rowFirst
+	int rowFirst = 0;
+	std::vector<double> line(dw * 3);
+	double se = 0; // the square error
+	for (int v = 0; v < dh; ++ v) {
+		const _Contrib &vc = vContribs[v];
+		int last = vc.first + (int)vc.weights.size() - 1;
+		while (!rows.empty() && rowFirst < vc.first) {
+			rows.pop_front();
+			++ rowFirst;
+		}
+		if (rows.empty()) {
+			rowFirst = vc.first;
+		}
+		while (rowFirst + (int)rows.size() <= last) {
+			const xl::uint8 *s = src->getLine(rowFirst + (int)rows.size());
+			rows.push_back(std::vector<double>(dw * 3));
+			std::vector<double> &row = rows.back();
+			for (int u = 0; u < dw; ++ u) {
+				const _Contrib &hc = hContribs[u];
+				for (int c = 0; c < 3; ++ c) {
+					double sum = 0;
+					for (size_t k = 0; k < hc.weights.size(); ++ k) {
+						sum += hc.weights[k] * s[(hc.first + k) * bpp + c];
+					}
+					row[u * 3 + c] = sum;
+				}
+			}
+		}
+
+		std::fill(line.begin(), line.end(), 0.0);
+		for (size_t k = 0; k < vc.weights.size(); ++ k) {
+			const std::vector<double> &row = rows[vc.first + k - rowFirst];
+			for (int i = 0; i < dw * 3; ++ i) {
+				line[i] += vc.weights[k] * row[i];
+			}
+		}
+
+		const xl::uint8 *d = dst->getLine(v);
+		for (int u = 0; u < dw; ++ u) {
+			for (int c = 0; c < 3; ++ c) {
+				double r = floor(line[u * 3 + c] + 0.5);
+				r = r < 0 ? 0 : r > 255 ? 255 : r;
+				double e = r - d[u * bpp + c];
+				se += e * e;
+			}
+		}
+	}
+
+	double mse = se / ((double)dw * dh * 3);
+	return mse == 0 ? PSNR_IDENTICAL : (std::min)(PSNR_IDENTICAL, 10 * log10(255.0 * 255.0 / mse));
+}
+
+// the reference of the filter used by @c
+static REF_FILTER _GetRefFilter (const Case &c) {
+	switch (c.filter) {
+	case FILTER_FAST:
+		return REF_NEAREST;
+	case FILTER_BOX:
+		return REF_BOX;
+	case FILTER_BICUBIC:
+		return REF_BICUBIC;
+	case FILTER_HQ:
+		// the same as CImage::_GetResizeType(), the integer reducing is not exactly the box
+		return (double)c.dstWidth / c.src->getWidth() > 0.33 ? REF_BICUBIC : REF_BOX;
+	default:
+		assert(false);
+		return REF_NEAREST;
+	}
+}
+
+
+int main (int argc, char *argv[]) {
+	Options options;
+	if (!_ParseOptions(argc, argv, options)) {
+		_Usage();
+		return 2;
+	}
+
+	CBenchJson json;
+	json.beginObject();
+	json.add("benchmark", "resize");
+	json.add("format", 1);
+	json.beginObject("environment");
+	json.addEnvironment();
+	json.endObject();
+	json.beginArray("results");
+
+	FILE *out = options.json == "-" ? stderr : stdout;
+	fprintf(out, "%-11s %-11s %4s %-6s %-7s %3s %9s %9s %9s %9s %9s %7s\n",
+		"source", "result", "bits", "api", "filter", "thr", "p50 ms", "p99 ms", "h p50", "v p50", "MP/s", "PSNR");
+
+	int failures = 0;
+	for (size_t m = 0; m < options.megapixels.size(); ++ m) {
+		BenchImageSpec spec(BenchImageSpec::JPEG_BASELINE, options.megapixels[m]); // only for the size
+		for (size_t b = 0; b < options.bitcounts.size(); ++ b) {
+			Case c;
+			c.iterations = options.iterations;
+			c.src = _CreateSource(spec.width, spec.height, options.bitcounts[b]);
+			if (c.src == NULL) {
+				fprintf(stderr, "out of memory for the source of %d MP\n", spec.megapixels);
+				++ failures;
+				continue;
+			}
+			c.srcImage.reset(new CImage());
+			c.srcImage->insertImage(c.src, CImage::DELAY_INFINITE);
+
+			for (size_t r = 0; r < options.ratios.size(); ++ r) {
+				double ratio = options.ratios[r];
+				c.dstWidth = (std::max)(1, (int)(spec.width * ratio + 0.5));
+				c.dstHeight = (std::max)(1, (int)(spec.height * ratio + 0.5));
+				if ((double)c.dstWidth * c.dstHeight > options.maxDstMegapixels * 1000000.0) {
+					continue;
+				}
+
+				for (int a = 0; a < API_COUNT; ++ a) {
+					for (int f = 0; f < FILTER_COUNT; ++ f) {
+						if (!options.apis[a] || !options.filters[f] || !_IsSupported((API)a, (FILTER)f)) {
+							continue;
+						}
+						c.api = (API)a;
+						c.filter = (FILTER)f;
+
+						double psnr = -1;
+						for (size_t t = 0; t < options.threads.size(); ++ t) {
+							Result result;
+							bool ok = _Run(c, options.threads[t], result);
+							if (ok && options.psnr && psnr < 0) {
+								psnr = _Reference(c.src.get(), result.dst.get(), _GetRefFilter(c));
+							}
+							CDIBSectionPool::getInstance()->recycle(result.dst);
+
+							double srcMp = (double)spec.width * spec.height / 1000000.0;
+							double mpps = ok && result.wallMs > 0
+								? srcMp * result.samples.getCount() / (result.wallMs / 1000.0) : 0;
+
+							json.beginObject();
+							json.add("src_width", spec.width);
+							json.add("src_height", spec.height);
+							json.add("dst_width", c.dstWidth);
+							json.add("dst_height", c.dstHeight);
+							json.add("ratio", ratio);
+							json.add("bits", options.bitcounts[b]);
+							json.add("api", API_NAMES[a]);
+							json.add("filter", FILTER_NAMES[f]);
+							json.add("threads", result.threads);
+							json.add("ok", ok);
+							if (ok) {
+								json.add("iterations", (int)result.samples.getCount());
+								json.add("ms_p50", result.samples.getPercentile(50));
+								json.add("ms_p99", result.samples.getPercentile(99));
+								json.add("ms_min", result.samples.getMin());
+								if (c.api == API_PASSES) {
+									json.add("ms_h_p50", result.hSamples.getPercentile(50));
+									json.add("ms_v_p50", result.vSamples.getPercentile(50));
+								}
+								json.add("mp_per_s", mpps); // of the sources, all the threads
+								if (psnr >= 0) {
+									json.add("psnr_db", psnr);
+								}
+							}
+							json.endObject();
+
+							char source[32], target[32];
+							sprintf(source, "%dx%d", spec.width, spec.height);
+							sprintf(target, "%dx%d", c.dstWidth, c.dstHeight);
+							if (ok) {
+								char h[16] = "-", v[16] = "-", q[16] = "-";
+								if (c.api == API_PASSES) {
+									sprintf(h, "%.2f", result.hSamples.getPercentile(50));
+									sprintf(v, "%.2f", result.vSamples.getPercentile(50));
+								}
+								if (psnr >= 0) {
+									sprintf(q, "%.2f", psnr);
+								}
+								fprintf(out, "%-11s %-11s %4d %-6s %-7s %3d %9.2f %9.2f %9s %9s %9.1f %7s\n",
+									source, target, options.bitcounts[b], API_NAMES[a], FILTER_NAMES[f], result.threads,
+									result.samples.getPercentile(50), result.samples.getPercentile(99), h, v, mpps, q);
+							} else {
+								fprintf(out, "%-11s %-11s %4d %-6s %-7s %3d failed\n",
+									source, target, options.bitcounts[b], API_NAMES[a], FILTER_NAMES[f], result.threads);
+								++ failures;
+							}
+							fflush(out);
+						}
+					}
+				}
+			}
+
+			c.srcImage.reset();
+			CDIBSectionPool::getInstance()->recycle(c.src);
+		}
+	}
+
+	json.endArray();
+	json.endObject();
+	if (!options.json.empty() && !json.save(options.json)) {
+		fprintf(stderr, "can't write %s\n", options.json.c_str());
+		++ failures;
+	}
+
+	CJobScheduler::getInstance()->stop();
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,815 @@
+#ifndef _WIN32
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <string>
+#include "Portable.h"
+
+//////////////////////////////////////////////////////////////////////////
+// the kernel objects
+
+namespace {
+
+static __thread DWORD _lastError = 0;
+
+static DWORD _SetError (DWORD error) {
+	_lastError = error;
+	return error;
+}
+
+struct _Object {
+	enum TYPE {
+		TYPE_EVENT,
+		TYPE_SEMAPHORE,
+		TYPE_THREAD,
+		TYPE_FILE,
+		TYPE_MAPPING,
+		TYPE_FIND
+	};
+	TYPE           type;
+
+	_Object (TYPE type) : type(type) {}
+	virtual ~_Object () {}
+};
+
+// the events, the semaphores and the threads can be waited
+struct _Waitable : public _Object {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	_Waitable (TYPE type) : _Object(type) {
+		pthread_mutex_init(&mutex, NULL);
+		pthread_condattr_t attr;
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&cond, &attr);
+		pthread_condattr_destroy(&attr);
+	}
+	virtual ~_Waitable () {
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&mutex);
+	}
+
+	// called in the lock, acquires it (resets the auto reset event, ...) if signaled
+	virtual bool tryAcquire () = 0;
+};
+
+struct _Event : public _Waitable {
+	bool           manualReset;
+	bool           signaled;
+
+	_Event (bool manualReset, bool signaled)
+		: _Waitable(TYPE_EVENT), manualReset(manualReset), signaled(signaled) {}
+	virtual bool tryAcquire () {
+		if (!signaled) {
+			return false;
+		}
+		if (!manualReset) {
+			signaled = false;
+		}
+		return true;
+	}
+};
+
+struct _Semaphore : public _Waitable {
+	LONG           count;
+	LONG           maximum;
+
+	_Semaphore (LONG count, LONG maximum)
+		: _Waitable(TYPE_SEMAPHORE), count(count), maximum(maximum) {}
+	virtual bool tryAcquire () {
+		if (count <= 0) {
+			return false;
+		}
+		-- count;
+		return true;
+	}
+};
+
+struct _Thread : public _Waitable {
+	pthread_t      thread;
+	bool           exited;
+	bool           joined;
+	unsigned     (*proc) (void *);
+	void          *arg;
+
+	_Thread () : _Waitable(TYPE_THREAD), exited(false), joined(false), proc(NULL), arg(NULL) {}
+	virtual bool tryAcquire () { return exited; }
+};
+
+struct _File : public _Object {
+	int            fd;
+	std::string    name;
+	bool           deleteOnClose;
+
+	_File (int fd, const char *name, bool deleteOnClose)
+		: _Object(TYPE_FILE), fd(fd), name(name), deleteOnClose(deleteOnClose) {}
+	virtual ~_File () {
+		close(fd);
+		if (deleteOnClose) {
+			unlink(name.c_str());
+		}
+	}
+};
+
+struct _Mapping : public _Object {
+	int            fd;
+	size_t         size;
+
+	_Mapping (int fd, size_t size) : _Object(TYPE_MAPPING), fd(fd), size(size) {}
+	virtual ~_Mapping () { close(fd); }
+};
+
+struct _Find : public _Object {
+	DIR           *dir;
+	std::string    directory;
+	std::string    pattern;
+
+	_Find (DIR *dir, const std::string &directory, const std::string &pattern)
+		: _Object(TYPE_FIND), dir(dir), directory(directory), pattern(pattern) {}
+	virtual ~_Find () { closedir(dir); }
+};
+
+// the sizes of the mapped views, for UnmapViewOfFile()
+static pthread_mutex_t _viewsLock = PTHREAD_MUTEX_INITIALIZER;
+static std::tr1::unordered_map<const void *, size_t> _views;
+
+static _Object* _Get (HANDLE h, _Object::TYPE type) {
+	if (h == NULL || h == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+	_Object *object = (_Object *)h;
+	assert(object->type == type);
+	return object->type == type ? object : NULL;
+}
+
+static _Waitable* _GetWaitable (HANDLE h) {
+	if (h == NULL || h == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+	_Object *object = (_Object *)h;
+	if (object->type != _Object::TYPE_EVENT && object->type != _Object::TYPE_SEMAPHORE
+		&& object->type != _Object::TYPE_THREAD)
+	{
+		return NULL;
+	}
+	return (_Waitable *)object;
+}
+
+static void _GetDeadline (DWORD ms, struct timespec &deadline) {
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += ms / 1000;
+	deadline.tv_nsec += (long)(ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000;
+	}
+}
+
+static void* _ThreadProc (void *param) {
+	_Thread *thread = (_Thread *)param;
+	thread->proc(thread->arg);
+
+	pthread_mutex_lock(&thread->mutex);
+	thread->exited = true;
+	pthread_cond_broadcast(&thread->cond);
+	pthread_mutex_unlock(&thread->mutex);
+	return NULL;
+}
+
+static int _OpenFlags (DWORD access) {
+	if ((access & GENERIC_READ) && (access & GENERIC_WRITE)) {
+		return O_RDWR;
+	}
+	return (access & GENERIC_WRITE) ? O_WRONLY : O_RDONLY;
+}
+
+static void _FillFileInfo (const struct stat &st, DWORD &attributes, FILETIME &lastWrite, DWORD &sizeHigh, DWORD &sizeLow) {
+	attributes = S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+	// 100 ns since 1601-01-01, as the FILETIME
+	ULONGLONG t = ((ULONGLONG)st.st_mtime + 11644473600ULL) * 10000000ULL;
+	lastWrite.dwLowDateTime = (DWORD)t;
+	lastWrite.dwHighDateTime = (DWORD)(t >> 32);
+	sizeHigh = (DWORD)((ULONGLONG)st.st_size >> 32);
+	sizeLow = (DWORD)st.st_size;
+}
+
+static bool _NextFile (_Find *find, WIN32_FIND_DATA *data) {
+	struct dirent *entry;
+	while ((entry = readdir(find->dir)) != NULL) {
+		if (fnmatch(find->pattern.c_str(), entry->d_name, 0) != 0) {
+			continue;
+		}
+		std::string path = find->directory + entry->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0) {
+			continue;
+		}
+		_FillFileInfo(st, data->dwFileAttributes, data->ftLastWriteTime, data->nFileSizeHigh, data->nFileSizeLow);
+		snprintf(data->cFileName, MAX_PATH, "%s", entry->d_name);
+		return true;
+	}
+	return false;
+}
+
+} // namespace
+
+
+//////////////////////////////////////////////////////////////////////////
+// time, threads and synchronization
+
+DWORD GetTickCount () {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (DWORD)((ULONGLONG)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+BOOL QueryPerformanceCounter (LARGE_INTEGER *counter) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	counter->QuadPart = (LONGLONG)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	return TRUE;
+}
+
+BOOL QueryPerformanceFrequency (LARGE_INTEGER *frequency) {
+	frequency->QuadPart = 1000000000; // ns
+	return TRUE;
+}
+
+void Sleep (DWORD ms) {
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000;
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+	}
+}
+
+BOOL SwitchToThread () {
+	return sched_yield() == 0;
+}
+
+DWORD GetCurrentThreadId () {
+	return (DWORD)syscall(SYS_gettid);
+}
+
+HANDLE GetCurrentThread () {
+	return (HANDLE)(LONG_PTR)-2; // the pseudo handle
+}
+
+HANDLE GetCurrentProcess () {
+	return (HANDLE)(LONG_PTR)-1;
+}
+
+DWORD GetLastError () {
+	return _lastError;
+}
+
+BOOL SetThreadPriority (HANDLE /*hThread*/, int /*priority*/) {
+	return TRUE; // not changed, a normal user can only lower it on Linux
+}
+
+BOOL TerminateThread (HANDLE /*hThread*/, DWORD /*exitCode*/) {
+	return FALSE; // never, the thread is left running
+}
+
+void GetSystemInfo (SYSTEM_INFO *si) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	si->dwNumberOfProcessors = cpus > 0 ? (DWORD)cpus : 1;
+	si->dwPageSize = (DWORD)sysconf(_SC_PAGESIZE);
+}
+
+HANDLE CreateEvent (void * /*sa*/, BOOL manualReset, BOOL initialState, LPCTSTR /*name*/) {
+	return new _Event(manualReset != FALSE, initialState != FALSE);
+}
+
+BOOL SetEvent (HANDLE hEvent) {
+	_Event *e = (_Event *)_Get(hEvent, _Object::TYPE_EVENT);
+	if (e == NULL) {
+		return FALSE;
+	}
+	pthread_mutex_lock(&e->mutex);
+	e->signaled = true;
+	pthread_cond_broadcast(&e->cond);
+	pthread_mutex_unlock(&e->mutex);
+	return TRUE;
+}
+
+BOOL ResetEvent (HANDLE hEvent) {
+	_Event *e = (_Event *)_Get(hEvent, _Object::TYPE_EVENT);
+	if (e == NULL) {
+		return FALSE;
+	}
+	pthread_mutex_lock(&e->mutex);
+	e->signaled = false;
+	pthread_mutex_unlock(&e->mutex);
+	return TRUE;
+}
+
+HANDLE CreateSemaphore (void * /*sa*/, LONG initialCount, LONG maximumCount, LPCTSTR /*name*/) {
+	assert(initialCount >= 0 && initialCount <= maximumCount);
+	return new _Semaphore(initialCount, maximumCount);
+}
+
+BOOL ReleaseSemaphore (HANDLE hSemaphore, LONG releaseCount, LONG *previousCount) {
+	_Semaphore *s = (_Semaphore *)_Get(hSemaphore, _Object::TYPE_SEMAPHORE);
+	if (s == NULL || releaseCount <= 0) {
+		return FALSE;
+	}
+	pthread_mutex_lock(&s->mutex);
+	if (previousCount != NULL) {
+		*previousCount = s->count;
+	}
+	BOOL ok = s->count + releaseCount <= s->maximum;
+	if (ok) {
+		s->count += releaseCount;
+		pthread_cond_broadcast(&s->cond);
+	}
+	pthread_mutex_unlock(&s->mutex);
+	return ok;
+}
+
+HANDLE CreateMutex (void *sa, BOOL initialOwner, LPCTSTR name) {
+	return CreateSemaphore(sa, initialOwner ? 0 : 1, 1, name);
+}
+
+BOOL ReleaseMutex (HANDLE hMutex) {
+	return ReleaseSemaphore(hMutex, 1, NULL);
+}
+
+DWORD WaitForSingleObject (HANDLE h, DWORD ms) {
+	_Waitable *w = _GetWaitable(h);
+	if (w == NULL) {
+		_SetError(EINVAL);
+		return WAIT_FAILED;
+	}
+
+	struct timespec deadline;
+	if (ms != INFINITE) {
+		_GetDeadline(ms, deadline);
+	}
+	DWORD ret = WAIT_OBJECT_0;
+	pthread_mutex_lock(&w->mutex);
+	while (!w->tryAcquire()) {
+		if (ms == 0) {
+			ret = WAIT_TIMEOUT;
+			break;
+		} else if (ms == INFINITE) {
+			pthread_cond_wait(&w->cond, &w->mutex);
+		} else if (pthread_cond_timedwait(&w->cond, &w->mutex, &deadline) == ETIMEDOUT) {
+			ret = w->tryAcquire() ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&w->mutex);
+	return ret;
+}
+
+DWORD WaitForMultipleObjects (DWORD count, const HANDLE *handles, BOOL waitAll, DWORD ms) {
+	assert(count > 0 && handles != NULL);
+	DWORD begin = GetTickCount();
+	if (waitAll) {
+		// used for the threads only, so nothing is acquired by a partial success
+		for (DWORD i = 0; i < count; ++ i) {
+			DWORD elapsed = GetTickCount() - begin;
+			DWORD left = ms == INFINITE ? INFINITE : (elapsed < ms ? ms - elapsed : 0);
+			DWORD ret = WaitForSingleObject(handles[i], left);
+			if (ret != WAIT_OBJECT_0) {
+				return ret;
+			}
+		}
+		return WAIT_OBJECT_0;
+	}
+
+	for (;;) {
+		for (DWORD i = 0; i < count; ++ i) {
+			if (WaitForSingleObject(handles[i], 0) == WAIT_OBJECT_0) {
+				return WAIT_OBJECT_0 + i;
+			}
+		}
+		if (ms != INFINITE && GetTickCount() - begin >= ms) {
+			return WAIT_TIMEOUT;
+		}
+		Sleep(1);
+	}
+}
+
+BOOL CloseHandle (HANDLE h) {
+	if (h == NULL || h == INVALID_HANDLE_VALUE) {
+		return FALSE;
+	}
+	_Object *object = (_Object *)h;
+	if (object->type == _Object::TYPE_THREAD) {
+		_Thread *thread = (_Thread *)object;
+		pthread_mutex_lock(&thread->mutex);
+		bool exited = thread->exited;
+		pthread_mutex_unlock(&thread->mutex);
+		if (!exited) {
+			pthread_detach(thread->thread);
+			return TRUE; // leaked, as the thread is still running
+		}
+		pthread_join(thread->thread, NULL);
+	}
+	delete object;
+	return TRUE;
+}
+
+uintptr_t _beginthreadex (void * /*security*/, unsigned stackSize, unsigned (*proc) (void *),
+                          void *arg, unsigned /*initFlag*/, unsigned *threadId)
+{
+	_Thread *thread = new _Thread();
+	thread->proc = proc;
+	thread->arg = arg;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	if (stackSize > 0) {
+		pthread_attr_setstacksize(&attr, stackSize);
+	}
+	int ret = pthread_create(&thread->thread, &attr, _ThreadProc, thread);
+	pthread_attr_destroy(&attr);
+	if (ret != 0) {
+		delete thread;
+		_SetError(ret);
+		return 0;
+	}
+	if (threadId != NULL) {
+		*threadId = 0;
+	}
+	return (uintptr_t)thread;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// memory
+
+LPVOID VirtualAlloc (LPVOID address, SIZE_T size, DWORD type, DWORD /*protect*/) {
+	assert(address == NULL && (type & MEM_COMMIT));
+	if (address != NULL || (type & MEM_LARGE_PAGES)) {
+		_SetError(EINVAL);
+		return NULL;
+	}
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		_SetError(errno);
+		return NULL;
+	}
+	pthread_mutex_lock(&_viewsLock);
+	_views[p] = size;
+	pthread_mutex_unlock(&_viewsLock);
+	return p;
+}
+
+BOOL VirtualFree (LPVOID address, SIZE_T /*size*/, DWORD type) {
+	assert(type == MEM_RELEASE);
+	return UnmapViewOfFile(address);
+}
+
+SIZE_T GetLargePageMinimum () {
+	return 0; // not supported
+}
+
+void* _aligned_malloc (size_t size, size_t alignment) {
+	void *p = NULL;
+	if (alignment < sizeof(void *)) {
+		alignment = sizeof(void *);
+	}
+	return posix_memalign(&p, alignment, size) == 0 ? p : NULL;
+}
+
+void _aligned_free (void *p) {
+	free(p);
+}
+
+BOOL GlobalMemoryStatusEx (MEMORYSTATUSEX *ms) {
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long avail = sysconf(_SC_AVPHYS_PAGES);
+	long pageSize = sysconf(_SC_PAGESIZE);
+	if (pages <= 0 || avail < 0 || pageSize <= 0) {
+		return FALSE;
+	}
+	ms->ullTotalPhys = (ULONGLONG)pages * pageSize;
+	ms->ullAvailPhys = (ULONGLONG)avail * pageSize;
+	ms->dwMemoryLoad = (DWORD)(100 - ms->ullAvailPhys * 100 / ms->ullTotalPhys);
+	ms->ullTotalPageFile = ms->ullTotalPhys;
+	ms->ullAvailPageFile = ms->ullAvailPhys;
+	// the address space of a 64 bits process is never short
+	ms->ullTotalVirtual = (ULONGLONG)1 << 47;
+	ms->ullAvailVirtual = ms->ullTotalVirtual;
+	return TRUE;
+}
+
+BOOL GetProcessMemoryInfo (HANDLE /*hProcess*/, PROCESS_MEMORY_COUNTERS *pmc, DWORD cb) {
+	memset(pmc, 0, cb);
+	pmc->cb = cb;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (fp == NULL) {
+		return FALSE;
+	}
+	unsigned long size = 0, resident = 0;
+	int n = fscanf(fp, "%lu %lu", &size, &resident);
+	fclose(fp);
+	if (n != 2) {
+		return FALSE;
+	}
+	long pageSize = sysconf(_SC_PAGESIZE);
+	pmc->WorkingSetSize = (SIZE_T)resident * pageSize;
+	pmc->PeakWorkingSetSize = pmc->WorkingSetSize;
+	pmc->PagefileUsage = (SIZE_T)size * pageSize;
+	pmc->PeakPagefileUsage = pmc->PagefileUsage;
+	return TRUE;
+}
+
+BOOL OpenProcessToken (HANDLE /*hProcess*/, DWORD /*access*/, HANDLE * /*hToken*/) {
+	_SetError(EPERM);
+	return FALSE;
+}
+
+BOOL LookupPrivilegeValue (LPCTSTR /*system*/, LPCTSTR /*name*/, LUID * /*luid*/) {
+	_SetError(EPERM);
+	return FALSE;
+}
+
+BOOL AdjustTokenPrivileges (HANDLE, BOOL, TOKEN_PRIVILEGES *, DWORD, TOKEN_PRIVILEGES *, DWORD *) {
+	_SetError(EPERM);
+	return FALSE;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// files
+
+HANDLE CreateFile (LPCTSTR name, DWORD access, DWORD /*share*/, void * /*sa*/, DWORD disposition, DWORD flags, HANDLE /*hTemplate*/) {
+	int oflags = _OpenFlags(access);
+	if (disposition == CREATE_ALWAYS) {
+		oflags |= O_CREAT | O_TRUNC;
+	} else if (disposition == OPEN_ALWAYS) {
+		oflags |= O_CREAT;
+	}
+	int fd = open(name, oflags | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		_SetError(errno);
+		return INVALID_HANDLE_VALUE;
+	}
+	return new _File(fd, name, (flags & FILE_FLAG_DELETE_ON_CLOSE) != 0);
+}
+
+BOOL ReadFile (HANDLE hFile, void *buffer, DWORD bytes, DWORD *read, OVERLAPPED *ov) {
+	_File *file = (_File *)_Get(hFile, _Object::TYPE_FILE);
+	if (file == NULL) {
+		return FALSE;
+	}
+	ssize_t n;
+	if (ov != NULL) {
+		off_t offset = (off_t)(((ULONGLONG)ov->OffsetHigh << 32) | ov->Offset);
+		n = pread(file->fd, buffer, bytes, offset);
+	} else {
+		n = ::read(file->fd, buffer, bytes);
+	}
+	if (n < 0) {
+		_SetError(errno);
+		return FALSE;
+	}
+	if (read != NULL) {
+		*read = (DWORD)n;
+	}
+	return TRUE;
+}
+
+BOOL WriteFile (HANDLE hFile, const void *buffer, DWORD bytes, DWORD *written, OVERLAPPED *ov) {
+	_File *file = (_File *)_Get(hFile, _Object::TYPE_FILE);
+	if (file == NULL) {
+		return FALSE;
+	}
+	ssize_t n;
+	if (ov != NULL) {
+		off_t offset = (off_t)(((ULONGLONG)ov->OffsetHigh << 32) | ov->Offset);
+		n = pwrite(file->fd, buffer, bytes, offset);
+	} else {
+		n = ::write(file->fd, buffer, bytes);
+	}
+	if (n < 0) {
+		_SetError(errno);
+		return FALSE;
+	}
+	if (written != NULL) {
+		*written = (DWORD)n;
+	}
+	return TRUE;
+}
+
+BOOL SetFilePointerEx (HANDLE hFile, LARGE_INTEGER distance, LARGE_INTEGER *newPointer, DWORD method) {
+	_File *file = (_File *)_Get(hFile, _Object::TYPE_FILE);
+	if (file == NULL) {
+		return FALSE;
+	}
+	int whence = method == FILE_BEGIN ? SEEK_SET : (method == FILE_END ? SEEK_END : SEEK_CUR);
+	off_t pos = lseek(file->fd, (off_t)distance.QuadPart, whence);
+	if (pos == (off_t)-1) {
+		_SetError(errno);
+		return FALSE;
+	}
+	if (newPointer != NULL) {
+		newPointer->QuadPart = pos;
+	}
+	return TRUE;
+}
+
+BOOL GetFileSizeEx (HANDLE hFile, LARGE_INTEGER *size) {
+	_File *file = (_File *)_Get(hFile, _Object::TYPE_FILE);
+	struct stat st;
+	if (file == NULL || fstat(file->fd, &st) != 0) {
+		return FALSE;
+	}
+	size->QuadPart = st.st_size;
+	return TRUE;
+}
+
+BOOL SetEndOfFile (HANDLE hFile) {
+	_File *file = (_File *)_Get(hFile, _Object::TYPE_FILE);
+	if (file == NULL) {
+		return FALSE;
+	}
+	off_t pos = lseek(file->fd, 0, SEEK_CUR);
+	return pos != (off_t)-1 && ftruncate(file->fd, pos) == 0;
+}
+
+BOOL GetFileAttributesEx (LPCTSTR name, GET_FILEEX_INFO_LEVELS /*level*/, void *info) {
+	struct stat st;
+	if (stat(name, &st) != 0) {
+		_SetError(errno);
+		return FALSE;
+	}
+	WIN32_FILE_ATTRIBUTE_DATA *data = (WIN32_FILE_ATTRIBUTE_DATA *)info;
+	_FillFileInfo(st, data->dwFileAttributes, data->ftLastWriteTime, data->nFileSizeHigh, data->nFileSizeLow);
+	return TRUE;
+}
+
+BOOL MoveFileEx (LPCTSTR existingName, LPCTSTR newName, DWORD flags) {
+	struct stat st;
+	if (!(flags & MOVEFILE_REPLACE_EXISTING) && stat(newName, &st) == 0) {
+		_SetError(EEXIST);
+		return FALSE;
+	}
+	if (rename(existingName, newName) != 0) {
+		_SetError(errno);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BOOL DeleteFile (LPCTSTR name) {
+	if (unlink(name) != 0) {
+		_SetError(errno);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+DWORD GetTempPath (DWORD length, LPTSTR buffer) {
+	const char *dir = getenv("TMPDIR");
+	if (dir == NULL || dir[0] == '\0') {
+		dir = "/tmp";
+	}
+	int n = snprintf(buffer, length, "%s/", dir);
+	return n > 0 && (DWORD)n < length ? (DWORD)n : 0;
+}
+
+UINT GetTempFileName (LPCTSTR path, LPCTSTR prefix, UINT unique, LPTSTR name) {
+	assert(unique == 0);
+	snprintf(name, MAX_PATH, "%s%.3sXXXXXX", path, prefix);
+	int fd = mkstemp(name);
+	if (fd == -1) {
+		_SetError(errno);
+		return 0;
+	}
+	close(fd);
+	return unique == 0 ? 1 : unique;
+}
+
+HANDLE CreateFileMapping (HANDLE hFile, void * /*sa*/, DWORD protect, DWORD /*sizeHigh*/, DWORD /*sizeLow*/, LPCTSTR /*name*/) {
+	assert(protect == PAGE_READONLY);
+	_File *file = (_File *)_Get(hFile, _Object::TYPE_FILE);
+	struct stat st;
+	if (protect != PAGE_READONLY || file == NULL || fstat(file->fd, &st) != 0 || st.st_size == 0) {
+		return NULL;
+	}
+	int fd = dup(file->fd);
+	if (fd == -1) {
+		_SetError(errno);
+		return NULL;
+	}
+	return new _Mapping(fd, (size_t)st.st_size);
+}
+
+LPVOID MapViewOfFile (HANDLE hMapping, DWORD access, DWORD offsetHigh, DWORD offsetLow, SIZE_T bytes) {
+	assert(access == FILE_MAP_READ && offsetHigh == 0 && offsetLow == 0 && bytes == 0);
+	_Mapping *mapping = (_Mapping *)_Get(hMapping, _Object::TYPE_MAPPING);
+	if (mapping == NULL) {
+		return NULL;
+	}
+	void *p = mmap(NULL, mapping->size, PROT_READ, MAP_SHARED, mapping->fd, 0);
+	if (p == MAP_FAILED) {
+		_SetError(errno);
+		return NULL;
+	}
+	pthread_mutex_lock(&_viewsLock);
+	_views[p] = mapping->size;
+	pthread_mutex_unlock(&_viewsLock);
+	return p;
+}
+
+BOOL UnmapViewOfFile (const void *address) {
+	pthread_mutex_lock(&_viewsLock);
+	std::tr1::unordered_map<const void *, size_t>::iterator it = _views.find(address);
+	size_t size = 0;
+	if (it != _views.end()) {
+		size = it->second;
+		_views.erase(it);
+	}
+	pthread_mutex_unlock(&_viewsLock);
+	return size > 0 && munmap((void *)address, size) == 0;
+}
+
+HANDLE FindFirstFile (LPCTSTR pattern, WIN32_FIND_DATA *data) {
+	std::string s = pattern;
+	std::string::size_type slash = s.find_last_of("\\/");
+	std::string directory = slash == std::string::npos ? std::string("./") : s.substr(0, slash + 1);
+	std::string name = slash == std::string::npos ? s : s.substr(slash + 1);
+	if (name == "*.*") {
+		name = "*";
+	}
+
+	DIR *dir = opendir(directory.c_str());
+	if (dir == NULL) {
+		_SetError(errno);
+		return INVALID_HANDLE_VALUE;
+	}
+	_Find *find = new _Find(dir, directory, name);
+	if (!_NextFile(find, data)) {
+		delete find;
+		_SetError(ENOENT);
+		return INVALID_HANDLE_VALUE;
+	}
+	return find;
+}
+
+BOOL FindNextFile (HANDLE hFind, WIN32_FIND_DATA *data) {
+	_Find *find = (_Find *)_Get(hFind, _Object::TYPE_FIND);
+	return find != NULL && _NextFile(find, data);
+}
+
+BOOL FindClose (HANDLE hFind) {
+	_Find *find = (_Find *)_Get(hFind, _Object::TYPE_FIND);
+	delete find;
+	return find != NULL;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// UI
+
+BOOL PostMessage (HWND /*hWnd*/, UINT /*msg*/, WPARAM /*wParam*/, LPARAM /*lParam*/) {
+	return FALSE;
+}
+
+UINT_PTR SetTimer (HWND /*hWnd*/, UINT_PTR /*id*/, UINT /*elapse*/, TIMERPROC /*proc*/) {
+	return 0;
+}
+
+BOOL KillTimer (HWND /*hWnd*/, UINT_PTR /*id*/) {
+	return FALSE;
+}
+
+int MessageBox (HWND /*hWnd*/, LPCTSTR text, LPCTSTR /*caption*/, UINT /*type*/) {
+	fprintf(stderr, "%s\n", text);
+	return 0;
+}
+
+int StretchDIBits (HDC, int, int, int, int, int, int, int, int, const void *, const BITMAPINFO *, UINT, DWORD) {
+	return 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// CRT
+
+int _tdupenv_s (TCHAR **buffer, size_t *length, LPCTSTR name) {
+	const char *value = getenv(name);
+	*buffer = value != NULL ? strdup(value) : NULL;
+	if (length != NULL) {
+		*length = value != NULL ? strlen(value) + 1 : 0;
+	}
+	return 0;
+}
+
+
+#endif // _WIN32
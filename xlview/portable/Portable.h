@@ -0,0 +1,459 @@
+#ifndef XL_VIEW_PORTABLE_H
+#define XL_VIEW_PORTABLE_H
+/**
+ * The Win32 API used by the core (the decoding, caching and prefetching, see
+ * xlview_core in CMakeLists.txt), implemented on POSIX for the headless build.
+ *
+ * It's force included by the build (before <memory>, for std::tr1), and the
+ * headers in this directory (Windows.h, atltypes.h, tchar.h, ...) only include
+ * it. Only the functions and the fields used by the core are here, the ones of
+ * the UI (PostMessage(), StretchDIBits(), ...) do nothing. There is no UNICODE,
+ * TCHAR is char.
+ */
+#ifndef _WIN32
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <ctype.h>
+#include <strings.h>
+#include <tr1/memory>
+#include <tr1/unordered_map>
+#include <tr1/tuple>
+
+//////////////////////////////////////////////////////////////////////////
+// types
+
+typedef int                BOOL;
+typedef unsigned char      BYTE;
+typedef unsigned short     WORD;
+typedef uint32_t           DWORD;
+typedef int32_t            LONG;
+typedef int64_t            LONGLONG;
+typedef uint64_t           ULONGLONG;
+
+// LONG is 32 bits on Windows, so is LONG_MAX (the maximum count of a semaphore)
+#undef LONG_MAX
+#define LONG_MAX           0x7fffffffL
+
+typedef unsigned int       UINT;
+typedef uintptr_t          UINT_PTR;
+typedef intptr_t           LONG_PTR;
+typedef uintptr_t          ULONG_PTR;
+typedef uintptr_t          SIZE_T;
+typedef uintptr_t          WPARAM;
+typedef intptr_t           LPARAM;
+typedef void              *LPVOID;
+typedef void              *HANDLE;
+typedef HANDLE             HWND;
+typedef HANDLE             HDC;
+typedef HANDLE             HBITMAP;
+typedef HANDLE             HINSTANCE;
+typedef char               TCHAR;
+typedef char               CHAR;
+typedef const char        *LPCTSTR;
+typedef char              *LPTSTR;
+
+#define __int64            long long
+#define __stdcall
+#define WINAPI
+#define CALLBACK
+#define __forceinline      inline __attribute__((always_inline))
+#define __declspec(x)      __declspec_##x
+#define __declspec_thread  __thread
+
+#define TRUE               1
+#define FALSE              0
+#define MAX_PATH           260
+#define INFINITE           0xFFFFFFFF
+#define INVALID_HANDLE_VALUE ((HANDLE)(LONG_PTR)-1)
+
+#define WAIT_OBJECT_0      0
+#define WAIT_TIMEOUT       258
+#define WAIT_FAILED        0xFFFFFFFF
+
+#define ERROR_SUCCESS      0
+#define ERROR_NOT_ALL_ASSIGNED 1300
+
+#define _T(x)              x
+#define TEXT(x)            x
+
+#define CONTAINING_RECORD(address, type, field) \
+	((type *)((char *)(address) - offsetof(type, field)))
+
+typedef union _LARGE_INTEGER {
+	struct {
+		DWORD      LowPart;
+		LONG       HighPart;
+	};
+	LONGLONG       QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _FILETIME {
+	DWORD          dwLowDateTime;
+	DWORD          dwHighDateTime;
+} FILETIME;
+
+
+//////////////////////////////////////////////////////////////////////////
+// interlocked, SList
+
+inline LONG InterlockedIncrement (volatile LONG *p) { return __sync_add_and_fetch(p, 1); }
+inline LONG InterlockedDecrement (volatile LONG *p) { return __sync_sub_and_fetch(p, 1); }
+inline LONG InterlockedExchangeAdd (volatile LONG *p, LONG v) { return __sync_fetch_and_add(p, v); }
+inline LONG InterlockedExchange (volatile LONG *p, LONG v) { return __sync_lock_test_and_set(p, v); }
+inline LONGLONG InterlockedExchange64 (volatile LONGLONG *p, LONGLONG v) { return __sync_lock_test_and_set(p, v); }
+inline LONGLONG InterlockedExchangeAdd64 (volatile LONGLONG *p, LONGLONG v) { return __sync_fetch_and_add(p, v); }
+inline LONG InterlockedCompareExchange (volatile LONG *p, LONG v, LONG comparand) {
+	return __sync_val_compare_and_swap(p, comparand, v);
+}
+inline void YieldProcessor () { __builtin_ia32_pause(); }
+
+#define MEMORY_ALLOCATION_ALIGNMENT 16
+
+typedef struct _SLIST_ENTRY {
+	struct _SLIST_ENTRY *Next;
+} SLIST_ENTRY, *PSLIST_ENTRY;
+
+// only push and flush are used, so there is no ABA problem
+typedef struct _SLIST_HEADER {
+	PSLIST_ENTRY volatile Next;
+} SLIST_HEADER, *PSLIST_HEADER;
+
+inline void InitializeSListHead (PSLIST_HEADER head) { head->Next = NULL; }
+inline PSLIST_ENTRY InterlockedPushEntrySList (PSLIST_HEADER head, PSLIST_ENTRY entry) {
+	PSLIST_ENTRY first;
+	do {
+		first = head->Next;
+		entry->Next = first;
+	} while (!__sync_bool_compare_and_swap(&head->Next, first, entry));
+	return first;
+}
+inline PSLIST_ENTRY InterlockedFlushSList (PSLIST_HEADER head) {
+	return __sync_lock_test_and_set(&head->Next, (PSLIST_ENTRY)NULL);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// time, threads and synchronization
+
+DWORD GetTickCount ();
+BOOL QueryPerformanceCounter (LARGE_INTEGER *counter);
+BOOL QueryPerformanceFrequency (LARGE_INTEGER *frequency);
+void Sleep (DWORD ms);
+BOOL SwitchToThread ();
+DWORD GetCurrentThreadId ();
+HANDLE GetCurrentThread ();
+HANDLE GetCurrentProcess ();
+DWORD GetLastError ();
+
+#define THREAD_PRIORITY_LOWEST       -2
+#define THREAD_PRIORITY_BELOW_NORMAL -1
+#define THREAD_PRIORITY_NORMAL       0
+#define THREAD_PRIORITY_ABOVE_NORMAL 1
+BOOL SetThreadPriority (HANDLE hThread, int priority);
+BOOL TerminateThread (HANDLE hThread, DWORD exitCode);
+
+typedef struct _SYSTEM_INFO {
+	DWORD          dwPageSize;
+	DWORD          dwNumberOfProcessors;
+} SYSTEM_INFO;
+void GetSystemInfo (SYSTEM_INFO *si);
+
+// the security attributes and the names are ignored
+HANDLE CreateEvent (void *sa, BOOL manualReset, BOOL initialState, LPCTSTR name);
+BOOL SetEvent (HANDLE hEvent);
+BOOL ResetEvent (HANDLE hEvent);
+HANDLE CreateSemaphore (void *sa, LONG initialCount, LONG maximumCount, LPCTSTR name);
+BOOL ReleaseSemaphore (HANDLE hSemaphore, LONG releaseCount, LONG *previousCount);
+// not recursive, there is only one process in the headless build
+HANDLE CreateMutex (void *sa, BOOL initialOwner, LPCTSTR name);
+BOOL ReleaseMutex (HANDLE hMutex);
+DWORD WaitForSingleObject (HANDLE h, DWORD ms);
+DWORD WaitForMultipleObjects (DWORD count, const HANDLE *handles, BOOL waitAll, DWORD ms);
+BOOL CloseHandle (HANDLE h);
+
+uintptr_t _beginthreadex (void *security, unsigned stackSize, unsigned (*proc) (void *),
+                          void *arg, unsigned initFlag, unsigned *threadId);
+
+
+//////////////////////////////////////////////////////////////////////////
+// memory
+
+#define MEM_COMMIT         0x1000
+#define MEM_RESERVE        0x2000
+#define MEM_RELEASE        0x8000
+#define MEM_LARGE_PAGES    0x20000000
+#define PAGE_READONLY      0x02
+#define PAGE_READWRITE     0x04
+
+LPVOID VirtualAlloc (LPVOID address, SIZE_T size, DWORD type, DWORD protect);
+BOOL VirtualFree (LPVOID address, SIZE_T size, DWORD type);
+SIZE_T GetLargePageMinimum ();
+
+void* _aligned_malloc (size_t size, size_t alignment);
+void _aligned_free (void *p);
+
+typedef struct _MEMORYSTATUSEX {
+	DWORD          dwLength;
+	DWORD          dwMemoryLoad;
+	ULONGLONG      ullTotalPhys;
+	ULONGLONG      ullAvailPhys;
+	ULONGLONG      ullTotalPageFile;
+	ULONGLONG      ullAvailPageFile;
+	ULONGLONG      ullTotalVirtual;
+	ULONGLONG      ullAvailVirtual;
+} MEMORYSTATUSEX;
+BOOL GlobalMemoryStatusEx (MEMORYSTATUSEX *ms);
+
+typedef struct _PROCESS_MEMORY_COUNTERS {
+	DWORD          cb;
+	SIZE_T         WorkingSetSize;
+	SIZE_T         PeakWorkingSetSize;
+	SIZE_T         PagefileUsage;
+	SIZE_T         PeakPagefileUsage;
+} PROCESS_MEMORY_COUNTERS;
+BOOL GetProcessMemoryInfo (HANDLE hProcess, PROCESS_MEMORY_COUNTERS *pmc, DWORD cb);
+
+// the privilege of the large pages is never granted
+#define TOKEN_ADJUST_PRIVILEGES 0x0020
+#define TOKEN_QUERY        0x0008
+#define SE_PRIVILEGE_ENABLED 0x00000002
+#define SE_LOCK_MEMORY_NAME "SeLockMemoryPrivilege"
+typedef struct _LUID {
+	DWORD          LowPart;
+	LONG           HighPart;
+} LUID;
+typedef struct _LUID_AND_ATTRIBUTES {
+	LUID           Luid;
+	DWORD          Attributes;
+} LUID_AND_ATTRIBUTES;
+typedef struct _TOKEN_PRIVILEGES {
+	DWORD          PrivilegeCount;
+	LUID_AND_ATTRIBUTES Privileges[1];
+} TOKEN_PRIVILEGES;
+BOOL OpenProcessToken (HANDLE hProcess, DWORD access, HANDLE *hToken);
+BOOL LookupPrivilegeValue (LPCTSTR system, LPCTSTR name, LUID *luid);
+BOOL AdjustTokenPrivileges (HANDLE hToken, BOOL disableAll, TOKEN_PRIVILEGES *state, DWORD length, TOKEN_PRIVILEGES *previous, DWORD *returnLength);
+
+
+//////////////////////////////////////////////////////////////////////////
+// files
+
+#define GENERIC_READ       0x80000000
+#define GENERIC_WRITE      0x40000000
+#define FILE_SHARE_READ    0x00000001
+#define FILE_SHARE_WRITE   0x00000002
+#define CREATE_ALWAYS      2
+#define OPEN_EXISTING      3
+#define OPEN_ALWAYS        4
+#define FILE_ATTRIBUTE_DIRECTORY 0x00000010
+#define FILE_ATTRIBUTE_NORMAL 0x00000080
+#define FILE_ATTRIBUTE_TEMPORARY 0x00000100
+#define FILE_FLAG_DELETE_ON_CLOSE 0x04000000
+#define FILE_BEGIN         0
+#define FILE_CURRENT       1
+#define FILE_END           2
+#define FILE_MAP_READ      0x0004
+#define MOVEFILE_REPLACE_EXISTING 0x00000001
+
+// the offset of the I/O, the others are not used
+typedef struct _OVERLAPPED {
+	ULONG_PTR      Internal;
+	ULONG_PTR      InternalHigh;
+	DWORD          Offset;
+	DWORD          OffsetHigh;
+	HANDLE         hEvent;
+} OVERLAPPED;
+
+typedef struct _WIN32_FIND_DATA {
+	DWORD          dwFileAttributes;
+	FILETIME       ftLastWriteTime;
+	DWORD          nFileSizeHigh;
+	DWORD          nFileSizeLow;
+	TCHAR          cFileName[MAX_PATH];
+} WIN32_FIND_DATA;
+
+typedef struct _WIN32_FILE_ATTRIBUTE_DATA {
+	DWORD          dwFileAttributes;
+	FILETIME       ftLastWriteTime;
+	DWORD          nFileSizeHigh;
+	DWORD          nFileSizeLow;
+} WIN32_FILE_ATTRIBUTE_DATA;
+
+enum GET_FILEEX_INFO_LEVELS {
+	GetFileExInfoStandard
+};
+
+HANDLE CreateFile (LPCTSTR name, DWORD access, DWORD share, void *sa, DWORD disposition, DWORD flags, HANDLE hTemplate);
+BOOL ReadFile (HANDLE hFile, void *buffer, DWORD bytes, DWORD *read, OVERLAPPED *ov);
+BOOL WriteFile (HANDLE hFile, const void *buffer, DWORD bytes, DWORD *written, OVERLAPPED *ov);
+BOOL SetFilePointerEx (HANDLE hFile, LARGE_INTEGER distance, LARGE_INTEGER *newPointer, DWORD method);
+BOOL GetFileSizeEx (HANDLE hFile, LARGE_INTEGER *size);
+BOOL SetEndOfFile (HANDLE hFile);
+BOOL GetFileAttributesEx (LPCTSTR name, GET_FILEEX_INFO_LEVELS level, void *info);
+BOOL MoveFileEx (LPCTSTR existingName, LPCTSTR newName, DWORD flags);
+BOOL DeleteFile (LPCTSTR name);
+DWORD GetTempPath (DWORD length, LPTSTR buffer);
+UINT GetTempFileName (LPCTSTR path, LPCTSTR prefix, UINT unique, LPTSTR name);
+
+// the whole file is mapped read only
+HANDLE CreateFileMapping (HANDLE hFile, void *sa, DWORD protect, DWORD sizeHigh, DWORD sizeLow, LPCTSTR name);
+LPVOID MapViewOfFile (HANDLE hMapping, DWORD access, DWORD offsetHigh, DWORD offsetLow, SIZE_T bytes);
+BOOL UnmapViewOfFile (const void *address);
+
+// the pattern is "directory/*.*" or "directory/*"
+HANDLE FindFirstFile (LPCTSTR pattern, WIN32_FIND_DATA *data);
+BOOL FindNextFile (HANDLE hFind, WIN32_FIND_DATA *data);
+BOOL FindClose (HANDLE hFind);
+
+
+//////////////////////////////////////////////////////////////////////////
+// UI, nothing is shown in the headless build
+
+#define MB_OK              0x00000000
+#define SRCCOPY            0x00CC0020
+#define DIB_RGB_COLORS     0
+#define BI_RGB             0
+
+typedef struct _BITMAPINFOHEADER {
+	DWORD          biSize;
+	LONG           biWidth;
+	LONG           biHeight;
+	WORD           biPlanes;
+	WORD           biBitCount;
+	DWORD          biCompression;
+	DWORD          biSizeImage;
+	LONG           biXPelsPerMeter;
+	LONG           biYPelsPerMeter;
+	DWORD          biClrUsed;
+	DWORD          biClrImportant;
+} BITMAPINFOHEADER;
+
+typedef struct _RGBQUAD {
+	BYTE           rgbBlue;
+	BYTE           rgbGreen;
+	BYTE           rgbRed;
+	BYTE           rgbReserved;
+} RGBQUAD;
+
+typedef struct _BITMAPINFO {
+	BITMAPINFOHEADER bmiHeader;
+	RGBQUAD        bmiColors[1];
+} BITMAPINFO;
+
+typedef void (CALLBACK *TIMERPROC) (HWND, UINT, UINT_PTR, DWORD);
+
+BOOL PostMessage (HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
+UINT_PTR SetTimer (HWND hWnd, UINT_PTR id, UINT elapse, TIMERPROC proc);
+BOOL KillTimer (HWND hWnd, UINT_PTR id);
+int MessageBox (HWND hWnd, LPCTSTR text, LPCTSTR caption, UINT type);
+int StretchDIBits (HDC hdc, int x, int y, int w, int h, int sx, int sy, int sw, int sh,
+                   const void *bits, const BITMAPINFO *bmi, UINT usage, DWORD rop);
+
+
+//////////////////////////////////////////////////////////////////////////
+// CRT (tchar.h)
+
+#define _tgetenv           getenv
+#define _tcsicmp           strcasecmp
+#define _tcscmp            strcmp
+#define _tcslen            strlen
+#define _ttoi              atoi
+#define _totlower          tolower
+#define _stricmp           strcasecmp
+#define _stprintf_s        snprintf
+#define sprintf_s          snprintf
+
+// returns 0 if OK, *@buffer is free()ed by the caller
+int _tdupenv_s (TCHAR **buffer, size_t *length, LPCTSTR name);
+
+
+//////////////////////////////////////////////////////////////////////////
+// atltypes.h
+
+class CSize;
+class CPoint;
+class CRect;
+
+class CSize
+{
+public:
+	LONG cx;
+	LONG cy;
+
+	CSize () : cx(0), cy(0) {}
+	CSize (int x, int y) : cx(x), cy(y) {}
+
+	bool operator == (const CSize &s) const { return cx == s.cx && cy == s.cy; }
+	bool operator != (const CSize &s) const { return !(*this == s); }
+	CSize operator + (const CSize &s) const { return CSize(cx + s.cx, cy + s.cy); }
+	CSize operator - (const CSize &s) const { return CSize(cx - s.cx, cy - s.cy); }
+};
+
+class CPoint
+{
+public:
+	LONG x;
+	LONG y;
+
+	CPoint () : x(0), y(0) {}
+	CPoint (int x, int y) : x(x), y(y) {}
+
+	bool operator == (const CPoint &p) const { return x == p.x && y == p.y; }
+	bool operator != (const CPoint &p) const { return !(*this == p); }
+	CPoint operator + (const CSize &s) const { return CPoint(x + s.cx, y + s.cy); }
+	CPoint operator - (const CSize &s) const { return CPoint(x - s.cx, y - s.cy); }
+	CSize operator - (const CPoint &p) const { return CSize(x - p.x, y - p.y); }
+	void Offset (int dx, int dy) { x += dx; y += dy; }
+};
+
+class CRect
+{
+public:
+	LONG left;
+	LONG top;
+	LONG right;
+	LONG bottom;
+
+	CRect () : left(0), top(0), right(0), bottom(0) {}
+	CRect (int l, int t, int r, int b) : left(l), top(t), right(r), bottom(b) {}
+	CRect (CPoint pt, CSize sz) : left(pt.x), top(pt.y), right(pt.x + sz.cx), bottom(pt.y + sz.cy) {}
+
+	int Width () const { return right - left; }
+	int Height () const { return bottom - top; }
+	CSize Size () const { return CSize(Width(), Height()); }
+	CPoint TopLeft () const { return CPoint(left, top); }
+	CPoint BottomRight () const { return CPoint(right, bottom); }
+	BOOL IsRectEmpty () const { return left >= right || top >= bottom; }
+	BOOL PtInRect (CPoint pt) const { return pt.x >= left && pt.x < right && pt.y >= top && pt.y < bottom; }
+
+	void SetRect (int l, int t, int r, int b) { left = l; top = t; right = r; bottom = b; }
+	void OffsetRect (int dx, int dy) { left += dx; right += dx; top += dy; bottom += dy; }
+	void OffsetRect (CPoint pt) { OffsetRect(pt.x, pt.y); }
+	void InflateRect (int dx, int dy) { left -= dx; right += dx; top -= dy; bottom += dy; }
+	void DeflateRect (int dx, int dy) { InflateRect(-dx, -dy); }
+	BOOL IntersectRect (const CRect &a, const CRect &b) {
+		left = a.left > b.left ? a.left : b.left;
+		top = a.top > b.top ? a.top : b.top;
+		right = a.right < b.right ? a.right : b.right;
+		bottom = a.bottom < b.bottom ? a.bottom : b.bottom;
+		if (IsRectEmpty()) {
+			SetRect(0, 0, 0, 0);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	bool operator == (const CRect &r) const {
+		return left == r.left && top == r.top && right == r.right && bottom == r.bottom;
+	}
+	bool operator != (const CRect &r) const { return !(*this == r); }
+};
+
+
+#endif // _WIN32
+#endif
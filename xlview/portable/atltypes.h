@@ -0,0 +1,2 @@
+// see Portable.h
+#include "Portable.h"
@@ -16,6 +16,7 @@
 #define IDD_SETTING_FILEASSOC_XP        125
 #define IDD_SETTING_FILEASSOC_VISTA     126
 #define IDD_SETTING_ABOUT               127
+#define IDD_SETTING_OPTIONS             128
 #define IDC_SETTING_TAB                 1001
 #define IDC_LIST_GESTURE                1002
 #define IDC_BUTTON_EDIT_GESTURE         1003
@@ -46,15 +47,24 @@
 #define IDC_STATIC_VERSION              1028
 #define IDC_STATIC_KEYPAD_DESC          1029
 #define IDC_STATIC_KEYPAD               1030
+#define IDC_CHECKBOX_FULL_IMAGE         1031
+#define IDC_CHECKBOX_THUMBNAIL_RGB565   1032
+#define IDC_CHECKBOX_PIXEL_BGRX         1033
+#define IDC_STATIC_IMAGE_CACHE          1034
+#define IDC_EDIT_IMAGE_CACHE            1035
+#define IDC_STATIC_MEMORY_LIMIT         1036
+#define IDC_EDIT_MEMORY_LIMIT           1037
+#define IDC_STATIC_OPTIONS_RESTART      1038
+#define IDC_BUTTON_OPTIONS_APPLY        1039
 
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NO_MFC                     1
-#define _APS_NEXT_RESOURCE_VALUE        128
+#define _APS_NEXT_RESOURCE_VALUE        129
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1031
+#define _APS_NEXT_CONTROL_VALUE         1040
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
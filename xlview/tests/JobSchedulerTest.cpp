@@ -0,0 +1,89 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../JobScheduler.h"
+
+/**
+ * The delayed jobs are run in time when all the workers are busy: the workers
+ * are saturated by the long running jobs of a low priority, which check
+ * shouldYield() every STEP ms, then a job of PRIORITY_ZOOM is submitted with
+ * a delay, it must start within the delay plus one step (and some slack for
+ * the scheduling of the OS).
+ */
+
+static const DWORD STEP = 10;        // ms, of the long running jobs
+static const DWORD DELAY = 80;       // ms, the same as ZOOM_DEBOUNCE_TIME
+static const DWORD SLACK = 40;       // ms
+static const DWORD MAX_RUNNING = 3000;
+
+static volatile LONG s_yielded = 0;
+static volatile LONG s_started = 0; // the long running ones
+static volatile LONG s_stop = 0;
+
+class CLongJob : public CJob
+{
+public:
+	CLongJob () : CJob(PRIORITY_THUMBNAIL, NULL) {}
+
+	virtual void run () {
+		::InterlockedIncrement(&s_started);
+		DWORD begin = ::GetTickCount();
+		while (s_stop == 0 && ::GetTickCount() - begin < MAX_RUNNING) {
+			::Sleep(STEP);
+			if (shouldYield()) {
+				::InterlockedIncrement(&s_yielded);
+				return;
+			}
+		}
+	}
+};
+
+class CZoomJob : public CJob
+{
+	HANDLE             m_hDone;
+public:
+	DWORD              startTime;
+
+	CZoomJob (HANDLE hDone) : CJob(PRIORITY_ZOOM, NULL), m_hDone(hDone), startTime(0) {}
+
+	virtual void run () {
+		startTime = ::GetTickCount();
+		::SetEvent(m_hDone);
+	}
+};
+
+int main (int /*argc*/, char ** /*argv*/) {
+	CJobScheduler *scheduler = CJobScheduler::getInstance();
+	int workers = (int)scheduler->getWorkerCount();
+	for (int i = 0; i < workers; ++ i) {
+		scheduler->submit(CJobPtr(new CLongJob()));
+	}
+	while (s_started < workers) {
+		::Sleep(1);
+	}
+
+	HANDLE hDone = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+	CZoomJob *zoom = new CZoomJob(hDone);
+	CJobPtr job(zoom);
+	DWORD submitTime = ::GetTickCount();
+	scheduler->submit(job, DELAY);
+	bool run = ::WaitForSingleObject(hDone, MAX_RUNNING) == WAIT_OBJECT_0;
+	::InterlockedExchange(&s_stop, 1);
+
+	int failed = 0;
+	if (!run) {
+		fprintf(stderr, "FAILED: the delayed job is not run while the workers are busy\n");
+		failed = 1;
+	} else {
+		DWORD latency = zoom->startTime - submitTime;
+		printf("%d workers, the delayed job started after %d ms (%d yielded)\n", workers, (int)latency, (int)s_yielded);
+		if (latency > DELAY + STEP + SLACK) {
+			fprintf(stderr, "FAILED: started after %d ms, expected at most %d ms\n", (int)latency, (int)(DELAY + STEP + SLACK));
+			failed = 1;
+		}
+	}
+
+	scheduler->stop();
+	::CloseHandle(hDone);
+	return failed;
+}
@@ -0,0 +1,84 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "../Image.h"
+#include "../PixelBufferPool.h"
+
+/**
+ * CImage::resizeRect() gives the same pixels as the same area of resize():
+ * the source is a smooth gradient (which both the kernels of resizeRect()
+ * and of xl::ui::CResizeEngine keep), the areas are compared away from the
+ * edges of the whole image, where the kernels are clamped differently.
+ */
+
+static const int WIDTH = 640;
+static const int HEIGHT = 480;
+static const int MARGIN = 4;         // the destination pixels near the edges are not compared
+static const int TOLERANCE = 3;      // of each channel
+
+static xl::ui::CDIBSectionPtr _CreateGradient (int width, int height) {
+	xl::ui::CDIBSectionPtr dib = CDIBSectionPool::getInstance()->create(width, height, 24, false);
+	assert(dib != NULL);
+	for (int y = 0; y < height; ++ y) {
+		xl::uint8 *line = dib->getLine(y);
+		for (int x = 0; x < width; ++ x) {
+			line[0] = (xl::uint8)(x * 255 / (width - 1));
+			line[1] = (xl::uint8)(y * 255 / (height - 1));
+			line[2] = (xl::uint8)((x + y) * 255 / (width + height - 2));
+			line += 3;
+		}
+	}
+	return dib;
+}
+
+// the max difference of @part and the area of @whole at @rcPart
+static int _Compare (CImagePtr whole, CImagePtr part, CRect rcPart, CRect rcCompared) {
+	xl::ui::CDIBSectionPtr a = whole->getImage(0);
+	xl::ui::CDIBSectionPtr b = part->getImage(0);
+	int diff = 0;
+	for (int y = rcCompared.top; y < rcCompared.bottom; ++ y) {
+		const xl::uint8 *la = a->getLine(y) + rcCompared.left * 3;
+		const xl::uint8 *lb = b->getLine(y - rcPart.top) + (rcCompared.left - rcPart.left) * 3;
+		for (int i = 0; i < rcCompared.Width() * 3; ++ i) {
+			diff = (std::max)(diff, abs((int)la[i] - (int)lb[i]));
+		}
+	}
+	return diff;
+}
+
+static int _Test (CImagePtr image, CSize szZoom, CRect rcZoom, bool highQuality) {
+	CImagePtr whole = image->resize(szZoom.cx, szZoom.cy, highQuality);
+	CImagePtr part = image->resizeRect(szZoom, rcZoom, highQuality);
+	if (whole == NULL || part == NULL) {
+		fprintf(stderr, "FAILED: %dx%d is not resized\n", szZoom.cx, szZoom.cy);
+		return 1;
+	}
+	if (part->getImageSize() != rcZoom.Size()) {
+		fprintf(stderr, "FAILED: the area is %dx%d, expected %dx%d\n",
+			part->getImageSize().cx, part->getImageSize().cy, rcZoom.Width(), rcZoom.Height());
+		return 1;
+	}
+
+	CRect rcCompared(rcZoom);
+	rcCompared.IntersectRect(rcCompared, CRect(MARGIN, MARGIN, szZoom.cx - MARGIN, szZoom.cy - MARGIN));
+	int diff = _Compare(whole, part, rcZoom, rcCompared);
+	printf("%dx%d (%d, %d, %d, %d)%s: max difference %d\n", szZoom.cx, szZoom.cy,
+		rcZoom.left, rcZoom.top, rcZoom.right, rcZoom.bottom, highQuality ? " hq" : "", diff);
+	if (diff > TOLERANCE) {
+		fprintf(stderr, "FAILED: the max difference %d, expected at most %d\n", diff, TOLERANCE);
+		return 1;
+	}
+	return 0;
+}
+
+int main (int /*argc*/, char ** /*argv*/) {
+	CImagePtr image(new CImage());
+	image->insertImage(_CreateGradient(WIDTH, HEIGHT), 0);
+
+	int failed = 0;
+	failed += _Test(image, CSize(300, 225), CRect(40, 30, 200, 150), true);   // reduced
+	failed += _Test(image, CSize(1000, 750), CRect(333, 250, 777, 555), true); // enlarged
+	failed += _Test(image, CSize(300, 225), CRect(0, 0, 120, 90), true);      // at the corner
+	return failed;
+}